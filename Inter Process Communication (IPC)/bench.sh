@@ -0,0 +1,39 @@
+#!/bin/sh
+# runs process_simulation over configurations made by genconfig and reports, for every scenario
+# and set of options, the lines sent, the wall time and the lines sent per second
+#
+# usage: bench.sh <text_file> "<M values>" "<churn percents>" <steps> "<option sets, ':' separated>"
+# e.g.   bench.sh mobydick.txt "10 100" "1 10" 20000 "-q:-q -r:-q -p -f -b"
+
+if [ $# -ne 5 ]; then
+    echo "Usage: $0 <text_file> \"<M values>\" \"<churn percents>\" <steps> \"<option sets>\"" >&2
+    exit 1
+fi
+text=$1
+steps=$4
+config=$(mktemp)
+out=$(mktemp)
+trap 'rm -f "$config" "$out"' EXIT
+
+printf "%-6s %-6s %-8s %-20s %10s %10s %12s\n" M churn steps options lines "wall(s)" "lines/s"
+for M in $2; do
+    for churn in $3; do
+        ./genconfig -s 1 "$M" "$churn" "$steps" > "$config" || exit 1
+        echo "$5" | tr ':' '\n' | while read -r options; do
+            start=$(date +%s%N)
+            ./process_simulation -l $options "$config" "$text" "$M" > "$out"
+            status=$?
+            end=$(date +%s%N)
+            rm -f file*.log
+            if [ $status -ne 0 ]; then
+                echo "process_simulation $options failed for M=$M churn=$churn" >&2
+                exit 1
+            fi
+            #"Throughput: <lines> lines in <s> s, <rate> lines/s" from the latency summary
+            lines=$(sed -n 's/^Throughput: \([0-9]*\) lines.*/\1/p' "$out")
+            wall=$(awk -v s="$start" -v e="$end" 'BEGIN { printf "%.3f", (e - s) / 1e9 }')
+            rate=$(awk -v n="$lines" -v w="$wall" 'BEGIN { printf "%.0f", (w > 0 ? n / w : 0) }')
+            printf "%-6s %-6s %-8s %-20s %10s %10s %12s\n" "$M" "$churn" "$steps" "$options" "$lines" "$wall" "$rate"
+        done || exit 1
+    done
+done
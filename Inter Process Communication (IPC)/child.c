@@ -1,26 +1,179 @@
 #include "child.h"
 #include <time.h>
 
+/**
+ * ChildLog
+ * #################################################################################################
+ * where a child records what it receives: its `.log` file, or with binary logging its `.bin` file
+ * of LogRecords, and the console unless echo is off
+ *
+ * -> Fields
+ * ----------
+ * - file: the open log file
+ * - binary: 1 for LogRecords, 0 for text
+ * - echo: from sharedMem->echo
+ * - slot, pid: the slot of the child and the ID it logs under
+ */
+typedef struct ChildLog {
+    FILE *file;
+    int binary;
+    int echo;
+    int slot;
+    int pid;
+} ChildLog;
+
 /**
  * createChildFile
  * #################################################################################################
  * intended to create or open a `.log` file for the child process
- * the file is uniquely named after the child's PID to ensure each child has its own log file
+ * the file is uniquely named after the child's PID to ensure each child has its own log file. the
+ * thread ID is used, which for a child process is its PID and which also tells apart the children
+ * of the thread backend. with binary logging the file is `file[PID].bin` and starts with a
+ * LogFileHeader
  *
  * ->Parameters
  * --------------------------------
- *  -PID, used to name the log file
+ *  -PID (thread ID), used to name the log file
+ *  -binary:1 for a `.bin` file
  *
  * ->Returns
  * ----------------------------------------------
  *  -file ptr to the opened/created log file
  *  - and if the file cannot be created or opened, the program terminates with an error
  */
-static FILE* createChildFile(int PID) {
-    char fileName[20]; //used to allocate enough space for the filename (e.g., "file[12345].log"), 
-					   //20might seem a bit too much, but it is purely for safety purposes
-    snprintf(fileName, sizeof(fileName), "file[%d].log", PID); 
-    return fopen(fileName, "a"); 
+static FILE* createChildFile(int PID, int binary) {
+    char fileName[24]; //used to allocate enough space for the filename (e.g., "file[12345].log"), 
+					   //24might seem a bit too much, but it is purely for safety purposes
+    snprintf(fileName, sizeof(fileName), binary ? "file[%d].bin" : "file[%d].log", PID); 
+    FILE *file = fopen(fileName, "a"); 
+    if (file && binary && ftell(file) == 0) { //a new file, not one of an earlier child with this PID
+        LogFileHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, LOG_MAGIC, sizeof(LOG_MAGIC));
+        header.recordSize = sizeof(LogRecord);
+        fwrite(&header, sizeof(header), 1, file);
+    }
+    return file;
+}
+
+/**
+ * logRecord
+ * #################################################################################################
+ * appends one LogRecord to a binary log
+ */
+static void logRecord(ChildLog *log, int kind, int timestamp, long lineOffset, int lineLength, uint64_t latencyNs) {
+    LogRecord record;
+    memset(&record, 0, sizeof(record));
+    record.kind = kind;
+    record.timestamp = timestamp;
+    record.slot = log->slot;
+    record.pid = log->pid;
+    record.lineOffset = lineOffset;
+    record.lineLength = lineLength;
+    record.latencyNs = latencyNs;
+    fwrite(&record, sizeof(record), 1, log->file);
+}
+
+/**
+ * logLine
+ * #################################################################################################
+ * records one received line, in the child's `.log` file and, unless echo is off, on the console.
+ * a binary log only gets where the line is in the text (lineOffset) and the dispatch latency
+ */
+static void logLine(ChildLog *log, int timestamp, const char *line, int lineLength, long lineOffset, uint64_t latencyNs) {
+    if (log->binary) {
+        logRecord(log, LOG_RECORD_LINE, timestamp, lineOffset, lineLength, latencyNs);
+    } else {
+        fprintf(log->file, "[t = %d] Child[%d] received message: %.*s", timestamp, log->pid, lineLength, line);//one for the .log file
+    }
+    if (log->echo) {
+        printf("[t = %d] Child[%d] received message: %.*s", timestamp, log->pid, lineLength, line);///and another message for the console
+    }
+}
+
+/**
+ * logTerminate
+ * #################################################################################################
+ * records the TERMINATE message, in the child's `.log` file and on the console
+ */
+static void logTerminate(ChildLog *log, int timestamp, uint64_t latencyNs) {
+    if (log->binary) {
+        logRecord(log, LOG_RECORD_TERMINATE, timestamp, -1, 0, latencyNs);
+    } else {
+        fprintf(log->file, "[t = %d] Child[%d] received TERMINATE message. Exiting.\n", timestamp, log->pid);//writes in the.log files the message recieved
+    }
+    if (log->echo) {
+        printf("[t = %d] Child[%d] received TERMINATE message. Exiting.\n", timestamp, log->pid);//writes in the console the termination  message
+    }
+}
+
+/**
+ * ringDrain
+ * #################################################################################################
+ * logs every message queued in the child's ring, which in ring mode replaces the single line in
+ * sharedSpace. the parent does not wait for each message, it only needs to hear when room is made.
+ * with latency statistics, the time each message spent queued is recorded in dispatch
+ *
+ * ->Returns
+ * ---------
+ * -the timestamp of the TERMINATE message if it was among them
+ * -or -1 to keep waiting
+ */
+static int ringDrain(ChildRing *ring, const char *text, ChildLog *log, int *lineCntr, LatencyHist *dispatch) {
+    RingSlot *msg;
+    while ((msg = ringConsumerSlot(ring)) != NULL) {
+        uint64_t latency = 0;
+        if (dispatch) {
+            latency = nowNs() - msg->sentAt;
+            latencyRecord(dispatch, latency);
+        }
+        if (msg->terminate) {
+            int timestamp = msg->timestamp;
+            logTerminate(log, timestamp, latency);
+            ringRelease(ring);
+            return timestamp;
+        }
+        if (text) {
+            logLine(log, msg->timestamp, text + msg->lineOffset, msg->lineLength, msg->lineOffset, latency);
+        } else {
+            logLine(log, msg->timestamp, msg->line, (int)strlen(msg->line), msg->lineOffset, latency);
+        }
+        (*lineCntr)++;
+        ringRelease(ring);
+    }
+    return -1;
+}
+
+/**
+ * logSummary
+ * #################################################################################################
+ * records, in the child's `.log` file, how many lines it received between its activation and its
+ * TERMINATE
+ */
+static void logSummary(ChildLog *log, int lineCntr, int endsInTimestamp, int activation_time) {
+    if (log->binary) {
+        logRecord(log, LOG_RECORD_SUMMARY, endsInTimestamp, activation_time, lineCntr, 0);
+        return;
+    }
+    int timeActive = endsInTimestamp - activation_time;
+    fprintf(log->file, "Child[%d] terminated. Total lines received: %d, Active time: %d - %d = %d steps\n",
+            log->pid, lineCntr, endsInTimestamp, activation_time, timeActive);
+}
+
+/**
+ * retire
+ * #################################################################################################
+ * in pool mode, ends the lifetime of the label bound to the worker after its TERMINATE: the summary
+ * is logged, the counters start over for the next label, and the parent is told that the slot may
+ * be given out again. the post is the acknowledgement of the TERMINATE, so it comes last
+ */
+static void retire(ChildLog *log, int *lineCntr, int endsInTimestamp, ChildControl *control,
+                   sem_t *parentNotificationSemaphore) {
+    logSummary(log, *lineCntr, endsInTimestamp, control->activationTime);
+    fflush(log->file);
+    *lineCntr = 0;
+    atomic_store_explicit(&control->busy, 0, memory_order_release);
+    sem_post(parentNotificationSemaphore);
 }
 
 /**
@@ -47,47 +200,120 @@ static FILE* createChildFile(int PID) {
  *  -sharedMem:pointer to the shared memory structure used for inter-process communication
  *  -activation_time:timestamp when the child process was spawned
  *  -parentNotificationSemaphore:semaphore used to notify the parent process after processing a message
+ *  -text:in mmap mode the shared mapping of the text file, and messages are read in place from
+ *   sharedMem->lineOffset and sharedMem->lineLength, otherwise NULL and they are in sharedSpace
+ *  -ring:in ring mode the child's message ring, NULL otherwise. each post of the child's semaphore
+ *   then means "messages are queued", they are all logged before the parent is notified once
+ *  -control:in pool mode the worker's control block, NULL otherwise. the child is then forked before
+ *   the simulation starts and serves one label after another: a TERMINATE ends the current label
+ *   (see retire()) and the child waits for the next one, activation_time is then control's, and
+ *   a post with control->quit set makes it exit
+ *
+ * With sharedMem->bufferedLog set, the `.log` file gets a LOG_BUFFER_SIZE buffer so that logging is
+ * mostly a memory copy, and a line in sharedSpace is copied out and acknowledged before it is logged,
+ * which takes the file and console I/O off the parent's wait. sharedMem->echo turns the console
+ * copy of every message on or off, and sharedMem->binaryLog makes the child write LogRecords to
+ * `file[PID].bin` (buffered the same way) instead of text, see logreader. with latency statistics in the segment, the child records how
+ * long each message took to reach it in the dispatch histogram of its slot.
+ *
+ * the function returns once the child is done, a child process then exits while a child thread of
+ * the thread backend ends and is joined by the parent
  */
 
 
 
-void child(sem_t *seg_semaphores[], int M_requests, SharedMemory *sharedMem, int activation_time, sem_t *parentNotificationSemaphore) {
+void child(sem_t *seg_semaphores[], int M_requests, SharedMemory *sharedMem, int activation_time, sem_t *parentNotificationSemaphore, const char *text, ChildRing *ring, ChildControl *control) {
     int lineCntr = 0;
     int endsInTimestamp = -1;
-    FILE *writefile = createChildFile(getpid());
-    if (!writefile) {
+    ChildLog log;
+    log.binary = sharedMem->binaryLog;
+    log.echo = sharedMem->echo;
+    log.slot = M_requests;
+    log.pid = gettid();
+    log.file = createChildFile(log.pid, log.binary);
+    if (!log.file) {
         perror("Could not open .log file");
         exit(EXIT_FAILURE);
     }
+    int ackFirst = sharedMem->bufferedLog;
+    LatencyHist *dispatch = sharedMem->numOfStats > 0 ? &sharedStats(sharedMem)[M_requests].dispatch : NULL;
+    if (ackFirst || log.binary) {
+        setvbuf(log.file, NULL, _IOFBF, LOG_BUFFER_SIZE); //stdio allocates it
+    }
 
     while (1) {
-        if (sem_wait(seg_semaphores[M_requests]) < 0) {
+        if (semWait(seg_semaphores[M_requests], sharedMem->spinTries) < 0) {
             perror("Fail performing sem_wait()");
             exit(EXIT_FAILURE);
         }
+        if (control && atomic_load_explicit(&control->quit, memory_order_acquire)) {
+            break; //the simulation is over
+        }
+
+        if (ring) {
+            endsInTimestamp = ringDrain(ring, text, &log, &lineCntr, dispatch);
+            if (control && endsInTimestamp >= 0) {
+                retire(&log, &lineCntr, endsInTimestamp, control, parentNotificationSemaphore);
+                endsInTimestamp = -1; //back in the pool
+                continue;
+            }
+            sem_post(parentNotificationSemaphore); //room was made in the ring
+            if (endsInTimestamp >= 0) {
+                break;
+            }
+            continue;
+        }
 
+        uint64_t latency = 0;
+        if (dispatch) {
+            latency = nowNs() - sharedMem->sentAt;
+            latencyRecord(dispatch, latency);
+        }
         if (strcmp(sharedMem->sharedSpace, "TERMINATE") == 0) {
-            fprintf(writefile, "[t = %d] Child[%d] received TERMINATE message. Exiting.\n", sharedMem->endsInTimestamp, getpid());//writes in the.log files the message recieved
-            printf("[t = %d] Child[%d] received TERMINATE message. Exiting.\n", sharedMem->endsInTimestamp, getpid());//writes in the console the termination  message
             endsInTimestamp = sharedMem->endsInTimestamp;
-            sem_post(parentNotificationSemaphore);
+            if (control) {
+                logTerminate(&log, endsInTimestamp, latency);
+                retire(&log, &lineCntr, endsInTimestamp, control, parentNotificationSemaphore);
+                endsInTimestamp = -1;
+                continue;
+            }
+            if (ackFirst) {
+                sem_post(parentNotificationSemaphore);
+            }
+            logTerminate(&log, endsInTimestamp, latency);
+            if (!ackFirst) {
+                sem_post(parentNotificationSemaphore);
+            }
             break;
         }
 
-        fprintf(writefile, "[t = %d] Child[%d] received message: %s", sharedMem->endsInTimestamp, getpid(), sharedMem->sharedSpace);//one for the .log file
-        printf("[t = %d] Child[%d] received message: %s", sharedMem->endsInTimestamp, getpid(), sharedMem->sharedSpace);///and another message for the console
+        int timestamp = sharedMem->endsInTimestamp;
+        long lineOffset = sharedMem->lineOffset;
+        const char *line = sharedMem->sharedSpace;
+        int lineLength = (int)strlen(line);
+        char copy[MAX_LINE_SIZE];
+        if (text) { //mmap mode, the line is read in place from the shared text
+            line = text + sharedMem->lineOffset;
+            lineLength = sharedMem->lineLength;
+        } else if (ackFirst) { //sharedSpace is reused as soon as we acknowledge
+            memcpy(copy, line, lineLength);
+            line = copy;
+        }
+        if (ackFirst) {
+            sem_post(parentNotificationSemaphore);
+        }
+        logLine(&log, timestamp, line, lineLength, lineOffset, latency);
         lineCntr++;
-        sem_post(parentNotificationSemaphore);
+        if (!ackFirst) {
+            sem_post(parentNotificationSemaphore);
+        }
     }
 
     if (endsInTimestamp >= 0) {
-        int timeActive = endsInTimestamp - activation_time;
-        fprintf(writefile, "Child[%d] terminated. Total lines received: %d, Active time: %d - %d = %d steps\n",
-                getpid(), lineCntr, endsInTimestamp, activation_time, timeActive);
+        logSummary(&log, lineCntr, endsInTimestamp, activation_time);
     }
 
-    fclose(writefile);
-    exit(EXIT_SUCCESS);
+    fclose(log.file);
 }
 
 
@@ -3,5 +3,9 @@
 #include "common.h"
 
 /* Child process function that generates random requests for lines, waits for segment
-availability, records timing information, and writes the requested line to an output file.*/
-void child(sem_t* seg_semaphores[], int M_requests, SharedMemory* sharedMem, int activation_time, sem_t *parentNotificationSemaphore);
+availability, records timing information, and writes the requested line to an output file.
+text is the parent's mapping of the text file in mmap mode, or NULL when lines are copied,
+ring is the child's message ring in ring mode, or NULL, and control is the worker's control
+block in pool mode, or NULL. it returns when the child is done, for the caller to exit or,
+in the thread backend, to end the thread.*/
+void child(sem_t* seg_semaphores[], int M_requests, SharedMemory* sharedMem, int activation_time, sem_t *parentNotificationSemaphore, const char *text, ChildRing *ring, ChildControl *control);
@@ -1,163 +1,872 @@
 #include "common.h"
+#include <errno.h>
 #include <fcntl.h>
+#include <sys/stat.h>
 
 /**
- * freeSlotFinder
+ * slotsInit
  * #################################################################################################
- * identifies the first available (free) slot in the children array
- *  A free slot is represented by a value of 0 in the array, which implies no active child process is occupying that slot.
+ * sets up the bookkeeping for M child slots, all of them free. slots are handed out lowest first
  *
  * ->Parameters
  * ------------
- * -children: array containing the PIDs of child processes
- * -M: maximum size of the array
+ * -slots: the bookkeeping to set up, release it with slotsFree()
+ * -M: number of slots
+ */
+void slotsInit(ChildSlots *slots, int M) {
+    slots->M = M;
+    slots->freeStack = malloc(M * sizeof(int));
+    slots->active = malloc(M * sizeof(int));
+    slots->activePos = malloc(M * sizeof(int));
+    slots->slotOfLabel = NULL;
+    slots->labelCapacity = 0;
+    if (!slots->freeStack || !slots->active || !slots->activePos) {
+        perror("Failed to allocate child slots");
+        exit(EXIT_FAILURE);
+    }
+    slots->numOfFree = M;
+    for (int i = 0; i < M; i++) {
+        slots->freeStack[i] = M - 1 - i; //slot 0 on top
+        slots->activePos[i] = -1;
+    }
+    slots->numOfActive = 0;
+}
+
+/**
+ * slotsFree
+ * #################################################################################################
+ * releases the memory held by the slot bookkeeping
+ */
+void slotsFree(ChildSlots *slots) {
+    free(slots->freeStack);
+    free(slots->active);
+    free(slots->activePos);
+    free(slots->slotOfLabel);
+    memset(slots, 0, sizeof(*slots));
+}
+
+/**
+ * slotTake
+ * #################################################################################################
+ * takes an available (free) slot off the free stack, for a new child process
  *
  * ->Returns
  * ---------
- * -the index of the first free slot
+ * -the index of the slot
  * -or -1 if no slot is available
  */
-int freeSlotFinder(pid_t *children, int M) {
-    for (int i = 0; i < M; i++) {
-        if (children[i] == 0) { 
-            return i;
+int slotTake(ChildSlots *slots) {
+    if (slots->numOfFree == 0) {
+        return -1;
+    }
+    return slots->freeStack[--slots->numOfFree];
+}
+
+/**
+ * slotGive
+ * #################################################################################################
+ * puts a slot back on the free stack once its child has exited
+ */
+void slotGive(ChildSlots *slots, int slot) {
+    slots->freeStack[slots->numOfFree++] = slot;
+}
+
+/**
+ * slotActivate
+ * #################################################################################################
+ * records that the child in the given slot, with the given label, can now be sent lines
+ */
+void slotActivate(ChildSlots *slots, int slot, int labelId) {
+    if (labelId >= slots->labelCapacity) { //label IDs are dense, so the map is an array indexed by them
+        int capacity = slots->labelCapacity ? slots->labelCapacity : 64;
+        while (capacity <= labelId) {
+            capacity *= 2;
+        }
+        int *grown = realloc(slots->slotOfLabel, capacity * sizeof(int));
+        if (!grown) {
+            perror("Failed to grow label map");
+            exit(EXIT_FAILURE);
+        }
+        for (int i = slots->labelCapacity; i < capacity; i++) {
+            grown[i] = -1;
+        }
+        slots->slotOfLabel = grown;
+        slots->labelCapacity = capacity;
+    }
+    slots->slotOfLabel[labelId] = slot;
+    slots->activePos[slot] = slots->numOfActive;
+    slots->active[slots->numOfActive++] = slot;
+}
+
+/**
+ * slotDeactivate
+ * #################################################################################################
+ * removes the child in the given slot from the active children, when it is sent TERMINATE. the last
+ * active slot is moved into its place, so this does not depend on the number of children
+ */
+void slotDeactivate(ChildSlots *slots, int slot, int labelId) {
+    int pos = slots->activePos[slot];
+    if (pos < 0) {
+        return;
+    }
+    int last = slots->active[--slots->numOfActive];
+    slots->active[pos] = last;
+    slots->activePos[last] = pos;
+    slots->activePos[slot] = -1;
+    if (labelId >= 0 && labelId < slots->labelCapacity && slots->slotOfLabel[labelId] == slot) {
+        slots->slotOfLabel[labelId] = -1;
+    }
+}
+
+/**
+ * slotFindLabel
+ * #################################################################################################
+ * looks up the active child process with a specific label
+ *  labels are unique identifiers assigned to each child (e.g., "C1", "C2"), interned with labelIntern()
+ *
+ * ->Returns
+ * ---------
+ * -the index of the child process matching the label
+ * -or -1 if no active child has that label
+ */
+int slotFindLabel(const ChildSlots *slots, int labelId) {
+    if (labelId < 0 || labelId >= slots->labelCapacity) {
+        return -1;
+    }
+    return slots->slotOfLabel[labelId];
+}
+
+/**
+ * rngSeed
+ * #################################################################################################
+ * seeds a generator. the seed goes through splitmix64 first, so nearby seeds (like those of the
+ * dispatchers of one run) give unrelated sequences, and the state is never 0
+ */
+void rngSeed(Rng *rng, uint64_t seed) {
+    uint64_t z = seed + 0x9e3779b97f4a7c15u;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9u;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebu;
+    z ^= z >> 31;
+    rng->state = z ? z : 0x9e3779b97f4a7c15u;
+}
+
+/**
+ * rngBelow
+ * #################################################################################################
+ * returns a pseudo random number in [0, bound), bound > 0. the high 32 bits of a xorshift64* step
+ * are scaled into the range with a multiplication instead of a division
+ */
+uint32_t rngBelow(Rng *rng, uint32_t bound) {
+    uint64_t x = rng->state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    rng->state = x;
+    uint32_t r = (uint32_t)((x * 0x2545f4914f6cdd1du) >> 32);
+    return (uint32_t)(((uint64_t)r * bound) >> 32);
+}
+
+/**
+ * randomActiveSlot
+ * #################################################################################################
+ * selects a random active child process, uniformly, straight from the dense array of active slots
+ *
+ * ->Returns
+ * ---------
+ * -index of a randomly selected active child
+ * -or -1 if no active child exists
+ */
+int randomActiveSlot(const ChildSlots *slots, Rng *rng) {
+    if (slots->numOfActive == 0) {
+        return -1;
+    }
+    return slots->active[rngBelow(rng, (uint32_t)slots->numOfActive)];
+}
+
+/**
+ * labelHash
+ * #################################################################################################
+ * FNV-1a hash of a label, for the LabelTable buckets
+ */
+static unsigned labelHash(const char *label, size_t length) {
+    unsigned h = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        h = (h ^ (unsigned char)label[i]) * 16777619u;
+    }
+    return h;
+}
+
+/**
+ * labelRehash
+ * #################################################################################################
+ * doubles the buckets of a LabelTable and puts every label back in
+ */
+static void labelRehash(LabelTable *table) {
+    int numOfBuckets = table->numOfBuckets ? 2 * table->numOfBuckets : 64;
+    int *buckets = calloc(numOfBuckets, sizeof(int));
+    if (!buckets) {
+        perror("Failed to allocate label table");
+        exit(EXIT_FAILURE);
+    }
+    for (int id = 0; id < table->count; id++) {
+        unsigned b = labelHash(table->names[id], strlen(table->names[id])) & (numOfBuckets - 1);
+        while (buckets[b] != 0) {
+            b = (b + 1) & (numOfBuckets - 1);
         }
+        buckets[b] = id + 1;
     }
-    return -1; 
+    free(table->buckets);
+    table->buckets = buckets;
+    table->numOfBuckets = numOfBuckets;
 }
 
 /**
- * childLabelFinder
+ * labelIntern
  * #################################################################################################
- * searches for a specific child process based on its label in the childLabels array
- *  labels are unique identifiers assigned to each child (e.g., "C1", "C2").
+ * looks a label up in the table, adding it the first time it is seen. a zeroed LabelTable is empty
  *
  * ->Parameters
  * ------------
- * -childLabels: array containing labels of child processes
- * -label: the label to search for
- * -M: maximum size of the array
+ * -table: the label table
+ * -label, length: the label, which need not be null terminated
  *
  * ->Returns
  * ---------
- * -the index of the child process matching the label
- * -or -1 if the label is not found
+ * -the ID of the label
+ * -if memory runs out, the program terminates with an appropriate message
  */
-int childLabelFinder(char childLabels[][10], const char *label, int M) {
-    for (int i = 0; i < M; i++) {
-        if (strcmp(childLabels[i], label) == 0) { //Match found
-            return i;
+int labelIntern(LabelTable *table, const char *label, size_t length) {
+    if (2 * (table->count + 1) > table->numOfBuckets) { //keep the table at most half full
+        labelRehash(table);
+    }
+    unsigned b = labelHash(label, length) & (table->numOfBuckets - 1);
+    while (table->buckets[b] != 0) {
+        const char *name = table->names[table->buckets[b] - 1];
+        if (strncmp(name, label, length) == 0 && name[length] == '\0') {
+            return table->buckets[b] - 1;
+        }
+        b = (b + 1) & (table->numOfBuckets - 1);
+    }
+    if (table->count == table->capacity) {
+        table->capacity = table->capacity ? 2 * table->capacity : 64;
+        char **grown = realloc(table->names, table->capacity * sizeof(char *));
+        if (!grown) {
+            perror("Failed to allocate label table");
+            exit(EXIT_FAILURE);
+        }
+        table->names = grown;
+    }
+    char *name = malloc(length + 1);
+    if (!name) {
+        perror("Failed to allocate label");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(name, label, length);
+    name[length] = '\0';
+    table->names[table->count] = name;
+    table->buckets[b] = table->count + 1;
+    return table->count++;
+}
+
+/**
+ * labelName
+ * #################################################################################################
+ * gives back the text of an interned label
+ */
+const char *labelName(const LabelTable *table, int labelId) {
+    return table->names[labelId];
+}
+
+/**
+ * labelTableFree
+ * #################################################################################################
+ * releases the memory held by a label table
+ */
+void labelTableFree(LabelTable *table) {
+    for (int id = 0; id < table->count; id++) {
+        free(table->names[id]);
+    }
+    free(table->names);
+    free(table->buckets);
+    memset(table, 0, sizeof(*table));
+}
+
+/**
+ * lineIndexScan
+ * #################################################################################################
+ * adds the line starts found in the next n bytes of the file to the index, growing it as needed
+ *
+ * ->Parameters
+ * ------------
+ * -index: the index being built
+ * -bytes, n: the next bytes of the file
+ * -offset: file offset of bytes[0], advanced past them
+ * -atLineStart: whether the next byte begins a new line, carried between calls
+ */
+static void lineIndexScan(LineIndex *index, int *capacity, const char *bytes, size_t n, long *offset, int *atLineStart) {
+    for (size_t i = 0; i < n; i++, (*offset)++) {
+        if (*atLineStart) {
+            if (index->count + 1 >= *capacity) { //keep room for the closing offset
+                *capacity *= 2;
+                long *grown = realloc(index->offsets, *capacity * sizeof(long));
+                if (!grown) {
+                    perror("Failed to grow line index");
+                    exit(EXIT_FAILURE);
+                }
+                index->offsets = grown;
+            }
+            index->offsets[index->count++] = *offset;
         }
+        *atLineStart = (bytes[i] == '\n');
     }
-    return -1; 
 }
 
 /**
- * lineCount
+ * lineIndexStart
  * #################################################################################################
- * counts the total number of lines in the given file. This is useful for selecting random lines later
- * or for determining file statistics.
+ * allocates an empty index for lineIndexScan()
+ */
+static void lineIndexStart(LineIndex *index, int *capacity) {
+    *capacity = 1024;
+    index->count = 0;
+    index->offsets = malloc(*capacity * sizeof(long));
+    if (!index->offsets) {
+        perror("Failed to allocate line index");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ * lineIndexBuild
+ * #################################################################################################
+ * reads the given file once and records the offset at which every line starts, so that random lines
+ * can later be fetched directly instead of reading the file from the beginning each time.
+ * a line is everything up to and including a newline; a last line without one also counts
  *
  * ->Parameters
  * ------------
  * -fp: file pointer to the open file
+ * -index: the index to fill in, release it with lineIndexFree()
  *
  * ->Returns
  * ---------
  * -total number of lines in the file
+ * -if memory runs out, the program terminates with an appropriate message
  */
-int lineCount(FILE *fp) {
-    int totalLines = 0;
-    char buffer[MAX_LINE_SIZE];
-    rewind(fp); //here we reset the file pointer to the beginning of the file
-    while (fgets(buffer, sizeof(buffer), fp)) { //reading line by line
-        totalLines++;
+int lineIndexBuild(FILE *fp, LineIndex *index) {
+    char chunk[1 << 16];
+    int capacity;
+    long offset = 0;
+    size_t n;
+    int atLineStart = 1; //the next byte read begins a new line
+
+    lineIndexStart(index, &capacity);
+    rewind(fp);
+    while ((n = fread(chunk, 1, sizeof(chunk), fp)) > 0) { //reading in big chunks, not line by line
+        lineIndexScan(index, &capacity, chunk, n, &offset, &atLineStart);
     }
-    rewind(fp); //we most likely would want to reuse it so we reset the file ptr
-    return totalLines;
+    index->offsets[index->count] = offset; //end of the last line
+    rewind(fp);
+    return index->count;
+}
+
+/**
+ * lineIndexBuildMapped
+ * #################################################################################################
+ * same as lineIndexBuild(), for a text that is already in memory (see textMap())
+ *
+ * ->Parameters
+ * ------------
+ * -text, size: the mapped text
+ * -index: the index to fill in, release it with lineIndexFree()
+ */
+void lineIndexBuildMapped(const char *text, size_t size, LineIndex *index) {
+    int capacity;
+    long offset = 0;
+    int atLineStart = 1;
+
+    lineIndexStart(index, &capacity);
+    lineIndexScan(index, &capacity, text, size, &offset, &atLineStart);
+    index->offsets[index->count] = offset;
 }
 
 /**
- * randomActiveChildrenSelection
+ * lineIndexFree
  * #################################################################################################
- * selects a random active child process from the array of children. Active children are represented
- * by non-zero PID values in the array.
+ * releases the memory held by an index built with lineIndexBuild()
  *
  * ->Parameters
  * ------------
- * -children:array containing the PIDs of child processes
- * -M:maximum size of the array
+ * -index: the index to release
+ */
+void lineIndexFree(LineIndex *index) {
+    free(index->offsets);
+    index->offsets = NULL;
+    index->count = 0;
+}
+
+/**
+ * randomLineSelection
+ * #################################################################################################
+ * retrieves a random line from the file whose selection is selected based on a random index, ensuring
+ * uniform distribution across all lines. the line index gives its position, so this is a single seek
+ * and read, and lines longer than the buffer are cut to MAX_LINE_SIZE - 1 characters
+ *
+ * ->Parameters
+ * ------------
+ * -fp:file pointer to the open file
+ * -index:line index of the file, built with lineIndexBuild()
+ * -rng:the generator that picks the line
+ * -buffer:buffer of MAX_LINE_SIZE to store the randomly selected line
  *
  * ->Returns
  * ---------
- * -index of a randomly selected active child
- * -or -1 if no active child exists
+ * -the offset of the line in the file
  */
-int randomActiveChildrenSelection(pid_t *children, int M) {
-    int activeIndexes[M];
-    int countOfActive = 0;
-    for (int i = 0; i < M; i++) {
-        if (children[i] > 0) { 
-            activeIndexes[countOfActive++] = i;
-        }
+long randomLineSelection(FILE *fp, const LineIndex *index, Rng *rng, char *buffer) {
+    int randLine = (int)rngBelow(rng, (uint32_t)index->count); 
+    long start = index->offsets[randLine];
+    long length = index->offsets[randLine + 1] - start;
+    if (length > MAX_LINE_SIZE - 1) {
+        length = MAX_LINE_SIZE - 1;
     }
-    if (countOfActive == 0) {
-        return -1;
+    size_t got = 0;
+    if (fseek(fp, start, SEEK_SET) == 0) {
+        got = fread(buffer, 1, length, fp);
     }
-    return activeIndexes[rand() % countOfActive];
+    buffer[got] = '\0';
+    return start;
 }
 
 /**
- * randomLineSelection
+ * randomLineSpan
  * #################################################################################################
- * retrieves a random line from the file whose selection is selected based on a random index, ensuring
- * uniform distribution across all lines.
+ * like randomLineSelection(), but only picks the line, for texts mapped with textMap(). nothing is
+ * copied and the line may be of any length
  *
  * ->Parameters
  * ------------
- * -fp:file pointer to the open file
- * -buffer:buffer to store the randomly selected line
- * -totalLines: total number of lines in the file
+ * -index:line index of the text
+ * -rng:the generator that picks the line
+ * -offset, length:set to where the randomly selected line starts in the text and to its length
  */
-void randomLineSelection(FILE *fp, char *buffer, int totalLines) {
-    int randLine = rand() % totalLines; 
-    rewind(fp); 
-    for (int i = 0; i <= randLine; i++) { 
-        fgets(buffer, MAX_LINE_SIZE, fp);
+void randomLineSpan(const LineIndex *index, Rng *rng, long *offset, int *length) {
+    int randLine = (int)rngBelow(rng, (uint32_t)index->count);
+    *offset = index->offsets[randLine];
+    *length = (int)(index->offsets[randLine + 1] - *offset);
+}
+
+/**
+ * textMap
+ * #################################################################################################
+ * maps the whole text file read-only into memory. the mapping is inherited by children forked
+ * afterwards, so they can read lines at the offsets the parent sends without any copying
+ *
+ * ->Parameters
+ * ------------
+ * -filename:name of the text file
+ * -size:set to the size of the file
+ *
+ * ->Returns
+ * ---------
+ * -pointer to the mapped text, NULL for an empty file, release it with munmap()
+ * -if the file cannot be opened or mapped, the program terminates with an appropriate message
+ */
+const char *textMap(const char *filename, size_t *size) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        perror("Failed to open text file");
+        exit(EXIT_FAILURE);
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        perror("Failed to stat text file");
+        exit(EXIT_FAILURE);
     }
+    *size = st.st_size;
+    if (*size == 0) { //mmap refuses empty mappings, and there are no lines to send anyway
+        close(fd);
+        return NULL;
+    }
+    const char *text = mmap(NULL, *size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); //the mapping stays valid without the descriptor
+    if (text == MAP_FAILED) {
+        perror("Failed to map text file");
+        exit(EXIT_FAILURE);
+    }
+    return text;
 }
 
 /**
- * sharedMemSetup
+ * ringInFlight
  * #################################################################################################
- * initializes and sets up the shared memory segment for inter-process communication (IPC)
+ * counts the messages the parent has published to a child's ring that the child has not consumed yet
+ */
+unsigned ringInFlight(ChildRing *ring) {
+    unsigned tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    unsigned head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    return tail - head;
+}
+
+/**
+ * ringProducerSlot
+ * #################################################################################################
+ * gives the parent the next free slot of a child's ring to fill in. the message becomes visible to
+ * the child only once it is published with ringPublish()
+ *
+ * ->Parameters
+ * ------------
+ * -ring:the child's ring
  *
  * ->Returns
  * ---------
- * -pointer to the initialized shared memory structure
+ * -pointer to the free slot
+ * -or NULL if the ring is full
+ */
+RingSlot *ringProducerSlot(ChildRing *ring) {
+    unsigned tail = atomic_load_explicit(&ring->tail, memory_order_relaxed); //only we write it
+    unsigned head = atomic_load_explicit(&ring->head, memory_order_acquire); //the child is done with slots before head
+    if (tail - head == RING_SLOTS) {
+        return NULL;
+    }
+    return &ring->slots[tail % RING_SLOTS];
+}
+
+/**
+ * ringPublish
+ * #################################################################################################
+ * hands the slot filled in after ringProducerSlot() over to the child
+ */
+void ringPublish(ChildRing *ring) {
+    unsigned tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release); //the slot's contents first
+}
+
+/**
+ * ringConsumerSlot
+ * #################################################################################################
+ * gives the child the oldest message of its ring, which stays valid until ringRelease()
+ *
+ * ->Parameters
+ * ------------
+ * -ring:the child's ring
+ *
+ * ->Returns
+ * ---------
+ * -pointer to the message
+ * -or NULL if the ring is empty
+ */
+RingSlot *ringConsumerSlot(ChildRing *ring) {
+    unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed); //only we write it
+    unsigned tail = atomic_load_explicit(&ring->tail, memory_order_acquire); //messages before tail are complete
+    if (head == tail) {
+        return NULL;
+    }
+    return &ring->slots[head % RING_SLOTS];
+}
+
+/**
+ * ringRelease
+ * #################################################################################################
+ * gives the slot of the message returned by ringConsumerSlot() back to the parent
+ */
+void ringRelease(ChildRing *ring) {
+    unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release); //after we are done reading
+}
+
+/**
+ * alignUp
+ * #################################################################################################
+ * rounds an offset in the shared segment up to a multiple of SEGMENT_ALIGN
+ */
+static size_t alignUp(size_t offset) {
+    return (offset + SEGMENT_ALIGN - 1) & ~(size_t)(SEGMENT_ALIGN - 1);
+}
+
+/**
+ * segmentCreate
+ * #################################################################################################
+ * creates and maps a shared segment of at least *size bytes, private to this run, that the children
+ * inherit when forked:
+ * -SEGMENT_SYSV:shmget(IPC_PRIVATE), so every run and every dispatcher gets its own segment
+ * -SEGMENT_POSIX:shm_open() under /ipcsim.<pid>.<n>, which is unique to the run, sized with
+ *  ftruncate() and mapped with mmap()
+ * -SEGMENT_HUGETLB:an anonymous MAP_SHARED | MAP_HUGETLB mapping, rounded up to HUGE_PAGE_SIZE,
+ *  which keeps large rings on few TLB entries. huge pages have to be reserved (vm.nr_hugepages),
+ *  without them this falls back to SEGMENT_POSIX with a warning
+ *
+ * ->Parameters
+ * ------------
+ * -kind, size:the kind of segment and its size, updated to what was created
+ * -shmid, name, nameSize:set to the SysV id or POSIX name of the segment, as they apply
+ *
+ * ->Returns
+ * ---------
+ * -the address of the segment, zero-filled
  * -if an error occurs, the program terminates with an appropriate message
  */
-SharedMemory* sharedMemSetup() {
-    key_t key = ftok("shmfile", 65); //generation of unique Key for SharedMem
-    int shmid = shmget(key, sizeof(SharedMemory), 0666 | IPC_CREAT); //creation of sharedMem
-    if (shmid == -1) {
+static SharedMemory *segmentCreate(int *kind, size_t *size, int *shmid, char *name, size_t nameSize) {
+    if (*kind == SEGMENT_HUGETLB) {
+        size_t hugeSize = (*size + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+        void *segment = mmap(NULL, hugeSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (segment != MAP_FAILED) {
+            *size = hugeSize;
+            return segment;
+        }
+        perror("Warning: no huge pages for shared memory, using normal pages");
+        *kind = SEGMENT_POSIX;
+    }
+    if (*kind == SEGMENT_POSIX) {
+        static int segments = 0; //several per process in sharded mode, each dispatcher has its own pid
+        snprintf(name, nameSize, "/ipcsim.%d.%d", (int)getpid(), segments++);
+        int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0) {
+            perror("Failed to create shared memory");
+            exit(EXIT_FAILURE);
+        }
+        if (ftruncate(fd, (off_t)*size) < 0) {
+            perror("Failed to size shared memory");
+            shm_unlink(name);
+            exit(EXIT_FAILURE);
+        }
+        void *segment = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd); //the mapping keeps the segment
+        if (segment == MAP_FAILED) {
+            perror("Failed to map shared memory");
+            shm_unlink(name);
+            exit(EXIT_FAILURE);
+        }
+        return segment;
+    }
+    //a private segment, the children inherit the attachment and every dispatcher gets its own
+    *shmid = shmget(IPC_PRIVATE, *size, 0666 | IPC_CREAT); //creation of sharedMem
+    if (*shmid == -1) {
         perror("Failed to create shared memory");
         exit(EXIT_FAILURE);
     }
-
-    SharedMemory *sharedMem = (SharedMemory *)shmat(shmid, NULL, 0); 
-    if (sharedMem == (void *)-1) {
+    void *segment = shmat(*shmid, NULL, 0);
+    if (segment == (void *)-1) {
         perror("Failed to attach shared memory");
+        shmctl(*shmid, IPC_RMID, NULL);
         exit(EXIT_FAILURE);
     }
+    return segment;
+}
+
+/**
+ * segmentRelease
+ * #################################################################################################
+ * unmaps the shared segment and removes it, whichever way segmentCreate() made it
+ */
+static void segmentRelease(SharedMemory *sharedMem) {
+    int kind = sharedMem->segmentKind;
+    size_t size = sharedMem->segmentSize;
+    int shmid = sharedMem->shmid;
+    char name[sizeof(sharedMem->segmentName)];
+    memcpy(name, sharedMem->segmentName, sizeof(name));
+    if (kind == SEGMENT_SYSV) {
+        shmdt(sharedMem);
+        shmctl(shmid, IPC_RMID, NULL);
+        return;
+    }
+    munmap(sharedMem, size);
+    if (kind == SEGMENT_POSIX) {
+        shm_unlink(name);
+    }
+}
+
+/**
+ * sharedMemSetup
+ * #################################################################################################
+ * initializes and sets up the shared memory segment for inter-process communication (IPC)
+ *
+ * ->Parameters
+ * ------------
+ * -numOfRings:number of child rings to allocate after the structure, 0 unless in ring mode
+ * -numOfControls:number of worker control blocks to allocate after the rings, 0 unless in pool mode
+ * -numOfStats:number of LatencyStats to allocate after those, 0 unless latency statistics are kept
+ * -numOfSems:number of semaphores to make room for after those, for semInitShared()
+ * -segmentKind:SEGMENT_SYSV, SEGMENT_POSIX or SEGMENT_HUGETLB, see segmentCreate()
+ *
+ * ->Returns
+ * ---------
+ * -pointer to the initialized shared memory structure
+ * -if an error occurs, the program terminates with an appropriate message
+ */
+SharedMemory* sharedMemSetup(int numOfRings, int numOfControls, int numOfStats, int numOfSems, int segmentKind) {
+    //each part starts at a multiple of SEGMENT_ALIGN, shmat() returns a page aligned segment
+    size_t controlsOffset = alignUp(sizeof(SharedMemory) + numOfRings * sizeof(ChildRing));
+    size_t statsOffset = alignUp(controlsOffset + numOfControls * sizeof(ChildControl));
+    size_t semsOffset = alignUp(statsOffset + numOfStats * sizeof(LatencyStats));
+    size_t size = semsOffset + numOfSems * sizeof(PaddedSem);
+    int shmid = -1;
+    char name[sizeof(((SharedMemory *)0)->segmentName)] = "";
+    SharedMemory *sharedMem = segmentCreate(&segmentKind, &size, &shmid, name, sizeof(name));
 
     //we initialize the fields of the sharedMem structure
+    sharedMem->segmentKind = segmentKind;
+    sharedMem->segmentSize = size;
+    memcpy(sharedMem->segmentName, name, sizeof(name));
     sharedMem->activeChildIndx = -1; //at start no child exists
     sharedMem->endsInTimestamp = -1;   //no termination timestamp by default
+    sharedMem->lineOffset = 0;
+    sharedMem->lineLength = 0;
+    sharedMem->shmid = shmid;
+    sharedMem->instance = 0;
+    sharedMem->numOfRings = numOfRings;
+    sharedMem->numOfControls = numOfControls;
+    sharedMem->numOfStats = numOfStats;
+    sharedMem->numOfSems = numOfSems;
+    sharedMem->controlsOffset = controlsOffset;
+    sharedMem->statsOffset = statsOffset;
+    sharedMem->semsOffset = semsOffset;
+    sharedMem->sentAt = 0;
+    sharedMem->spinTries = 0;
+    sharedMem->bufferedLog = 0;
+    sharedMem->echo = 1;
+    sharedMem->binaryLog = 0;
+    for (int i = 0; i < numOfRings; i++) { //all rings start empty
+        atomic_init(&sharedMem->rings[i].head, 0);
+        atomic_init(&sharedMem->rings[i].tail, 0);
+    }
+    ChildControl *controls = sharedControls(sharedMem);
+    for (int i = 0; i < numOfControls; i++) { //all workers start idle
+        controls[i].activationTime = -1;
+        atomic_init(&controls[i].busy, 0);
+        atomic_init(&controls[i].quit, 0);
+    }
+    memset(sharedStats(sharedMem), 0, numOfStats * sizeof(LatencyStats));
     memset(sharedMem->sharedSpace, 0, sizeof(sharedMem->sharedSpace)); //cleanup
     return sharedMem;
 }
 
+/**
+ * sharedControls
+ * #################################################################################################
+ * returns the worker control blocks of the segment, which follow the rings
+ */
+ChildControl *sharedControls(SharedMemory *sharedMem) {
+    return (ChildControl *)((char *)sharedMem + sharedMem->controlsOffset);
+}
+
+/**
+ * sharedStats
+ * #################################################################################################
+ * returns the latency statistics of the segment, one per slot, which follow the control blocks
+ */
+LatencyStats *sharedStats(SharedMemory *sharedMem) {
+    return (LatencyStats *)((char *)sharedMem + sharedMem->statsOffset);
+}
+
+/**
+ * nowNs
+ * #################################################################################################
+ * returns the CLOCK_MONOTONIC time in nanoseconds, the clock is the same for all processes
+ */
+uint64_t nowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/**
+ * latencyBucket
+ * #################################################################################################
+ * returns the histogram bucket of a latency: values below 2^LAT_SUB_BITS have their own, above that
+ * the bucket is given by the highest set bit and the LAT_SUB_BITS bits after it
+ */
+static int latencyBucket(uint64_t ns) {
+    if (ns < (1u << LAT_SUB_BITS)) {
+        return (int)ns;
+    }
+    int msb = 63 - __builtin_clzll(ns);
+    int bucket = ((msb - LAT_SUB_BITS + 1) << LAT_SUB_BITS) + (int)((ns >> (msb - LAT_SUB_BITS)) & ((1u << LAT_SUB_BITS) - 1));
+    return bucket < LAT_BUCKETS ? bucket : LAT_BUCKETS - 1;
+}
+
+/**
+ * latencyBucketValue
+ * #################################################################################################
+ * returns the smallest latency that falls in a bucket, the inverse of latencyBucket()
+ */
+static uint64_t latencyBucketValue(int bucket) {
+    if (bucket < (1 << LAT_SUB_BITS)) {
+        return (uint64_t)bucket;
+    }
+    int msb = (bucket >> LAT_SUB_BITS) + LAT_SUB_BITS - 1;
+    uint64_t sub = (uint64_t)(bucket & ((1 << LAT_SUB_BITS) - 1));
+    return ((uint64_t)1 << msb) | (sub << (msb - LAT_SUB_BITS));
+}
+
+/**
+ * latencyRecord
+ * #################################################################################################
+ * adds one latency sample, in nanoseconds, to a histogram
+ */
+void latencyRecord(LatencyHist *hist, uint64_t ns) {
+    hist->count++;
+    hist->sum += ns;
+    if (ns > hist->max) {
+        hist->max = ns;
+    }
+    hist->buckets[latencyBucket(ns)]++;
+}
+
+/**
+ * latencyMerge
+ * #################################################################################################
+ * adds the samples of one histogram to another
+ */
+void latencyMerge(LatencyHist *into, const LatencyHist *hist) {
+    into->count += hist->count;
+    into->sum += hist->sum;
+    if (hist->max > into->max) {
+        into->max = hist->max;
+    }
+    for (int i = 0; i < LAT_BUCKETS; i++) {
+        into->buckets[i] += hist->buckets[i];
+    }
+}
+
+/**
+ * latencyPercentile
+ * #################################################################################################
+ * returns the p-th percentile (0 to 100) of a histogram, as the start of the bucket it falls in
+ * (or the maximum, if that is smaller), or 0 for an empty histogram
+ */
+uint64_t latencyPercentile(const LatencyHist *hist, double p) {
+    if (hist->count == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(p / 100.0 * (double)hist->count);
+    if (rank >= hist->count) {
+        rank = hist->count - 1;
+    }
+    uint64_t seen = 0;
+    for (int i = 0; i < LAT_BUCKETS; i++) {
+        seen += hist->buckets[i];
+        if (seen > rank) {
+            uint64_t value = latencyBucketValue(i);
+            return value < hist->max ? value : hist->max;
+        }
+    }
+    return hist->max;
+}
+
+/**
+ * semName
+ * #################################################################################################
+ * builds the name of a named semaphore, /semaphore_<index> for a child slot and /parent_notification
+ * for index -1. the ones of dispatcher instance k > 0 in sharded mode get a .k suffix
+ */
+static void semName(char *name, size_t size, int instance, int index) {
+    int n = index < 0 ? snprintf(name, size, "/parent_notification") : snprintf(name, size, "/semaphore_%d", index);
+    if (instance > 0 && n >= 0 && (size_t)n < size) {
+        snprintf(name + n, size - n, ".%d", instance);
+    }
+}
+
 /**
  * rescourceCleanup
  * #################################################################################################
@@ -172,19 +881,29 @@ SharedMemory* sharedMemSetup() {
  */
 
 void rescourceCleanup(SharedMemory *sharedMem, sem_t *semaphores[], int M, sem_t *parentNotificationSemaphore) {
-    shmdt(sharedMem);
-    shmctl(shmget(ftok("shmfile", 65), sizeof(SharedMemory), 0666 | IPC_CREAT), IPC_RMID, NULL);
+    int instance = sharedMem->instance;
+    if (sharedMem->numOfSems > 0) { //semInitShared() ones live in the segment and have no names
+        for (int i = 0; i < M; i++) {
+            sem_destroy(semaphores[i]);
+        }
+        sem_destroy(parentNotificationSemaphore);
+        segmentRelease(sharedMem);
+        return;
+    }
+    segmentRelease(sharedMem);
     for (int i = 0; i < M; i++) {
         if (semaphores[i]) {
             sem_close(semaphores[i]);
-            char semName[32];
-            snprintf(semName, sizeof(semName), "/semaphore_%d", i);
-            sem_unlink(semName);
+            char name[48];
+            semName(name, sizeof(name), instance, i);
+            sem_unlink(name);
         }
     }
     if (parentNotificationSemaphore) {
         sem_close(parentNotificationSemaphore);
-        sem_unlink("/parent_notification");
+        char name[48];
+        semName(name, sizeof(name), instance, -1);
+        sem_unlink(name);
     }
 }
 
@@ -200,23 +919,83 @@ void rescourceCleanup(SharedMemory *sharedMem, sem_t *semaphores[], int M, sem_t
  * parameters:
  * -semaphores:array to store initialized semaphore pointers for child processes
  * -M:number of semaphores to initialize for child processes
+ * -instance:the dispatcher the semaphores belong to, 0 unless sharded, see semName()
  * -parentNotificationSemaphore:pointer to store the initialized parent notification semaphore
  */
 
-void semInit(sem_t *semaphores[], int M, sem_t **parentNotificationSemaphore) {
+void semInit(sem_t *semaphores[], int M, int instance, sem_t **parentNotificationSemaphore) {
+    char name[48];
     for (int i = 0; i < M; i++) {
-        char semName[32];
-        snprintf(semName, sizeof(semName), "/semaphore_%d", i);
-        semaphores[i] = sem_open(semName, O_CREAT, 0644, 0);
+        semName(name, sizeof(name), instance, i);
+        semaphores[i] = sem_open(name, O_CREAT, 0644, 0);
         if (semaphores[i] == SEM_FAILED) {
             perror("Failed to create semaphore");
             exit(EXIT_FAILURE);
         }
     }
     
-    *parentNotificationSemaphore = sem_open("/parent_notification", O_CREAT, 0644, 0);
+    semName(name, sizeof(name), instance, -1);
+    *parentNotificationSemaphore = sem_open(name, O_CREAT, 0644, 0);
     if (*parentNotificationSemaphore == SEM_FAILED) {
         perror("Failed to create parent notification semaphore");
         exit(EXIT_FAILURE);
     }
 }
+
+/**
+ * semInitShared
+ * #################################################################################################
+ * like semInit(), but the semaphores are unnamed process-shared ones placed in the shared memory
+ * segment after the rings, control blocks and statistics, which sharedMemSetup() must have made room for (M + 1
+ * of them). they do not go through the filesystem namespace, so there is nothing to unlink, and
+ * waiting on them with semWait() spins for a while before sleeping in the kernel
+ *
+ * parameters:
+ * -sharedMem:the shared memory segment, inherited by the children
+ * -semaphores:array to store initialized semaphore pointers for child processes
+ * -M:number of semaphores to initialize for child processes
+ * -parentNotificationSemaphore:pointer to store the initialized parent notification semaphore
+ */
+void semInitShared(SharedMemory *sharedMem, sem_t *semaphores[], int M, sem_t **parentNotificationSemaphore) {
+    PaddedSem *sems = (PaddedSem *)((char *)sharedMem + sharedMem->semsOffset);
+    if (sharedMem->numOfSems < M + 1) {
+        fprintf(stderr, "Error: no room for %d semaphores in shared memory.\n", M + 1);
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i <= M; i++) {
+        if (sem_init(&sems[i].sem, 1, 0) < 0) {
+            perror("Failed to initialize semaphore");
+            exit(EXIT_FAILURE);
+        }
+    }
+    *parentNotificationSemaphore = &sems[0].sem;
+    for (int i = 0; i < M; i++) {
+        semaphores[i] = &sems[i + 1].sem;
+    }
+    sharedMem->spinTries = SEM_SPIN_TRIES;
+}
+
+/**
+ * semWait
+ * #################################################################################################
+ * waits on a semaphore, first trying it spinTries times without sleeping, since the other side
+ * usually posts within microseconds, then blocking in sem_wait() (interrupted waits are retried)
+ *
+ * ->Returns
+ * ---------
+ * -0 once the semaphore was taken
+ * -or -1 on error, with errno set
+ */
+int semWait(sem_t *sem, int spinTries) {
+    for (int i = 0; i < spinTries; i++) {
+        if (sem_trywait(sem) == 0) {
+            return 0;
+        }
+    }
+    while (sem_wait(sem) < 0) {
+        if (errno != EINTR) {
+            return -1;
+        }
+    }
+    return 0;
+}
@@ -1,5 +1,7 @@
 #pragma once
 
+#define _GNU_SOURCE //for getopt() and mmap() under -std=c11
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,12 +11,90 @@
 #include <sys/wait.h>
 #include <sys/ipc.h>
 #include <sys/shm.h>
+#include <sys/mman.h>
 #include <semaphore.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <time.h>
 
 #define MAX_CONFIG_LINES 100
 #define MAX_LINE_SIZE 1000
 #define MAX_CHILDREN 100
 #define MAX_REQUESTS 10
+#define RING_SLOTS 16 //messages one child can have queued in ring mode
+#define SEM_SPIN_TRIES 2000 //sem_trywait() attempts before sleeping, with in-segment semaphores
+#define LOG_BUFFER_SIZE (1 << 20) //stdio buffer of a child's .log file with buffered logging
+#define CHILD_THREAD_STACK (256 * 1024) //stack of a child thread, child() needs little
+#define LAT_SUB_BITS 3 //latency histograms split every power of two of nanoseconds in 2^LAT_SUB_BITS buckets
+#define LAT_BUCKETS ((40 - LAT_SUB_BITS + 1) << LAT_SUB_BITS) //up to 2^40 ns, longer ones go in the last
+#define CACHE_LINE_SIZE 64
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024) //a MAP_HUGETLB segment is rounded up to whole huge pages
+
+//kinds of LogRecord
+#define LOG_RECORD_LINE 1
+#define LOG_RECORD_TERMINATE 2
+#define LOG_RECORD_SUMMARY 3
+#define LOG_MAGIC "IPCLOG1" //start of a binary log file, see LogFileHeader
+
+//how the parent picks the child to send the line of a timestep to, see selectChild()
+#define POLICY_RANDOM 0
+#define POLICY_ROUND_ROBIN 1
+#define POLICY_LEAST_LOADED 2
+
+//how the shared segment is created, see sharedMemSetup()
+#define SEGMENT_SYSV 0 //shmget(IPC_PRIVATE) and shmat()
+#define SEGMENT_POSIX 1 //shm_open() under a name unique to the run, and mmap()
+#define SEGMENT_HUGETLB 2 //an anonymous shared mmap() on huge pages, inherited by the children
+#define SEGMENT_ALIGN CACHE_LINE_SIZE //each part of the shared segment starts on its own cache line
+
+/*
+ * one message in a child's ring:
+ *-timestamp:timestep at which the parent sent it
+ *-sentAt:with latency statistics, the CLOCK_MONOTONIC time in ns at which it was queued
+ *-terminate:1 for a TERMINATE message, which is always the last one
+ *-lineOffset, lineLength:in mmap mode, the position of the line in the text mapping
+ *-line:otherwise, the line itself
+ * every slot starts on its own cache line, so the one the parent fills does not share a line with
+ * the one the child reads
+ * */
+typedef struct RingSlot {
+    _Alignas(CACHE_LINE_SIZE) int timestamp;
+    int terminate;
+    uint64_t sentAt;
+    long lineOffset;
+    int lineLength;
+    char line[MAX_LINE_SIZE];
+} RingSlot;
+
+/*
+ * single-producer/single-consumer queue of messages from the parent to one child, used in ring
+ * mode so the parent can queue lines without waiting for each to be acknowledged:
+ *-head:count of messages the child has consumed, written only by the child
+ *-tail:count of messages the parent has published, written only by the parent
+ *-slots:message i is in slots[i % RING_SLOTS], the ring is full when tail - head == RING_SLOTS
+ * head and tail are on cache lines of their own, so each side's counter is written without taking
+ * the line of the other's, and rings of different children never share a line
+ * */
+typedef struct ChildRing {
+    _Alignas(CACHE_LINE_SIZE) atomic_uint head;
+    _Alignas(CACHE_LINE_SIZE) atomic_uint tail;
+    RingSlot slots[RING_SLOTS];
+} ChildRing;
+
+/*
+ * state of one slot's pre-forked worker in pool mode, kept in the shared segment:
+ *-activationTime:timestep the label bound to the worker was spawned at, written by the parent
+ * before it binds the label
+ *-busy:1 from the SPAWN of a label until the worker has logged that label's TERMINATE, the parent
+ * only gives the slot out again once it is 0
+ *-quit:set by the parent at the end of the simulation, the worker then exits
+ * each block takes a whole cache line, so workers clearing busy do not disturb their neighbours
+ * */
+typedef struct ChildControl {
+    _Alignas(CACHE_LINE_SIZE) int activationTime;
+    atomic_int busy;
+    atomic_int quit;
+} ChildControl;
 
  /*
  * structure for the shared memory used for inter-process communication (IPC) between
@@ -22,20 +102,258 @@
  *-activeChildIndx:index of the currently active child process, or -1 if none
  *-endsInTimestamp:the termination timestamp for the most recently terminated child
  *-sharedSpace:buffer used to exchange a single line of text between parent and child
+ *-lineOffset, lineLength:in mmap mode the line is not copied into sharedSpace, these point at it
+ * inside the text mapping that the children inherit, and sharedSpace then only carries TERMINATE
+ *-numOfRings, numOfControls, numOfStats, numOfSems:how many rings, worker control blocks, latency
+ * statistics and in-segment semaphores follow the structure, in that order
+ *-spinTries:how long semWait() spins before it sleeps, 0 for the named semaphores
+ *-sentAt:with latency statistics, when the message in sharedSpace was sent, like RingSlot's
+ *-segmentKind, segmentSize:how the segment was created (SEGMENT_*) and its size, for rescourceCleanup()
+ *-shmid:with SEGMENT_SYSV the segment, which is private to one run and removed by rescourceCleanup()
+ *-segmentName:with SEGMENT_POSIX the shm_open() name of the segment, unlinked by rescourceCleanup()
+ *-instance:the dispatcher the segment belongs to, 0 unless sharded, its named semaphores include it
+ *-controlsOffset, statsOffset, semsOffset:where in the segment the control blocks, the latency
+ * statistics and the semaphores start, each part aligned to SEGMENT_ALIGN
+ *-bufferedLog:children log through a LOG_BUFFER_SIZE buffer and acknowledge a line before logging it
+ *-echo:children also print what they receive on the console
+ *-binaryLog:children write LogRecords to file[PID].bin instead of text to file[PID].log. the
+ * parent then also fills in lineOffset and lineLength (RingSlot's too) when it copies lines
+ *-rings:in ring mode, one message ring per child slot, the other fields are then unused. with
+ * a worker pool, the ChildControl blocks follow the rings, then with latency statistics one
+ * LatencyStats per slot, and with in-segment semaphores numOfSems unnamed process-shared semaphores
+ * come last
+ * the fields set up once and read by every child come first, the message fields that the parent
+ * writes for every line start on a cache line of their own after them
  * */
 typedef struct SharedMemory {
-    int activeChildIndx;        
+    int segmentKind;
+    size_t segmentSize;
+    int shmid;
+    char segmentName[48];
+    int instance;
+    int numOfRings;
+    int numOfControls;
+    int numOfStats;
+    int numOfSems;
+    size_t controlsOffset;
+    size_t statsOffset;
+    size_t semsOffset;
+    int spinTries;
+    int bufferedLog;
+    int echo;
+    int binaryLog;
+    _Alignas(CACHE_LINE_SIZE) int activeChildIndx;        
     int endsInTimestamp;           
+    uint64_t sentAt;
+    long lineOffset;
+    int lineLength;
     char sharedSpace[MAX_LINE_SIZE]; 
+    ChildRing rings[];
 } SharedMemory;
 
+/*
+ * an in-segment semaphore padded to a cache line, the children post the parent's and wait on their
+ * own all at once
+ * */
+typedef struct PaddedSem {
+    _Alignas(CACHE_LINE_SIZE) sem_t sem;
+} PaddedSem;
+
+/*
+ * histogram of latencies in nanoseconds, with 2^LAT_SUB_BITS buckets for every power of two so
+ * that percentiles read from it are within 1/2^LAT_SUB_BITS of the exact value:
+ *-count, sum, max:number of samples, their total and the largest one
+ *-buckets:samples per bucket, see latencyBucket()
+ * */
+typedef struct LatencyHist {
+    _Alignas(CACHE_LINE_SIZE) uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[LAT_BUCKETS];
+} LatencyHist;
+
+/*
+ * latency statistics of one child slot, each histogram has a single writer:
+ *-dispatch:from the parent posting (or queueing) a message to the child taking it, kept by the child
+ *-ack:from the parent posting a message to the child's acknowledgement, in the modes where the
+ * parent waits for it, kept by the parent
+ *-terminate:from the parent sending TERMINATE to the child being reaped, kept by the parent
+ * every histogram starts on a cache line, so the child's and the parent's updates stay apart
+ * */
+typedef struct LatencyStats {
+    LatencyHist dispatch;
+    LatencyHist ack;
+    LatencyHist terminate;
+} LatencyStats;
+
+/*
+ * start of a binary `.bin` log file, written once when the file is created:
+ *-magic:LOG_MAGIC and a 0
+ *-recordSize:sizeof(LogRecord), so that a reader can tell a file of another layout
+ * */
+typedef struct LogFileHeader {
+    char magic[8];
+    int32_t recordSize;
+    int32_t reserved;
+} LogFileHeader;
+
+/*
+ * one event of a child's binary log, which replaces a line of its text `.log` file with binary
+ * logging, so that writing it is a copy and reading it needs no parsing:
+ *-kind:LOG_RECORD_LINE (a line received), LOG_RECORD_TERMINATE or LOG_RECORD_SUMMARY (the
+ * "terminated. Total lines received" line)
+ *-timestamp:timestep of the message, or for a summary the timestep of the TERMINATE
+ *-slot, pid:the child slot and the ID the child logs under (its PID, or thread ID)
+ *-lineOffset, lineLength:for a line, where it is in the text file; for a summary the activation
+ * timestep and the number of lines received
+ *-latencyNs:with latency statistics, the dispatch latency of the message, 0 otherwise
+ * */
+typedef struct LogRecord {
+    int32_t kind;
+    int32_t timestamp;
+    int32_t slot;
+    int32_t pid;
+    int64_t lineOffset;
+    int32_t lineLength;
+    int32_t reserved;
+    uint64_t latencyNs;
+} LogRecord;
+
+/*
+ * pseudo random generator of one dispatcher, xorshift64*: a single 64-bit word of state, so every
+ * dispatcher has its own and a seed gives the same run every time
+ * */
+typedef struct Rng {
+    uint64_t state;
+} Rng;
+
+/*
+ * index of the line starts of the text file, built once so that a random line can be
+ * fetched with a single seek instead of reading the file up to it:
+ *-offsets:offsets[i] is the file offset where line i starts, offsets[count] is the file size
+ *-count:number of lines in the file
+ * */
+typedef struct LineIndex {
+    long *offsets;
+    int count;
+} LineIndex;
+
+/*
+ * table interning the process labels of the configuration file, so that entries and child slots
+ * refer to a label by a small integer ID instead of comparing strings:
+ *-names:names[id] is the label with that ID, IDs are given out from 0 in order of first appearance
+ *-count, capacity:number of labels and allocated names
+ *-buckets, numOfBuckets:open-addressing hash table of id + 1 (0 for an empty bucket), a power of two
+ * */
+typedef struct LabelTable {
+    char **names;
+    int count;
+    int capacity;
+    int *buckets;
+    int numOfBuckets;
+} LabelTable;
+
+/*
+ * the parent's bookkeeping of child slots, which keeps every per-timestep lookup O(1) however large M is:
+ *-M:number of slots
+ *-freeStack, numOfFree:the free slots, the one to use next on top
+ *-active, numOfActive:dense array of the slots whose child can be sent lines, in no particular order
+ *-activePos:position of each slot in active, -1 when it is not there
+ *-slotOfLabel, labelCapacity:slot of the active child with a given label ID, or -1, grown as needed
+ * */
+typedef struct ChildSlots {
+    int M;
+    int *freeStack;
+    int numOfFree;
+    int *active;
+    int numOfActive;
+    int *activePos;
+    int *slotOfLabel;
+    int labelCapacity;
+} ChildSlots;
+
+/*
+ * options of a simulation run, set from the command line:
+ *-useMmap:map the text file once and send children (offset, length) descriptors instead of copies
+ *-useRing:queue messages in per-child rings instead of one round trip per message
+ *-pipelined:every timestep queue a line for every active child whose ring has fewer than window
+ * messages in flight, and collect acknowledgements and exits without blocking (implies useRing)
+ *-window:messages one child may have in flight in pipelined mode, at most RING_SLOTS - 1 so that
+ * a TERMINATE always fits
+ *-batch:lines sent to a child in one handshake, each timestep (at most RING_SLOTS - 1)
+ *-syncRing:set when batch > 1 without -r or -p, the rings then only hold each batch and the parent
+ * still waits for the child's acknowledgement of every handshake
+ *-sharedSems:use unnamed semaphores inside the shared segment, waited on spin-then-sleep, instead of
+ * the named /semaphore_%d ones
+ *-bufferedLog, binaryLog, quiet:see SharedMemory, quiet turns the children's console echo off
+ *-latency:keep LatencyStats for every slot and print their percentiles and the throughput at exit
+ *-seed, seeded:the seed of the dispatchers' generators, if one was given (otherwise the time is used)
+ *-policy:POLICY_RANDOM, POLICY_ROUND_ROBIN or POLICY_LEAST_LOADED
+ *-segmentKind:how the shared segment is created, SEGMENT_SYSV by default
+ *-tickNs:in paced mode, the wall-clock length of a timestep in ns, 0 to run as fast as possible
+ *-numOfShards, shard:in sharded mode, the number of dispatcher processes and which one this is, the
+ * labels of the configuration are divided among them by ID (1 and 0 otherwise)
+ *-threads:run the children as threads of the parent instead of processes, with the same child()
+ *-pool:fork M workers up front and bind a label to an idle one on SPAWN, a TERMINATE then returns
+ * the worker to the pool instead of ending the process
+ * */
+typedef struct SimOptions {
+    int useMmap;
+    int useRing;
+    int pipelined;
+    int window;
+    int batch;
+    int syncRing;
+    int sharedSems;
+    int bufferedLog;
+    int binaryLog;
+    int quiet;
+    int pool;
+    int threads;
+    int latency;
+    long tickNs;
+    int segmentKind;
+    uint64_t seed;
+    int seeded;
+    int policy;
+    int numOfShards;
+    int shard;
+} SimOptions;
+
 
-int freeSlotFinder(pid_t *children, int M);
-int childLabelFinder(char child_labels[][10], const char *label, int M);
-int lineCount(FILE *fp);
-int randomActiveChildrenSelection(pid_t *children, int M);
-void randomLineSelection(FILE *fp, char *buffer, int total_lines);
-SharedMemory *sharedMemSetup();
+void slotsInit(ChildSlots *slots, int M);
+void slotsFree(ChildSlots *slots);
+int slotTake(ChildSlots *slots);
+void slotGive(ChildSlots *slots, int slot);
+void slotActivate(ChildSlots *slots, int slot, int labelId);
+void slotDeactivate(ChildSlots *slots, int slot, int labelId);
+int slotFindLabel(const ChildSlots *slots, int labelId);
+void rngSeed(Rng *rng, uint64_t seed);
+uint32_t rngBelow(Rng *rng, uint32_t bound);
+int randomActiveSlot(const ChildSlots *slots, Rng *rng);
+int labelIntern(LabelTable *table, const char *label, size_t length);
+const char *labelName(const LabelTable *table, int labelId);
+void labelTableFree(LabelTable *table);
+int lineIndexBuild(FILE *fp, LineIndex *index);
+void lineIndexBuildMapped(const char *text, size_t size, LineIndex *index);
+void lineIndexFree(LineIndex *index);
+long randomLineSelection(FILE *fp, const LineIndex *index, Rng *rng, char *buffer);
+void randomLineSpan(const LineIndex *index, Rng *rng, long *offset, int *length);
+const char *textMap(const char *filename, size_t *size);
+unsigned ringInFlight(ChildRing *ring);
+RingSlot *ringProducerSlot(ChildRing *ring);
+void ringPublish(ChildRing *ring);
+RingSlot *ringConsumerSlot(ChildRing *ring);
+void ringRelease(ChildRing *ring);
+SharedMemory *sharedMemSetup(int numOfRings, int numOfControls, int numOfStats, int numOfSems, int segmentKind);
+ChildControl *sharedControls(SharedMemory *sharedMem);
+LatencyStats *sharedStats(SharedMemory *sharedMem);
+uint64_t nowNs(void);
+void latencyRecord(LatencyHist *hist, uint64_t ns);
+void latencyMerge(LatencyHist *into, const LatencyHist *hist);
+uint64_t latencyPercentile(const LatencyHist *hist, double p);
 void rescourceCleanup(SharedMemory *sharedMem, sem_t *semaphores[], int M, sem_t *parentNotificationSemaphore);
-void semInit(sem_t *semaphores[], int M, sem_t **parentNotificationSemaphore);
+void semInit(sem_t *semaphores[], int M, int instance, sem_t **parentNotificationSemaphore);
+void semInitShared(SharedMemory *sharedMem, sem_t *semaphores[], int M, sem_t **parentNotificationSemaphore);
+int semWait(sem_t *sem, int spinTries);
 
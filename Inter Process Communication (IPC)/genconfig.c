@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+/**
+ * genconfig
+ * #################################################################################################
+ * writes a configuration file for process_simulation on stdout, for benchmarks: over the given
+ * number of timesteps, each timestep has a churn percent chance of a SPAWN or a TERMINATE, with at
+ * most M labels alive at a time, and the file ends with EXIT. labels of terminated children are
+ * spawned again later, from a set of 2 * M of them
+ *
+ * usage: genconfig [-s seed] <M> <churn> <steps>
+ */
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-s seed] <M> <churn percent> <steps>\n", prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    unsigned seed = (unsigned)time(NULL);
+    int opt;
+    while ((opt = getopt(argc, argv, "s:")) != -1) {
+        if (opt == 's') {
+            seed = (unsigned)strtoul(optarg, NULL, 10);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (argc - optind != 3) {
+        usage(argv[0]);
+    }
+    int M = atoi(argv[optind]);
+    int churn = atoi(argv[optind + 1]);
+    int steps = atoi(argv[optind + 2]);
+    if (M <= 0 || churn < 0 || churn > 100 || steps <= 0) {
+        usage(argv[0]);
+    }
+
+    //labels C1..C(2M), alive ones first: alive[0..numOfAlive) are spawned, the rest are not
+    int numOfLabels = 2 * M;
+    int *labels = malloc(numOfLabels * sizeof(int));
+    if (!labels) {
+        perror("Failed to allocate labels");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < numOfLabels; i++) {
+        labels[i] = i + 1;
+    }
+
+    srand(seed);
+    printf("0 C%d S\n", labels[0]); //so that there is something to send to from the start
+    int numOfAlive = 1;
+    for (int t = 1; t < steps; t++) {
+        if (rand() % 100 >= churn) {
+            continue;
+        }
+        int spawn = numOfAlive == 0 || (numOfAlive < M && rand() % 2 == 0);
+        if (spawn) {
+            int pick = numOfAlive + rand() % (numOfLabels - numOfAlive);
+            int label = labels[pick];
+            labels[pick] = labels[numOfAlive];
+            labels[numOfAlive++] = label;
+            printf("%d C%d S\n", t, label);
+        } else {
+            int pick = rand() % numOfAlive;
+            int label = labels[pick];
+            labels[pick] = labels[--numOfAlive];
+            labels[numOfAlive] = label;
+            printf("%d C%d T\n", t, label);
+        }
+    }
+    printf("%d EXIT\n", steps);
+    free(labels);
+    return 0;
+}
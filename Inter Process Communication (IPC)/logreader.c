@@ -0,0 +1,193 @@
+#include "common.h"
+
+/**
+ * logreader
+ * #################################################################################################
+ * reads the binary `file[PID].bin` logs that children write with process_simulation -B: it prints
+ * statistics aggregated over all the given files and, with -t, turns every `.bin` file back into
+ * the `.log` text file the child would have written, taking the lines from the text file
+ *
+ * usage: logreader [-t text_file] file[PID].bin...
+ */
+
+/**
+ * LogTotals
+ * #################################################################################################
+ * what is summed up over the records of all files
+ *
+ * -> Fields
+ * ----------
+ * - files, lines, terminates, lifetimes: files read and records of each kind
+ * - activeSteps: timesteps the children were active for, over all their lifetimes
+ * - first, last: earliest and latest timestep of a record
+ * - latency: dispatch latencies of the records that have one
+ */
+typedef struct LogTotals {
+    long files;
+    long lines;
+    long terminates;
+    long lifetimes;
+    long activeSteps;
+    int first;
+    int last;
+    LatencyHist latency;
+} LogTotals;
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-t text_file] file[PID].bin...\n", prog);
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * textLogName
+ * #################################################################################################
+ * derives the name of the text log from that of a binary one, file[PID].bin -> file[PID].log
+ */
+static void textLogName(const char *binName, char *name, size_t size) {
+    snprintf(name, size, "%s", binName);
+    size_t length = strlen(name);
+    if (length >= 4 && strcmp(name + length - 4, ".bin") == 0) {
+        memcpy(name + length - 4, ".log", 4);
+    } else if (length + 4 < size) {
+        strcat(name, ".log");
+    }
+}
+
+/**
+ * writeRecord
+ * #################################################################################################
+ * writes one record as the line of the text log the child would have written for it
+ */
+static void writeRecord(FILE *out, const LogRecord *record, const char *text, size_t textSize) {
+    if (record->kind == LOG_RECORD_LINE) {
+        int length = record->lineLength;
+        const char *line = "";
+        if (record->lineOffset >= 0 && (size_t)record->lineOffset + length <= textSize) {
+            line = text + record->lineOffset;
+        } else {
+            length = 0; //not in this text file
+        }
+        fprintf(out, "[t = %d] Child[%d] received message: %.*s", record->timestamp, record->pid, length, line);
+    } else if (record->kind == LOG_RECORD_TERMINATE) {
+        fprintf(out, "[t = %d] Child[%d] received TERMINATE message. Exiting.\n", record->timestamp, record->pid);
+    } else if (record->kind == LOG_RECORD_SUMMARY) {
+        int activation = (int)record->lineOffset;
+        fprintf(out, "Child[%d] terminated. Total lines received: %d, Active time: %d - %d = %d steps\n",
+                record->pid, record->lineLength, record->timestamp, activation, record->timestamp - activation);
+    }
+}
+
+/**
+ * readLog
+ * #################################################################################################
+ * reads one binary log, adding its records to the totals and, if out is not NULL, writing them to it
+ * as text
+ *
+ * ->Returns
+ * ---------
+ * -0, or -1 if the file could not be read or is not a binary log of this layout
+ */
+static int readLog(const char *name, LogTotals *totals, FILE *out, const char *text, size_t textSize) {
+    FILE *fp = fopen(name, "rb");
+    if (!fp) {
+        perror(name);
+        return -1;
+    }
+    LogFileHeader header;
+    if (fread(&header, sizeof(header), 1, fp) != 1 || memcmp(header.magic, LOG_MAGIC, sizeof(LOG_MAGIC)) != 0 ||
+        header.recordSize != (int32_t)sizeof(LogRecord)) {
+        fprintf(stderr, "%s: not a binary log of this version\n", name);
+        fclose(fp);
+        return -1;
+    }
+    totals->files++;
+    LogRecord record;
+    while (fread(&record, sizeof(record), 1, fp) == 1) {
+        if (totals->first < 0 || record.timestamp < totals->first) {
+            totals->first = record.timestamp;
+        }
+        if (record.timestamp > totals->last) {
+            totals->last = record.timestamp;
+        }
+        if (record.kind == LOG_RECORD_LINE) {
+            totals->lines++;
+        } else if (record.kind == LOG_RECORD_TERMINATE) {
+            totals->terminates++;
+        } else if (record.kind == LOG_RECORD_SUMMARY) {
+            totals->lifetimes++;
+            totals->activeSteps += record.timestamp - record.lineOffset;
+        }
+        if (record.latencyNs > 0) {
+            latencyRecord(&totals->latency, record.latencyNs);
+        }
+        if (out) {
+            writeRecord(out, &record, text, textSize);
+        }
+    }
+    fclose(fp);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    const char *textFile = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:")) != -1) {
+        if (opt == 't') {
+            textFile = optarg;
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (optind == argc) {
+        usage(argv[0]);
+    }
+    const char *text = NULL;
+    size_t textSize = 0;
+    if (textFile) {
+        text = textMap(textFile, &textSize);
+    }
+
+    LogTotals totals;
+    memset(&totals, 0, sizeof(totals));
+    totals.first = -1;
+    int status = 0;
+    for (int i = optind; i < argc; i++) {
+        FILE *out = NULL;
+        char outName[256];
+        if (text) {
+            textLogName(argv[i], outName, sizeof(outName));
+            out = fopen(outName, "w");
+            if (!out) {
+                perror(outName);
+                status = EXIT_FAILURE;
+                continue;
+            }
+        }
+        if (readLog(argv[i], &totals, out, text, textSize) < 0) {
+            status = EXIT_FAILURE;
+        }
+        if (out) {
+            fclose(out);
+        }
+    }
+
+    printf("Files: %ld, lines received: %ld, TERMINATEs: %ld, lifetimes: %ld\n", totals.files, totals.lines,
+           totals.terminates, totals.lifetimes);
+    if (totals.first >= 0) {
+        printf("Timesteps: %d - %d\n", totals.first, totals.last);
+    }
+    if (totals.lifetimes > 0) {
+        printf("Per lifetime: %.1f lines, %.1f steps active\n", (double)totals.lines / totals.lifetimes,
+               (double)totals.activeSteps / totals.lifetimes);
+    }
+    const LatencyHist *h = &totals.latency;
+    if (h->count > 0) {
+        printf("Dispatch latency (us): p50 %.1f, p90 %.1f, p99 %.1f, p99.9 %.1f, max %.1f, mean %.1f\n",
+               latencyPercentile(h, 50) / 1e3, latencyPercentile(h, 90) / 1e3, latencyPercentile(h, 99) / 1e3,
+               latencyPercentile(h, 99.9) / 1e3, h->max / 1e3, (double)h->sum / h->count / 1e3);
+    }
+    if (text) {
+        munmap((void *)text, textSize);
+    }
+    return status;
+}
@@ -8,6 +8,13 @@
 #include <time.h>
 #include <semaphore.h>
 #include <sys/wait.h>
+#include <limits.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#define CONFIG_READAHEAD 4096 //configuration entries read ahead of the current timestep
 
 /**
  * ConfigEntry
@@ -18,86 +25,926 @@
  * -> Fields
  * ----------
  * - timestamp: an integer representing the time step when the action should occur (e.g., 5, 10, 15).
- * - processLabel: a string (up to 9 characters + null terminator) identifying the target process
- *   (e.g., "C1" for child 0).
+ * - labelId: the ID of the label identifying the target process (e.g., "C1" for child 0), interned
+ *   in a LabelTable, or -1 for EXIT.
  * - command: a character specifying the action type. It can take the following values:
  *     * 'S': Spawn a new child process.
  *     * 'T': Terminate an existing child process.
  *     * 'E': Exit the simulation (used to define the end time of the simulation).
+ * - seq: position of the entry in the configuration file, so that entries with the same timestamp
+ *   run in file order.
  */
 typedef struct ConfigEntry {
     int timestamp;//first column
-    char processLabel[10];//second column
+    int labelId;//second column
     char command;//third column of the config.txt file
+    int seq;
 } ConfigEntry;
 
-/**configInfo
+/**
+ * EventQueue
+ * #################################################################################################
+ * the configuration entries ordered by (timestamp, seq) in a binary min-heap, so the main loop takes
+ * each timestep's entries off the top instead of scanning all of them every timestep, and can tell
+ * when the next entry is due
+ *
+ * -> Fields
+ * ----------
+ * - heap: the entries, heap[0] is the next one due
+ * - count, capacity: number of entries queued and allocated
+ */
+typedef struct EventQueue {
+    ConfigEntry *heap;
+    int count;
+    int capacity;
+} EventQueue;
+
+/**
+ * eventBefore
+ * #################################################################################################
+ * the ordering of the queue: earlier timestamp first, then earlier in the file
+ */
+static int eventBefore(const ConfigEntry *a, const ConfigEntry *b) {
+    if (a->timestamp != b->timestamp) {
+        return a->timestamp < b->timestamp;
+    }
+    return a->seq < b->seq;
+}
+
+/**
+ * eventPush
+ * #################################################################################################
+ * adds an entry to the queue, growing it as needed
+ */
+static void eventPush(EventQueue *q, const ConfigEntry *entry) {
+    if (q->count == q->capacity) {
+        q->capacity = q->capacity ? 2 * q->capacity : 64;
+        ConfigEntry *grown = realloc(q->heap, q->capacity * sizeof(ConfigEntry));
+        if (!grown) {
+            perror("Failed to allocate memory for commands");
+            exit(EXIT_FAILURE);
+        }
+        q->heap = grown;
+    }
+    int i = q->count++;
+    while (i > 0 && eventBefore(entry, &q->heap[(i - 1) / 2])) { //sift up
+        q->heap[i] = q->heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    q->heap[i] = *entry;
+}
+
+/**
+ * eventPop
+ * #################################################################################################
+ * removes the entry that is due first from a non-empty queue and returns it
+ */
+static ConfigEntry eventPop(EventQueue *q) {
+    ConfigEntry top = q->heap[0];
+    ConfigEntry last = q->heap[--q->count];
+    int i = 0;
+    while (2 * i + 1 < q->count) { //sift down
+        int c = 2 * i + 1;
+        if (c + 1 < q->count && eventBefore(&q->heap[c + 1], &q->heap[c])) {
+            c++;
+        }
+        if (!eventBefore(&q->heap[c], &last)) {
+            break;
+        }
+        q->heap[i] = q->heap[c];
+        i = c;
+    }
+    if (q->count > 0) {
+        q->heap[i] = last;
+    }
+    return top;
+}
+
+/**
+ * ConfigReader
+ * #################################################################################################
+ * reads the configuration file one entry at a time, in a single pass, so that entries are fed into
+ * the EventQueue as the simulation reaches them and only a bounded read-ahead is kept in memory
+ *
+ * -> Fields
+ * ----------
+ * - fp, line, lineCapacity: the open file and the getline() buffer, so lines may be of any length
+ * - labels: table the process labels are interned in
+ * - lineNo: lines read so far, also the seq of the next entry
+ * - lastTimestamp: the largest timestamp read so far
+ * - quitTimestamp: timestamp of the first EXIT entry, -1 until one is read
+ * - done: 1 once there is nothing more to read, at the end of the file, after an error, or when the
+ *   remaining entries come after the EXIT
+ * - error: 1 if a line could not be parsed
+ * - shard, numOfShards: in sharded mode only the SPAWN and TERMINATE entries of the labels with
+ *   labelId % numOfShards == shard are fed, every dispatcher reads the whole file (0 and 1 otherwise)
+ */
+typedef struct ConfigReader {
+    FILE *fp;
+    char *line;
+    size_t lineCapacity;
+    LabelTable *labels;
+    int lineNo;
+    int lastTimestamp;
+    int quitTimestamp;
+    int done;
+    int error;
+    int shard;
+    int numOfShards;
+} ConfigReader;
+
+/**configOpen
  *#################################################################################################
- *parses the configuration file to extract commands and data for the parent process
- *reads the file line by line and populates an array of ConfigEntry structures
+ *opens the configuration file for configNext()
  *
  *->Parameters
  *------------
+ *-reader:the reader to set up, release it with configClose()
  *-filename:name of the configuration file
- *-lineCount:pointer to store the total number of lines in the file
+ *-labels:table the process labels are interned in
+ */
+static void configOpen(ConfigReader *reader, const char *filename, LabelTable *labels) {
+    memset(reader, 0, sizeof(*reader));
+    reader->fp = fopen(filename, "r");//open config file for reading
+    if (!reader->fp) {
+        perror("Failed to open configuration file");
+        exit(EXIT_FAILURE);
+    }
+    reader->labels = labels;
+    reader->lastTimestamp = -1;
+    reader->quitTimestamp = -1;
+    reader->numOfShards = 1;
+}
+
+/**configClose
+ *#################################################################################################
+ *closes the configuration file and frees the reader's line buffer
+ */
+static void configClose(ConfigReader *reader) {
+    fclose(reader->fp);
+    free(reader->line);
+}
+
+/**configParse
+ *#################################################################################################
+ *parses one line of the configuration file, "<timestamp> EXIT" or "<timestamp> <label> <command>"
  *
  *->Returns
  *---------
- *-dynamically allocated array of ConfigEntry structures
- *-the caller is responsible for freeing the memory after usage
+ *-0 with the entry filled in
+ *-or -1 if the line is malformed
  */
-ConfigEntry *configInfo(const char *filename, int *lineCount) {
-    FILE *fp = fopen(filename, "r");//open config file for reading
-    if (!fp) {
-        perror("Failed to open configuration file");
-        exit(EXIT_FAILURE);
+static int configParse(ConfigReader *reader, char *line, ConfigEntry *entry) {
+    char *p = line, *end;
+    long timestamp = strtol(p, &end, 10);
+    if (end == p) {
+        return -1;
+    }
+    p = end;
+    while (*p == ' ' || *p == '\t') {
+        p++;
+    }
+    char *label = p;
+    while (*p && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r') {
+        p++;
+    }
+    size_t labelLength = p - label;
+    if (labelLength == 0) {
+        return -1;
+    }
+    entry->timestamp = (int)timestamp;
+    entry->seq = reader->lineNo;
+    //we check if the command is EXIT
+    if (labelLength == 4 && strncmp(label, "EXIT", 4) == 0) {
+        entry->labelId = -1;
+        entry->command = 'E';
+        return 0;
+    }
+    //(SPAWN/TERMINATE)
+    while (*p == ' ' || *p == '\t') {
+        p++;
     }
-    int count = 0;//initialization of the line counter
-    char line[256];//buffer to read each line, I thought that 256 is a generous upper limit
-    while (fgets(line, sizeof(line), fp)) {
-        count++;//and now we are incrementing counter for each line read
+    if (*p == '\0' || *p == '\n' || *p == '\r') {
+        return -1;
     }
-    rewind(fp);//resetting the file pointer to the beginning for parsing
+    entry->command = *p;
+    entry->labelId = labelIntern(reader->labels, label, labelLength);
+    return 0;
+}
 
-	//we allocate memory for ConfigEntry array (one entry per line)
-    ConfigEntry *commands = malloc(count * sizeof(ConfigEntry));
-    if (!commands) {
-        perror("Failed to allocate memory for commands");
-        exit(EXIT_FAILURE);
+/**configNext
+ *#################################################################################################
+ *reads the next entry of the configuration file
+ *
+ *->Parameters
+ *------------
+ *-reader:the reader, set up with configOpen()
+ *-entry:filled in with the entry read
+ *
+ *->Returns
+ *---------
+ *-1 if an entry was read
+ *-0 at the end of the file, or if a line is malformed (reader->error is then set)
+ */
+static int configNext(ConfigReader *reader, ConfigEntry *entry) {
+    if (reader->done) {
+        return 0;
     }
+    if (getline(&reader->line, &reader->lineCapacity, reader->fp) < 0) {
+        reader->done = 1;
+        return 0;
+    }
+    if (configParse(reader, reader->line, entry) < 0) {
+        fprintf(stderr, "Error parsing command in configuration file: %s\n", reader->line);
+        reader->done = 1;
+        reader->error = 1;
+        return 0;
+    }
+    reader->lineNo++;
+    if (entry->timestamp > reader->lastTimestamp) {
+        reader->lastTimestamp = entry->timestamp;
+    }
+    if (entry->command == 'E' && reader->quitTimestamp == -1) {
+        reader->quitTimestamp = entry->timestamp;
+    }
+    return 1;
+}
 
-    int i = 0; 
-    while (fgets(line, sizeof(line), fp)) {
-		//we check if the command is EXIT
-        if (strstr(line, "EXIT")) {
-            int timestamp;
-            if (sscanf(line, "%d EXIT", &timestamp) == 1) {
-                commands[i].timestamp = timestamp;
-                strcpy(commands[i].processLabel, "EXIT");
-                commands[i].command = 'E';
-            } else {
-                fprintf(stderr, "Error parsing EXIT command in configuration file.\n");
-                free(commands);
-                exit(EXIT_FAILURE);
+/**configFeed
+ *#################################################################################################
+ *moves entries from the configuration file into the event queue: every entry up to currTime, and
+ *beyond it until CONFIG_READAHEAD entries are queued. a sorted file is so kept to a bounded read-ahead,
+ *while small files are read whole up front. EXIT entries are only noted in the reader, entries after
+ *the EXIT or before timestep 0 are dropped, as are the labels of other dispatchers, and an entry read after its timestep already passed (the
+ *file is out of order there) runs at the current timestep, with a warning
+ */
+static void configFeed(ConfigReader *reader, EventQueue *events, int currTime) {
+    ConfigEntry entry;
+    while (events->count < CONFIG_READAHEAD || reader->lastTimestamp <= currTime) {
+        if (!configNext(reader, &entry)) {
+            break;
+        }
+        if (entry.command == 'E' || entry.timestamp < 0 ||
+            (reader->quitTimestamp >= 0 && entry.timestamp > reader->quitTimestamp)) {
+            continue; //never runs
+        }
+        if (entry.labelId % reader->numOfShards != reader->shard) {
+            continue; //another dispatcher's label
+        }
+        if (entry.timestamp < currTime) {
+            printf("[t = %d] Warning: configuration line %d for t = %d is out of order, running it now\n",
+                   currTime, entry.seq + 1, entry.timestamp);
+            entry.timestamp = currTime;
+        }
+        eventPush(events, &entry);
+    }
+}
+
+struct Dispatcher;
+
+/**
+ * ChildThread
+ * #################################################################################################
+ * a child of the thread backend, which runs child() in a thread of the parent
+ *
+ * -> Fields
+ * ----------
+ * - thread: the thread, joined once child() returns
+ * - started, tid: the thread stores its ID in tid and posts started, the parent waits for that so it
+ *   can report the ID the child logs under (that of a child process is its PID)
+ * - d, slot, activationTime, control: the arguments of child()
+ */
+typedef struct ChildThread {
+    pthread_t thread;
+    sem_t started;
+    pid_t tid;
+    struct Dispatcher *d;
+    int slot;
+    int activationTime;
+    ChildControl *control;
+} ChildThread;
+
+/**
+ * Dispatcher
+ * #################################################################################################
+ * the state of the parent process while it runs the simulation, shared by the helpers below
+ *
+ * -> Fields
+ * ----------
+ * - M, opts: the maximum number of children and the options of the run
+ * - children, childLabelIds, activationTime, terminationTime: per child slot, the PID (0 when the slot
+ *   is free, in pool mode the slot's worker for the whole run), the ID of the label from the configuration file (-1 when free), and when the child was
+ *   spawned and terminated
+ * - labels: the interned labels, for printing them
+ * - slots: the free slots, the active children (those that can be sent lines) and the slot of each label
+ * - draining, numOfDraining: in pipelined mode, the slots whose child was sent TERMINATE but is not
+ *   reaped yet
+ * - activeChildren: number of slots in use, including children that are still terminating
+ * - sharedMem, semaphores, parentNotificationSemaphore: the IPC objects shared with the children
+ * - controls: in pool mode, the control blocks of the workers in shared memory, NULL otherwise
+ * - stats, terminateSentAt, linesSent: with latency statistics, the LatencyStats of each slot in shared
+ *   memory (NULL otherwise), when each slot was last sent TERMINATE, and the lines sent in total
+ * - rng, nextRoundRobin, linesTo: the dispatcher's random generator, the position in slots.active that
+ *   round-robin selection sends to next, and the lines sent to each slot's child since it was spawned
+ * - threads: with the thread backend, the thread of each slot, NULL otherwise. children then holds
+ *   the thread IDs
+ * - fp, text, textSize, lineIndex: the text file, either open with stdio (fp) or mapped (text, in mmap
+ *   mode), and the index of its lines
+ */
+typedef struct Dispatcher {
+    int M;
+    const SimOptions *opts;
+    pid_t *children;
+    int *childLabelIds;
+    const LabelTable *labels;
+    int *activationTime;
+    int *terminationTime;
+    ChildSlots slots;
+    int *draining;
+    int numOfDraining;
+    int activeChildren;
+    SharedMemory *sharedMem;
+    sem_t **semaphores;
+    sem_t *parentNotificationSemaphore;
+    ChildControl *controls;
+    ChildThread *threads;
+    LatencyStats *stats;
+    uint64_t *terminateSentAt;
+    long linesSent;
+    Rng rng;
+    int nextRoundRobin;
+    long *linesTo;
+    FILE *fp;
+    const char *text;
+    size_t textSize;
+    LineIndex lineIndex;
+} Dispatcher;
+
+/**
+ * ringReserve
+ * #################################################################################################
+ * in ring mode, gets the slot for the next message to a child. if the child's ring is full this waits
+ * until children report, through parentNotificationSemaphore, that they have made room
+ *
+ * ->Returns
+ * ---------
+ * -the slot to fill in, then ringPublish() it and post the child's semaphore
+ */
+static RingSlot *ringReserve(Dispatcher *d, int childIndx) {
+    RingSlot *msg;
+    while ((msg = ringProducerSlot(&d->sharedMem->rings[childIndx])) == NULL) {
+        semWait(d->parentNotificationSemaphore, d->sharedMem->spinTries);
+    }
+    return msg;
+}
+
+/**
+ * childThread
+ * #################################################################################################
+ * start routine of a child thread of the thread backend
+ */
+static void *childThread(void *arg) {
+    ChildThread *t = arg;
+    Dispatcher *d = t->d;
+    t->tid = gettid();
+    sem_post(&t->started);
+    child(d->semaphores, t->slot, d->sharedMem, t->activationTime, d->parentNotificationSemaphore, d->text,
+          d->opts->useRing ? &d->sharedMem->rings[t->slot] : NULL, t->control);
+    return NULL;
+}
+
+/**
+ * startChild
+ * #################################################################################################
+ * starts the child of the given slot, a forked process or, with the thread backend, a thread
+ *
+ * ->Parameters
+ * ------------
+ * -activationTime, control:passed on to child()
+ *
+ * ->Returns
+ * ---------
+ * -the PID of the child process, or the thread ID of the child thread
+ * -or -1 if it could not be started
+ */
+static pid_t startChild(Dispatcher *d, int slot, int activationTime, ChildControl *control) {
+    if (d->threads) {
+        ChildThread *t = &d->threads[slot];
+        t->d = d;
+        t->slot = slot;
+        t->activationTime = activationTime;
+        t->control = control;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setstacksize(&attr, CHILD_THREAD_STACK);
+        int err = pthread_create(&t->thread, &attr, childThread, t);
+        pthread_attr_destroy(&attr);
+        if (err != 0) {
+            errno = err;
+            return -1;
+        }
+        semWait(&t->started, 0);
+        return t->tid;
+    }
+    fflush(stdout); //or the child would inherit what is buffered
+    pid_t child_pid = fork();
+    if (child_pid == 0) {
+        child(d->semaphores, slot, d->sharedMem, activationTime, d->parentNotificationSemaphore, d->text,
+              d->opts->useRing ? &d->sharedMem->rings[slot] : NULL, control);
+        exit(EXIT_SUCCESS);
+    }
+    return child_pid;
+}
+
+/**
+ * joinChild
+ * #################################################################################################
+ * waits for the child process or thread of the given slot to end
+ *
+ * ->Parameters
+ * ------------
+ * -block:0 to return at once if it has not ended yet
+ *
+ * ->Returns
+ * ---------
+ * -1 if it has ended, 0 otherwise
+ */
+static int joinChild(Dispatcher *d, int slot, int block) {
+    if (d->threads) {
+        if (block) {
+            return pthread_join(d->threads[slot].thread, NULL) == 0;
+        }
+        return pthread_tryjoin_np(d->threads[slot].thread, NULL) == 0;
+    }
+    return waitpid(d->children[slot], NULL, block ? 0 : WNOHANG) != 0;
+}
+
+/**
+ * startPool
+ * #################################################################################################
+ * in pool mode, starts the idle worker of every slot before the simulation starts, so that a SPAWN
+ * only binds a label to one of them. if one cannot be started the workers already forked are killed
+ */
+static void startPool(Dispatcher *d) {
+    for (int i = 0; i < d->M; i++) {
+        pid_t worker = startChild(d, i, -1, &d->controls[i]);
+        if (worker < 0) {
+            perror("Failed to start worker");
+            for (int j = 0; j < i && !d->threads; j++) { //threads end with the process
+
+                kill(d->children[j], SIGKILL);
+                waitpid(d->children[j], NULL, 0);
             }
+            rescourceCleanup(d->sharedMem, d->semaphores, d->M, d->parentNotificationSemaphore);
+            exit(EXIT_FAILURE);
+        }
+        d->children[i] = worker;
+    }
+}
+
+/**
+ * stopPool
+ * #################################################################################################
+ * in pool mode, once every label was terminated, tells all the workers to exit and waits for them
+ */
+static void stopPool(Dispatcher *d) {
+    for (int i = 0; i < d->M; i++) {
+        atomic_store_explicit(&d->controls[i].quit, 1, memory_order_release);
+        sem_post(d->semaphores[i]);
+    }
+    for (int i = 0; i < d->M; i++) {
+        joinChild(d, i, 1);
+        d->children[i] = 0;
+    }
+}
+
+/**
+ * spawnChild
+ * #################################################################################################
+ * starts a new child process (or thread) in a free slot and records its details. in pool mode the slot's
+ * worker already runs, and is only given the label and activation time
+ */
+static void spawnChild(Dispatcher *d, int labelId, int currTime) {
+    int freeSlot = slotTake(&d->slots); 
+    if (freeSlot == -1) {
+        return;
+    }
+    pid_t child_pid;
+    if (d->controls) {
+        d->controls[freeSlot].activationTime = currTime; //read by the worker at its TERMINATE
+        atomic_store_explicit(&d->controls[freeSlot].busy, 1, memory_order_relaxed); //seen through the later posts
+        child_pid = d->children[freeSlot];
+    } else {
+        child_pid = startChild(d, freeSlot, currTime, NULL); 
+    }
+    if (child_pid > 0) { 
+        d->children[freeSlot] = child_pid;
+        d->childLabelIds[freeSlot] = labelId;
+        d->activationTime[freeSlot] = currTime;
+        slotActivate(&d->slots, freeSlot, labelId);
+        d->linesTo[freeSlot] = 0;
+        d->activeChildren++;
+        printf("\n[t = %d] Spawned process %s (PID: %d)\n", currTime, labelName(d->labels, labelId), child_pid);
+    } else {
+        slotGive(&d->slots, freeSlot);
+    }
+}
+
+/**
+ * reapChild
+ * #################################################################################################
+ * waits for the child in the given slot to exit and frees the slot. in pool mode the worker does not
+ * exit, it is waited for until it has logged its TERMINATE, which it acknowledges last
+ *
+ * ->Parameters
+ * ------------
+ * -block:0 to return at once if the child has not exited yet
+ *
+ * ->Returns
+ * ---------
+ * -1 if the child was reaped, 0 otherwise
+ */
+static int reapChild(Dispatcher *d, int childIndx, int block) {
+    if (d->controls) {
+        while (atomic_load_explicit(&d->controls[childIndx].busy, memory_order_acquire)) {
+            if (!block) {
+                return 0;
+            }
+            semWait(d->parentNotificationSemaphore, d->sharedMem->spinTries); //posted after busy is cleared
+        }
+    } else if (!joinChild(d, childIndx, block)) {
+        return 0;
+    }
+    if (d->stats) {
+        latencyRecord(&d->stats[childIndx].terminate, nowNs() - d->terminateSentAt[childIndx]);
+    }
+    printf("[t = %d] Child[%d] has terminated.\n", d->terminationTime[childIndx], childIndx);
+    if (!d->controls) {
+        d->children[childIndx] = 0;  //marking the slot free for reuse
+    }
+    slotGive(&d->slots, childIndx);
+    d->activeChildren--; 
+    return 1;
+}
+
+/**
+ * collectAcks
+ * #################################################################################################
+ * in pipelined mode, takes in the acknowledgements the children have posted so far and reaps the
+ * children that have exited after a TERMINATE, without waiting for any of them unless block is set.
+ * terminateAll() also collects its children here
+ */
+static void collectAcks(Dispatcher *d, int block) {
+    while (sem_trywait(d->parentNotificationSemaphore) == 0) {
+        //the rings' head counters say what was consumed, the posts only need draining
+    }
+    for (int i = d->numOfDraining - 1; i >= 0; i--) { //backwards, so removing one keeps the rest in place
+        if (reapChild(d, d->draining[i], block)) {
+            d->draining[i] = d->draining[--d->numOfDraining];
+        }
+    }
+}
+
+/**
+ * terminateBegin
+ * #################################################################################################
+ * takes the child in the given slot out of the active ones before it is sent TERMINATE
+ *
+ * ->Returns
+ * ---------
+ * -with latency statistics, the time the TERMINATE is sent at, 0 otherwise
+ */
+static uint64_t terminateBegin(Dispatcher *d, int childIndx, int currTime) {
+    d->terminationTime[childIndx] = currTime; //then update the shared memory
+    slotDeactivate(&d->slots, childIndx, d->childLabelIds[childIndx]); //no more lines for it
+    d->childLabelIds[childIndx] = -1; //the label may be spawned again
+    printf("\n[t = %d] Parent sent TERMINATE message to child[%d]\n", currTime, childIndx);
+    uint64_t sentAt = d->stats ? nowNs() : 0;
+    if (d->stats) {
+        d->terminateSentAt[childIndx] = sentAt;
+    }
+    return sentAt;
+}
+
+/**
+ * queueTerminate
+ * #################################################################################################
+ * in ring mode, queues TERMINATE behind the lines the child in the given slot still has to log
+ * and wakes the child
+ */
+static void queueTerminate(Dispatcher *d, int childIndx, int currTime, uint64_t sentAt) {
+    RingSlot *msg = ringReserve(d, childIndx);
+    msg->timestamp = currTime;
+    msg->terminate = 1;
+    msg->sentAt = sentAt;
+    ringPublish(&d->sharedMem->rings[childIndx]);
+    sem_post(d->semaphores[childIndx]);
+}
+
+/**
+ * terminateChild
+ * #################################################################################################
+ * sends TERMINATE to the child in the given slot, waits for it to exit and frees the slot.
+ * in ring mode TERMINATE is queued behind the lines the child still has to log; the child's
+ * acknowledgements then only say that it made room, so its exit is what is waited for.
+ * in pipelined mode the exit is not waited for here, collectAcks() reaps the child later
+ */
+static void terminateChild(Dispatcher *d, int childIndx, int currTime) {
+    SharedMemory *sharedMem = d->sharedMem;
+    uint64_t sentAt = terminateBegin(d, childIndx, currTime);
+    if (d->opts->useRing) {
+        queueTerminate(d, childIndx, currTime, sentAt);
+        if (d->opts->pipelined) {
+            d->draining[d->numOfDraining++] = childIndx;
+            return;
+        }
+        if (d->opts->syncRing) {
+            semWait(d->parentNotificationSemaphore, d->sharedMem->spinTries); //keep the handshakes in step
+        }
+    } else {
+        sharedMem->endsInTimestamp = currTime;
+        sharedMem->sentAt = sentAt;
+        strcpy(sharedMem->sharedSpace, "TERMINATE");//set a terminate message, as asked
+        sem_post(d->semaphores[childIndx]); //signaling semaphore to unblock the child
+        semWait(d->parentNotificationSemaphore, d->sharedMem->spinTries); // waiting for child to notify the parent
+    }
+    reapChild(d, childIndx, 1); //and the child process to exit
+}
+
+/**
+ * terminateAll
+ * #################################################################################################
+ * at EXIT, sends TERMINATE to every active child at once and only then collects them, so that they
+ * all shut down at the same time instead of one after the other. without rings, the one TERMINATE
+ * in sharedSpace is read by all of them, so the slots' semaphores are posted together; with rings
+ * TERMINATE is queued in every ring. the children are then reaped, with those still draining from
+ * pipelined mode, in one collectAcks() pass, and their acknowledgements are not waited for one by one
+ */
+static void terminateAll(Dispatcher *d, int currTime) {
+    SharedMemory *sharedMem = d->sharedMem;
+    if (!d->opts->useRing) {
+        sharedMem->endsInTimestamp = currTime;
+        sharedMem->sentAt = d->stats ? nowNs() : 0;
+        strcpy(sharedMem->sharedSpace, "TERMINATE"); //the same message for all of them
+    }
+    while (d->slots.numOfActive > 0) {
+        int childIndx = d->slots.active[0]; //terminateBegin() takes it out of the active ones
+        uint64_t sentAt = terminateBegin(d, childIndx, currTime);
+        if (d->opts->useRing) {
+            queueTerminate(d, childIndx, currTime, sentAt);
         } else {
-			//(SPAWN/TERMINATE)
-            char processLabel[10];
-            if (sscanf(line, "%d %s %c", &commands[i].timestamp,
-                       processLabel, &commands[i].command) == 3) {
-						// Store the parsed data in the commands array
-                strcpy(commands[i].processLabel, processLabel);
-            } else {
-                fprintf(stderr, "Error parsing command in configuration file: %s\n", line);
-                free(commands);
-                exit(EXIT_FAILURE);
+            sem_post(d->semaphores[childIndx]);
+        }
+        d->draining[d->numOfDraining++] = childIndx;
+    }
+    collectAcks(d, 1);
+}
+
+/**
+ * queueLine
+ * #################################################################################################
+ * in ring mode, puts a random line of the text in the ring of the child in the given slot. the child
+ * sees it once its semaphore is posted
+ */
+static void queueLine(Dispatcher *d, int childIndx, int currTime) {
+    RingSlot *msg = ringReserve(d, childIndx);
+    const char *sent;
+    int sentLength;
+    msg->timestamp = currTime;
+    msg->terminate = 0;
+    msg->sentAt = d->stats ? nowNs() : 0;
+    d->linesSent++;
+    d->linesTo[childIndx]++;
+    if (d->text) {
+        randomLineSpan(&d->lineIndex, &d->rng, &msg->lineOffset, &msg->lineLength);
+        sent = d->text + msg->lineOffset;
+        sentLength = msg->lineLength;
+    } else {
+        msg->lineOffset = randomLineSelection(d->fp, &d->lineIndex, &d->rng, msg->line); //for binary logs
+        sent = msg->line;
+        sentLength = (int)strlen(msg->line);
+        msg->lineLength = sentLength;
+    }
+    printf("[t = %d] Parent sent message to child[%d]: %.*s", currTime, childIndx, sentLength, sent);
+    ringPublish(&d->sharedMem->rings[childIndx]);
+}
+
+/**
+ * sendLines
+ * #################################################################################################
+ * sends count random lines of the text to the child in the given slot in one handshake. in ring mode
+ * the lines are queued behind a single post of the child's semaphore and, unless opts->syncRing is
+ * set, the parent moves on. otherwise the one line is placed in shared memory and the child's
+ * acknowledgement awaited
+ */
+static void sendLines(Dispatcher *d, int childIndx, int currTime, int count) {
+    SharedMemory *sharedMem = d->sharedMem;
+    char line[MAX_LINE_SIZE];
+    const char *sent = line;
+    int sentLength;
+    uint64_t sentAt;
+    if (d->opts->useRing) {
+        for (int i = 0; i < count; i++) {
+            queueLine(d, childIndx, currTime);
+        }
+        sentAt = d->stats ? nowNs() : 0;
+        sem_post(d->semaphores[childIndx]);
+        if (d->opts->syncRing) {
+            semWait(d->parentNotificationSemaphore, d->sharedMem->spinTries); //the child logged the whole batch
+            if (d->stats) {
+                latencyRecord(&d->stats[childIndx].ack, nowNs() - sentAt);
+            }
+        }
+        return;
+    }
+    if (d->text) { //mmap mode, only the position of the line goes to shared memory
+        randomLineSpan(&d->lineIndex, &d->rng, &sharedMem->lineOffset, &sharedMem->lineLength);
+        sharedMem->sharedSpace[0] = '\0'; //clear any earlier TERMINATE
+        sent = d->text + sharedMem->lineOffset;
+        sentLength = sharedMem->lineLength;
+    } else {
+        sharedMem->lineOffset = randomLineSelection(d->fp, &d->lineIndex, &d->rng, line); //for binary logs
+        strcpy(sharedMem->sharedSpace, line); //we store the line in shared memory
+        sentLength = (int)strlen(line);
+        sharedMem->lineLength = sentLength;
+    }
+    sharedMem->endsInTimestamp = currTime;
+    sharedMem->activeChildIndx = childIndx;
+    printf("[t = %d] Parent sent message to child[%d]: %.*s", currTime, childIndx, sentLength, sent);
+    d->linesSent++;
+    d->linesTo[childIndx]++;
+    sentAt = d->stats ? nowNs() : 0;
+    sharedMem->sentAt = sentAt;
+    sem_post(d->semaphores[childIndx]); 
+    semWait(d->parentNotificationSemaphore, d->sharedMem->spinTries); 
+    if (d->stats) {
+        latencyRecord(&d->stats[childIndx].ack, nowNs() - sentAt);
+    }
+}
+
+/**
+ * selectChild
+ * #################################################################################################
+ * picks the active child that the line of a timestep goes to, by opts->policy:
+ * -POLICY_RANDOM:uniformly at random
+ * -POLICY_ROUND_ROBIN:each active child in turn
+ * -POLICY_LEAST_LOADED:the one with the fewest lines in flight in its ring when the parent does not
+ *  wait for acknowledgements, otherwise the one that was sent the fewest lines since it was spawned,
+ *  the first such one on ties
+ *
+ * ->Returns
+ * ---------
+ * -the slot of the child, or -1 if no child is active
+ */
+static int selectChild(Dispatcher *d) {
+    const ChildSlots *slots = &d->slots;
+    if (slots->numOfActive == 0) {
+        return -1;
+    }
+    if (d->opts->policy == POLICY_ROUND_ROBIN) {
+        if (d->nextRoundRobin >= slots->numOfActive) {
+            d->nextRoundRobin = 0;
+        }
+        return slots->active[d->nextRoundRobin++];
+    }
+    if (d->opts->policy == POLICY_LEAST_LOADED) {
+        int inFlight = d->opts->useRing && !d->opts->syncRing;
+        int best = -1;
+        long bestLoad = 0;
+        for (int j = 0; j < slots->numOfActive; j++) {
+            int i = slots->active[j];
+            long load = inFlight ? (long)ringInFlight(&d->sharedMem->rings[i]) : d->linesTo[i];
+            if (best == -1 || load < bestLoad) {
+                best = i;
+                bestLoad = load;
             }
         }
-        i++;
+        return best;
+    }
+    return randomActiveSlot(slots, &d->rng);
+}
+
+/**
+ * dispatchAll
+ * #################################################################################################
+ * in pipelined mode, queues a batch of lines for every active child, as far as its in-flight window
+ * has room. a child that is behind is skipped for this timestep rather than waited for, so one slow
+ * child does not hold up the others
+ */
+static void dispatchAll(Dispatcher *d, int currTime) {
+    for (int j = 0; j < d->slots.numOfActive; j++) {
+        int i = d->slots.active[j];
+        int room = d->opts->window - (int)ringInFlight(&d->sharedMem->rings[i]);
+        int count = room < d->opts->batch ? room : d->opts->batch;
+        if (count > 0) {
+            sendLines(d, i, currTime, count);
+        }
+    }
+}
+
+/**
+ * printLatencyRow
+ * #################################################################################################
+ * prints the sample count, percentiles and maximum of one histogram, in microseconds
+ */
+static void printLatencyRow(const char *who, const char *kind, const LatencyHist *hist) {
+    if (hist->count == 0) {
+        return;
+    }
+    printf("%-10s %-9s %10" PRIu64 " %10.1f %10.1f %10.1f %10.1f %10.1f\n", who, kind, hist->count,
+           latencyPercentile(hist, 50) / 1e3, latencyPercentile(hist, 90) / 1e3,
+           latencyPercentile(hist, 99) / 1e3, latencyPercentile(hist, 99.9) / 1e3, hist->max / 1e3);
+}
+
+/**
+ * printLatencySummary
+ * #################################################################################################
+ * with latency statistics, prints once every child is done the percentiles of each slot that has
+ * samples and of all of them together, then the throughput of the run
+ *
+ * ->Parameters
+ * ------------
+ * -elapsedNs:wall time of the simulation, from the first timestep until every child was done
+ */
+static void printLatencySummary(Dispatcher *d, uint64_t elapsedNs) {
+    static const char *kinds[] = {"dispatch", "ack", "terminate"};
+    LatencyStats all;
+    memset(&all, 0, sizeof(all));
+    printf("\nLatency summary (us):\n");
+    printf("%-10s %-9s %10s %10s %10s %10s %10s %10s\n", "slot", "latency", "count", "p50", "p90", "p99",
+           "p99.9", "max");
+    for (int i = 0; i < d->M; i++) {
+        const LatencyHist *hists[] = {&d->stats[i].dispatch, &d->stats[i].ack, &d->stats[i].terminate};
+        LatencyHist *totals[] = {&all.dispatch, &all.ack, &all.terminate};
+        char who[24];
+        snprintf(who, sizeof(who), "child[%d]", i);
+        for (int k = 0; k < 3; k++) {
+            printLatencyRow(who, kinds[k], hists[k]);
+            latencyMerge(totals[k], hists[k]);
+        }
+    }
+    printLatencyRow("all", kinds[0], &all.dispatch);
+    printLatencyRow("all", kinds[1], &all.ack);
+    printLatencyRow("all", kinds[2], &all.terminate);
+    double seconds = elapsedNs / 1e9;
+    printf("Throughput: %ld lines in %.3f s, %.0f lines/s\n", d->linesSent, seconds,
+           seconds > 0 ? d->linesSent / seconds : 0.0);
+}
+
+/**
+ * Pacer
+ * #################################################################################################
+ * in paced mode, holds timestep t back until start + t * tickNs on CLOCK_MONOTONIC. the deadlines are
+ * absolute, so a late timestep does not push the later ones back, and how late each one started
+ * is recorded
+ *
+ * -> Fields
+ * ----------
+ * - tickNs, start: the length of a timestep and when timestep 0 was due
+ * - ticks: timesteps paced
+ * - overruns: how late the timesteps that missed their deadline started, in ns
+ */
+typedef struct Pacer {
+    long tickNs;
+    uint64_t start;
+    long ticks;
+    LatencyHist overruns;
+} Pacer;
+
+/**
+ * paceTick
+ * #################################################################################################
+ * sleeps until the deadline of the given timestep, or, if the loop is already past it, reports by
+ * how much
+ */
+static void paceTick(Pacer *pacer, int currTime) {
+    uint64_t deadline = pacer->start + (uint64_t)currTime * (uint64_t)pacer->tickNs;
+    uint64_t now = nowNs();
+    pacer->ticks++;
+    if (now > deadline) {
+        latencyRecord(&pacer->overruns, now - deadline);
+        printf("[t = %d] Overrun: timestep started %.1f us late\n", currTime, (now - deadline) / 1e3);
+        return;
+    }
+    struct timespec ts = {(time_t)(deadline / 1000000000u), (long)(deadline % 1000000000u)};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+        //interrupted, the deadline is absolute so we just sleep again
+    }
+}
+
+/**
+ * printPacingSummary
+ * #################################################################################################
+ * prints how many of the paced timesteps overran their deadline, and by how much
+ */
+static void printPacingSummary(const Pacer *pacer) {
+    const LatencyHist *o = &pacer->overruns;
+    printf("\nPacing: %ld timesteps of %.1f us, %" PRIu64 " overran", pacer->ticks, pacer->tickNs / 1e3, o->count);
+    if (o->count > 0) {
+        printf(" (p50 %.1f us, p99 %.1f us, max %.1f us, mean %.1f us)", latencyPercentile(o, 50) / 1e3,
+               latencyPercentile(o, 99) / 1e3, o->max / 1e3, (double)o->sum / o->count / 1e3);
     }
-    *lineCount = count; //updating the line count for the caller
-    fclose(fp);
-    return commands;
+    printf("\n");
 }
 
 /**
@@ -114,7 +961,7 @@ ConfigEntry *configInfo(const char *filename, int *lineCount) {
  * detailed functionality:
  * --------------------------
  * 1. initialization:
- *    -reads the configuration file (config_file) and loads all commands into memory
+ *    -opens the configuration file (config_file) and starts feeding its commands into the event queue
  *    -opens the text file (text_file) to retrieve random lines for communication with child processes
  *    -sets up shared memory (SharedMemory) for inter-process communication
  *    -initializes an array of semaphores (semaphores) for parent-child synchronization
@@ -144,145 +991,460 @@ ConfigEntry *configInfo(const char *filename, int *lineCount) {
  * -config_file:input configuration file containing SPAWN, TERMINATE, and EXIT commands
  * -text_file:input text file from which random lines are sent to child processes
  * -M:maximum number of child processes allowed (also defines the size of the semaphore array)
+ * -opts:options of the run, in mmap mode (opts->useMmap) the text file is mapped once, shared
+ *  with the children, and only the position of each line is written to shared memory. in ring mode
+ *  (opts->useRing) each child has a queue of RING_SLOTS messages, the parent only waits when the
+ *  queue is full, and TERMINATE is queued behind the lines the child has yet to log. with
+ *  opts->batch > 1 each handshake carries that many lines. in pool mode (opts->pool) the M workers
+ *  are forked up front and SPAWN and TERMINATE only bind and release their labels. with the thread
+ *  backend (opts->threads) the children are threads of this process running the same child(). with
+ *  opts->latency the latencies of every slot are kept in shared memory and summarized at the end.
+ *  with opts->tickNs every timestep is paced to that wall-clock interval, see Pacer
+ *
+ * -linesSent:if not NULL, set to the number of lines sent to the children
+ *
+ * returns:
+ * ---------------
+ * -0, or -1 if the configuration file turned out to be malformed or without EXIT only after the
+ *  simulation had started, in which case it was stopped at that timestep
  */
-void parentProcess(const char *config_file, const char *text_file, int M) {
-    pid_t children[M]; 
-    char childLabels[M][10]; 
-    int childSemArr[M+1];
-    int activationTime[M];
-    int terminationTime[M]; 
-    memset(children, 0, sizeof(children));
-    memset(childLabels, 0, sizeof(childLabels));
-    memset(childSemArr, -1, sizeof(childSemArr));
-    memset(activationTime, -1, sizeof(activationTime));
-    memset(terminationTime, -1, sizeof(terminationTime));
-
-    int numOfConfigLines = 0; 
-    ConfigEntry *commands = configInfo(config_file, &numOfConfigLines);
-    int quitTimestamp = -1;
-
-    for (int i = 0; i < numOfConfigLines; ++i) {
-        if (commands[i].command == 'E') {
-            quitTimestamp = commands[i].timestamp;
-            break;
+int parentProcess(const char *config_file, const char *text_file, int M, const SimOptions *opts, long *linesSent) {
+    //per slot arrays live on the heap, M may be far past MAX_CHILDREN
+    pid_t *children = calloc(M, sizeof(pid_t)); 
+    int *childLabelIds = malloc(M * sizeof(int)); 
+    int *activationTime = malloc(M * sizeof(int));
+    int *terminationTime = malloc(M * sizeof(int)); 
+    int *draining = malloc(M * sizeof(int));
+    long *linesTo = calloc(M, sizeof(long));
+    sem_t **semaphores = malloc(M * sizeof(sem_t *)); 
+    if (!children || !childLabelIds || !activationTime || !terminationTime || !draining || !linesTo || !semaphores) {
+        perror("Failed to allocate child tables");
+        exit(EXIT_FAILURE);
+    }
+    memset(childLabelIds, -1, M * sizeof(int));
+    memset(activationTime, -1, M * sizeof(int));
+    memset(terminationTime, -1, M * sizeof(int));
+
+    LabelTable labels;
+    memset(&labels, 0, sizeof(labels));
+    Dispatcher d;
+    memset(&d, 0, sizeof(d));
+    d.M = M;
+    d.opts = opts;
+    d.children = children;
+    d.childLabelIds = childLabelIds;
+    d.labels = &labels;
+    d.activationTime = activationTime;
+    d.terminationTime = terminationTime;
+    d.draining = draining;
+    d.linesTo = linesTo;
+    rngSeed(&d.rng, opts->seed + (uint64_t)opts->shard); //every dispatcher its own sequence
+    slotsInit(&d.slots, M);
+    if (opts->threads) {
+        d.threads = calloc(M, sizeof(ChildThread));
+        if (!d.threads) {
+            perror("Failed to allocate child tables");
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < M; i++) {
+            sem_init(&d.threads[i].started, 0, 0);
         }
     }
 
-    if (quitTimestamp == -1) {
-        fprintf(stderr, "Error: EXIT command not found in configuration file.\n");
-        free(commands);
+    ConfigReader reader;
+    configOpen(&reader, config_file, &labels);
+    reader.shard = opts->shard;
+    reader.numOfShards = opts->numOfShards;
+    EventQueue events;
+    memset(&events, 0, sizeof(events));
+    configFeed(&reader, &events, 0); //small files are read whole here, so their errors show up front
+
+    if (reader.error || (reader.done && reader.quitTimestamp == -1)) {
+        if (!reader.error) {
+            fprintf(stderr, "Error: EXIT command not found in configuration file.\n");
+        }
+        configClose(&reader);
+        free(events.heap);
+        labelTableFree(&labels);
         exit(EXIT_FAILURE);
     }
 
-    FILE *fp = fopen(text_file, "r");
-    if (!fp) {
-        perror("Failed to open text file");
-        free(commands);
-        exit(EXIT_FAILURE);
+    int numOfLinesInText;
+    if (opts->useMmap) {
+        d.text = textMap(text_file, &d.textSize);
+        lineIndexBuildMapped(d.text, d.textSize, &d.lineIndex);
+        numOfLinesInText = d.lineIndex.count;
+    } else {
+        d.fp = fopen(text_file, "r");
+        if (!d.fp) {
+            perror("Failed to open text file");
+            exit(EXIT_FAILURE);
+        }
+        numOfLinesInText = lineIndexBuild(d.fp, &d.lineIndex); 
+    }
+    d.sharedMem = sharedMemSetup(opts->useRing ? M : 0, opts->pool ? M : 0, opts->latency ? M : 0,
+                                 opts->sharedSems ? M + 1 : 0, opts->segmentKind);
+    d.semaphores = semaphores;
+    d.sharedMem->bufferedLog = opts->bufferedLog;
+    d.sharedMem->echo = !opts->quiet;
+    d.sharedMem->binaryLog = opts->binaryLog;
+    d.sharedMem->instance = opts->shard;
+    if (opts->sharedSems) {
+        semInitShared(d.sharedMem, semaphores, M, &d.parentNotificationSemaphore);
+    } else {
+        semInit(semaphores, M, opts->shard, &d.parentNotificationSemaphore);
+    }
+    if (opts->latency) {
+        d.stats = sharedStats(d.sharedMem);
+        d.terminateSentAt = calloc(M, sizeof(uint64_t));
+        if (!d.terminateSentAt) {
+            perror("Failed to allocate child tables");
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (opts->pool) {
+        d.controls = sharedControls(d.sharedMem);
+        fflush(stdout); //or the workers would inherit what is buffered
+        startPool(&d);
     }
 
-    int numOfLinesInText = lineCount(fp); 
-    SharedMemory *sharedMem = sharedMemSetup();
-    sem_t *semaphores[M]; 
-    sem_t *parentNotificationSemaphore; 
-    semInit(semaphores, M, &parentNotificationSemaphore);
-    int activeChildren = 0; 
-    for (int currTime = 0; currTime <= quitTimestamp; ++currTime) {
-        for (int i = 0; i < numOfConfigLines; ++i) {
-            if (commands[i].timestamp == currTime) { 
-                char *label = commands[i].processLabel; 
-                char command = commands[i].command;
-				//spawn a new child process
-                if (command == 'S' && activeChildren < M) {
-                    int freeSlot = freeSlotFinder(children, M); 
-                    if (freeSlot != -1) {
-                        pid_t child_pid = fork(); 
-                        if (child_pid == 0) {
-                            child(semaphores, freeSlot, sharedMem, currTime, parentNotificationSemaphore); 
-                            exit(EXIT_SUCCESS);
-                        } else if (child_pid > 0) { 
-                            children[freeSlot] = child_pid;
-                            strncpy(childLabels[freeSlot], label, 10);
-                            childSemArr[freeSlot] = freeSlot;
-                            activationTime[freeSlot] = currTime;
-                            activeChildren++;
-                            printf("\n[t = %d] Spawned process %s (PID: %d)\n", currTime, label, child_pid);
-                        }
-                    }
-                } else if (command == 'T') { 
-                    int childIndx = childLabelFinder(childLabels, label, M); //first of we find the child index
-                    if (childIndx != -1) {
-                        terminationTime[childIndx] = currTime; //then update the shared memory
-                        sharedMem->endsInTimestamp = currTime;
-                        strcpy(sharedMem->sharedSpace, "TERMINATE");//set a terminate message, as asked
-                        printf("\n[t = %d] Parent sent TERMINATE message to child[%d]\n", currTime, childIndx);
-                        sem_post(semaphores[childIndx]); //signaling semaphore to unblock the child
-                        sem_wait(parentNotificationSemaphore); // waiting for child to notify the parent
-                        waitpid(children[childIndx], NULL, 0); //and the child process to exit
-                        printf("[t = %d] Child[%d] has terminated.\n", currTime, childIndx);
-                        children[childIndx] = 0;  //marking the slot free for reuse
-                        activeChildren--; 
-                    }else {
-                        //covers the case of command issued for a non-existent or inactive process
-                        printf("[t = %d] Warning: Terminate command issued for non-existent or inactive process: %s\n",
-                               currTime, label);
-                    }
+    int status = 0;
+    int quitTimestamp;
+    uint64_t startedAt = nowNs();
+    Pacer pacer;
+    memset(&pacer, 0, sizeof(pacer));
+    pacer.tickNs = opts->tickNs;
+    pacer.start = startedAt;
+    for (int currTime = 0; ; ++currTime) {
+        configFeed(&reader, &events, currTime);
+        if (d.activeChildren == 0) { //nothing is sent until the next entry, skip the idle timesteps
+            int next = reader.quitTimestamp >= 0 ? reader.quitTimestamp : INT_MAX;
+            if (events.count > 0 && events.heap[0].timestamp < next) {
+                next = events.heap[0].timestamp;
+            }
+            if (next != INT_MAX && next > currTime) {
+                currTime = next;
+                configFeed(&reader, &events, currTime);
+            }
+        }
+        if (pacer.tickNs > 0) {
+            paceTick(&pacer, currTime); //skipped timesteps still take their time
+        }
+        if (reader.error || (reader.done && reader.quitTimestamp == -1)) { //a long file went wrong midway
+            if (!reader.error) {
+                fprintf(stderr, "Error: EXIT command not found in configuration file.\n");
+            }
+            status = -1;
+            quitTimestamp = currTime;
+            break;
+        }
+        if (reader.quitTimestamp >= 0 && currTime > reader.quitTimestamp) { //an EXIT read out of order
+            quitTimestamp = currTime;
+            break;
+        }
+        while (events.count > 0 && events.heap[0].timestamp <= currTime) { //only this timestep's entries
+            ConfigEntry entry = eventPop(&events);
+            int labelId = entry.labelId; 
+            char command = entry.command;
+            if (command == 'S' && d.activeChildren == M && opts->pipelined) {
+                collectAcks(&d, 1); //make room by finishing queued terminations
+            }
+			//spawn a new child process
+            if (command == 'S' && d.activeChildren < M) {
+                spawnChild(&d, labelId, currTime);
+            } else if (command == 'T') { 
+                int childIndx = slotFindLabel(&d.slots, labelId); //first of we find the child index
+                if (childIndx != -1) {
+                    terminateChild(&d, childIndx, currTime);
+                }else {
+                    //covers the case of command issued for a non-existent or inactive process
+                    printf("[t = %d] Warning: Terminate command issued for non-existent or inactive process: %s\n",
+                           currTime, labelName(&labels, labelId));
                 }
             }
         }
 
-        if (activeChildren > 0) {
-            int randChildIndx = randomActiveChildrenSelection(children, M);
+        if (opts->pipelined) {
+            if (numOfLinesInText > 0) {
+                dispatchAll(&d, currTime);
+            }
+            collectAcks(&d, 0);
+        } else if (d.activeChildren > 0) {
+            int randChildIndx = selectChild(&d);
             if (randChildIndx != -1 && numOfLinesInText > 0) {
-                char line[MAX_LINE_SIZE];
-                randomLineSelection(fp, line, numOfLinesInText);
-                strcpy(sharedMem->sharedSpace, line); //we store the line in shared memory
-                sharedMem->endsInTimestamp = currTime;
-                sharedMem->activeChildIndx = randChildIndx;
-                printf("[t = %d] Parent sent message to child[%d]: %s", currTime, randChildIndx, line);
-                sem_post(semaphores[randChildIndx]); 
-                sem_wait(parentNotificationSemaphore); 
+                sendLines(&d, randChildIndx, currTime, opts->batch);
             }
         }
+        if (currTime == reader.quitTimestamp) {
+            quitTimestamp = currTime;
+            break;
+        }
     }
 	//here we terminate all remaining active child processes that have not terminated with exit
-    for (int i = 0; i < M; ++i) {
-        if (children[i] > 0) {
-            terminationTime[i] = quitTimestamp; 
-            sharedMem->endsInTimestamp = quitTimestamp; 
-            strcpy(sharedMem->sharedSpace, "TERMINATE"); 
-            printf("\n[t = %d] Parent sent TERMINATE message to child[%d]\n", quitTimestamp, i);
-            sem_post(semaphores[i]); 
-            sem_wait(parentNotificationSemaphore); 
-            waitpid(children[i], NULL, 0); 
-            printf("[t = %d] Child[%d] has terminated.\n", quitTimestamp, i);
+    terminateAll(&d, quitTimestamp);
+    if (d.controls) {
+        stopPool(&d);
+    }
+    if (d.stats) {
+        printLatencySummary(&d, nowNs() - startedAt);
+    }
+    if (pacer.tickNs > 0) {
+        printPacingSummary(&pacer);
+    }
+
+    if (linesSent) {
+        *linesSent = d.linesSent;
+    }
+    rescourceCleanup(d.sharedMem, semaphores, M, d.parentNotificationSemaphore); 
+    lineIndexFree(&d.lineIndex);
+    if (d.fp) {
+        fclose(d.fp);
+    }
+    if (d.text) {
+        munmap((void *)d.text, d.textSize);
+    }
+    configClose(&reader);
+    free(events.heap);
+    labelTableFree(&labels);
+    slotsFree(&d.slots);
+    free(children);
+    free(childLabelIds);
+    free(activationTime);
+    free(terminationTime);
+    free(draining);
+    free(linesTo);
+    free(semaphores);
+    free(d.terminateSentAt);
+    if (d.threads) {
+        for (int i = 0; i < M; i++) {
+            sem_destroy(&d.threads[i].started);
+        }
+        free(d.threads);
+    }
+    return status;
+}
+
+/**
+ * runShards
+ * #################################################################################################
+ * sharded mode: the master process forks opts->numOfShards dispatchers, each running parentProcess()
+ * with its own share of the M slots, its own segment and semaphore set, and the labels of the
+ * configuration whose ID falls to it, so that dispatching runs on as many cores. the master only
+ * waits for them and, with latency statistics, sums up their throughput
+ *
+ * ->Returns
+ * ---------
+ * -0, or -1 if a dispatcher failed
+ */
+static int runShards(const char *config_file, const char *text_file, int M, const SimOptions *opts) {
+    int numOfShards = opts->numOfShards;
+    pid_t *dispatchers = calloc(numOfShards, sizeof(pid_t));
+    //where the dispatchers leave their line counts, shared with them
+    long *linesSent = mmap(NULL, numOfShards * sizeof(long), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (!dispatchers || linesSent == MAP_FAILED) {
+        perror("Failed to allocate dispatcher tables");
+        exit(EXIT_FAILURE);
+    }
+    uint64_t startedAt = nowNs();
+    fflush(stdout); //or the dispatchers would inherit what is buffered
+    for (int s = 0; s < numOfShards; s++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            SimOptions mine = *opts;
+            mine.shard = s;
+            int shardM = M / numOfShards + (s < M % numOfShards);
+            exit(parentProcess(config_file, text_file, shardM, &mine, &linesSent[s]) < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+        } else if (pid < 0) {
+            perror("Failed to fork dispatcher");
+            for (int j = 0; j < s; j++) {
+                kill(dispatchers[j], SIGTERM);
+                waitpid(dispatchers[j], NULL, 0);
+            }
+            exit(EXIT_FAILURE);
         }
+        dispatchers[s] = pid;
+    }
+    int status = 0;
+    long total = 0;
+    for (int s = 0; s < numOfShards; s++) {
+        int wstatus;
+        if (waitpid(dispatchers[s], &wstatus, 0) < 0 || !WIFEXITED(wstatus) || WEXITSTATUS(wstatus) != 0) {
+            status = -1;
+        }
+        total += linesSent[s];
+    }
+    if (opts->latency) {
+        double seconds = (nowNs() - startedAt) / 1e9;
+        printf("\nSharded throughput: %d dispatchers, %ld lines in %.3f s, %.0f lines/s\n", numOfShards, total,
+               seconds, seconds > 0 ? total / seconds : 0.0);
     }
+    munmap(linesSent, numOfShards * sizeof(long));
+    free(dispatchers);
+    return status;
+}
 
-    rescourceCleanup(sharedMem, semaphores, M, parentNotificationSemaphore); 
-    fclose(fp);
-    free(commands);
+/**
+ * usage
+ * #################################################################################################
+ * prints the command line syntax and the available options, then exits with a failure status
+ */
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-m] [-r] [-p] [-w window] [-k batch] [-f] [-b] [-q] [-B] [-P] [-t|--threads] [-l] [-i interval_us] [-D dispatchers] [-o|-H] [--seed n] [--policy random|round-robin|least-loaded] <config_file> <text_file> <M>\n", prog);
+    fprintf(stderr, "  -m  map the text file and send line positions instead of copies\n");
+    fprintf(stderr, "  -r  queue messages in per-child rings instead of waiting for each one\n");
+    fprintf(stderr, "  -p  pipelined: every timestep send to all children, never wait on one\n");
+    fprintf(stderr, "  -w  messages in flight per child in pipelined mode (1-%d, default %d)\n",
+            RING_SLOTS - 1, RING_SLOTS - 1);
+    fprintf(stderr, "  -k  lines sent to a child per timestep in one handshake (1-%d, default 1)\n",
+            RING_SLOTS - 1);
+    fprintf(stderr, "  -f  unnamed semaphores in shared memory, spin-then-sleep waits\n");
+    fprintf(stderr, "  -b  children buffer their logs and acknowledge before logging\n");
+    fprintf(stderr, "  -q  children do not echo what they receive on the console\n");
+    fprintf(stderr, "  -B  children write binary file[PID].bin logs, read with logreader\n");
+    fprintf(stderr, "  -P  pre-fork a pool of M workers, SPAWN and TERMINATE recycle them\n");
+    fprintf(stderr, "  -t, --threads  run the children as threads instead of processes\n");
+    fprintf(stderr, "  -l  keep latency histograms and print percentiles and throughput at exit\n");
+    fprintf(stderr, "  -i  pace every timestep to interval_us microseconds of wall-clock time\n");
+    fprintf(stderr, "  -D  divide the labels and the M slots among that many dispatcher processes\n");
+    fprintf(stderr, "  -o, --shm-open   POSIX shm_open()/mmap() shared memory under a per-run name\n");
+    fprintf(stderr, "  -H, --hugepages  shared memory on huge pages (falls back to -o without them)\n");
+    fprintf(stderr, "  --seed    seed of the line and child selection, for reproducible runs\n");
+    fprintf(stderr, "  --policy  how the child of each timestep is picked (default random)\n");
+    exit(EXIT_FAILURE);
 }
 
 int main(int argc, char *argv[]) {
-    if (argc != 4) {
-        fprintf(stderr, "Usage: %s <config_file> <text_file> <M>\n", argv[0]);
-        exit(EXIT_FAILURE);
+    SimOptions opts;
+    memset(&opts, 0, sizeof(opts));
+    opts.window = RING_SLOTS - 1;
+    opts.batch = 1;
+    opts.numOfShards = 1;
+    static const struct option longOptions[] = {
+        {"threads", no_argument, NULL, 't'},
+        {"shm-open", no_argument, NULL, 'o'},
+        {"hugepages", no_argument, NULL, 'H'},
+        {"seed", required_argument, NULL, 'S'},
+        {"policy", required_argument, NULL, 'y'},
+        {NULL, 0, NULL, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "mrpw:k:fbqBPtli:D:oHS:y:", longOptions, NULL)) != -1) {
+        switch (opt) {
+        case 'm':
+            opts.useMmap = 1;
+            break;
+        case 'r':
+            opts.useRing = 1;
+            break;
+        case 'p':
+            opts.pipelined = 1;
+            opts.useRing = 1;
+            break;
+        case 'w':
+            opts.window = atoi(optarg);
+            if (opts.window < 1 || opts.window > RING_SLOTS - 1) {
+                usage(argv[0]);
+            }
+            break;
+        case 'f':
+            opts.sharedSems = 1;
+            break;
+        case 'b':
+            opts.bufferedLog = 1;
+            break;
+        case 'q':
+            opts.quiet = 1;
+            break;
+        case 'B':
+            opts.binaryLog = 1;
+            break;
+        case 'P':
+            opts.pool = 1;
+            break;
+        case 't':
+            opts.threads = 1;
+            break;
+        case 'l':
+            opts.latency = 1;
+            break;
+        case 'S': {
+            char *end;
+            opts.seed = strtoull(optarg, &end, 10);
+            if (end == optarg || *end != '\0') {
+                usage(argv[0]);
+            }
+            opts.seeded = 1;
+            break;
+        }
+        case 'y':
+            if (strcmp(optarg, "random") == 0) {
+                opts.policy = POLICY_RANDOM;
+            } else if (strcmp(optarg, "round-robin") == 0) {
+                opts.policy = POLICY_ROUND_ROBIN;
+            } else if (strcmp(optarg, "least-loaded") == 0) {
+                opts.policy = POLICY_LEAST_LOADED;
+            } else {
+                usage(argv[0]);
+            }
+            break;
+        case 'o':
+            opts.segmentKind = SEGMENT_POSIX;
+            break;
+        case 'H':
+            opts.segmentKind = SEGMENT_HUGETLB;
+            break;
+        case 'D':
+            opts.numOfShards = atoi(optarg);
+            if (opts.numOfShards < 1) {
+                usage(argv[0]);
+            }
+            break;
+        case 'i':
+            opts.tickNs = atol(optarg) * 1000;
+            if (opts.tickNs <= 0) {
+                usage(argv[0]);
+            }
+            break;
+        case 'k':
+            opts.batch = atoi(optarg);
+            if (opts.batch < 1 || opts.batch > RING_SLOTS - 1) {
+                usage(argv[0]);
+            }
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (argc - optind != 3) {
+        usage(argv[0]);
+    }
+    if (opts.batch > 1 && !opts.useRing) { //a batch needs the rings, but keeps the handshakes
+        opts.useRing = 1;
+        opts.syncRing = 1;
     }
 
-    const char *config_file = argv[1];
-    const char *text_file = argv[2];
-    int M = atoi(argv[3]);
+    const char *config_file = argv[optind];
+    const char *text_file = argv[optind + 1];
+    int M = atoi(argv[optind + 2]);
 
     if (M <= 0) {
         fprintf(stderr, "Error: M must be a positive integer.\n");
         exit(EXIT_FAILURE);
     }
 
-    srand(time(NULL));
-
-    parentProcess(config_file, text_file, M);
+    if (!opts.seeded) {
+        opts.seed = (uint64_t)time(NULL) ^ ((uint64_t)getpid() << 32);
+    }
 
+    if (opts.numOfShards > M) { //every dispatcher needs a slot
+        opts.numOfShards = M;
+    }
+    if (opts.numOfShards > 1) {
+        return runShards(config_file, text_file, M, &opts) < 0 ? EXIT_FAILURE : 0;
+    }
+    if (parentProcess(config_file, text_file, M, &opts, NULL) < 0) {
+        return EXIT_FAILURE;
+    }
     return 0;
 }
 
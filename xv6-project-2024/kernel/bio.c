@@ -1,13 +1,15 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
 //
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
-// * After changing buffer data, call bwrite to write it to disk.
+// * After changing buffer data, call bwrite to write it to disk,
+//     or bwrite_start and later bwait to overlap several writes,
+//     or bdwrite to leave the write to a later bflush.
 // * When done with the buffer, call brelse.
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
@@ -22,36 +24,71 @@
 #include "defs.h"
 #include "fs.h"
 #include "buf.h"
+#include "kstat.h"
+
+// The cache is split into NBUCKET hash buckets keyed by
+// (dev, blockno), each with its own lock and list of buffers,
+// so lookups of different blocks don't contend on one lock.
+// bcache.lock is only taken to recycle a buffer, which may
+// move it from one bucket to another.
+#define NBUCKET 13
+#define BHASH(dev, blockno) ((((dev) << 27) | (blockno)) % NBUCKET)
+
+struct bucket {
+  struct spinlock lock;
+  // Doubly-linked list of the buffers hashed to this bucket,
+  // through prev/next.
+  struct buf head;
+};
 
 struct {
   struct spinlock lock;
   struct buf buf[NBUF];
-
-  // Linked list of all buffers, through prev/next.
-  // Sorted by how recently the buffer was used.
-  // head.next is most recent, head.prev is least.
-  struct buf head;
+  struct bucket bucket[NBUCKET];
+  int ndirty;   // buffers written by bdwrite() and not yet by bflush()
 } bcache;
 
 void
 binit(void)
 {
   struct buf *b;
+  struct bucket *bk;
 
   initlock(&bcache.lock, "bcache");
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++){
+    initlock(&bk->lock, "bcache.bucket");
+    bk->head.prev = &bk->head;
+    bk->head.next = &bk->head;
+  }
+
+  // Spread the buffers over the buckets to start with;
+  // eviction moves them to wherever they are needed.
   for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
+    bk = &bcache.bucket[(b - bcache.buf) % NBUCKET];
+    b->next = bk->head.next;
+    b->prev = &bk->head;
     initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    bk->head.next->prev = b;
+    bk->head.next = b;
   }
 }
 
+// Find the least recently used unreferenced buffer in bucket bk.
+// Dirty buffers are left for bflush() to write first.
+// Caller must hold bk->lock.
+static struct buf*
+blru(struct bucket *bk)
+{
+  struct buf *b, *lru = 0;
+
+  for(b = bk->head.next; b != &bk->head; b = b->next){
+    if(b->refcnt == 0 && !b->dirty && (lru == 0 || b->lastuse < lru->lastuse))
+      lru = b;
+  }
+  return lru;
+}
+
 // Look through buffer cache for block on device dev.
 // If not found, allocate a buffer.
 // In either case, return locked buffer.
@@ -59,33 +96,84 @@ static struct buf*
 bget(uint dev, uint blockno)
 {
   struct buf *b;
+  struct bucket *bk, *victim;
+  int flushed = 0;
 
-  acquire(&bcache.lock);
+  bk = &bcache.bucket[BHASH(dev, blockno)];
+again:
+  acquire(&bk->lock);
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
+  for(b = bk->head.next; b != &bk->head; b = b->next){
     if(b->dev == dev && b->blockno == blockno){
       b->refcnt++;
-      release(&bcache.lock);
+      release(&bk->lock);
+      kstatadd(KS_BGET_HIT, 1);
       acquiresleep(&b->lock);
       return b;
     }
   }
+  release(&bk->lock);
 
   // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
+  // Only one CPU at a time may recycle a buffer, so that two
+  // CPUs can't both miss on the same block and cache it twice,
+  // and so that holding two bucket locks can't deadlock.
+  acquire(&bcache.lock);
+  acquire(&bk->lock);
+
+  // Someone may have cached the block while we had no locks.
+  for(b = bk->head.next; b != &bk->head; b = b->next){
+    if(b->dev == dev && b->blockno == blockno){
+      b->refcnt++;
+      release(&bk->lock);
       release(&bcache.lock);
+      kstatadd(KS_BGET_HIT, 1);
       acquiresleep(&b->lock);
       return b;
     }
   }
-  panic("bget: no buffers");
+
+  // Recycle the LRU unused buffer, preferring one that already
+  // lives in this bucket. Otherwise take one from another bucket.
+  if((b = blru(bk)) == 0){
+    for(victim = bcache.bucket; victim < bcache.bucket+NBUCKET; victim++){
+      if(victim == bk)
+        continue;
+      acquire(&victim->lock);
+      if((b = blru(victim)) != 0){
+        b->next->prev = b->prev;
+        b->prev->next = b->next;
+        release(&victim->lock);
+        b->next = bk->head.next;
+        b->prev = &bk->head;
+        bk->head.next->prev = b;
+        bk->head.next = b;
+        break;
+      }
+      release(&victim->lock);
+    }
+  }
+  if(b == 0 && !flushed){
+    // every free buffer is dirty; clean some and look again.
+    release(&bk->lock);
+    release(&bcache.lock);
+    bflush(0);
+    flushed = 1;
+    goto again;
+  }
+  if(b == 0)
+    panic("bget: no buffers");
+
+  b->dev = dev;
+  b->blockno = blockno;
+  b->valid = 0;
+  b->refcnt = 1;
+  release(&bk->lock);
+  release(&bcache.lock);
+  kstatadd(KS_BGET_MISS, 1);
+  acquiresleep(&b->lock);
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -102,6 +190,49 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+// Return a locked buffer for a block that was just allocated,
+// zero-filled without reading the disk, since the block's old
+// contents are garbage.
+struct buf*
+bnew(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno);
+  memset(b->data, 0, BSIZE);
+  b->valid = 1;
+  return b;
+}
+
+// Start reading a block without waiting, for read-ahead.
+// Returns the locked buffer, to be passed to bread_finish(),
+// or 0 if the block is already cached.
+struct buf*
+bread_start(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno);
+  if(b->valid){
+    brelse(b);
+    return 0;
+  }
+  virtio_disk_submit(b, 0);
+  return b;
+}
+
+// Wait for a read started by bread_start() and release
+// the buffer, leaving the block in the cache.
+void
+bread_finish(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bread_finish");
+  virtio_disk_wait(b);
+  b->valid = 1;
+  brelse(b);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -111,43 +242,223 @@ bwrite(struct buf *b)
   virtio_disk_rw(b, 1);
 }
 
+// Start writing b's contents to disk without waiting.
+// Must be locked, and must stay locked until bwait(b)
+// says the write is done.
+void
+bwrite_start(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bwrite_start");
+  virtio_disk_submit(b, 1);
+}
+
+// Start writing b's contents to disk block blockno rather
+// than to b's own block, leaving the cached copy of blockno
+// alone. The log uses this to install a committed block
+// from its log copy. Finish with bwait(b).
+void
+bwrite_to(struct buf *b, uint blockno)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bwrite_to");
+  virtio_disk_submit_at(b, blockno, 1);
+}
+
+// Start writing the n bufs bs[] to the consecutive blocks
+// from blockno, at most DISKRUN of them in each disk request.
+// Finish with bwait() on each.
+void
+bwrite_run(struct buf **bs, int n, uint blockno)
+{
+  int i, m;
+
+  for(i = 0; i < n; i += m){
+    m = n - i < DISKRUN ? n - i : DISKRUN;
+    for(int j = i; j < i + m; j++)
+      if(!holdingsleep(&bs[j]->lock))
+        panic("bwrite_run");
+    virtio_disk_submitv(bs + i, m, blockno + i, 1);
+  }
+}
+
+// Leave b's contents to be written to disk later, by bflush(),
+// so that repeated writes of the block cost one disk write.
+// Must be locked. Until then b stays cached.
+void
+bdwrite(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bdwrite");
+  if(!b->dirty){
+    b->dirty = 1;
+    __sync_fetch_and_add(&bcache.ndirty, 1);
+  }
+}
+
+// Forget a bdwrite() of b, because the log has taken over
+// writing it. Must be locked.
+void
+bclean(struct buf *b)
+{
+  if(b->dirty){
+    b->dirty = 0;
+    __sync_fetch_and_sub(&bcache.ndirty, 1);
+  }
+}
+
+// How many buffers bdwrite() has left for bflush().
+int
+bdirty(void)
+{
+  return bcache.ndirty;
+}
+
+// Sort bs[0..n) by device and block number.
+static void
+bsort(struct buf **bs, int n)
+{
+  int i, j;
+  struct buf *b;
+
+  for(i = 1; i < n; i++){
+    b = bs[i];
+    for(j = i; j > 0 && (bs[j-1]->dev > b->dev ||
+        (bs[j-1]->dev == b->dev && bs[j-1]->blockno > b->blockno)); j--)
+      bs[j] = bs[j-1];
+    bs[j] = b;
+  }
+}
+
+// Write out and release the n locked dirty bufs bs[], sorted,
+// as runs of adjacent blocks.
+static void
+bflushv(struct buf **bs, int n)
+{
+  int i, j;
+
+  bsort(bs, n);
+  for(i = 0; i < n; i = j){
+    for(j = i + 1; j < n && bs[j]->dev == bs[i]->dev &&
+        bs[j]->blockno == bs[j-1]->blockno + 1; j++)
+      ;
+    bwrite_run(bs + i, j - i, bs[i]->blockno);
+  }
+  for(i = 0; i < n; i++){
+    bwait(bs[i]);
+    bclean(bs[i]);
+    brelse(bs[i]);
+  }
+}
+
+// Write the dirty buffers to disk, in block order. Buffers in
+// use are skipped unless wait is set, in which case bflush()
+// waits for them one at a time and writes them by themselves,
+// so that it never sleeps for a lock while holding another;
+// then the caller must not hold any buffer. Buffers the log has
+// pinned are always skipped: an install may still write an
+// older, logged copy of the block home, which would land on top
+// of this write. log_force() waits for them to be unpinned.
+void
+bflush(int wait)
+{
+  struct buf *bs[64], *b;
+  struct bucket *bk;
+  int n, busy;
+
+  do {
+    n = 0;
+    busy = 0;
+    // bcache.lock keeps buffers from moving between buckets.
+    acquire(&bcache.lock);
+    for(b = bcache.buf; b < bcache.buf+NBUF && n < NELEM(bs); b++){
+      if(!b->dirty)
+        continue;
+      bk = &bcache.bucket[BHASH(b->dev, b->blockno)];
+      acquire(&bk->lock);
+      if(b->dirty && b->refcnt == 0 && tryacquiresleep(&b->lock)){
+        b->refcnt++;
+        bs[n++] = b;
+      } else if(b->dirty){
+        busy = 1;
+      }
+      release(&bk->lock);
+    }
+    release(&bcache.lock);
+    bflushv(bs, n);
+  } while(n == NELEM(bs));
+
+  if(!wait || !busy)
+    return;
+  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
+    if(!b->dirty)
+      continue;
+    acquire(&bcache.lock);
+    bk = &bcache.bucket[BHASH(b->dev, b->blockno)];
+    acquire(&bk->lock);
+    if(!b->dirty || b->pins > 0){
+      release(&bk->lock);
+      release(&bcache.lock);
+      continue;
+    }
+    b->refcnt++;
+    release(&bk->lock);
+    release(&bcache.lock);
+    acquiresleep(&b->lock);
+    if(b->dirty)
+      bflushv(&b, 1);
+    else
+      brelse(b);
+  }
+}
+
+// Wait for a write started by bwrite_start() to finish.
+void
+bwait(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bwait");
+  virtio_disk_wait(b);
+}
+
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
+// Stamp it with the time of last use for LRU recycling.
 void
 brelse(struct buf *b)
 {
+  struct bucket *bk;
+
   if(!holdingsleep(&b->lock))
     panic("brelse");
 
   releasesleep(&b->lock);
 
-  acquire(&bcache.lock);
+  bk = &bcache.bucket[BHASH(b->dev, b->blockno)];
+  acquire(&bk->lock);
   b->refcnt--;
   if (b->refcnt == 0) {
     // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
-  
-  release(&bcache.lock);
+    b->lastuse = tickcount();
+  }
+  release(&bk->lock);
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = &bcache.bucket[BHASH(b->dev, b->blockno)];
+
+  acquire(&bk->lock);
   b->refcnt++;
-  release(&bcache.lock);
+  b->pins++;
+  release(&bk->lock);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = &bcache.bucket[BHASH(b->dev, b->blockno)];
+
+  acquire(&bk->lock);
   b->refcnt--;
-  release(&bcache.lock);
+  b->pins--;
+  release(&bk->lock);
 }
-
-
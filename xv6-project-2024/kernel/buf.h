@@ -1,12 +1,17 @@
 struct buf {
   int valid;   // has data been read from disk?
   int disk;    // does disk "own" buf?
+  int dirty;   // bdwrite() data not yet on disk
   uint dev;
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
+  uint pins;        // bpin()s by the log, also counted in refcnt
+  uint lastuse;     // ticks at last brelse(), for LRU
+  struct buf *prev; // hash bucket list
   struct buf *next;
+  struct buf *runnext; // next buf of the same disk request
+  int vq;           // virtqueue the disk request went to
   uchar data[BSIZE];
 };
 
@@ -138,8 +138,9 @@ consoleintr(int c)
   acquire(&cons.lock);
 
   switch(c){
-  case C('P'):  // Print process list.
+  case C('P'):  // Print process list and allocator stats.
     procdump();
+    kmemdump();
     break;
   case C('U'):  // Kill line.
     while(cons.e != cons.w &&
@@ -4,16 +4,29 @@ struct file;
 struct inode;
 struct pipe;
 struct proc;
+struct slab;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct vma;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bwrite_start(struct buf*);
+void            bwrite_to(struct buf*, uint);
+void            bwrite_run(struct buf**, int, uint);
+void            bwait(struct buf*);
+void            bdwrite(struct buf*);
+void            bclean(struct buf*);
+int             bdirty(void);
+void            bflush(int);
+struct buf*     bnew(uint, uint);
+struct buf*     bread_start(uint, uint);
+void            bread_finish(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
 
@@ -24,6 +37,9 @@ void            consputc(int);
 
 // exec.c
 int             exec(char*, char**);
+int             execproc(struct proc*, char*, char**);
+struct vmseg;
+int             loadseg(struct proc*, struct vmseg*, uint64, char*);
 
 // file.c
 struct file*    filealloc(void);
@@ -32,10 +48,16 @@ struct file*    filedup(struct file*);
 void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
 int             filestat(struct file*, uint64 addr);
+int             filelseek(struct file*, int, int);
+int             filesplice(struct file*, struct file*, int n);
 int             filewrite(struct file*, uint64, int n);
 
 // fs.c
 void            fsinit(int);
+void            dcenter(struct inode*, char*, uint, uint);
+uint            dcgen(void);
+struct inode*   symget(struct inode*);
+void            symset(struct inode*, uint, uint);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
@@ -53,6 +75,8 @@ int             readi(struct inode*, int, uint64, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
 void            itrunc(struct inode*);
+int             itruncstep(struct inode*);
+void            itruncsteps(struct inode*);
 
 // ramdisk.c
 void            ramdiskinit(void);
@@ -61,20 +85,52 @@ void            ramdiskrw(struct buf*);
 
 // kalloc.c
 void*           kalloc(void);
+void*           kalloc_zeroed(void);
+int             kzerofill(void);
 void            kfree(void *);
 void            kinit(void);
+void            kmemdump(void);
+void            krefinc(void *);
+int             krefcnt(void *);
+
+// kstat.c
+void            kstatinit(void);
+void            kstatadd(int, uint64);
+
+// prof.c
+void            profinit(void);
+void            profsample(uint64, int);
+int             profctl(int, uint64, int);
 
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
 void            begin_op(void);
+void            begin_opn(int);
 void            end_op(void);
+void            log_force(void);
+
+// mmap.c
+struct vma*     vmafind(struct proc*, uint64);
+uint64          vmabase(struct proc*);
+uint64          mmap(uint64, int, int, struct file*, uint);
+int             munmap(uint64, uint64);
+int             vmafault(struct proc*, struct vma*, uint64);
+int             vmawrite(pagetable_t, uint64, pte_t*);
+int             vmashare(struct proc*);
+int             vmacopy(struct proc*, struct proc*);
+void            vmaexit(struct proc*);
 
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
 int             pipewrite(struct pipe*, uint64, int);
+int             pipewbegin(struct pipe*, int, char**);
+void            pipewend(struct pipe*, int);
+int             piperbegin(struct pipe*, int, char**, int);
+void            piperend(struct pipe*, int);
 
 // printf.c
 int            printf(char*, ...) __attribute__ ((format (printf, 1, 2)));
@@ -85,6 +141,7 @@ void            printfinit(void);
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
+int             spawn(char*, char**, int*);
 int             growproc(int);
 void            proc_mapstacks(pagetable_t);
 pagetable_t     proc_pagetable(struct proc *);
@@ -97,8 +154,15 @@ struct cpu*     getmycpu(void);
 struct proc*    myproc();
 void            procinit(void);
 void            scheduler(void) __attribute__((noreturn));
+void            setrunnable(struct proc*);
+void            cpukick(int);
+int             setpriority(int, int);
+int             setaffinity(int, int);
 void            sched(void);
 void            sleep(void*, struct spinlock*);
+void            sleeptimed(void*, struct spinlock*, uint);
+void            timertick(void);
+void            timerarm(void);
 void            userinit(void);
 int             wait(uint64);
 void            wakeup(void*);
@@ -107,6 +171,11 @@ int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
 
+// slab.c
+void            slabinit(struct slab*, char*, uint, int);
+void*           slaballoc(struct slab*);
+void            slabfree(struct slab*, void*);
+
 // swtch.S
 void            swtch(struct context*, struct context*);
 
@@ -114,12 +183,15 @@ void            swtch(struct context*, struct context*);
 void            acquire(struct spinlock*);
 int             holding(struct spinlock*);
 void            initlock(struct spinlock*, char*);
+void            initticketlock(struct spinlock*, char*);
 void            release(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
+int             lockstatcopy(uint64, int);
 
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
+int             tryacquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
@@ -142,10 +214,9 @@ int             fetchaddr(uint64, uint64*);
 void            syscall();
 
 // trap.c
-extern uint     ticks;
+uint            tickcount(void);
 void            trapinit(void);
 void            trapinithart(void);
-extern struct spinlock tickslock;
 void            usertrapret(void);
 
 // uart.c
@@ -165,6 +236,7 @@ void            uvmfirst(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64, int);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
+int             uvmcopyrange(pagetable_t, pagetable_t, uint64, uint64, int);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
@@ -173,6 +245,12 @@ uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
+int             cowfault(pagetable_t, uint64);
+int             lazyalloc(pagetable_t, uint64);
+int             vmfault(struct proc*, uint64, int);
+void            vmprefault(struct proc*, uint64, uint64);
+uint64          uvmshare(pagetable_t, uint64);
+int             uvmremap(pagetable_t, uint64, uint64);
 
 // plic.c
 void            plicinit(void);
@@ -183,6 +261,10 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_submit(struct buf *, int);
+void            virtio_disk_submit_at(struct buf *, uint, int);
+void            virtio_disk_submitv(struct buf **, int, uint, int);
+void            virtio_disk_wait(struct buf *);
 void            virtio_disk_intr(void);
 
 // number of elements in fixed-size array
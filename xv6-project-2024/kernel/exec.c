@@ -7,8 +7,6 @@
 #include "defs.h"
 #include "elf.h"
 
-static int loadseg(pde_t *, uint64, struct inode *, uint, uint);
-
 int flags2perm(int flags)
 {
     int perm = 0;
@@ -21,17 +19,29 @@ int flags2perm(int flags)
 
 int
 exec(char *path, char **argv)
+{
+  return execproc(myproc(), path, argv);
+}
+
+// Replace process p's user image with the program at path,
+// for exec() on the current process or for spawn() on a new
+// child that has not run yet. Returns argc, or -1 with p's
+// old image left in place.
+int
+execproc(struct proc *p, char *path, char **argv)
 {
   char *s, *last;
   int i, off;
   uint64 argc, sz = 0, sp, ustack[MAXARG], stackbase;
   struct elfhdr elf;
-  struct inode *ip;
+  struct inode *ip, *exe = 0, *oldexe;
   struct proghdr ph;
+  struct vmseg seg[NSEG];
+  int nseg = 0;
   pagetable_t pagetable = 0, oldpagetable;
-  struct proc *p = myproc();
 
-  begin_op();
+  // exec only reads the file system.
+  begin_opn(0);
 
   if((ip = namei(path)) == 0){
     end_op();
@@ -49,7 +59,8 @@ exec(char *path, char **argv)
   if((pagetable = proc_pagetable(p)) == 0)
     goto bad;
 
-  // Load program into memory.
+  // Record the program's segments. Nothing is read in
+  // yet: vmfault() fills pages from ip on first touch.
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -61,18 +72,23 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
-    uint64 sz1;
-    if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz, flags2perm(ph.flags))) == 0)
-      goto bad;
-    sz = sz1;
-    if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if(ph.vaddr + ph.memsz >= TRAPFRAME || nseg >= NSEG)
       goto bad;
+    seg[nseg].va = ph.vaddr;
+    seg[nseg].memsz = ph.memsz;
+    seg[nseg].filesz = ph.filesz;
+    seg[nseg].off = ph.off;
+    seg[nseg].perm = flags2perm(ph.flags);
+    nseg++;
+    if(ph.vaddr + ph.memsz > sz)
+      sz = ph.vaddr + ph.memsz;
   }
-  iunlockput(ip);
+  // keep the reference to ip for paging in the segments.
+  iunlock(ip);
   end_op();
+  exe = ip;
   ip = 0;
 
-  p = myproc();
   uint64 oldsz = p->sz;
 
   // Allocate some pages at the next page boundary.
@@ -121,12 +137,22 @@ exec(char *path, char **argv)
   safestrcpy(p->name, last, sizeof(p->name));
     
   // Commit to the user image.
+  vmaexit(p);
   oldpagetable = p->pagetable;
   p->pagetable = pagetable;
   p->sz = sz;
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
+  oldexe = p->exe;
+  p->exe = exe;
+  p->nseg = nseg;
+  memmove(p->seg, seg, sizeof(seg));
   proc_freepagetable(oldpagetable, oldsz);
+  if(oldexe){
+    begin_opn(0);
+    iput(oldexe);
+    end_op();
+  }
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
 
@@ -137,30 +163,38 @@ exec(char *path, char **argv)
     iunlockput(ip);
     end_op();
   }
+  if(exe){
+    begin_opn(0);
+    iput(exe);
+    end_op();
+  }
   return -1;
 }
 
-// Load a program segment into pagetable at virtual address va.
-// va must be page-aligned
-// and the pages from va to va+sz must already be mapped.
+// Fill mem, the page of process p at page-aligned va, with
+// its contents from segment s of p's executable. mem must
+// already be zeroed, which takes care of the bss.
+// May sleep, so the caller must not hold any spinlocks.
 // Returns 0 on success, -1 on failure.
-static int
-loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz)
+int
+loadseg(struct proc *p, struct vmseg *s, uint64 va, char *mem)
 {
-  uint i, n;
-  uint64 pa;
-
-  for(i = 0; i < sz; i += PGSIZE){
-    pa = walkaddr(pagetable, va + i);
-    if(pa == 0)
-      panic("loadseg: address should exist");
-    if(sz - i < PGSIZE)
-      n = sz - i;
-    else
-      n = PGSIZE;
-    if(readi(ip, 0, (uint64)pa, offset+i, n) != n)
-      return -1;
+  uint64 start, end;
+  uint n;
+
+  start = va < s->va ? s->va : va;
+  end = s->va + s->filesz;
+  if(end > va + PGSIZE)
+    end = va + PGSIZE;
+  if(start >= end)
+    return 0;  // all bss
+  n = end - start;
+
+  ilock(p->exe);
+  if(readi(p->exe, 0, (uint64)mem + (start - va), s->off + (start - s->va), n) != n){
+    iunlock(p->exe);
+    return -1;
   }
-  
+  iunlock(p->exe);
   return 0;
 }
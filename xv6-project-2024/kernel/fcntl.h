@@ -4,4 +4,20 @@
 #define O_CREATE  0x200
 #define O_TRUNC   0x400
 #define O_NOFOLLOW 0x1000
+#define O_EXTENT  0x2000  // with O_CREATE: map an empty file with extents
+
+// mmap() prot
+#define PROT_READ  0x1
+#define PROT_WRITE 0x2
+#define PROT_EXEC  0x4
+
+// mmap() flags
+#define MAP_SHARED  0x01
+#define MAP_PRIVATE 0x02
+#define MAP_ANON    0x20  // anonymous memory; fd is ignored
+
+// lseek() whence
+#define SEEK_SET  0
+#define SEEK_CUR  1
+#define SEEK_END  2
 
@@ -12,17 +12,23 @@
 #include "file.h"
 #include "stat.h"
 #include "proc.h"
+#include "fcntl.h"
+#include "slab.h"
 
 struct devsw devsw[NDEV];
+
+// Open files come from a slab cache holding at most NFILE of
+// them; ftable.lock protects their reference counts.
 struct {
   struct spinlock lock;
-  struct file file[NFILE];
+  struct slab cache;
 } ftable;
 
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  slabinit(&ftable.cache, "file", sizeof(struct file), NFILE);
 }
 
 // Allocate a file structure.
@@ -31,16 +37,10 @@ filealloc(void)
 {
   struct file *f;
 
-  acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
-  }
-  release(&ftable.lock);
-  return 0;
+  if((f = slaballoc(&ftable.cache)) == 0)
+    return 0;
+  f->ref = 1;
+  return f;
 }
 
 // Increment ref count for file f.
@@ -72,11 +72,13 @@ fileclose(struct file *f)
   f->ref = 0;
   f->type = FD_NONE;
   release(&ftable.lock);
+  slabfree(&ftable.cache, f);
 
   if(ff.type == FD_PIPE){
     pipeclose(ff.pipe, ff.writable);
   } else if(ff.type == FD_INODE || ff.type == FD_DEVICE){
-    begin_op();
+    // writes nothing, unless the file goes, which end_op() does.
+    begin_opn(0);
     iput(ff.ip);
     end_op();
   }
@@ -101,6 +103,35 @@ filestat(struct file *f, uint64 addr)
   return -1;
 }
 
+// Set the offset of file f, relative to the start, the
+// current offset or the end as whence says. Seeking past
+// the end is allowed; writing there leaves a hole.
+// Returns the new offset, or -1.
+int
+filelseek(struct file *f, int off, int whence)
+{
+  int base;
+
+  if(f->type != FD_INODE)
+    return -1;
+  ilock(f->ip);
+  if(whence == SEEK_SET)
+    base = 0;
+  else if(whence == SEEK_CUR)
+    base = f->off;
+  else if(whence == SEEK_END)
+    base = f->ip->size;
+  else
+    base = -1;
+  if(base < 0 || base + off < 0){
+    iunlock(f->ip);
+    return -1;
+  }
+  f->off = base + off;
+  iunlock(f->ip);
+  return f->off;
+}
+
 // Read from file f.
 // addr is a user virtual address.
 int
@@ -111,6 +142,10 @@ fileread(struct file *f, uint64 addr, int n)
   if(f->readable == 0)
     return -1;
 
+  // the pipe and console copy with spinlocks held.
+  if(n > 0)
+    vmprefault(myproc(), addr, n);
+
   if(f->type == FD_PIPE){
     r = piperead(f->pipe, addr, n);
   } else if(f->type == FD_DEVICE){
@@ -129,6 +164,35 @@ fileread(struct file *f, uint64 addr, int n)
   return r;
 }
 
+// Log blocks a writei() of n bytes can dirty: the data blocks,
+// plus 2 of slop for non-aligned writes; the indirect, doubly-
+// indirect and middle map blocks above them; the i-node; and
+// the bitmap blocks for new blocks, of which the file system
+// has only FSSIZE/BPB+1.
+static int
+writeres(int n)
+{
+  int data = n/BSIZE + 2;
+  int map = data/NINDIRECT + 3;
+  int bitmap = data + map;
+
+  if(bitmap > FSSIZE/BPB + 1)
+    bitmap = FSSIZE/BPB + 1;
+  return data + map + 1 + bitmap;
+}
+
+// The longest write, in whole blocks, whose writeres()
+// fits in MAXWRBLOCKS.
+static int
+writemax(void)
+{
+  int n = MAXWRBLOCKS * BSIZE;
+
+  while(n > BSIZE && writeres(n) > MAXWRBLOCKS)
+    n -= BSIZE;
+  return n;
+}
+
 // Write to file f.
 // addr is a user virtual address.
 int
@@ -139,6 +203,10 @@ filewrite(struct file *f, uint64 addr, int n)
   if(f->writable == 0)
     return -1;
 
+  // the pipe and console copy with spinlocks held.
+  if(n > 0)
+    vmprefault(myproc(), addr, n);
+
   if(f->type == FD_PIPE){
     ret = pipewrite(f->pipe, addr, n);
   } else if(f->type == FD_DEVICE){
@@ -146,20 +214,17 @@ filewrite(struct file *f, uint64 addr, int n)
       return -1;
     ret = devsw[f->major].write(1, addr, n);
   } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
+    // write as many blocks per transaction as fit in a
+    // MAXWRBLOCKS log reservation.
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
     int i = 0;
     while(i < n){
       int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
+      if(writeres(n1) > MAXWRBLOCKS)
+        n1 = writemax();
 
-      begin_op();
+      begin_opn(writeres(n1));
       ilock(f->ip);
       if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
         f->off += r;
@@ -180,3 +245,65 @@ filewrite(struct file *f, uint64 addr, int n)
   return ret;
 }
 
+
+// Move up to n bytes from file in to file out without a user
+// buffer, where one is a pipe and the other an i-node: readi()
+// straight into the pipe's ring, or writei() straight out of
+// it. Returns the number of bytes moved, or -1 for any other
+// kind of file or if nothing could be moved. Like read(),
+// taking from a pipe waits only for the first bytes.
+int
+filesplice(struct file *in, struct file *out, int n)
+{
+  char *buf;
+  int m, r, i = 0, err = 0;
+
+  if(in->readable == 0 || out->writable == 0 || n < 0)
+    return -1;
+
+  if(in->type == FD_INODE && out->type == FD_PIPE){
+    while(i < n){
+      if((m = pipewbegin(out->pipe, n - i, &buf)) < 0){
+        err = 1;
+        break;
+      }
+      // the pipe's lock is not held, so readi() may sleep.
+      ilock(in->ip);
+      if((r = readi(in->ip, 0, (uint64)buf, in->off, m)) > 0)
+        in->off += r;
+      iunlock(in->ip);
+      pipewend(out->pipe, r > 0 ? r : 0);
+      if(r <= 0){
+        err = r < 0;  // else end of file
+        break;
+      }
+      i += r;
+    }
+  } else if(in->type == FD_PIPE && out->type == FD_INODE){
+    while(i < n){
+      if((m = piperbegin(in->pipe, n - i, &buf, i == 0)) <= 0){
+        err = m < 0;
+        break;
+      }
+      begin_opn(writeres(m));
+      ilock(out->ip);
+      if((r = writei(out->ip, 0, (uint64)buf, out->off, m)) > 0)
+        out->off += r;
+      iunlock(out->ip);
+      end_op();
+      piperend(in->pipe, r > 0 ? r : 0);
+      if(r != m){
+        // error from writei
+        err = 1;
+        if(r > 0)
+          i += r;
+        break;
+      }
+      i += r;
+    }
+  } else {
+    return -1;
+  }
+
+  return i > 0 ? i : (err ? -1 : 0);
+}
@@ -18,14 +18,25 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *next, *prev;       // hash bucket chain
+  struct inode *lrunext, *lruprev; // itable.lru, while ref is 0
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
   short type;         // copy of disk inode
   short major;
-  short minor;
+  union {
+    short minor;
+    short flags;
+  };
+  uint ranext;        // block after the last one readi() returned
+  uint raend;         // blocks below this have been read ahead
+  uint lastalloc;     // block bmap() allocated last, a placement hint
+  uint syminum;       // symlink: inode the chain resolved to
+  uint symgen;        // directory generation syminum holds for
   short nlink;
   uint size;
+  struct inode *freenext; // proc's ifree list
   uint addrs[NDIRECT+2];//**edited** i added one to NDIRECT+1 /
 };
 
@@ -38,3 +49,4 @@ struct devsw {
 extern struct devsw devsw[];
 
 #define CONSOLE 1
+#define KSTAT   2
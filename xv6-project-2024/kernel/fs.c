@@ -22,10 +22,27 @@
 #include "file.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
+
+// what holes in sparse files read as.
+static const char zeroes[BSIZE];
 // there should be one superblock per disk device, but we run with
 // only one device
 struct superblock sb; 
 
+// Free-block allocation state, kept in memory: a cursor where
+// the next balloc() scan starts and the number of free blocks,
+// counted from the bitmap at boot.
+struct {
+  struct spinlock lock;
+  uint next;
+  uint nfree;
+} bmapinfo;
+
+static void bcount(int);
+static void dcinit(void);
+static void dcpurge(uint, uint);
+static void dcchanged(void);
+
 // Read the super block.
 static void
 readsb(int dev, struct superblock *sb)
@@ -37,6 +54,8 @@ readsb(int dev, struct superblock *sb)
   brelse(bp);
 }
 
+static void iorphans(int);
+
 // Init fs
 void
 fsinit(int dev) {
@@ -44,64 +63,189 @@ fsinit(int dev) {
   if(sb.magic != FSMAGIC)
     panic("invalid file system");
   initlog(dev, &sb);
+  bcount(dev);
+  iorphans(dev);
 }
 
-// Zero a block.
+// Zero a newly allocated block. The zeroes are only logged;
+// the block is not read first, and a writei() of new data
+// into it in the same transaction shares its log slot.
 static void
 bzero(int dev, int bno)
 {
   struct buf *bp;
 
-  bp = bread(dev, bno);
-  memset(bp->data, 0, BSIZE);
+  bp = bnew(dev, bno);
   log_write(bp);
   brelse(bp);
 }
 
 // Blocks.
 
+#define BWORDS (BPB / 64)  // 64-bit words per bitmap block
+
+// Count the free blocks in the bitmap and start
+// allocating at the first data block.
+static void
+bcount(int dev)
+{
+  struct buf *bp;
+  uint64 *w;
+  uint b, i, nbits;
+
+  initlock(&bmapinfo.lock, "bmapinfo");
+  bmapinfo.nfree = 0;
+  bmapinfo.next = sb.bmapstart + sb.size/BPB + 1;
+  for(b = 0; b < sb.size; b += BPB){
+    bp = bread(dev, BBLOCK(b, sb));
+    w = (uint64*)bp->data;
+    for(i = 0; i < BWORDS && b + i*64 < sb.size; i++){
+      nbits = sb.size - (b + i*64);
+      if(nbits >= 64)
+        bmapinfo.nfree += 64 - __builtin_popcountll(w[i]);
+      else
+        bmapinfo.nfree += nbits - __builtin_popcountll(w[i] & ((1L << nbits) - 1));
+    }
+    brelse(bp);
+  }
+}
+
 // Allocate a zeroed disk block.
+// Scans the bitmap a word at a time, starting at the cursor
+// and wrapping around once.
 // returns 0 if out of disk space.
 static uint
 balloc(uint dev)
 {
-  int b, bi, m;
   struct buf *bp;
+  uint64 *w;
+  uint start, nwords, i, wi, b, bit;
 
+  acquire(&bmapinfo.lock);
+  if(bmapinfo.nfree == 0){
+    release(&bmapinfo.lock);
+    printf("balloc: out of blocks\n");
+    return 0;
+  }
+  start = bmapinfo.next / 64;
+  release(&bmapinfo.lock);
+
+  nwords = (sb.size + 63) / 64;
   bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
+  for(i = 0; i <= nwords; i++){
+    wi = (start + i) % nwords;
+    if(bp == 0 || wi % BWORDS == 0){
+      if(bp)
         brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
-      }
+      bp = bread(dev, BBLOCK(wi*64, sb));
     }
+    w = (uint64*)bp->data + wi % BWORDS;
+    if(*w == ~0UL)
+      continue;
+    bit = __builtin_ctzll(~*w);
+    b = wi*64 + bit;
+    if(b >= sb.size)
+      continue;
+    *w |= 1UL << bit;  // Mark block in use.
+    log_write(bp);
     brelse(bp);
+    acquire(&bmapinfo.lock);
+    bmapinfo.nfree--;
+    bmapinfo.next = b + 1;
+    release(&bmapinfo.lock);
+    bzero(dev, b);
+    return b;
   }
+  if(bp)
+    brelse(bp);
   printf("balloc: out of blocks\n");
   return 0;
 }
 
-// Free a disk block.
-static void
-bfree(int dev, uint b)
+// Allocate disk block b if it is free, for callers that
+// want their blocks contiguous. The block is zeroed.
+// returns b, or 0 if b is in use or out of range.
+static uint
+balloc_at(uint dev, uint b)
 {
   struct buf *bp;
   int bi, m;
 
+  if(b < sb.bmapstart + sb.size/BPB + 1 || b >= sb.size)
+    return 0;
   bp = bread(dev, BBLOCK(b, sb));
   bi = b % BPB;
   m = 1 << (bi % 8);
-  if((bp->data[bi/8] & m) == 0)
-    panic("freeing free block");
-  bp->data[bi/8] &= ~m;
+  if(bp->data[bi/8] & m){
+    brelse(bp);
+    return 0;
+  }
+  bp->data[bi/8] |= m;
   log_write(bp);
   brelse(bp);
+  acquire(&bmapinfo.lock);
+  bmapinfo.nfree--;
+  release(&bmapinfo.lock);
+  bzero(dev, b);
+  return b;
+}
+
+// Allocate a zeroed block for inode ip, right after the one
+// it allocated last if that is free, so that a file written
+// sequentially lands in contiguous blocks even when other
+// files grow at the same time.
+// returns 0 if out of disk space.
+static uint
+ballocnear(struct inode *ip)
+{
+  uint b = 0;
+
+  if(ip->lastalloc)
+    b = balloc_at(ip->dev, ip->lastalloc + 1);
+  if(b == 0)
+    b = balloc(ip->dev);
+  if(b)
+    ip->lastalloc = b;
+  return b;
+}
+
+// Free the n disk blocks b[], reading and logging each bitmap
+// block they are in once. Sorts b[].
+static void
+bfreev(int dev, uint *b, int n)
+{
+  struct buf *bp;
+  int i, j, bi, m;
+  uint t;
+
+  for(i = 1; i < n; i++){
+    t = b[i];
+    for(j = i; j > 0 && b[j-1] > t; j--)
+      b[j] = b[j-1];
+    b[j] = t;
+  }
+  for(i = 0; i < n; i = j){
+    bp = bread(dev, BBLOCK(b[i], sb));
+    for(j = i; j < n && BBLOCK(b[j], sb) == BBLOCK(b[i], sb); j++){
+      bi = b[j] % BPB;
+      m = 1 << (bi % 8);
+      if((bp->data[bi/8] & m) == 0)
+        panic("freeing free block");
+      bp->data[bi/8] &= ~m;
+    }
+    log_write(bp);
+    brelse(bp);
+  }
+  acquire(&bmapinfo.lock);
+  bmapinfo.nfree += n;
+  release(&bmapinfo.lock);
+}
+
+// Free a disk block.
+static void
+bfree(int dev, uint b)
+{
+  bfreev(dev, &b, 1);
 }
 
 // Inodes.
@@ -129,18 +273,19 @@ bfree(int dev, uint b)
 //   is non-zero. ialloc() allocates, and iput() frees if
 //   the reference and link counts have fallen to zero.
 //
-// * Referencing in table: an entry in the inode table
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
-//   the number of in-memory pointers to the entry (open
-//   files and current directories). iget() finds or
-//   creates a table entry and increments its ref; iput()
-//   decrements ref.
+// * Referencing in table: ip->ref tracks the number of
+//   in-memory pointers to an entry (open files and current
+//   directories). iget() finds or creates a table entry and
+//   increments its ref; iput() decrements ref. An entry
+//   whose ref is zero still caches its inode, and iget()
+//   can find it again, until it is recycled for another
+//   inode, least recently released first.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   table entry is only correct when ip->valid is 1.
 //   ilock() reads the inode from
 //   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   ip->valid when it frees the inode.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -164,33 +309,102 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
-// The itable.lock spin-lock protects the allocation of itable
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold itable.lock while using any of those fields.
+// The table is split into NIBUCKET hash buckets keyed by
+// (dev, inum), like the buffer cache. A bucket's lock protects
+// its chain and the ref of each inode on it, so lookups of
+// different inodes don't contend. Entries with ref zero are
+// also on the itable.lru list, oldest first, under the leaf
+// lock itable.lrulock. itable.lock is only taken to recycle an
+// entry, which changes its dev and inum and moves it to another
+// bucket; so dev and inum may be read holding either lock.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+#define NIBUCKET 31
+#define IHASH(dev, inum) ((((dev) << 27) | (inum)) % NIBUCKET)
+#define IBUCKET(ip) (&itable.bucket[IHASH((ip)->dev, (ip)->inum)])
+
+struct ibucket {
+  struct spinlock lock;
+  struct inode head;  // chain through prev/next
+};
+
 struct {
   struct spinlock lock;
   struct inode inode[NINODE];
+  struct ibucket bucket[NIBUCKET];
+  struct spinlock lrulock;
+  struct inode lru;   // ref zero entries through lruprev/lrunext
 } itable;
 
+static void
+lruadd(struct inode *ip)
+{
+  acquire(&itable.lrulock);
+  ip->lruprev = itable.lru.lruprev;
+  ip->lrunext = &itable.lru;
+  itable.lru.lruprev->lrunext = ip;
+  itable.lru.lruprev = ip;
+  release(&itable.lrulock);
+}
+
+static void
+lrudel(struct inode *ip)
+{
+  acquire(&itable.lrulock);
+  ip->lrunext->lruprev = ip->lruprev;
+  ip->lruprev->lrunext = ip->lrunext;
+  release(&itable.lrulock);
+}
+
 void
 iinit()
 {
-  int i = 0;
+  struct ibucket *bk;
+  struct inode *ip;
   
   initlock(&itable.lock, "itable");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&itable.inode[i].lock, "inode");
+  initlock(&itable.lrulock, "itable.lru");
+  dcinit();
+  itable.lru.lruprev = itable.lru.lrunext = &itable.lru;
+  for(bk = itable.bucket; bk < itable.bucket+NIBUCKET; bk++){
+    initlock(&bk->lock, "itable.bucket");
+    bk->head.prev = bk->head.next = &bk->head;
+  }
+  // Unused entries have inum 0, which no lookup asks for, and
+  // are spread over the buckets to start with.
+  for(ip = itable.inode; ip < itable.inode+NINODE; ip++){
+    initsleeplock(&ip->lock, "inode");
+    bk = &itable.bucket[(ip - itable.inode) % NIBUCKET];
+    ip->next = bk->head.next;
+    ip->prev = &bk->head;
+    bk->head.next->prev = ip;
+    bk->head.next = ip;
+    lruadd(ip);
   }
 }
 
 static struct inode* iget(uint dev, uint inum);
 
+// Look for (dev, inum) in bucket bk and take a reference to it.
+// Caller must hold bk->lock.
+static struct inode*
+ifind(struct ibucket *bk, uint dev, uint inum)
+{
+  struct inode *ip;
+
+  for(ip = bk->head.next; ip != &bk->head; ip = ip->next){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0)
+        lrudel(ip);
+      return ip;
+    }
+  }
+  return 0;
+}
+
 // Allocate an inode on device dev.
 // Mark it as allocated by  giving it type type.
 // Returns an unlocked but allocated and referenced inode,
@@ -246,31 +460,65 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip;
+  struct ibucket *bk, *vb;
 
-  acquire(&itable.lock);
+  bk = &itable.bucket[IHASH(dev, inum)];
+  acquire(&bk->lock);
 
   // Is the inode already in the table?
-  empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
-      release(&itable.lock);
-      return ip;
-    }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
+  if((ip = ifind(bk, dev, inum)) != 0){
+    release(&bk->lock);
+    return ip;
   }
+  release(&bk->lock);
 
-  // Recycle an inode entry.
-  if(empty == 0)
-    panic("iget: no inodes");
+  // Not cached. Only one CPU at a time recycles an entry, so
+  // two misses on the same inode can't both add it, and so
+  // holding two bucket locks can't deadlock.
+  acquire(&itable.lock);
+  acquire(&bk->lock);
+  if((ip = ifind(bk, dev, inum)) != 0){
+    release(&bk->lock);
+    release(&itable.lock);
+    return ip;
+  }
+
+  // Take the least recently released entry. Its bucket can't
+  // change under us, but its ref can until we hold that lock.
+  for(;;){
+    acquire(&itable.lrulock);
+    ip = itable.lru.lrunext;
+    release(&itable.lrulock);
+    if(ip == &itable.lru)
+      panic("iget: no inodes");
+    vb = IBUCKET(ip);
+    if(vb != bk)
+      acquire(&vb->lock);
+    if(ip->ref == 0)
+      break;
+    if(vb != bk)
+      release(&vb->lock);
+  }
+  lrudel(ip);
+  ip->next->prev = ip->prev;
+  ip->prev->next = ip->next;
+  if(vb != bk)
+    release(&vb->lock);
+  ip->next = bk->head.next;
+  ip->prev = &bk->head;
+  bk->head.next->prev = ip;
+  bk->head.next = ip;
 
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->ranext = 0;
+  ip->raend = 0;
+  ip->syminum = 0;
+  ip->lastalloc = 0;
+  release(&bk->lock);
   release(&itable.lock);
 
   return ip;
@@ -281,9 +529,11 @@ iget(uint dev, uint inum)
 struct inode*
 idup(struct inode *ip)
 {
-  acquire(&itable.lock);
+  struct ibucket *bk = IBUCKET(ip);
+
+  acquire(&bk->lock);
   ip->ref++;
-  release(&itable.lock);
+  release(&bk->lock);
   return ip;
 }
 
@@ -332,11 +582,27 @@ iunlock(struct inode *ip)
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
-// case it has to free the inode.
+// case it has to free the inode. If the inode still has
+// content, or the transaction's reservation is too small,
+// the reference goes to the process's ifree list instead,
+// for end_op() to truncate the inode with itruncsteps() and
+// then put it.
 void
 iput(struct inode *ip)
 {
-  acquire(&itable.lock);
+  struct ibucket *bk = IBUCKET(ip);
+  struct proc *p = myproc();
+
+  acquire(&bk->lock);
+
+  // ip->ref == 1 means no one else can change ip->size.
+  if(ip->ref == 1 && ip->valid && ip->nlink == 0 &&
+     (p->logres < MAXOPBLOCKS || ip->size > 0)){
+    ip->freenext = p->ifree;
+    p->ifree = ip;
+    release(&bk->lock);
+    return;
+  }
 
   if(ip->ref == 1 && ip->valid && ip->nlink == 0){
     // inode has no links and no other references: truncate and free.
@@ -345,8 +611,10 @@ iput(struct inode *ip)
     // so this acquiresleep() won't block (or deadlock).
     acquiresleep(&ip->lock);
 
-    release(&itable.lock);
+    release(&bk->lock);
 
+    if(ip->type == T_DIR)
+      dcpurge(ip->dev, ip->inum);
     itrunc(ip);
     ip->type = 0;
     iupdate(ip);
@@ -354,11 +622,42 @@ iput(struct inode *ip)
 
     releasesleep(&ip->lock);
 
-    acquire(&itable.lock);
+    acquire(&bk->lock);
   }
 
-  ip->ref--;
-  release(&itable.lock);
+  if(--ip->ref == 0)
+    lruadd(ip);
+  release(&bk->lock);
+}
+
+// Free the files a crash left allocated with no links. unlink()
+// commits nlink = 0 in one transaction and end_op() frees the
+// file in later ones, or the last close() does if it was open,
+// so a crash in between leaks it. Called once, by fsinit().
+static void
+iorphans(int dev)
+{
+  struct buf *bp;
+  struct dinode *dip;
+  struct inode *ip;
+  uint inum;
+  int orphan;
+
+  for(inum = 1; inum < sb.ninodes; inum++){
+    bp = bread(dev, IBLOCK(inum, sb));
+    dip = (struct dinode*)bp->data + inum%IPB;
+    orphan = dip->type != 0 && dip->nlink == 0;
+    brelse(bp);
+    if(!orphan)
+      continue;
+    // the last iput() frees it, as after an unlink().
+    ip = iget(dev, inum);
+    begin_op();
+    ilock(ip);
+    iunlock(ip);
+    iput(ip);
+    end_op();
+  }
 }
 
 // Common idiom: unlock, then put.
@@ -376,17 +675,100 @@ iunlockput(struct inode *ip)
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
 // listed in block ip->addrs[NDIRECT].
 
+// Return the disk block address of the nth block in extent
+// inode ip. If bn is just past the end of the file and alloc
+// is set, allocate it, extending the last extent if the next
+// disk block is free.
+// returns 0 if not mapped, further past the end, or out of
+// disk space or extents.
+static uint
+emap(struct inode *ip, uint bn, int alloc)
+{
+  struct extent *e, *last;
+  struct buf *bp;
+  uint base, addr;
+  int i;
+
+  // the inline extents.
+  base = 0;
+  last = 0;
+  e = (struct extent*)ip->addrs;
+  for(i = 0; i < NEXTENT && e[i].len; i++){
+    if(bn < base + e[i].len)
+      return e[i].start + (bn - base);
+    base += e[i].len;
+    last = &e[i];
+  }
+  // the extent block is used once the inline extents are full.
+  if(i == NEXTENT && ip->addrs[NDIRECT+1])
+    goto block;
+  // extent files have no holes: writei() refuses to write past
+  // the end, and anything else past it is not mapped.
+  if(!alloc || bn != base)
+    return 0;
+
+  if(i < NEXTENT || ip->addrs[NDIRECT+1] == 0){
+    if(last && (addr = balloc_at(ip->dev, last->start + last->len)) != 0){
+      last->len++;
+      return addr;
+    }
+    if(i < NEXTENT){
+      if((addr = balloc(ip->dev)) == 0)
+        return 0;
+      e[i].start = addr;
+      e[i].len = 1;
+      return addr;
+    }
+    if((addr = balloc(ip->dev)) == 0)
+      return 0;
+    ip->addrs[NDIRECT+1] = addr;
+  }
+
+ block:
+  bp = bread(ip->dev, ip->addrs[NDIRECT+1]);
+  e = (struct extent*)bp->data;
+  for(i = 0; i < NEXTENTBLK && e[i].len; i++){
+    if(bn < base + e[i].len){
+      addr = e[i].start + (bn - base);
+      brelse(bp);
+      return addr;
+    }
+    base += e[i].len;
+    last = &e[i];
+  }
+  if(!alloc || bn != base){
+    brelse(bp);
+    return 0;
+  }
+
+  // bn is the next block; writei() only extends files at the end.
+  if((addr = balloc_at(ip->dev, last->start + last->len)) != 0){
+    last->len++;
+  } else if(i < NEXTENTBLK && (addr = balloc(ip->dev)) != 0){
+    e[i].start = addr;
+    e[i].len = 1;
+  }
+  if(addr && e[0].len)  // else only the inline extent grew
+    log_write(bp);
+  brelse(bp);
+  return addr;
+}
+
 // Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
-// returns 0 if out of disk space.
+// If there is no such block and alloc is set, bmap allocates
+// one; otherwise the block is a hole and reads as zeros.
+// returns 0 if not mapped or out of disk space.
 static uint
-bmap(struct inode *ip, uint bn) {
+bmap(struct inode *ip, uint bn, int alloc) {
   uint addr, *a;
   struct buf *bp;
 
+  if(ip->type == T_FILE && (ip->flags & IF_EXTENT))
+    return emap(ip, bn, alloc);
+
   if (bn < NDIRECT) {
-    if ((addr = ip->addrs[bn]) == 0) {
-      addr = balloc(ip->dev); 
+    if ((addr = ip->addrs[bn]) == 0 && alloc) {
+      addr = ballocnear(ip); 
       if (addr == 0)
         return 0;
       ip->addrs[bn] = addr;
@@ -397,15 +779,17 @@ bmap(struct inode *ip, uint bn) {
 
   if (bn < NINDIRECT) {
     if ((addr = ip->addrs[NDIRECT]) == 0) {
-      addr = balloc(ip->dev); 
+      if (!alloc)
+        return 0;
+      addr = ballocnear(ip); 
       if (addr == 0)
         return 0;
       ip->addrs[NDIRECT] = addr; 
     }
     bp = bread(ip->dev, addr);
     a = (uint *)bp->data; 
-    if ((addr = a[bn]) == 0) {
-      addr = balloc(ip->dev); 
+    if ((addr = a[bn]) == 0 && alloc) {
+      addr = ballocnear(ip); 
       if (addr) {
         a[bn] = addr;
         log_write(bp);
@@ -419,7 +803,9 @@ bmap(struct inode *ip, uint bn) {
   if (bn < NDOUBLY_INDIRECT) {
     //here i intended to load double indirect block, allocating if necessary
     if ((addr = ip->addrs[NDIRECT + 1]) == 0) {
-      addr = balloc(ip->dev); //if the double indirect block if not present, we allocate it
+      if (!alloc)
+        return 0; //a hole: nothing is allocated below here
+      addr = ballocnear(ip); //if the double indirect block if not present, we allocate it
       if (addr == 0)
         return 0;
       ip->addrs[NDIRECT + 1] = addr; //then we assign the double indirect block
@@ -429,21 +815,23 @@ bmap(struct inode *ip, uint bn) {
 
     //here i loaded the second layer block
     uint double_index = bn / NINDIRECT; //determining the index in the first level
-    if ((addr = a[double_index]) == 0) {
-      addr = balloc(ip->dev); //allocating the second layer block if not present, same logic as above
+    if ((addr = a[double_index]) == 0 && alloc) {
+      addr = ballocnear(ip); //allocating the second layer block if not present, same logic as above
       if (addr) {
         a[double_index] = addr; //assigning the second layer block
         log_write(bp); //loging the update
       }
     }
     brelse(bp); //releasing the buffer
+    if (addr == 0)
+      return 0; //a hole, or out of blocks
 
     //here i loaded the first layer block
     bp = bread(ip->dev, addr); //then we read the first layer block
     a = (uint *)bp->data;
     uint pos = bn % NINDIRECT; //we determine the index in the first layer
-    if ((addr = a[pos]) == 0) {
-      addr = balloc(ip->dev); //adding the block if not present
+    if ((addr = a[pos]) == 0 && alloc) {
+      addr = ballocnear(ip); //adding the block if not present
       if (addr) {
         a[pos] = addr; //we assign the block
         log_write(bp); //and then we log the update
@@ -458,57 +846,206 @@ bmap(struct inode *ip, uint bn) {
 }
 
 
-// Truncate inode (discard contents).
-// Caller must hold ip->lock.
-void
-itrunc(struct inode *ip)
+// Blocks one itruncstep() may free, and bitmap blocks it may
+// change: with the i-node, the doubly-indirect block and one
+// partly freed index block, the step's transaction writes at
+// most MAXOPBLOCKS blocks.
+#define NTRUNC      128
+#define TRUNCBITMAP (MAXOPBLOCKS - 3)
+
+struct trunc {
+  uint b[NTRUNC];          // blocks to free
+  int n;
+  uint bmap[TRUNCBITMAP];  // bitmap blocks they are in
+  int nbmap;
+  int full;                // a block didn't fit
+};
+
+// Add block b to those t frees, if it fits.
+static int
+tadd(struct trunc *t, uint b)
 {
-  int i, j, k;
-  struct buf *bp, *bp2;//added *bp2 to handle the doubly indirect blocks
-  uint *a, *b;//added *b to handle the doubly indirect blocks
+  int i;
+
+  if(t->full || t->n == NTRUNC)
+    goto full;
+  for(i = 0; i < t->nbmap && t->bmap[i] != BBLOCK(b, sb); i++)
+    ;
+  if(i == t->nbmap){
+    if(t->nbmap == TRUNCBITMAP)
+      goto full;
+    t->bmap[t->nbmap++] = BBLOCK(b, sb);
+  }
+  t->b[t->n++] = b;
+  return 1;
+full:
+  t->full = 1;
+  return 0;
+}
 
-  for(i = 0; i < NDIRECT; i++){
-    if(ip->addrs[i]){
-      bfree(ip->dev, ip->addrs[i]);
-      ip->addrs[i] = 0;
-    }
+// Free the blocks a[n-1], a[n-2], ... while they fit in t,
+// zeroing their entries. Returns how many entries are left.
+static int
+tpop(struct trunc *t, uint *a, int n)
+{
+  for(; n > 0; n--){
+    if(a[n-1] && !tadd(t, a[n-1]))
+      break;
+    a[n-1] = 0;
   }
+  return n;
+}
 
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
+// Free the blocks of the index block *pp from its end, and
+// then the index block itself, clearing *pp. Returns how many
+// of its entries are left.
+static int
+tpopindex(struct trunc *t, uint dev, uint *pp)
+{
+  struct buf *bp;
+  int left;
+
+  bp = bread(dev, *pp);
+  left = tpop(t, (uint*)bp->data, NINDIRECT);
+  if(left == 0 && tadd(t, *pp)){
+    brelse(bp);  // freed; its contents no longer matter
+    *pp = 0;
+    return 0;
+  }
+  log_write(bp);
+  brelse(bp);
+  return left;
+}
+
+// Free the blocks of the n extents ext, from the end of the
+// last one, while they fit in t, trimming the extents. Returns
+// how many blocks they still hold.
+static uint
+tpopext(struct trunc *t, struct extent *ext, int n)
+{
+  uint left = 0;
+
+  for(; n > 0; n--){
+    while(ext[n-1].len > 0 && tadd(t, ext[n-1].start + ext[n-1].len - 1))
+      ext[n-1].len--;
+    if(ext[n-1].len > 0)
+      break;
+    ext[n-1].start = 0;
+  }
+  for(; n > 0; n--)
+    left += ext[n-1].len;
+  return left;
+}
+
+// Free as many of ip's blocks as one transaction can afford,
+// from the end of the file, shrinking ip->size to what is left.
+// Returns 1 once ip has no blocks.
+// Caller must hold ip->lock, in a transaction.
+int
+itruncstep(struct inode *ip)
+{
+  struct trunc t;
+  struct buf *bp;
+  uint *a, keep;
+  int i, left;
+
+  if(ip->type == T_SYMLINK)
+    dcchanged();
+  if(ip->type == T_SYMLINK && (ip->flags & IF_INLINE)){
+    memset(ip->addrs, 0, sizeof(ip->addrs));
+    ip->size = 0;
+    iupdate(ip);
+    return 1;
+  }
+
+  t.n = t.nbmap = t.full = 0;
+
+  // extents cover the file in order: the extent block's, after
+  // the inline ones.
+  if(ip->type == T_FILE && (ip->flags & IF_EXTENT)){
+    keep = 0;
+    if(ip->addrs[NDIRECT+1]){
+      bp = bread(ip->dev, ip->addrs[NDIRECT+1]);
+      keep = tpopext(&t, (struct extent*)bp->data, NEXTENTBLK);
+      if(keep == 0 && tadd(&t, ip->addrs[NDIRECT+1])){
+        brelse(bp);
+        ip->addrs[NDIRECT+1] = 0;
+      } else {
+        log_write(bp);
+        brelse(bp);
+      }
     }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
+    keep += tpopext(&t, (struct extent*)ip->addrs, NEXTENT);
+    goto done;
   }
 
-  //added the below code to handle the doubly indirect blocks
-  if(ip->addrs[NDIRECT + 1]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT + 1]);
+  keep = MAXFILE;  // file blocks from keep on are gone
+
+  if(ip->addrs[NDIRECT+1]){
+    bp = bread(ip->dev, ip->addrs[NDIRECT+1]);
     a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j]){
-        bp2 = bread(ip->dev, a[j]);
-        b = (uint*)bp2->data;
-        for(k = 0; k < NINDIRECT; k++){
-          if(b[k]){
-            bfree(ip->dev, b[k]);
-          }
-        }
-        brelse(bp2);
-        bfree(ip->dev, a[j]);
-      }
+    for(i = NINDIRECT; i > 0 && !t.full; i--){
+      if(a[i-1] == 0)
+        continue;
+      left = tpopindex(&t, ip->dev, &a[i-1]);
+      keep = NDIRECT + NINDIRECT + (i-1)*NINDIRECT + left;
     }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT + 1]);
-    ip->addrs[NDIRECT + 1] = 0;
+    if(!t.full && tadd(&t, ip->addrs[NDIRECT+1])){
+      brelse(bp);
+      ip->addrs[NDIRECT+1] = 0;
+    } else {
+      log_write(bp);
+      brelse(bp);
+    }
+  }
+  if(!t.full)
+    keep = NDIRECT + NINDIRECT;
+
+  if(!t.full && ip->addrs[NDIRECT])
+    keep = NDIRECT + tpopindex(&t, ip->dev, &ip->addrs[NDIRECT]);
+  if(!t.full)
+    keep = NDIRECT;
+
+  if(!t.full)
+    keep = tpop(&t, ip->addrs, NDIRECT);
+
+done:
+  bfreev(ip->dev, t.b, t.n);
+  if(ip->size > keep*BSIZE){
+    ip->size = keep*BSIZE;
+    ip->raend = 0;
   }
-  ip->size = 0;
   iupdate(ip);
+  return !t.full;
+}
+
+// Truncate inode (discard contents), all in the caller's
+// transaction, so only for inodes known to be small.
+// Caller must hold ip->lock.
+void
+itrunc(struct inode *ip)
+{
+  while(!itruncstep(ip))
+    ;
+}
+
+// Truncate ip one itruncstep() per transaction, so that
+// freeing a big file never makes a transaction too big and
+// keeps other operations waiting only one step at a time.
+// Caller must hold a reference to ip, but neither its lock
+// nor a transaction.
+void
+itruncsteps(struct inode *ip)
+{
+  int done;
+
+  do {
+    begin_op();
+    ilock(ip);
+    done = itruncstep(ip);
+    iunlock(ip);
+    end_op();
+  } while(!done);
 }
 
 // Copy stat information from inode.
@@ -523,6 +1060,28 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Start reads of file blocks [from, to) that are not cached,
+// then wait for them all, so that the disk works on several
+// at once. bmap() reads the map blocks along the way.
+// Holes are skipped.
+static void
+readahead(struct inode *ip, uint from, uint to)
+{
+  struct buf *b[RAWINDOW];
+  uint addr;
+  int i, n;
+
+  n = 0;
+  for(; from < to && n < RAWINDOW; from++){
+    if((addr = bmap(ip, from, 0)) == 0)
+      continue;  // a hole
+    if((b[n] = bread_start(ip->dev, addr)) != 0)
+      n++;
+  }
+  for(i = 0; i < n; i++)
+    bread_finish(b[i]);
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
@@ -530,7 +1089,8 @@ stati(struct inode *ip, struct stat *st)
 int
 readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 {
-  uint tot, m;
+  uint tot, m, nblocks, from, to;
+  int seq;
   struct buf *bp;
 
   if(off > ip->size || off + n < off)
@@ -538,12 +1098,37 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
   if(off + n > ip->size)
     n = ip->size - off;
 
+  if(ip->type == T_SYMLINK && (ip->flags & IF_INLINE)){
+    if(either_copyout(user_dst, dst, (char*)ip->addrs + off, n) == -1)
+      return -1;
+    return n;
+  }
+
+  // a read that starts where the last one stopped is sequential;
+  // keep RAWINDOW blocks ahead of it in the cache.
+  nblocks = (ip->size + BSIZE - 1) / BSIZE;
+  seq = off/BSIZE == ip->ranext || off/BSIZE + 1 == ip->ranext;
+  if(!seq)
+    ip->raend = 0;
+
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    uint addr = bmap(ip, off/BSIZE);
-    if(addr == 0)
-      break;
-    bp = bread(ip->dev, addr);
+    if(seq && off/BSIZE + RAWINDOW/2 >= ip->raend && ip->raend < nblocks){
+      from = ip->raend > off/BSIZE ? ip->raend : off/BSIZE;
+      to = min(from + RAWINDOW, nblocks);
+      readahead(ip, from, to);
+      ip->raend = to;
+    }
+    uint addr = bmap(ip, off/BSIZE, 0);
     m = min(n - tot, BSIZE - off%BSIZE);
+    if(addr == 0){
+      // a hole in a sparse file.
+      if(either_copyout(user_dst, dst, (void*)zeroes, m) == -1) {
+        tot = -1;
+        break;
+      }
+      continue;
+    }
+    bp = bread(ip->dev, addr);
     if(either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
       brelse(bp);
       tot = -1;
@@ -551,6 +1136,8 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
     }
     brelse(bp);
   }
+  if(tot > 0)
+    ip->ranext = (off - 1)/BSIZE + 1;
   return tot;
 }
 
@@ -567,13 +1154,30 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
   uint tot, m;
   struct buf *bp;
 
-  if(off > ip->size || off + n < off)
+  if(off + n < off)
+    return -1;
+  // writing past the end leaves a hole, except in directories,
+  // symlinks and extent files, which have none.
+  if(off > ip->size && (ip->type != T_FILE || (ip->flags & IF_EXTENT)))
     return -1;
   if(off + n > MAXFILE*BSIZE)
     return -1;
 
+  if(ip->type == T_SYMLINK)
+    dcchanged();
+  if(ip->type == T_SYMLINK && (ip->flags & IF_INLINE)){
+    if(off + n > sizeof(ip->addrs))
+      return -1;
+    if(either_copyin((char*)ip->addrs + off, user_src, src, n) == -1)
+      return -1;
+    if(off + n > ip->size)
+      ip->size = off + n;
+    iupdate(ip);
+    return n;
+  }
+
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    uint addr = bmap(ip, off/BSIZE);
+    uint addr = bmap(ip, off/BSIZE, 1);
     if(addr == 0)
       break;
     bp = bread(ip->dev, addr);
@@ -582,7 +1186,12 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
       brelse(bp);
       break;
     }
-    log_write(bp);
+    // file data is written back later; directories and
+    // symlinks are metadata and go through the log.
+    if(WRITEBEHIND && ip->type == T_FILE)
+      bdwrite(bp);
+    else
+      log_write(bp);
     brelse(bp);
   }
 
@@ -605,6 +1214,448 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Directory name cache: maps (directory, name) to the inum and
+// offset of its dirent, so that dirlookup() need not scan the
+// directory. inum 0 records that the name is absent. Entries
+// for a directory change only with the directory locked:
+// dirlookup() fills them in, dirlink() and sys_unlink() report
+// changes with dcenter(), and freeing a directory drops them
+// all with dcpurge(). Every change bumps gen, which the
+// symlink memo below depends on.
+#define NDCSET  32  // hash sets
+#define NDCWAY  4   // entries per set
+
+struct dentry {
+  uint dev;
+  uint dir;        // directory inum, 0 if unused
+  uint inum;       // 0 for a negative entry
+  uint off;        // offset of the dirent in dir
+  char name[DIRSIZ];
+};
+
+struct {
+  struct spinlock lock;
+  struct dentry set[NDCSET][NDCWAY];
+  uint hand[NDCSET];  // next way to replace
+  uint gen;           // count of directory changes
+} dcache;
+
+static void
+dcinit(void)
+{
+  initlock(&dcache.lock, "dcache");
+}
+
+static struct dentry*
+dcset(uint dev, uint dir, const char *name)
+{
+  uint h = dev * 31 + dir;
+
+  for(int i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 31 + (uchar)name[i];
+  return dcache.set[h % NDCSET];
+}
+
+// Look name up in dp in the cache.
+// Caller must hold dcache.lock.
+static struct dentry*
+dcfind(struct inode *dp, const char *name)
+{
+  struct dentry *d = dcset(dp->dev, dp->inum, name);
+
+  for(int i = 0; i < NDCWAY; i++, d++)
+    if(d->dir == dp->inum && d->dev == dp->dev && namecmp(d->name, name) == 0)
+      return d;
+  return 0;
+}
+
+// Record that name in dp has inum at offset off, or with
+// inum 0 that it is absent. Caller must hold dcache.lock.
+static void
+dcfill(struct inode *dp, char *name, uint inum, uint off)
+{
+  struct dentry *d, *set;
+  uint h;
+
+  if((d = dcfind(dp, name)) == 0){
+    set = dcset(dp->dev, dp->inum, name);
+    h = (set - dcache.set[0]) / NDCWAY;
+    d = &set[dcache.hand[h]];
+    dcache.hand[h] = (dcache.hand[h] + 1) % NDCWAY;
+    d->dev = dp->dev;
+    d->dir = dp->inum;
+    strncpy(d->name, name, DIRSIZ);
+  }
+  d->inum = inum;
+  d->off = off;
+}
+
+// Record a change to dp: name now has inum at offset off,
+// or with inum 0, it was removed. Caller must hold dp->lock.
+void
+dcenter(struct inode *dp, char *name, uint inum, uint off)
+{
+  acquire(&dcache.lock);
+  dcfill(dp, name, inum, off);
+  dcache.gen++;
+  release(&dcache.lock);
+}
+
+// A symlink remembers the inode its chain of links ended at,
+// if every target in the chain was an absolute path, so that
+// sys_open() can skip the walk next time. The memo holds
+// until any directory changes.
+
+// Return the inode the chain starting at symlink ip resolved
+// to, unlocked, or 0 if unknown.
+struct inode*
+symget(struct inode *ip)
+{
+  uint inum = 0;
+
+  acquire(&dcache.lock);
+  if(ip->syminum && ip->symgen == dcache.gen)
+    inum = ip->syminum;
+  release(&dcache.lock);
+  return inum ? iget(ip->dev, inum) : 0;
+}
+
+// Remember that the chain starting at symlink ip, walked
+// since directory generation gen, resolved to inum.
+void
+symset(struct inode *ip, uint gen, uint inum)
+{
+  acquire(&dcache.lock);
+  if(gen == dcache.gen){
+    ip->syminum = inum;
+    ip->symgen = gen;
+  }
+  release(&dcache.lock);
+}
+
+// A symlink's target was rewritten; forget all memos.
+static void
+dcchanged(void)
+{
+  acquire(&dcache.lock);
+  dcache.gen++;
+  release(&dcache.lock);
+}
+
+// The current directory generation, for symset().
+uint
+dcgen(void)
+{
+  uint gen;
+
+  acquire(&dcache.lock);
+  gen = dcache.gen;
+  release(&dcache.lock);
+  return gen;
+}
+
+// Drop every entry for directory dir, which is being freed.
+static void
+dcpurge(uint dev, uint dir)
+{
+  acquire(&dcache.lock);
+  for(int i = 0; i < NDCSET; i++)
+    for(int j = 0; j < NDCWAY; j++)
+      if(dcache.set[i][j].dir == dir && dcache.set[i][j].dev == dev)
+        dcache.set[i][j].dir = 0;
+  release(&dcache.lock);
+}
+
+// Hashed directories. A linear directory that fills DIRHASHMIN
+// blocks is rebuilt around an index block (struct dirhent in
+// fs.h), after which a lookup reads the index and one leaf, and
+// dirlink() splits a leaf in two when it fills. A name that
+// can't go in its leaf, because the index is full or the leaf
+// holds a single hash value, is spilled into any free slot and
+// the directory marked DH_OVERFLOW. Callers hold dp->lock.
+#define DPB        (BSIZE / sizeof(struct dirent))
+#define DIRHASHMAX (PGSIZE / BSIZE)  // most blocks dhconvert() rebuilds
+#define DHCONVBLOCKS (DIRHASHMAX + 4) // log blocks dhconvert() writes: dp's blocks, the bitmap, an indirect block, dp
+
+// Directories have no holes, so every block below size is mapped.
+static struct buf*
+dirbread(struct inode *dp, uint bn)
+{
+  return bread(dp->dev, bmap(dp, bn, 0));
+}
+
+// The index record for hash h.
+static int
+dhleaf(struct dirhent *x, uint h)
+{
+  int i;
+
+  for(i = x[0].nleaf; i > 1 && x[i].hash > h; i--)
+    ;
+  return i;
+}
+
+// Look for name in block bn of dp. Returns its inum and sets
+// *poff, or returns 0.
+static uint
+dirscan(struct inode *dp, uint bn, char *name, uint *poff)
+{
+  struct buf *bp;
+  struct dirent *de;
+  uint inum = 0;
+
+  bp = dirbread(dp, bn);
+  de = (struct dirent*)bp->data;
+  for(int i = 0; i < DPB; i++){
+    if(de[i].inum && namecmp(name, de[i].name) == 0){
+      inum = de[i].inum;
+      *poff = bn*BSIZE + i*sizeof(*de);
+      break;
+    }
+  }
+  brelse(bp);
+  return inum;
+}
+
+static uint
+dhlookup(struct inode *dp, char *name, uint *poff)
+{
+  struct buf *bp;
+  struct dirhent *x;
+  uint inum, leaf, bn;
+  int overflow;
+
+  bp = dirbread(dp, 0);
+  x = (struct dirhent*)bp->data;
+  if(x[0].hash != DIRHMAGIC)
+    panic("dhlookup: bad index");
+  leaf = x[dhleaf(x, dirhash(name))].block;
+  overflow = x[0].block & DH_OVERFLOW;
+  brelse(bp);
+
+  if((inum = dirscan(dp, leaf, name, poff)) != 0 || !overflow)
+    return inum;
+  for(bn = 1; bn < dp->size / BSIZE; bn++)
+    if(bn != leaf && (inum = dirscan(dp, bn, name, poff)) != 0)
+      return inum;
+  return 0;
+}
+
+// Find an empty block of dp that no index record names, or
+// append one if grow is set. Returns its block number, or -1.
+static int
+dhfree(struct inode *dp, struct dirhent *x, int grow)
+{
+  struct buf *bp;
+  struct dirent *de;
+  uint bn, nb = dp->size / BSIZE;
+  int i, used;
+
+  for(bn = 1; bn < nb; bn++){
+    for(i = 1; i <= x[0].nleaf && x[i].block != bn; i++)
+      ;
+    if(i <= x[0].nleaf)
+      continue;
+    bp = dirbread(dp, bn);
+    de = (struct dirent*)bp->data;
+    for(used = i = 0; i < DPB; i++)
+      used |= de[i].inum;
+    brelse(bp);
+    if(!used)
+      return bn;
+  }
+  if(!grow || bmap(dp, nb, 1) == 0)
+    return -1;
+  dp->size = (nb + 1) * BSIZE;
+  iupdate(dp);
+  return nb;
+}
+
+// Write (name, inum) into a free slot anywhere in dp, appending
+// a block if there is none, and mark dp DH_OVERFLOW. Returns the
+// entry's offset, or -1.
+static int
+dhspill(struct inode *dp, char *name, uint inum)
+{
+  struct buf *bp;
+  struct dirhent *x;
+  struct dirent *de;
+  uint bn, nb;
+  int i;
+
+  bp = dirbread(dp, 0);
+  x = (struct dirhent*)bp->data;
+  if((x[0].block & DH_OVERFLOW) == 0){
+    x[0].block |= DH_OVERFLOW;
+    log_write(bp);
+  }
+  brelse(bp);
+
+  nb = dp->size / BSIZE;
+  for(bn = 1; ; bn++){
+    if(bn == nb){
+      if(bmap(dp, nb, 1) == 0)
+        return -1;
+      dp->size = ++nb * BSIZE;
+      iupdate(dp);
+    }
+    bp = dirbread(dp, bn);
+    de = (struct dirent*)bp->data;
+    for(i = 0; i < DPB && de[i].inum; i++)
+      ;
+    if(i < DPB){
+      strncpy(de[i].name, name, DIRSIZ);
+      de[i].inum = inum;
+      log_write(bp);
+      brelse(bp);
+      return bn*BSIZE + i*sizeof(*de);
+    }
+    brelse(bp);
+  }
+}
+
+// Choose the hash at which to split the full leaf de, covering
+// [lo, hi) (or [lo, ~0] if last), so both halves keep entries:
+// the median hash of the entries in range, or the next larger
+// one if the median is the lowest. Returns 0 if they all
+// share one hash. Entries spilled in from other ranges stay.
+static uint
+dhsplit(struct dirent *de, uint lo, uint hi, int last)
+{
+  uint hs[DPB], h;
+  int i, j, n = 0;
+
+  for(i = 0; i < DPB; i++){
+    h = dirhash(de[i].name);
+    if(h < lo || (!last && h >= hi))
+      continue;
+    for(j = n++; j > 0 && hs[j-1] > h; j--)
+      hs[j] = hs[j-1];
+    hs[j] = h;
+  }
+  if(n < 2)
+    return 0;
+  for(i = n/2; i < n && hs[i] == hs[0]; i++)
+    ;
+  return i < n ? hs[i] : 0;
+}
+
+// Add (name, inum) to hashed directory dp. Returns the entry's
+// offset, or -1. Unless grow is set, a split only reuses empty
+// blocks, and a name spills if there are none.
+static int
+dhinsert(struct inode *dp, char *name, uint inum, int grow)
+{
+  struct buf *ib, *lb, *nb;
+  struct dirhent *x;
+  struct dirent *de, *nde;
+  uint h = dirhash(name), split, hi;
+  int i, j, k, bn, off;
+
+  for(;;){
+    ib = dirbread(dp, 0);
+    x = (struct dirhent*)ib->data;
+    i = dhleaf(x, h);
+    lb = dirbread(dp, x[i].block);
+    de = (struct dirent*)lb->data;
+    for(j = 0; j < DPB && de[j].inum; j++)
+      ;
+    if(j < DPB){
+      strncpy(de[j].name, name, DIRSIZ);
+      de[j].inum = inum;
+      log_write(lb);
+      off = x[i].block*BSIZE + j*sizeof(*de);
+      brelse(lb);
+      brelse(ib);
+      return off;
+    }
+
+    // The leaf is full: split it, or spill.
+    hi = i < x[0].nleaf ? x[i+1].hash : 0;
+    split = dhsplit(de, x[i].hash, hi, i == x[0].nleaf);
+    if(x[0].nleaf == NDIRHLEAF || split == 0 || (bn = dhfree(dp, x, grow)) < 0){
+      brelse(lb);
+      brelse(ib);
+      return dhspill(dp, name, inum);
+    }
+    nb = dirbread(dp, bn);
+    nde = (struct dirent*)nb->data;
+    for(j = k = 0; j < DPB; j++){
+      h = dirhash(de[j].name);
+      if(h >= split && (i == x[0].nleaf || h < hi)){
+        nde[k++] = de[j];
+        memset(&de[j], 0, sizeof(de[j]));
+      }
+    }
+    memmove(&x[i+2], &x[i+1], (x[0].nleaf - i) * sizeof(*x));
+    memset(&x[i+1], 0, sizeof(*x));
+    x[i+1].hash = split;
+    x[i+1].block = bn;
+    x[0].nleaf++;
+    log_write(nb);
+    log_write(lb);
+    log_write(ib);
+    brelse(nb);
+    brelse(lb);
+    brelse(ib);
+    // moved entries have new offsets.
+    dcpurge(dp->dev, dp->inum);
+    h = dirhash(name);
+  }
+}
+
+// Rebuild full linear directory dp, of at most DIRHASHMAX
+// blocks, as a hashed one. Returns -1, with dp unchanged, if
+// there is no room. It appends one block, for the index, and
+// the entries then go back into dp's blocks without any more
+// being appended, so the rebuild logs at most DHCONVBLOCKS
+// blocks.
+static int
+dhconvert(struct inode *dp)
+{
+  struct dirent *ents, *de;
+  struct dirhent *x;
+  struct buf *bp;
+  uint bn, nb = dp->size / BSIZE;
+  int i, n = 0;
+
+  // one block more than before, since the index takes one;
+  // the old blocks then hold every entry even if all spill.
+  if((ents = kalloc()) == 0)
+    return -1;
+  if(bmap(dp, nb, 1) == 0){
+    kfree(ents);
+    return -1;
+  }
+  for(bn = 0; bn < nb; bn++){
+    bp = dirbread(dp, bn);
+    de = (struct dirent*)bp->data;
+    for(i = 0; i < DPB; i++)
+      if(de[i].inum)
+        ents[n++] = de[i];
+    memset(bp->data, 0, BSIZE);
+    if(bn == 0){
+      x = (struct dirhent*)bp->data;
+      x[0].nleaf = 1;
+      x[0].hash = DIRHMAGIC;
+      x[1].hash = 0;
+      x[1].block = 1;
+    }
+    log_write(bp);
+    brelse(bp);
+  }
+  dp->size = (nb + 1) * BSIZE;
+  dp->flags |= IF_DIRHASH;
+  iupdate(dp);
+  dcpurge(dp->dev, dp->inum);
+
+  for(i = 0; i < n; i++)
+    if(dhinsert(dp, ents[i].name, ents[i].inum, 0) < 0)
+      panic("dhconvert");
+  kfree(ents);
+  return 0;
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 struct inode*
@@ -613,10 +1664,38 @@ dirlookup(struct inode *dp, char *name, uint *poff)
   uint off, inum;
   struct dirent de;
 
+  struct dentry *d;
+
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
-  for(off = 0; off < dp->size; off += sizeof(de)){
+  acquire(&dcache.lock);
+  if((d = dcfind(dp, name)) != 0){
+    inum = d->inum;
+    off = d->off;
+    release(&dcache.lock);
+    if(inum == 0)
+      return 0;
+    if(poff)
+      *poff = off;
+    return iget(dp->dev, inum);
+  }
+  release(&dcache.lock);
+
+  off = 0;
+  if(dp->flags & IF_DIRHASH){
+    if((inum = dhlookup(dp, name, &off)) != 0){
+      if(poff)
+        *poff = off;
+      acquire(&dcache.lock);
+      dcfill(dp, name, inum, off);
+      release(&dcache.lock);
+      return iget(dp->dev, inum);
+    }
+    off = dp->size;
+  }
+
+  for(; off < dp->size; off += sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
       panic("dirlookup read");
     if(de.inum == 0)
@@ -626,10 +1705,16 @@ dirlookup(struct inode *dp, char *name, uint *poff)
       if(poff)
         *poff = off;
       inum = de.inum;
+      acquire(&dcache.lock);
+      dcfill(dp, name, inum, off);
+      release(&dcache.lock);
       return iget(dp->dev, inum);
     }
   }
 
+  acquire(&dcache.lock);
+  dcfill(dp, name, 0, 0);
+  release(&dcache.lock);
   return 0;
 }
 
@@ -648,6 +1733,9 @@ dirlink(struct inode *dp, char *name, uint inum)
     return -1;
   }
 
+  if(dp->flags & IF_DIRHASH)
+    goto hashed;
+
   // Look for an empty dirent.
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
@@ -656,12 +1744,28 @@ dirlink(struct inode *dp, char *name, uint inum)
       break;
   }
 
+  // A full directory that is about to grow a block gets an index,
+  // if the operation has log space for the rebuild as well as
+  // for the rest of itself; see LINKBLOCKS.
+  if(off == dp->size && off % BSIZE == 0 &&
+     off >= DIRHASHMIN*BSIZE && off <= DIRHASHMAX*BSIZE &&
+     myproc()->logres >= DHCONVBLOCKS + MAXOPBLOCKS &&
+     dhconvert(dp) == 0)
+    goto hashed;
+
   strncpy(de.name, name, DIRSIZ);
   de.inum = inum;
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     return -1;
+  dcenter(dp, name, inum, off);
 
   return 0;
+
+ hashed:
+  if((off = dhinsert(dp, name, inum, 1)) < 0)
+    return -1;
+  dcenter(dp, name, inum, off);
+  return 0;
 }
 
 // Paths
@@ -32,7 +32,10 @@ struct superblock {
 struct dinode {
   short type;           // File type
   short major;          // Major device number (T_DEVICE only)
-  short minor;          // Minor device number (T_DEVICE only)
+  union {
+    short minor;        // Minor device number (T_DEVICE only)
+    short flags;        // IF_ flags (other types)
+  };
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
   uint addrs[NDIRECT+2];   // Attention!! It was initially NDIRECT+1, and it seems like I did not respect
@@ -42,6 +45,22 @@ struct dinode {
 							// so sizeof(addrs)= ndirect' + 1 = ndirect+1 + 1= ndirect + 2 ) 
 };
 
+// Inode flags.
+#define IF_EXTENT 0x1   // addrs[] holds extents instead of block numbers
+#define IF_INLINE 0x2   // addrs[] holds the contents (short symlinks)
+#define IF_DIRHASH 0x4  // directory is hash-indexed, see struct dirhent
+
+// Extent inodes map their blocks as runs of contiguous disk
+// blocks. addrs[] holds NEXTENT (start, length) pairs, and
+// addrs[NDIRECT+1] names a block of NEXTENTBLK more. The runs
+// cover the file's blocks in order, without holes.
+struct extent {
+  uint start;  // first disk block
+  uint len;    // number of blocks, 0 if unused
+};
+#define NEXTENT ((NDIRECT+1)/2)
+#define NEXTENTBLK (BSIZE / sizeof(struct extent))
+
 // Inodes per block.
 #define IPB           (BSIZE / sizeof(struct dinode))
 
@@ -62,3 +81,35 @@ struct dirent {
   char name[DIRSIZ];
 };
 
+// A hashed directory's block 0 is an index of dirhent records,
+// each the size of a dirent and with 0 where a dirent has its
+// inum, so programs reading the directory as dirents skip them.
+// Record 0 is a header. Records 1..nleaf map hash ranges to
+// leaf blocks, sorted by hash: a name whose dirhash() is at
+// least hash[i] but below hash[i+1] lives in leaf block[i].
+// Leaves are ordinary blocks of dirents. With DH_OVERFLOW set,
+// some names live outside their leaf and lookups that miss in
+// the leaf must scan the rest of the directory.
+struct dirhent {
+  ushort zero;     // always 0
+  ushort nleaf;    // header: number of leaf records
+  uint hash;       // lowest hash in the leaf; header: DIRHMAGIC
+  uint block;      // leaf's block in the directory; header: DH_ flags
+  uint pad;
+};
+#define DIRHMAGIC   0x48524944
+#define DH_OVERFLOW 0x1
+#define NDIRHLEAF   (BSIZE / sizeof(struct dirhent) - 1)
+#define DIRHASHMIN  2   // blocks a linear directory fills before it is indexed
+
+// FNV-1a hash of a directory entry name.
+static inline uint
+dirhash(const char *name)
+{
+  uint h = 2166136261u;
+
+  for(int i = 0; i < DIRSIZ && name[i]; i++)
+    h = (h ^ (uchar)name[i]) * 16777619u;
+  return h;
+}
+
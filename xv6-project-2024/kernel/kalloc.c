@@ -8,6 +8,7 @@
 #include "spinlock.h"
 #include "riscv.h"
 #include "defs.h"
+#include "kstat.h"
 
 void freerange(void *pa_start, void *pa_end);
 
@@ -18,15 +19,41 @@ struct run {
   struct run *next;
 };
 
-struct {
+// Each CPU has its own free list and lock, so that kalloc() and
+// kfree() on different CPUs don't contend. A CPU whose list runs
+// dry steals a batch of KSTEAL pages from another CPU's list.
+#define KSTEAL 32
+
+// Each CPU also keeps up to NZERO pages that its idle loop has
+// already zeroed, for kalloc_zeroed(). They still count as free:
+// kalloc() falls back on them when the free lists run dry.
+#define NZERO 64
+
+struct kmem {
   struct spinlock lock;
   struct run *freelist;
-} kmem;
+  struct run *zerolist;  // zeroed pages, but for run.next
+  int nzero;             // length of zerolist
+  uint nsteal;   // number of times this CPU stole from another
+  uint nstolen;  // pages taken from other CPUs
+};
+
+struct kmem kmem[NCPU];
+
+// Reference counts for physical pages, so that copy-on-write
+// fork can share a page between page tables. A page goes back
+// on a free list only when its count drops to zero.
+// Updated with atomic instructions rather than a lock.
+#define PA2REF(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+int kref[PA2REF(PHYSTOP)];
 
 void
 kinit()
 {
-  initlock(&kmem.lock, "kmem");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&kmem[i].lock, "kmem");
+  // all pages start on the booting CPU's list; the
+  // others steal what they need.
   freerange(end, (void*)PHYSTOP);
 }
 
@@ -35,31 +62,102 @@ freerange(void *pa_start, void *pa_end)
 {
   char *p;
   p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
+  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE){
+    kref[PA2REF(p)] = 1;
     kfree(p);
+  }
 }
 
-// Free the page of physical memory pointed at by pa,
+// Drop a reference to the page of physical memory pointed at by pa,
 // which normally should have been returned by a
 // call to kalloc().  (The exception is when
 // initializing the allocator; see kinit above.)
+// The page is freed when the last reference goes away.
 void
 kfree(void *pa)
 {
   struct run *r;
+  struct kmem *km;
+  int ref;
 
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  if((ref = __sync_sub_and_fetch(&kref[PA2REF(pa)], 1)) > 0)
+    return;
+  if(ref < 0)
+    panic("kfree: ref");
+
+  kstatadd(KS_KFREE, 1);
+
+#if KJUNK
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
+#endif
 
   r = (struct run*)pa;
 
-  acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  release(&kmem.lock);
+  push_off();
+  km = &kmem[cpuid()];
+  acquire(&km->lock);
+  r->next = km->freelist;
+  km->freelist = r;
+  release(&km->lock);
+  pop_off();
+}
+
+// Move up to KSTEAL pages from some other CPU's free list
+// to CPU id's list, and return one of them.
+// Returns 0 if every list is empty.
+// Interrupts must be disabled.
+static struct run*
+ksteal(int id)
+{
+  struct run *r, *first, *last;
+  int i, n;
+
+  first = last = 0;
+  n = 0;
+  for(i = (id + 1) % NCPU; i != id && n == 0; i = (i + 1) % NCPU){
+    acquire(&kmem[i].lock);
+    while(n < KSTEAL && (r = kmem[i].freelist) != 0){
+      kmem[i].freelist = r->next;
+      r->next = first;
+      if(first == 0)
+        last = r;
+      first = r;
+      n++;
+    }
+    release(&kmem[i].lock);
+  }
+  if(first == 0)
+    return 0;
+
+  // keep the first page for the caller, the rest go on our list.
+  acquire(&kmem[id].lock);
+  if(first != last){
+    last->next = kmem[id].freelist;
+    kmem[id].freelist = first->next;
+  }
+  kmem[id].nsteal++;
+  kmem[id].nstolen += n;
+  release(&kmem[id].lock);
+  return first;
+}
+
+// Take a pre-zeroed page off CPU id's zero list, or return 0.
+static struct run*
+kzeropop(int id)
+{
+  struct run *r;
+
+  acquire(&kmem[id].lock);
+  if((r = kmem[id].zerolist) != 0){
+    kmem[id].zerolist = r->next;
+    kmem[id].nzero--;
+  }
+  release(&kmem[id].lock);
+  return r;
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -69,14 +167,123 @@ void *
 kalloc(void)
 {
   struct run *r;
+  struct kmem *km;
+  int id, i;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
+  push_off();
+  id = cpuid();
+  km = &kmem[id];
+  acquire(&km->lock);
+  r = km->freelist;
   if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
+    km->freelist = r->next;
+  release(&km->lock);
+  if(r == 0)
+    r = ksteal(id);
+  for(i = 0; r == 0 && i < NCPU; i++)
+    r = kzeropop((id + i) % NCPU);
+  pop_off();
 
-  if(r)
+  if(r){
+    kref[PA2REF(r)] = 1;
+    kstatadd(KS_KALLOC, 1);
+#if KJUNK
     memset((char*)r, 5, PGSIZE); // fill with junk
+#endif
+  }
+  return (void*)r;
+}
+
+// Allocate a page of zeroed physical memory, from this CPU's
+// pool of pages zeroed while idle if it has one, so that page
+// tables and fresh user pages skip the memset on the fork,
+// exec and sbrk paths.
+// Returns 0 if the memory cannot be allocated.
+void *
+kalloc_zeroed(void)
+{
+  struct run *r;
+
+  push_off();
+  r = kzeropop(cpuid());
+  pop_off();
+
+  if(r == 0){
+    if((r = kalloc()) != 0)
+      memset((char*)r, 0, PGSIZE);
+    return (void*)r;
+  }
+  r->next = 0;
+  kref[PA2REF(r)] = 1;
+  kstatadd(KS_KALLOC, 1);
   return (void*)r;
 }
+
+// Zero one free page onto this CPU's zero list, unless the list
+// is full or there are no free pages. Called by an idle
+// scheduler(); returns 1 if it did any work.
+int
+kzerofill(void)
+{
+  struct run *r;
+  struct kmem *km;
+
+  push_off();
+  km = &kmem[cpuid()];
+  acquire(&km->lock);
+  if(km->nzero >= NZERO || (r = km->freelist) == 0){
+    release(&km->lock);
+    pop_off();
+    return 0;
+  }
+  km->freelist = r->next;
+  release(&km->lock);
+
+  memset((char*)r, 0, PGSIZE);
+
+  acquire(&km->lock);
+  r->next = km->zerolist;
+  km->zerolist = r;
+  km->nzero++;
+  release(&km->lock);
+  pop_off();
+  return 1;
+}
+
+// Add a reference to an allocated page, e.g. when
+// uvmcopy() shares it copy-on-write with a child.
+void
+krefinc(void *pa)
+{
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("krefinc");
+  if(__sync_fetch_and_add(&kref[PA2REF(pa)], 1) < 1)
+    panic("krefinc: free page");
+}
+
+// Return the number of references to page pa.
+int
+krefcnt(void *pa)
+{
+  return kref[PA2REF(pa)];
+}
+
+// Print per-CPU allocator statistics to the console.
+// Runs when user types ^P on console, like procdump().
+void
+kmemdump(void)
+{
+  struct run *r;
+  int i, nfree;
+
+  for(i = 0; i < NCPU; i++){
+    nfree = 0;
+    acquire(&kmem[i].lock);
+    for(r = kmem[i].freelist; r; r = r->next)
+      nfree++;
+    printf("kmem %d: free %d zeroed %d steals %d stolen %d acquires %d spins %d\n",
+           i, nfree, kmem[i].nzero, kmem[i].nsteal, kmem[i].nstolen,
+           kmem[i].lock.n, kmem[i].lock.nts);
+    release(&kmem[i].lock);
+  }
+}
@@ -0,0 +1,52 @@
+// Kernel performance counters.
+//
+// Each CPU has its own row of counters that only it updates,
+// with interrupts off, so counting takes no lock and no
+// atomic instruction. kstatread() sums the rows; a total may
+// be a few counts stale, which is fine for profiling.
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "defs.h"
+#include "kstat.h"
+
+struct {
+  uint64 c[NKSTAT];
+} __attribute__((aligned(64))) kstats[NCPU];
+
+// Add n to counter i of this CPU.
+void
+kstatadd(int i, uint64 n)
+{
+  push_off();
+  kstats[cpuid()].c[i] += n;
+  pop_off();
+}
+
+// Read the counter totals, at most n bytes of them.
+static int
+kstatread(int user_dst, uint64 dst, int n)
+{
+  uint64 tot[NKSTAT];
+
+  memset(tot, 0, sizeof(tot));
+  for(int c = 0; c < NCPU; c++)
+    for(int i = 0; i < NKSTAT; i++)
+      tot[i] += kstats[c].c[i];
+  if(n > sizeof(tot))
+    n = sizeof(tot);
+  if(either_copyout(user_dst, dst, tot, n) == -1)
+    return -1;
+  return n;
+}
+
+void
+kstatinit(void)
+{
+  devsw[KSTAT].read = kstatread;
+}
@@ -0,0 +1,20 @@
+// Kernel performance counters. A read of the kstat device
+// (major KSTAT) returns NKSTAT uint64 totals, summed over
+// all CPUs, in this order.
+enum {
+  KS_SYSCALL,    // system calls
+  KS_SWTCH,      // scheduler switches to a process
+  KS_PGFAULT,    // user page faults handled
+  KS_KALLOC,     // pages allocated
+  KS_KFREE,      // pages freed
+  KS_BGET_HIT,   // buffer cache hits
+  KS_BGET_MISS,  // buffer cache misses
+  KS_COMMIT,     // log commits
+  KS_SPIN,       // spin iterations waiting for a spinlock
+  NKSTAT
+};
+
+#define KSTAT_NAMES { \
+  "syscall", "swtch", "pgfault", "kalloc", "kfree", \
+  "bget_hit", "bget_miss", "commit", "spin", \
+}
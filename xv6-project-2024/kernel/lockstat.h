@@ -0,0 +1,10 @@
+// Contention statistics of the spinlocks with one name,
+// as returned by the lockstat() system call.
+#define NLOCKSTAT 64   // distinct lock names tracked
+
+struct lockstat {
+  char name[16];
+  uint64 nacquire;  // acquire() calls
+  uint64 ncontend;  // acquire() calls that had to spin
+  uint64 cycles;    // r_time() units spent spinning
+};
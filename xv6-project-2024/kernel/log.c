@@ -6,6 +6,9 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "file.h"
+#include "proc.h"
+#include "kstat.h"
 
 // Simple logging that allows concurrent FS system calls.
 //
@@ -20,6 +23,30 @@
 // the count of in-progress FS system calls and returns.
 // But if it thinks the log is close to running out, it
 // sleeps until the last outstanding end_op() commits.
+// begin_op() reserves MAXOPBLOCKS of log space; a call that
+// knows it needs more, such as a large write(), or less, such
+// as close() or unlink(), reserves its own amount with
+// begin_opn(). Each block an operation adds to the log moves
+// from its reservation to log.lh.n, so the log only waits for
+// space that the outstanding operations may still need. An
+// operation with less than MAXOPBLOCKS of its reservation left
+// can't free a file: its iput() leaves that to end_op(), which
+// frees the inode in a transaction of its own; after a crash
+// in between, fsinit() frees it.
+//
+// The last end_op() of a transaction may wait up to LOGWINDOW
+// ticks for more system calls to join it before committing,
+// so that bursts of small operations share one commit.
+//
+// Committing is double-buffered. Only the first phase, which
+// copies the transaction to the on-disk log and writes the
+// header, keeps new system calls out. The second phase, which
+// installs the committed blocks at their home locations, runs
+// while the next transaction accumulates; that transaction's
+// commit waits until the install is done and the on-disk log
+// is free again. Installs are written from the log copies, not
+// from the cache, because the cached blocks may already hold
+// changes of the next, uncommitted transaction.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
@@ -28,7 +55,21 @@
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// Log appends are synchronous as a whole, but write_log() and
+// install_trans() start all of a transaction's block writes
+// before waiting for any of them, so the disk sees the batch.
+// commit() sorts a transaction by home block number, so the log
+// and the runs of adjacent home blocks each go to the disk as
+// a few multi-block requests rather than one per block.
+//
+// With WRITEBEHIND, the data blocks of regular files bypass the
+// log: writei() leaves them dirty in the cache with bdwrite(),
+// and bflush() writes them out later, once for any number of
+// overwrites. A crash may then lose file data that the metadata
+// already points to, but never corrupts the file system.
+// log_force() and bflush(1), which sync() and fsync() call, are
+// the durability points. bflush() leaves out buffers the log
+// has pinned, so sync() flushes again after log_force().
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
@@ -42,14 +83,24 @@ struct log {
   int start;
   int size;
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int reserved;    // log blocks reserved by the outstanding calls.
+  int committing;  // writing the log in commit(), please wait.
+  int installing;  // installing clh; its log space is still in use.
+  uint seq;        // sequence number of the transaction in lh.
+  uint cseq;       // sequence number of the transaction in clh.
+  uint done;       // last sequence number whose header is on disk.
   int dev;
-  struct logheader lh;
+  struct logheader lh;       // transaction being built
+  struct buf *lhbuf[LOGSIZE]; // pinned cache buffers of lh's blocks
+  struct logheader clh;      // committed transaction being installed
+  struct buf *clhbuf[LOGSIZE];
+  struct buf *io[LOGSIZE]; // commit()'s buffers with writes in flight
 };
 struct log log;
 
 static void recover_from_log(void);
 static void commit();
+static void writeruns(struct buf **, int *, int);
 
 void
 initlog(int dev, struct superblock *sb)
@@ -61,12 +112,15 @@ initlog(int dev, struct superblock *sb)
   log.start = sb->logstart;
   log.size = sb->nlog;
   log.dev = dev;
+  log.seq = 1;
+  log.done = 0;
   recover_from_log();
 }
 
-// Copy committed blocks from log to their home location
+// Copy committed blocks from log to their home location.
+// Only used by recovery, before anything is cached.
 static void
-install_trans(int recovering)
+install_trans(void)
 {
   int tail;
 
@@ -74,11 +128,64 @@ install_trans(int recovering)
     struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
     struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
     memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    if(recovering == 0)
-      bunpin(dbuf);
     brelse(lbuf);
-    brelse(dbuf);
+    log.io[tail] = dbuf;
+  }
+  writeruns(log.io, log.lh.block, log.lh.n);  // start writing dsts to disk
+  for (tail = 0; tail < log.lh.n; tail++) {
+    bwait(log.io[tail]);
+    brelse(log.io[tail]);
+  }
+}
+
+// Write the committed transaction clh from the log blocks
+// to the blocks' home locations, leaving the cache alone,
+// then unpin the cached copies.
+static void
+install_committed(void)
+{
+  int tail;
+
+  for (tail = 0; tail < log.clh.n; tail++)
+    log.io[tail] = bread(log.dev, log.start+tail+1); // read log block
+  writeruns(log.io, log.clh.block, log.clh.n);  // start writing them home
+  for (tail = 0; tail < log.clh.n; tail++) {
+    bwait(log.io[tail]);
+    brelse(log.io[tail]);
+    bunpin(log.clhbuf[tail]);
+  }
+}
+
+// Start writing each bs[i] to block[i], one disk request per
+// run of adjacent block numbers. Finish with bwait() on each.
+static void
+writeruns(struct buf **bs, int *block, int n)
+{
+  int i, j;
+
+  for (i = 0; i < n; i = j) {
+    for (j = i + 1; j < n && block[j] == block[j-1] + 1; j++)
+      ;
+    bwrite_run(bs + i, j - i, block[i]);
+  }
+}
+
+// Sort clh and its pinned buffers by home block number.
+static void
+sort_committed(void)
+{
+  int i, j, b;
+  struct buf *bp;
+
+  for (i = 1; i < log.clh.n; i++) {
+    b = log.clh.block[i];
+    bp = log.clhbuf[i];
+    for (j = i; j > 0 && log.clh.block[j-1] > b; j--) {
+      log.clh.block[j] = log.clh.block[j-1];
+      log.clhbuf[j] = log.clhbuf[j-1];
+    }
+    log.clh.block[j] = b;
+    log.clhbuf[j] = bp;
   }
 }
 
@@ -96,18 +203,18 @@ read_head(void)
   brelse(buf);
 }
 
-// Write in-memory log header to disk.
+// Write log header lh to disk.
 // This is the true point at which the
 // current transaction commits.
 static void
-write_head(void)
+write_head(struct logheader *lh)
 {
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+  hb->n = lh->n;
+  for (i = 0; i < lh->n; i++) {
+    hb->block[i] = lh->block[i];
   }
   bwrite(buf);
   brelse(buf);
@@ -117,61 +224,143 @@ static void
 recover_from_log(void)
 {
   read_head();
-  install_trans(1); // if committed, copy from log to disk
+  install_trans(); // if committed, copy from log to disk
   log.lh.n = 0;
-  write_head(); // clear the log
+  write_head(&log.lh); // clear the log
 }
 
-// called at the start of each FS system call.
+// called at the start of each FS system call that writes
+// at most n blocks.
 void
-begin_op(void)
+begin_opn(int n)
 {
+  if(n > LOGSIZE)
+    panic("begin_opn: too big");
   acquire(&log.lock);
   while(1){
     if(log.committing){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    } else if(log.lh.n + log.reserved + n > LOGSIZE){
       // this op might exhaust log space; wait for commit.
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
+      log.reserved += n;
+      myproc()->logres = n;
       release(&log.lock);
       break;
     }
   }
 }
 
-// called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// called at the start of each FS system call.
 void
-end_op(void)
+begin_op(void)
 {
-  int do_commit = 0;
+  begin_opn(MAXOPBLOCKS);
+}
+
+// leave the transaction, committing it if this was the last
+// outstanding operation.
+static void
+leave_op(void)
+{
+  uint seq, deadline;
+
+  // write-behind data has piled up; write some of it out.
+  // this takes no log space and holds no buffers, so it may
+  // run before the operation leaves the transaction.
+  if(WRITEBEHIND && bdirty() > DIRTYMAX)
+    bflush(0);
 
   acquire(&log.lock);
   log.outstanding -= 1;
+  log.reserved -= myproc()->logres;
+  myproc()->logres = 0;
   if(log.committing)
     panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
-  } else {
+  if(log.outstanding > 0){
     // begin_op() may be waiting for log space,
     // and decrementing log.outstanding has decreased
     // the amount of reserved space.
     wakeup(&log);
+    release(&log.lock);
+    return;
   }
-  release(&log.lock);
 
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
+  // This was the last operation. Hold the transaction open
+  // for the batching window, and until the previous commit's
+  // install has freed the on-disk log. If another operation
+  // joins meanwhile, the last of those commits instead.
+  seq = log.seq;
+  deadline = tickcount() + LOGWINDOW;
+  wakeup(&log);  // begin_op() may be waiting for the space we freed
+  while(log.outstanding == 0 && log.seq == seq &&
+        (int)(deadline - tickcount()) > 0 &&
+        log.lh.n + MAXOPBLOCKS <= LOGSIZE)
+    sleeptimed(&log, &log.lock, deadline);
+  while(log.installing && log.outstanding == 0 && log.seq == seq)
+    sleep(&log, &log.lock);
+  if(log.outstanding > 0 || log.seq != seq){
     release(&log.lock);
+    return;
   }
+
+  // call commit w/o holding locks, since not allowed
+  // to sleep with locks.
+  log.committing = 1;
+  log.cseq = log.seq;
+  log.seq++;
+  log.clh = log.lh;
+  memmove(log.clhbuf, log.lhbuf, sizeof(log.lhbuf));
+  log.lh.n = 0;
+  release(&log.lock);
+
+  commit();
+}
+
+// called at the end of each FS system call.
+void
+end_op(void)
+{
+  struct proc *p = myproc();
+  struct inode *ip;
+
+  leave_op();
+
+  // free the inodes whose last iput() left them to us: first
+  // their blocks, a bounded transaction at a time, and then,
+  // with nothing left to truncate, the inodes themselves.
+  while((ip = p->ifree) != 0){
+    p->ifree = ip->freenext;
+    ip->freenext = 0;
+    itruncsteps(ip);
+    begin_op();
+    iput(ip);
+    leave_op();
+  }
+}
+
+// Wait until every FS operation that has finished so far is
+// committed to disk. Joins the current transaction and, as
+// its last operation or behind the one that is, waits for
+// its header to be written and its blocks installed, so that
+// none of them is pinned any more.
+void
+log_force(void)
+{
+  uint seq;
+
+  begin_opn(0);
+  acquire(&log.lock);
+  seq = log.seq;
+  release(&log.lock);
+  end_op();
+
+  acquire(&log.lock);
+  while((int)(log.done - seq) < 0 || (log.installing && log.cseq == seq))
+    sleep(&log, &log.lock);
+  release(&log.lock);
 }
 
 // Copy modified blocks from cache to log.
@@ -180,26 +369,49 @@ write_log(void)
 {
   int tail;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
+  for (tail = 0; tail < log.clh.n; tail++) {
     struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
+    struct buf *from = bread(log.dev, log.clh.block[tail]); // cache block
     memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
     brelse(from);
-    brelse(to);
+    log.io[tail] = to;
+  }
+  bwrite_run(log.io, log.clh.n, log.start+1);  // start writing the log
+  for (tail = 0; tail < log.clh.n; tail++) {
+    bwait(log.io[tail]);
+    brelse(log.io[tail]);
   }
 }
 
+// Commit the transaction that end_op() moved to clh.
 static void
 commit()
 {
-  if (log.lh.n > 0) {
+  kstatadd(KS_COMMIT, 1);
+  if (log.clh.n > 0) {
+    sort_committed(); // Order by home block so installs coalesce
     write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(0); // Now install writes to home locations
-    log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+    write_head(&log.clh);    // Write header to disk -- the real commit
+  }
+
+  // Let the next transaction start while this one installs.
+  acquire(&log.lock);
+  log.committing = 0;
+  log.done = log.cseq;
+  log.installing = 1;
+  wakeup(&log);
+  release(&log.lock);
+
+  if (log.clh.n > 0) {
+    install_committed(); // Now install writes to home locations
+    log.clh.n = 0;
+    write_head(&log.clh);    // Erase the transaction from the log
   }
+
+  acquire(&log.lock);
+  log.installing = 0;
+  wakeup(&log);
+  release(&log.lock);
 }
 
 // Caller has modified b->data and is done with the buffer.
@@ -226,11 +438,16 @@ log_write(struct buf *b)
     if (log.lh.block[i] == b->blockno)   // log absorption
       break;
   }
+  bclean(b);  // the log writes it now, with the transaction
   log.lh.block[i] = b->blockno;
   if (i == log.lh.n) {  // Add new block to log?
     bpin(b);
+    log.lhbuf[i] = b;
     log.lh.n++;
+    if (myproc()->logres > 0) {  // it is no longer just reserved
+      myproc()->logres--;
+      log.reserved--;
+    }
   }
   release(&log.lock);
 }
-
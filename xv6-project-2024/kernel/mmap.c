@@ -0,0 +1,302 @@
+// Memory-mapped regions: mmap() and munmap().
+//
+// A process's regions are placed downwards from TRAPFRAME, and
+// the heap may grow up to the lowest one. Nothing is mapped up
+// front: lazyalloc() calls vmafault() on first touch, which
+// zero-fills anonymous pages and reads file pages with readi().
+//
+// MAP_SHARED pages stay shared with fork()ed children rather
+// than becoming copy-on-write; fork() first faults in the ones
+// never touched, so that parent and child map the same pages. A shared file page is mapped
+// read-only until the first store, which makes it writable and
+// marks it PTE_DIRTY; munmap() and exit() write dirty pages back
+// through the buffer cache. File mappings are per-process
+// copies of the file's blocks: two processes that mmap() the
+// same file separately see each other's stores only once they
+// are written back.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "proc.h"
+#include "fcntl.h"
+#include "defs.h"
+
+// Return p's region that contains va, or 0.
+struct vma*
+vmafind(struct proc *p, uint64 va)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->len && va >= v->va && va < v->va + v->len)
+      return v;
+  return 0;
+}
+
+// Return the lowest address mapped by any of p's regions,
+// or TRAPFRAME if there are none.
+uint64
+vmabase(struct proc *p)
+{
+  struct vma *v;
+  uint64 base = TRAPFRAME;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->len && v->va < base)
+      base = v->va;
+  return base;
+}
+
+// PTE permissions for region v. RISC-V requires R with W.
+static int
+vmaperm(struct vma *v)
+{
+  int perm = PTE_U | PTE_R;
+
+  if(v->prot & PROT_WRITE)
+    perm |= PTE_W;
+  if(v->prot & PROT_EXEC)
+    perm |= PTE_X;
+  return perm;
+}
+
+// Map len bytes of f at offset off, or anonymous memory if f
+// is 0, into the current process.
+// Returns the address, or -1.
+uint64
+mmap(uint64 len, int prot, int flags, struct file *f, uint off)
+{
+  struct proc *p = myproc();
+  struct vma *v, *nv;
+  uint64 va;
+  int share;
+
+  share = flags & (MAP_SHARED|MAP_PRIVATE);
+  if(len == 0 || (prot & (PROT_READ|PROT_WRITE|PROT_EXEC)) == 0 ||
+     (share != MAP_SHARED && share != MAP_PRIVATE) || off % PGSIZE != 0)
+    return -1;
+  if(f){
+    if(f->type != FD_INODE || !f->readable)
+      return -1;
+    if((prot & PROT_WRITE) && share == MAP_SHARED && !f->writable)
+      return -1;
+  }
+
+  nv = 0;
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->len == 0){
+      nv = v;
+      break;
+    }
+  }
+  len = PGROUNDUP(len);
+  if(nv == 0 || len > vmabase(p))
+    return -1;
+  va = vmabase(p) - len;
+  if(va < PGROUNDUP(p->sz))
+    return -1;
+
+  nv->va = va;
+  nv->len = len;
+  nv->prot = prot;
+  nv->flags = flags;
+  nv->f = f ? filedup(f) : 0;
+  nv->off = off;
+  return va;
+}
+
+// Fill in and map the page at page-aligned va of p's region v.
+// May sleep reading the file.
+// Returns 0 on success, -1 on failure.
+int
+vmafault(struct proc *p, struct vma *v, uint64 va)
+{
+  char *mem;
+  int perm;
+
+  if((mem = kalloc_zeroed()) == 0)
+    return -1;
+  perm = vmaperm(v);
+  if(v->f){
+    ilock(v->f->ip);
+    if(readi(v->f->ip, 0, (uint64)mem, v->off + (va - v->va), PGSIZE) < 0){
+      iunlock(v->f->ip);
+      kfree(mem);
+      return -1;
+    }
+    iunlock(v->f->ip);
+    // catch the first store, see vmawrite().
+    if(v->flags & MAP_SHARED)
+      perm &= ~PTE_W;
+  }
+  if(mappages(p->pagetable, va, PGSIZE, (uint64)mem, perm) != 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// Handle a store to the resident read-only page at va, whose
+// PTE is *pte: allowed, and noted for write-back, if the page
+// belongs to a writable MAP_SHARED file region.
+// Returns 0 if the store may go ahead, -1 otherwise.
+int
+vmawrite(pagetable_t pagetable, uint64 va, pte_t *pte)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+
+  if(p == 0 || p->pagetable != pagetable || (v = vmafind(p, va)) == 0)
+    return -1;
+  if(v->f == 0 || (v->flags & MAP_SHARED) == 0 || (v->prot & PROT_WRITE) == 0)
+    return -1;
+  *pte |= PTE_W | PTE_DIRTY;
+  return 0;
+}
+
+// Write the dirty page pa at va of region v back to its file.
+// Only the part within the file's current size is written.
+static void
+vmawriteback(struct vma *v, uint64 va, uint64 pa)
+{
+  struct inode *ip = v->f->ip;
+  uint off, n;
+
+  off = v->off + (va - v->va);
+  begin_op();
+  ilock(ip);
+  if(off < ip->size){
+    n = ip->size - off < PGSIZE ? ip->size - off : PGSIZE;
+    writei(ip, 0, pa, off, n);
+  }
+  iunlock(ip);
+  end_op();
+}
+
+// Write back and unmap the pages of [va, va+len) in p's region v.
+static void
+vmaunmap(struct proc *p, struct vma *v, uint64 va, uint64 len)
+{
+  uint64 a;
+  pte_t *pte;
+
+  for(a = va; v->f && a < va + len; a += PGSIZE){
+    if((pte = walk(p->pagetable, a, 0)) != 0 && (*pte & PTE_V) &&
+       (*pte & PTE_DIRTY))
+      vmawriteback(v, a, PTE2PA(*pte));
+  }
+  uvmunmap(p->pagetable, va, len / PGSIZE, 1);
+}
+
+// Unmap [va, va+len) from the current process. The range must
+// be the whole of a region, or its start or its end.
+// Returns 0 on success, -1 on failure.
+int
+munmap(uint64 va, uint64 len)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+
+  len = PGROUNDUP(len);
+  if(va % PGSIZE != 0 || len == 0 || (v = vmafind(p, va)) == 0)
+    return -1;
+  if(va + len > v->va + v->len)
+    return -1;
+  if(va != v->va && va + len != v->va + v->len)
+    return -1;  // would leave a hole
+
+  vmaunmap(p, v, va, len);
+  if(va == v->va){
+    v->va += len;
+    v->off += len;
+  }
+  v->len -= len;
+  if(v->len == 0 && v->f){
+    fileclose(v->f);
+    v->f = 0;
+  }
+  return 0;
+}
+
+// Fault in the untouched pages of p's MAP_SHARED regions, for
+// fork(): uvmcopyrange() can share only resident pages, and
+// the child's lock, held around vmacopy(), forbids sleeping
+// on the file there. Returns 0 on success, -1 on failure.
+int
+vmashare(struct proc *p)
+{
+  struct vma *v;
+  uint64 va;
+  pte_t *pte;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->len == 0 || (v->flags & MAP_SHARED) == 0)
+      continue;
+    for(va = v->va; va < v->va + v->len; va += PGSIZE){
+      pte = walk(p->pagetable, va, 0);
+      if((pte == 0 || (*pte & PTE_V) == 0) && vmafault(p, v, va) < 0)
+        return -1;
+    }
+  }
+  return 0;
+}
+
+// Give np, a new child under construction, copies of p's
+// regions. Resident shared pages are shared outright, private
+// ones copy-on-write. On failure undoes everything.
+// Returns 0 on success, -1 on failure.
+int
+vmacopy(struct proc *p, struct proc *np)
+{
+  int i;
+  struct vma *v;
+
+  for(i = 0; i < NVMA; i++){
+    v = &p->vma[i];
+    if(v->len == 0)
+      continue;
+    if(uvmcopyrange(p->pagetable, np->pagetable, v->va, v->va + v->len,
+                    v->flags & MAP_SHARED) < 0)
+      goto bad;
+    np->vma[i] = *v;
+    if(v->f)
+      filedup(v->f);
+  }
+  return 0;
+
+ bad:
+  while(--i >= 0){
+    v = &np->vma[i];
+    if(v->len == 0)
+      continue;
+    uvmunmap(np->pagetable, v->va, v->len / PGSIZE, 1);
+    if(v->f)
+      fileclose(v->f);
+    v->len = 0;
+    v->f = 0;
+  }
+  return -1;
+}
+
+// Unmap all of p's regions, for exit() and exec().
+void
+vmaexit(struct proc *p)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->len == 0)
+      continue;
+    vmaunmap(p, v, v->va, v->len);
+    if(v->f)
+      fileclose(v->f);
+    v->len = 0;
+    v->f = 0;
+  }
+}
@@ -4,15 +4,30 @@
 #define NPROC        64  // maximum number of processes (speedsup bigfile)
 #endif
 #define NCPU          8  // maximum number of CPUs
+#define TICKTIME  1000000  // timer cycles per tick, about a tenth of a second
+#define IDLETICKS    10  // ticks an idle CPU sleeps before looking for work
+#define NICEMIN     -20  // most favoured nice level for setpriority()
+#define NICEMAX      19  // least favoured nice level
+#define TICKETLOCKS   1  // initticketlock() makes ticket locks; 0 for plain spinlocks
+#define KJUNK         1  // kalloc()/kfree() junk-fill pages to catch dangling refs; 0 to skip
 #define NOFILE       16  // open files per process
+#define NSPAWNFD      3  // descriptors a spawn() child gets when given a map
 #define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NINODE      200  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define UNLINKBLOCKS 3   // blocks an unlink() writes: a directory block and two i-nodes
+#define LINKBLOCKS   (MAXOPBLOCKS*3) // blocks an op adding a directory entry reserves, so dirlink() may index the directory
+#define DISKRUN      8   // max # of adjacent blocks in one disk request
+#define LOGSIZE      254 // max data blocks in on-disk log; the header must fit in a block
+#define MAXWRBLOCKS  (LOGSIZE/2) // max log blocks one write() transaction reserves
+#define LOGWINDOW    0   // ticks a commit waits for more FS ops to join
+#define RAWINDOW     8   // blocks readi() reads ahead of a sequential reader
+#define NBUF         (LOGSIZE*3+MAXOPBLOCKS*3)  // size of disk block cache; lh and clh pin up to LOGSIZE each, and installing clh reads LOGSIZE more
+#define WRITEBEHIND  1   // file data is written back from the cache, not logged; 0 to log it
+#define DIRTYMAX     (NBUF/4) // dirty buffers end_op() lets pile up before a bflush()
 #ifdef LAB_FS
 #define FSSIZE       200000  // size of file system in blocks
 #else
@@ -7,18 +7,56 @@
 #include "fs.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "slab.h"
 
-#define PIPESIZE 512
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+// A pipe's buffer is a ring of PIPEPAGES pages. Data moves in
+// chunks of up to a page per copyin()/copyout(). When a whole,
+// page-aligned user page lines up with a whole ring page, the
+// page itself is handed over copy-on-write instead of copied:
+// pipewrite() puts the writer's page into the ring, and
+// piperead() maps a full ring page into the reader. Pages of
+// mmap()ed regions are always copied, to keep them shared.
+// splice() moves bytes between the ring and the buffer cache
+// without any user page, a chunk at a time: pipewbegin() and
+// piperbegin() hand out a piece of the ring to fill or drain
+// without the pipe's lock, and keep other writers or readers
+// out until pipewend() or piperend() takes it back.
+#define PIPEPAGES 4
+#define PIPESIZE (PIPEPAGES*PGSIZE)
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *page[PIPEPAGES]; // ring buffer
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  int wsplice;    // a splice() is filling the ring after nwrite
+  int rsplice;    // a splice() is draining the ring at nread
+  char *rpage;    // the page it drains, holding a reference
 };
 
+// struct pipe is small, so pipes share pages through a cache
+// rather than taking a kalloc() page each.
+static struct slab pipecache;
+
+void
+pipeinit(void)
+{
+  slabinit(&pipecache, "pipe", sizeof(struct pipe), 0);
+}
+
+static void
+pipefree(struct pipe *pi)
+{
+  for(int i = 0; i < PIPEPAGES; i++)
+    if(pi->page[i])
+      kfree(pi->page[i]);
+  slabfree(&pipecache, pi);
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -28,12 +66,19 @@ pipealloc(struct file **f0, struct file **f1)
   *f0 = *f1 = 0;
   if((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
     goto bad;
-  if((pi = (struct pipe*)kalloc()) == 0)
+  if((pi = slaballoc(&pipecache)) == 0)
     goto bad;
+  for(int i = 0; i < PIPEPAGES; i++){
+    if((pi->page[i] = kalloc()) == 0)
+      goto bad;
+  }
   pi->readopen = 1;
   pi->writeopen = 1;
   pi->nwrite = 0;
   pi->nread = 0;
+  pi->wsplice = 0;
+  pi->rsplice = 0;
+  pi->rpage = 0;
   initlock(&pi->lock, "pipe");
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
@@ -47,7 +92,7 @@ pipealloc(struct file **f0, struct file **f1)
 
  bad:
   if(pi)
-    kfree((char*)pi);
+    pipefree(pi);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -68,16 +113,39 @@ pipeclose(struct pipe *pi, int writable)
   }
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
-    kfree((char*)pi);
+    pipefree(pi);
   } else
     release(&pi->lock);
 }
 
+// Return ring page slot for pipewrite() to copy into. If the
+// page is still shared with a user page after a flip, give the
+// ring a private copy first, keeping any unread bytes in it
+// unless the whole page is free.
+static char*
+wpage(struct pipe *pi, int slot, int whole)
+{
+  char *mem;
+
+  if(krefcnt(pi->page[slot]) > 1){
+    if((mem = kalloc()) == 0)
+      return 0;
+    if(!whole)
+      memmove(mem, pi->page[slot], PGSIZE);
+    kfree(pi->page[slot]);
+    pi->page[slot] = mem;
+  }
+  return pi->page[slot];
+}
+
 int
 pipewrite(struct pipe *pi, uint64 addr, int n)
 {
   int i = 0;
   struct proc *pr = myproc();
+  uint off, m, space;
+  uint64 pa;
+  char *buf;
 
   acquire(&pi->lock);
   while(i < n){
@@ -85,16 +153,32 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
       release(&pi->lock);
       return -1;
     }
+    if(pi->wsplice){
+      sleep(&pi->nwrite, &pi->lock);
+      continue;
+    }
     if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
       wakeup(&pi->nread);
       sleep(&pi->nwrite, &pi->lock);
+      continue;
+    }
+    off = pi->nwrite % PIPESIZE;
+    space = pi->nread + PIPESIZE - pi->nwrite;
+    if(off % PGSIZE == 0 && space >= PGSIZE && n - i >= PGSIZE &&
+       (addr + i) % PGSIZE == 0 && vmafind(pr, addr + i) == 0 &&
+       (pa = uvmshare(pr->pagetable, addr + i)) != 0){
+      // flip the writer's page into the ring.
+      kfree(pi->page[off / PGSIZE]);
+      pi->page[off / PGSIZE] = (char*)pa;
+      m = PGSIZE;
     } else {
-      char ch;
-      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
+      m = min(n - i, min(space, PGSIZE - off % PGSIZE));
+      buf = wpage(pi, off / PGSIZE, off % PGSIZE == 0 && space >= PGSIZE);
+      if(buf == 0 || copyin(pr->pagetable, buf + off % PGSIZE, addr + i, m) == -1)
         break;
-      pi->data[pi->nwrite++ % PIPESIZE] = ch;
-      i++;
     }
+    pi->nwrite += m;
+    i += m;
   }
   wakeup(&pi->nread);
   release(&pi->lock);
@@ -107,24 +191,130 @@ piperead(struct pipe *pi, uint64 addr, int n)
 {
   int i;
   struct proc *pr = myproc();
-  char ch;
+  uint off, m, avail;
+  char *page;
 
   acquire(&pi->lock);
-  while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
+  while((pi->nread == pi->nwrite && pi->writeopen) || pi->rsplice){  //DOC: pipe-empty
     if(killed(pr)){
       release(&pi->lock);
       return -1;
     }
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(pi->nread == pi->nwrite)
-      break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
+  for(i = 0; i < n && pi->nread != pi->nwrite; i += m){  //DOC: piperead-copy
+    off = pi->nread % PIPESIZE;
+    avail = pi->nwrite - pi->nread;
+    page = pi->page[off / PGSIZE];
+    if(off % PGSIZE == 0 && avail >= PGSIZE && n - i >= PGSIZE &&
+       (addr + i) % PGSIZE == 0 && vmafind(pr, addr + i) == 0){
+      // map the full ring page into the reader.
+      krefinc(page);
+      if(uvmremap(pr->pagetable, addr + i, (uint64)page) == 0){
+        m = PGSIZE;
+        pi->nread += m;
+        continue;
+      }
+      kfree(page);
+    }
+    m = min(n - i, min(avail, PGSIZE - off % PGSIZE));
+    if(copyout(pr->pagetable, addr + i, page + off % PGSIZE, m) == -1)
       break;
+    pi->nread += m;
   }
   wakeup(&pi->nwrite);  //DOC: piperead-wakeup
   release(&pi->lock);
   return i;
 }
+
+// Wait for room in the ring and hand the caller a piece of it
+// to fill: returns how many bytes, up to n, may go at *buf,
+// all in one ring page, or -1 if the read side is closed.
+int
+pipewbegin(struct pipe *pi, int n, char **buf)
+{
+  struct proc *pr = myproc();
+  uint off, space;
+
+  acquire(&pi->lock);
+  for(;;){
+    if(pi->readopen == 0 || killed(pr)){
+      release(&pi->lock);
+      return -1;
+    }
+    if(!pi->wsplice && pi->nwrite != pi->nread + PIPESIZE)
+      break;
+    wakeup(&pi->nread);
+    sleep(&pi->nwrite, &pi->lock);
+  }
+  off = pi->nwrite % PIPESIZE;
+  space = pi->nread + PIPESIZE - pi->nwrite;
+  if((*buf = wpage(pi, off / PGSIZE, off % PGSIZE == 0 && space >= PGSIZE)) == 0){
+    release(&pi->lock);
+    return -1;
+  }
+  *buf += off % PGSIZE;
+  pi->wsplice = 1;
+  release(&pi->lock);
+  return min(n, min(space, PGSIZE - off % PGSIZE));
+}
+
+// End a pipewbegin(), the caller having filled m bytes.
+void
+pipewend(struct pipe *pi, int m)
+{
+  acquire(&pi->lock);
+  pi->nwrite += m;
+  pi->wsplice = 0;
+  wakeup(&pi->nread);
+  wakeup(&pi->nwrite);
+  release(&pi->lock);
+}
+
+// Hand the caller unread bytes of the ring to drain: returns
+// how many, up to n, are at *buf, all in one ring page; 0 at
+// end of file or, unless wait is set, if the pipe is empty;
+// or -1 if killed.
+int
+piperbegin(struct pipe *pi, int n, char **buf, int wait)
+{
+  struct proc *pr = myproc();
+  uint off, avail;
+
+  acquire(&pi->lock);
+  while((pi->nread == pi->nwrite && pi->writeopen && wait) || pi->rsplice){
+    if(killed(pr)){
+      release(&pi->lock);
+      return -1;
+    }
+    sleep(&pi->nread, &pi->lock);
+  }
+  if(pi->nread == pi->nwrite){
+    release(&pi->lock);
+    return 0;
+  }
+  off = pi->nread % PIPESIZE;
+  avail = pi->nwrite - pi->nread;
+  // a writer wrapping around into this page may swap it for a
+  // private copy with wpage(); keep it alive until piperend().
+  pi->rpage = pi->page[off / PGSIZE];
+  krefinc(pi->rpage);
+  *buf = pi->rpage + off % PGSIZE;
+  pi->rsplice = 1;
+  release(&pi->lock);
+  return min(n, min(avail, PGSIZE - off % PGSIZE));
+}
+
+// End a piperbegin(), the caller having drained m bytes.
+void
+piperend(struct pipe *pi, int m)
+{
+  acquire(&pi->lock);
+  pi->nread += m;
+  pi->rsplice = 0;
+  kfree(pi->rpage);
+  pi->rpage = 0;
+  wakeup(&pi->nwrite);
+  wakeup(&pi->nread);
+  release(&pi->lock);
+}
@@ -5,11 +5,43 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "defs.h"
+#include "kstat.h"
 
 struct cpu cpus[NCPU];
 
 struct proc proc[NPROC];
 
+// Sleep queues, hashed by wait channel, so that wakeup()
+// visits only processes that might be sleeping on chan.
+// A process is on the queue for p->chan exactly when it is
+// SLEEPING. Lock order: the lock passed to sleep(), then
+// the queue's lock, then p->lock.
+#define NSLEEPQ 61
+struct sleepq {
+  struct spinlock lock;
+  struct proc *head;
+} sleepq[NSLEEPQ];
+
+#define SQHASH(chan) (&sleepq[((uint64)(chan) >> 3) % NSLEEPQ])
+
+// Each CPU has a timer wheel of the processes in sleeptimed()
+// there, hashed into slots by deadline tick, and programs its
+// timer for the earliest deadline rather than every tick.
+// Only a CPU running a process also takes a scheduling tick.
+// Lock order: p->lock, then the wheel's lock; timertick()
+// lets go of the wheel before waking anyone.
+#define NWHEEL 32
+struct twheel {
+  struct spinlock lock;
+  struct proc *slot[NWHEEL];  // linked through p->tmnext
+  int n;                      // processes on the wheel
+  uint next;                  // earliest deadline, if n > 0
+  uint last;                  // last tick expired
+} twheel[NCPU];
+
+// is tick a before tick b, allowing for wraparound?
+#define TBEFORE(a, b) ((int)((a) - (b)) < 0)
+
 struct proc *initproc;
 
 int nextpid = 1;
@@ -48,9 +80,16 @@ void
 procinit(void)
 {
   struct proc *p;
+  struct cpu *c;
   
   initlock(&pid_lock, "nextpid");
-  initlock(&wait_lock, "wait_lock");
+  initticketlock(&wait_lock, "wait_lock");
+  for(c = cpus; c < &cpus[NCPU]; c++)
+    initlock(&c->rqlock, "runq");
+  for(int i = 0; i < NSLEEPQ; i++)
+    initlock(&sleepq[i].lock, "sleepq");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&twheel[i].lock, "twheel");
   for(p = proc; p < &proc[NPROC]; p++) {
       initlock(&p->lock, "proc");
       p->state = UNUSED;
@@ -123,6 +162,9 @@ allocproc(void)
 found:
   p->pid = allocpid();
   p->state = USED;
+  p->cpu = cpuid();
+  p->nice = 0;
+  p->prefcpu = -1;
 
   // Allocate a trapframe page.
   if((p->trapframe = (struct trapframe *)kalloc()) == 0){
@@ -168,6 +210,9 @@ freeproc(struct proc *p)
   p->chan = 0;
   p->killed = 0;
   p->xstate = 0;
+  p->exe = 0;
+  p->nseg = 0;
+  p->ucpt = 0;
   p->state = UNUSED;
 }
 
@@ -250,12 +295,15 @@ userinit(void)
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  setrunnable(p);
 
   release(&p->lock);
 }
 
 // Grow or shrink user memory by n bytes.
+// Growing only reserves the address range; the pages are
+// allocated and zeroed on first use, by vmfault() or by
+// copyin()/copyout().
 // Return 0 on success, -1 on failure.
 int
 growproc(int n)
@@ -266,9 +314,9 @@ growproc(int n)
   sz = p->sz;
   
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
+    if(sz + n < sz || sz + n > vmabase(p))
       return -1;
-    }
+    sz += n;
   } else if(n < 0){
     sz = uvmdealloc(p->pagetable, sz, sz + n);
   }
@@ -285,6 +333,10 @@ fork(void)
   struct proc *np;
   struct proc *p = myproc();
 
+  // shared regions must be resident to be shared.
+  if(vmashare(p) < 0)
+    return -1;
+
   // Allocate process.
   if((np = allocproc()) == 0){
     return -1;
@@ -297,7 +349,11 @@ fork(void)
     return -1;
   }
   np->sz = p->sz;
-
+  if(vmacopy(p, np) < 0){
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
 
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
@@ -310,6 +366,12 @@ fork(void)
     if(p->ofile[i])
       np->ofile[i] = filedup(p->ofile[i]);
   np->cwd = idup(p->cwd);
+  if(p->exe)
+    np->exe = idup(p->exe);
+  np->nseg = p->nseg;
+  memmove(np->seg, p->seg, sizeof(p->seg));
+  np->nice = p->nice;
+  np->prefcpu = p->prefcpu;
 
   safestrcpy(np->name, p->name, sizeof(p->name));
 
@@ -322,13 +384,73 @@ fork(void)
   release(&wait_lock);
 
   acquire(&np->lock);
-  np->state = RUNNABLE;
+  setrunnable(np);
 
   release(&np->lock);
 
   return pid;
 }
 
+// Create a new process running the program at path with
+// arguments argv, as fork() then exec() in the child would,
+// but built straight from the ELF file instead of copying the
+// caller's memory first. The child inherits the caller's open
+// files, unless fds is not 0: then it gets just descriptors
+// 0..NSPAWNFD-1, with fd i referring to the caller's fds[i],
+// or closed if fds[i] < 0.
+// Returns the child's pid, or -1.
+int
+spawn(char *path, char **argv, int *fds)
+{
+  int i, argc, pid;
+  struct proc *np;
+  struct proc *p = myproc();
+  struct file *f;
+
+  for(i = 0; fds && i < NSPAWNFD; i++)
+    if(fds[i] >= NOFILE || (fds[i] >= 0 && p->ofile[fds[i]] == 0))
+      return -1;
+
+  if((np = allocproc()) == 0){
+    return -1;
+  }
+  // execproc() sets the registers main() needs; don't let the
+  // child start with whatever the trapframe page held.
+  memset(np->trapframe, 0, sizeof(*np->trapframe));
+  release(&np->lock);
+
+  if((argc = execproc(np, path, argv)) < 0){
+    acquire(&np->lock);
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  np->trapframe->a0 = argc;
+  np->nice = p->nice;
+  np->prefcpu = p->prefcpu;
+
+  for(i = 0; i < NOFILE; i++){
+    f = p->ofile[i];
+    if(fds)
+      f = (i < NSPAWNFD && fds[i] >= 0) ? p->ofile[fds[i]] : 0;
+    if(f)
+      np->ofile[i] = filedup(f);
+  }
+  np->cwd = idup(p->cwd);
+
+  pid = np->pid;
+
+  acquire(&wait_lock);
+  np->parent = p;
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  setrunnable(np);
+  release(&np->lock);
+
+  return pid;
+}
+
 // Pass p's abandoned children to init.
 // Caller must hold wait_lock.
 void
@@ -355,6 +477,9 @@ exit(int status)
   if(p == initproc)
     panic("init exiting");
 
+  // Write back and drop mmap()ed regions.
+  vmaexit(p);
+
   // Close all open files.
   for(int fd = 0; fd < NOFILE; fd++){
     if(p->ofile[fd]){
@@ -365,10 +490,13 @@ exit(int status)
   }
 
   
-  begin_op();
+  begin_opn(0);
   iput(p->cwd);
+  if(p->exe)
+    iput(p->exe);
   end_op();
   p->cwd = 0;
+  p->exe = 0;
 
   acquire(&wait_lock);
 
@@ -399,6 +527,10 @@ wait(uint64 addr)
   int havekids, pid;
   struct proc *p = myproc();
 
+  // copyout() below runs with spinlocks held.
+  if(addr != 0)
+    vmprefault(p, addr, sizeof(int));
+
   acquire(&wait_lock);
 
   for(;;){
@@ -439,6 +571,165 @@ wait(uint64 addr)
   }
 }
 
+// Per-CPU run queues. A RUNNABLE process sits on exactly one
+// queue, that of the cpu it is pinned to or else normally the
+// one it last ran on, so harts do not contend for each other's
+// locks and keep their caches warm. Each queue has a FIFO per
+// priority band. An idle cpu steals from the longest queue.
+// Lock order: p->lock, then rqlock.
+
+// Every RQFAIR-th pick on a cpu serves its worst non-empty
+// band first, so that nice processes are slowed, not starved.
+#define RQFAIR 8
+
+// Mark p RUNNABLE and append it to its cpu's run queue.
+// Caller must hold p->lock.
+void
+setrunnable(struct proc *p)
+{
+  struct cpu *c;
+  int b;
+
+  if(p->prefcpu >= 0)
+    p->cpu = p->prefcpu;
+  c = &cpus[p->cpu];
+
+  p->state = RUNNABLE;
+  b = PRIOBAND(p->nice);
+  acquire(&c->rqlock);
+  p->rqnext = 0;
+  if(c->rqtail[b])
+    c->rqtail[b]->rqnext = p;
+  else
+    c->rqhead[b] = p;
+  c->rqtail[b] = p;
+  c->rqlen++;
+  release(&c->rqlock);
+
+  // an idle CPU takes no ticks and may be stopped in wfi
+  // until its next deadline; wake it to run p.
+  if(c->idle && c != mycpu())
+    cpukick(c - cpus);
+}
+
+// Wake cpu id from wfi with a software interrupt.
+void
+cpukick(int id)
+{
+  *(volatile uint32*)CLINT_MSIP(id) = 1;
+}
+
+// Take the next process for cpu id off c's run queue: the
+// first in the best non-empty band, skipping processes pinned
+// to other cpus. Returns 0 if there is none.
+static struct proc*
+rqpop(struct cpu *c, int id)
+{
+  struct proc *p, *prev;
+  int i, b;
+
+  acquire(&c->rqlock);
+  p = 0;
+  c->rqturn++;
+  for(i = 0; i < NPRIO && p == 0; i++){
+    b = c->rqturn % RQFAIR == 0 ? NPRIO - 1 - i : i;
+    prev = 0;
+    for(p = c->rqhead[b]; p; prev = p, p = p->rqnext)
+      if(p->prefcpu < 0 || p->prefcpu == id)
+        break;
+    if(p == 0)
+      continue;
+    if(prev)
+      prev->rqnext = p->rqnext;
+    else
+      c->rqhead[b] = p->rqnext;
+    if(c->rqtail[b] == p)
+      c->rqtail[b] = prev;
+    c->rqlen--;
+    p->rqnext = 0;
+  }
+  release(&c->rqlock);
+  return p;
+}
+
+// Choose a process for cpu c: from its own queue if it
+// has one, else stolen from the longest other queue, or
+// from any queue holding a process pinned to c.
+static struct proc*
+pickproc(struct cpu *c)
+{
+  struct cpu *o, *busiest;
+  struct proc *p;
+  int id = c - cpus;
+
+  if((p = rqpop(c, id)) != 0)
+    return p;
+  // rqlen is read without the lock; it is only a hint.
+  busiest = 0;
+  for(o = cpus; o < &cpus[NCPU]; o++){
+    if(o != c && o->rqlen > 0 && (busiest == 0 || o->rqlen > busiest->rqlen))
+      busiest = o;
+  }
+  if(busiest == 0)
+    return 0;
+  if((p = rqpop(busiest, id)) != 0)
+    return p;
+  for(o = cpus; o < &cpus[NCPU]; o++)
+    if(o != c && o != busiest && o->rqlen > 0 && (p = rqpop(o, id)) != 0)
+      return p;
+  return 0;
+}
+
+// Set the nice level of process pid, or of the caller if pid
+// is 0; it takes effect the next time the process is queued.
+// Returns 0, or -1 if there is no such process or nice is out
+// of range.
+int
+setpriority(int pid, int nice)
+{
+  struct proc *p;
+
+  if(nice < NICEMIN || nice > NICEMAX)
+    return -1;
+  if(pid == 0)
+    pid = myproc()->pid;
+  for(p = proc; p < &proc[NPROC]; p++){
+    acquire(&p->lock);
+    if(p->pid == pid && p->state != UNUSED){
+      p->nice = nice;
+      release(&p->lock);
+      return 0;
+    }
+    release(&p->lock);
+  }
+  return -1;
+}
+
+// Pin process pid, or the caller if pid is 0, to cpu, or let
+// it run anywhere if cpu is -1. The process moves to the cpu
+// the next time it is queued.
+// Returns 0, or -1 if there is no such process or cpu.
+int
+setaffinity(int pid, int cpu)
+{
+  struct proc *p;
+
+  if(cpu < -1 || cpu >= NCPU || (cpu >= 0 && !cpus[cpu].online))
+    return -1;
+  if(pid == 0)
+    pid = myproc()->pid;
+  for(p = proc; p < &proc[NPROC]; p++){
+    acquire(&p->lock);
+    if(p->pid == pid && p->state != UNUSED){
+      p->prefcpu = cpu;
+      release(&p->lock);
+      return 0;
+    }
+    release(&p->lock);
+  }
+  return -1;
+}
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
@@ -453,40 +744,46 @@ scheduler(void)
   struct cpu *c = mycpu();
 
   c->proc = 0;
+  c->online = 1;
   for(;;){
     // The most recent process to run may have had interrupts
     // turned off; enable them to avoid a deadlock if all
     // processes are waiting.
     intr_on();
 
-    int nproc = 0;
-    for(p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if(p->state != UNUSED) {
-        nproc++;
-      }
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-      }
-      release(&p->lock);
-    }
-    if(nproc <= 2) {   // only init and sh exist
-      // nothing to run; stop running on this core until an interrupt.
-      intr_on();
+    // idle before looking, so that a setrunnable() that the
+    // look misses sees it and sends cpukick().
+    c->idle = 1;
+    if((p = pickproc(c)) == 0){
+      // nothing to run; zero a page for kalloc_zeroed(), or
+      // stop running on this core until an interrupt.
+      if(kzerofill())
+        continue;
 #ifndef LAB_FS
       asm volatile("wfi");
 #endif
+      continue;
     }
+
+    // Switch to chosen process.  It is the process's job
+    // to release its lock and then reacquire it
+    // before jumping back to us.
+    acquire(&p->lock);
+    if(p->state != RUNNABLE)
+      panic("scheduler: not runnable");
+    p->state = RUNNING;
+    p->cpu = c - cpus;
+    c->proc = p;
+    c->idle = 0;
+    kstatadd(KS_SWTCH, 1);
+    timerarm();  // a scheduling tick, now that there's a process
+
+    swtch(&c->context, &p->context);
+
+    // Process is done running for now.
+    // It should have changed its p->state before coming back.
+    c->proc = 0;
+    release(&p->lock);
   }
 }
 
@@ -523,7 +820,7 @@ yield(void)
 {
   struct proc *p = myproc();
   acquire(&p->lock);
-  p->state = RUNNABLE;
+  setrunnable(p);
   sched();
   release(&p->lock);
 }
@@ -558,20 +855,25 @@ void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct sleepq *q = SQHASH(chan);
   
   // Must acquire p->lock in order to
   // change p->state and then call sched.
-  // Once we hold p->lock, we can be
+  // Once we hold the queue lock, we can be
   // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
+  // (wakeup locks it to find us),
   // so it's okay to release lk.
 
+  acquire(&q->lock);
   acquire(&p->lock);  //DOC: sleeplock1
   release(lk);
 
   // Go to sleep.
   p->chan = chan;
   p->state = SLEEPING;
+  p->sqnext = q->head;
+  q->head = p;
+  release(&q->lock);
 
   sched();
 
@@ -588,17 +890,185 @@ sleep(void *chan, struct spinlock *lk)
 void
 wakeup(void *chan)
 {
-  struct proc *p;
+  struct sleepq *q = SQHASH(chan);
+  struct proc *p, **pp;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    if(p != myproc()){
+  acquire(&q->lock);
+  for(pp = &q->head; (p = *pp) != 0; ){
+    acquire(&p->lock);
+    if(p->state == SLEEPING && p->chan == chan) {
+      *pp = p->sqnext;
+      p->sqnext = 0;
+      setrunnable(p);
+    } else {
+      pp = &p->sqnext;
+    }
+    release(&p->lock);
+  }
+  release(&q->lock);
+}
+
+// Wake p, found SLEEPING on chan, for kill() and timertick().
+static void
+wakeproc(struct proc *p, void *chan)
+{
+  struct sleepq *q = SQHASH(chan);
+  struct proc **pp;
+
+  acquire(&q->lock);
+  for(pp = &q->head; *pp != 0; pp = &(*pp)->sqnext){
+    if(*pp == p){
       acquire(&p->lock);
-      if(p->state == SLEEPING && p->chan == chan) {
-        p->state = RUNNABLE;
+      if(p->state == SLEEPING && p->chan == chan){
+        *pp = p->sqnext;
+        p->sqnext = 0;
+        setrunnable(p);
       }
       release(&p->lock);
+      break;
+    }
+  }
+  release(&q->lock);
+}
+
+// Like sleep(), but also wake up once tickcount() reaches
+// deadline, through this CPU's timer wheel. Returns at once
+// if the deadline has passed or p has been killed. lk may be
+// 0 if the caller needs no lock to check its condition.
+void
+sleeptimed(void *chan, struct spinlock *lk, uint deadline)
+{
+  struct proc *p = myproc();
+  struct sleepq *q = SQHASH(chan);
+  struct twheel *w;
+  struct proc **pp;
+
+  acquire(&q->lock);
+  acquire(&p->lock);
+  if(lk)
+    release(lk);
+  if(p->killed || !TBEFORE(tickcount(), deadline)){
+    release(&p->lock);
+    release(&q->lock);
+    if(lk)
+      acquire(lk);
+    return;
+  }
+
+  p->chan = chan;
+  p->state = SLEEPING;
+  p->sqnext = q->head;
+  q->head = p;
+  release(&q->lock);
+
+  // p->lock keeps timertick() from waking p until it is
+  // off this CPU.
+  w = &twheel[cpuid()];
+  acquire(&w->lock);
+  p->wakeat = deadline;
+  p->tchan = chan;
+  p->tw = w;
+  p->tmnext = w->slot[deadline % NWHEEL];
+  w->slot[deadline % NWHEEL] = p;
+  if(w->n++ == 0 || TBEFORE(deadline, w->next))
+    w->next = deadline;
+  release(&w->lock);
+  timerarm();
+
+  sched();
+
+  // Tidy up: leave the wheel, unless timertick() took p off.
+  p->chan = 0;
+  if((w = p->tw) != 0){
+    acquire(&w->lock);
+    for(pp = &w->slot[p->wakeat % NWHEEL]; *pp; pp = &(*pp)->tmnext){
+      if(*pp == p){
+        *pp = p->tmnext;
+        w->n--;
+        break;
+      }
+    }
+    p->tw = 0;
+    release(&w->lock);
+  }
+
+  release(&p->lock);
+  if(lk)
+    acquire(lk);
+}
+
+// Take one process due by tick now off wheel w, or return 0.
+// Sets *chan to the channel it sleeps on.
+static struct proc*
+wheeldue(struct twheel *w, uint now, void **chan)
+{
+  struct proc *p, **pp;
+  uint t;
+
+  // only the slots for ticks since the last expiry can hold
+  // processes that have come due.
+  t = TBEFORE(now - NWHEEL, w->last) ? w->last + 1 : now - NWHEEL + 1;
+  for(; !TBEFORE(now, t); t++){
+    for(pp = &w->slot[t % NWHEEL]; (p = *pp) != 0; pp = &p->tmnext){
+      if(!TBEFORE(now, p->wakeat)){
+        *pp = p->tmnext;
+        p->tw = 0;
+        w->n--;
+        *chan = p->tchan;
+        return p;
+      }
     }
   }
+  return 0;
+}
+
+// Timer interrupt: wake this CPU's processes whose deadlines
+// have come, and program the timer for the next event.
+void
+timertick(void)
+{
+  struct twheel *w;
+  struct proc *p;
+  void *chan;
+  uint now;
+
+  push_off();
+  w = &twheel[cpuid()];
+  now = tickcount();
+  for(;;){
+    acquire(&w->lock);
+    if((p = wheeldue(w, now, &chan)) == 0)
+      break;
+    release(&w->lock);
+    wakeproc(p, chan);
+  }
+  w->last = now;
+  // recompute the earliest deadline.
+  w->next = now + NWHEEL;
+  for(int i = 0; i < NWHEEL; i++)
+    for(p = w->slot[i]; p; p = p->tmnext)
+      if(TBEFORE(p->wakeat, w->next))
+        w->next = p->wakeat;
+  release(&w->lock);
+  timerarm();
+  pop_off();
+}
+
+// Program this CPU's timer for its wheel's earliest deadline,
+// and for a scheduling tick if it is running a process:
+// an idle CPU sleeps until a deadline, or for IDLETICKS.
+// Interrupts must be off.
+void
+timerarm(void)
+{
+  struct cpu *c = mycpu();
+  struct twheel *w = &twheel[cpuid()];
+  uint64 now = r_time(), at;
+
+  at = now + (c->proc ? 1 : IDLETICKS) * TICKTIME;
+  if(w->n > 0 && (uint64)w->next * TICKTIME < at)
+    at = (uint64)w->next * TICKTIME;
+  w_stimecmp(at);
 }
 
 // Kill the process with the given pid.
@@ -608,14 +1078,21 @@ int
 kill(int pid)
 {
   struct proc *p;
+  void *chan;
 
   for(p = proc; p < &proc[NPROC]; p++){
     acquire(&p->lock);
     if(p->pid == pid){
       p->killed = 1;
-      if(p->state == SLEEPING){
-        // Wake process from sleep().
-        p->state = RUNNABLE;
+      // Wake process from sleep(). The queue lock comes before
+      // p->lock, so let go of p->lock first, and try again if
+      // p went to sleep on another channel meanwhile.
+      chan = 0;
+      while(p->state == SLEEPING && p->chan != chan){
+        chan = p->chan;
+        release(&p->lock);
+        wakeproc(p, chan);
+        acquire(&p->lock);
       }
       release(&p->lock);
       return 0;
@@ -18,12 +18,24 @@ struct context {
   uint64 s11;
 };
 
+// Run queues have NPRIO priority bands, which split the nice
+// range NICEMIN..NICEMAX evenly; band 0 runs first.
+#define NPRIO 4
+#define PRIOBAND(nice) (((nice) - NICEMIN) * NPRIO / (NICEMAX - NICEMIN + 1))
+
 // Per-CPU state.
 struct cpu {
   struct proc *proc;          // The process running on this cpu, or null.
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  struct spinlock rqlock;     // protects the run queue
+  struct proc *rqhead[NPRIO]; // RUNNABLE processes, FIFO per band
+  struct proc *rqtail[NPRIO];
+  int rqlen;                  // length of the run queue
+  uint rqturn;                // picks made, for fairness to low bands
+  int idle;                   // scheduler() found nothing to run
+  int online;                 // this CPU has entered scheduler()
 };
 
 extern struct cpu cpus[NCPU];
@@ -81,6 +93,30 @@ struct trapframe {
 
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
+// A loadable ELF segment of the process's executable.
+// exec() only records these; the pages are read in from
+// the executable's inode on first touch by loadseg().
+#define NSEG 4
+struct vmseg {
+  uint64 va;      // page-aligned start address
+  uint64 memsz;   // bytes of memory, including zero-filled bss
+  uint64 filesz;  // bytes that come from the file
+  uint off;       // offset of the segment in the file
+  int perm;       // PTE_X/PTE_W permissions
+};
+
+// A region mapped by mmap(). The pages are filled in on
+// first touch, see vmafault().
+#define NVMA 16
+struct vma {
+  uint64 va;       // page-aligned start address
+  uint64 len;      // bytes, a multiple of PGSIZE; 0 if unused
+  int prot;        // PROT_ bits
+  int flags;       // MAP_ flags
+  struct file *f;  // mapped file, or 0 for MAP_ANON
+  uint off;        // offset of va in f
+};
+
 // Per-process state
 struct proc {
   struct spinlock lock;
@@ -91,6 +127,15 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  int cpu;                     // cpu whose run queue p joins
+  int nice;                    // NICEMIN..NICEMAX, lower runs first
+  int prefcpu;                 // cpu p is pinned to by setaffinity(), or -1
+  struct proc *rqnext;         // next on a cpu's run queue
+  struct proc *sqnext;         // next on chan's sleep queue
+  uint wakeat;                 // sleeptimed() deadline tick
+  void *tchan;                 // chan to wake at wakeat
+  struct twheel *tw;           // timer wheel p is on, or 0
+  struct proc *tmnext;         // next in tw's slot
 
   // wait_lock must be held when using this:
   struct proc *parent;         // Parent process
@@ -103,5 +148,15 @@ struct proc {
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
+  int logres;                  // log blocks reserved by begin_opn() and not yet used
+  struct inode *ifree;         // inodes iput() left for end_op() to free
+  pagetable_t ucpt;            // copyin/copyout's cached translation:
+  uint64 ucva;                 //   user page ucva of page table ucpt
+  uint64 ucpa;                 //   is at physical address ucpa,
+  int ucwrite;                 //   writable if ucwrite
+  struct inode *exe;           // Executable that seg[] is paged in from
+  int nseg;                    // Number of valid entries in seg[]
+  struct vmseg seg[NSEG];      // Demand-paged program segments
+  struct vma vma[NVMA];        // mmap()ed regions
   char name[16];               // Process name (debugging)
 };
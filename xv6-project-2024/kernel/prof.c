@@ -0,0 +1,117 @@
+// Sampling profiler.
+//
+// While profiling is on, every timer interrupt records the
+// interrupted pc in a ring of samples belonging to the CPU
+// it arrived on. Only that CPU adds to its ring, but prof()
+// can drain it from any CPU, so each ring has a lock. A full
+// ring drops new samples and counts them.
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+#include "prof.h"
+
+struct {
+  struct spinlock lock;
+  uint head;      // next sample to drain
+  uint tail;      // next free place; tail - head are buffered
+  uint64 dropped;
+  struct profsample s[NPROFSAMPLE];
+} __attribute__((aligned(64))) profbufs[NCPU];
+
+static volatile int profiling;
+
+void
+profinit(void)
+{
+  for(int c = 0; c < NCPU; c++)
+    initlock(&profbufs[c].lock, "prof");
+}
+
+// Record a sample of pc, from the timer interrupt.
+// Interrupts are off.
+void
+profsample(uint64 pc, int user)
+{
+  struct proc *p;
+  int c;
+
+  if(!profiling)
+    return;
+  c = cpuid();
+  p = myproc();
+  acquire(&profbufs[c].lock);
+  if(profbufs[c].tail - profbufs[c].head < NPROFSAMPLE){
+    struct profsample *s = &profbufs[c].s[profbufs[c].tail++ % NPROFSAMPLE];
+    s->pc = pc;
+    s->pid = p ? p->pid : 0;
+    s->cpu = c;
+    s->user = user;
+  } else {
+    profbufs[c].dropped++;
+  }
+  release(&profbufs[c].lock);
+}
+
+// Copy out up to n buffered samples to user address addr,
+// removing them. Returns the number copied, or -1. The
+// samples are taken out a few at a time, so that copyout()
+// runs without the ring's lock.
+static int
+profdrain(uint64 addr, int n)
+{
+  struct profsample s[16];
+  int i, k, got;
+
+  got = 0;
+  for(int c = 0; c < NCPU && got < n; c++){
+    for(;;){
+      acquire(&profbufs[c].lock);
+      for(k = 0; k < NELEM(s) && got + k < n && profbufs[c].head != profbufs[c].tail; k++)
+        s[k] = profbufs[c].s[profbufs[c].head++ % NPROFSAMPLE];
+      release(&profbufs[c].lock);
+      if(k == 0)
+        break;
+      for(i = 0; i < k; i++, got++)
+        if(copyout(myproc()->pagetable, addr + got*sizeof(s[0]), (char*)&s[i], sizeof(s[0])) < 0)
+          return -1;
+    }
+  }
+  return got;
+}
+
+// The prof() system call, op being one of PROF_*.
+int
+profctl(int op, uint64 addr, int n)
+{
+  uint64 dropped;
+
+  switch(op){
+  case PROF_START:
+    profiling = 0;
+    for(int c = 0; c < NCPU; c++){
+      acquire(&profbufs[c].lock);
+      profbufs[c].head = profbufs[c].tail = 0;
+      profbufs[c].dropped = 0;
+      release(&profbufs[c].lock);
+    }
+    __sync_synchronize();
+    profiling = 1;
+    return 0;
+  case PROF_STOP:
+    profiling = 0;
+    __sync_synchronize();
+    return 0;
+  case PROF_DRAIN:
+    return profdrain(addr, n);
+  case PROF_DROPPED:
+    dropped = 0;
+    for(int c = 0; c < NCPU; c++)
+      dropped += profbufs[c].dropped;
+    return dropped;
+  }
+  return -1;
+}
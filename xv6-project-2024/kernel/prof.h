@@ -0,0 +1,16 @@
+// Samples of the timer-driven profiler, as drained by the
+// prof() system call.
+#define NPROFSAMPLE 1024  // samples buffered per CPU
+
+// prof() operations.
+#define PROF_START   1  // discard old samples and start sampling
+#define PROF_STOP    2  // stop sampling; samples stay buffered
+#define PROF_DRAIN   3  // move up to n samples out; returns how many
+#define PROF_DROPPED 4  // samples lost to full buffers since start
+
+struct profsample {
+  uint64 pc;   // sepc at the timer interrupt
+  int pid;     // process on the CPU, 0 if none
+  short cpu;
+  short user;  // 1 if pc is a user address
+};
@@ -0,0 +1,88 @@
+// Slab caches for fixed-size kernel objects.
+//
+// Pages taken by a cache stay with it, so the memory of a burst
+// of objects is kept for the next one rather than going back to
+// kalloc(). Caches with a limit fail once that many objects are
+// in use, which keeps the old fixed-table limits (NFILE, &c).
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "slab.h"
+
+void
+slabinit(struct slab *s, char *name, uint size, int limit)
+{
+  initlock(&s->lock, name);
+  s->name = name;
+  s->size = (size + 7) & ~7;
+  if(s->size > PGSIZE)
+    panic("slabinit");
+  s->limit = limit;
+  s->nused = 0;
+  s->npages = 0;
+  s->free = 0;
+}
+
+// Carve a fresh page into free objects. Called and returns
+// with s->lock held.
+static int
+slabgrow(struct slab *s)
+{
+  char *pg, *o;
+
+  release(&s->lock);
+  pg = kalloc();
+  acquire(&s->lock);
+  if(pg == 0)
+    return -1;
+  for(o = pg; o + s->size <= pg + PGSIZE; o += s->size){
+    *(void**)o = s->free;
+    s->free = o;
+  }
+  s->npages++;
+  return 0;
+}
+
+// Return a zeroed object, or 0 if the cache is at its limit
+// or out of memory.
+void*
+slaballoc(struct slab *s)
+{
+  void *o;
+
+  acquire(&s->lock);
+  for(;;){
+    if(s->limit && s->nused >= s->limit)
+      goto fail;
+    if(s->free)
+      break;
+    if(slabgrow(s) < 0)
+      goto fail;
+  }
+  o = s->free;
+  s->free = *(void**)o;
+  s->nused++;
+  release(&s->lock);
+  memset(o, 0, s->size);
+  return o;
+
+ fail:
+  release(&s->lock);
+  return 0;
+}
+
+void
+slabfree(struct slab *s, void *o)
+{
+  acquire(&s->lock);
+  if(s->nused < 1)
+    panic("slabfree");
+  *(void**)o = s->free;
+  s->free = o;
+  s->nused--;
+  release(&s->lock);
+}
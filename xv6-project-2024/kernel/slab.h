@@ -0,0 +1,13 @@
+// A cache of same-sized kernel objects. Objects are carved out
+// of kalloc() pages and recycled through a free list threaded
+// through their first word, so allocation and freeing are O(1)
+// and small objects share a page instead of taking one each.
+struct slab {
+  struct spinlock lock;
+  char *name;        // for debugging
+  uint size;         // object size, rounded up to 8 bytes
+  int limit;         // most objects in use at once, 0 if unlimited
+  int nused;         // objects in use
+  int npages;        // pages carved up so far
+  void *free;        // free objects
+};
@@ -7,6 +7,70 @@
 #include "riscv.h"
 #include "proc.h"
 #include "defs.h"
+#include "kstat.h"
+#include "lockstat.h"
+
+// Contention counts, per lock name and CPU. initlock() finds
+// or adds the entry for its name. acquire() counts into its own
+// CPU's row with interrupts off, so harts share no counters and
+// need no atomics; lockstatcopy() sums the rows. The name table
+// is guarded by a bare test-and-set flag, since a spinlock here
+// would have to register itself.
+struct lockcount {
+  uint64 nacquire;
+  uint64 ncontend;
+  uint64 cycles;
+};
+
+static struct {
+  struct lockcount c[NLOCKSTAT];
+} __attribute__((aligned(64))) lockcounts[NCPU];
+
+static char locknames[NLOCKSTAT][sizeof(((struct lockstat*)0)->name)];
+static int nlockstats;
+static uint lockstats_busy;
+
+static int
+lockstat_for(char *name)
+{
+  int i;
+
+  while(__sync_lock_test_and_set(&lockstats_busy, 1) != 0)
+    ;
+  for(i = 0; i < nlockstats; i++)
+    if(strncmp(locknames[i], name, sizeof(locknames[i])-1) == 0)
+      break;
+  if(i == nlockstats){
+    if(nlockstats < NLOCKSTAT)
+      safestrcpy(locknames[nlockstats++], name, sizeof(locknames[i]));
+    else
+      i = -1;
+  }
+  __sync_lock_release(&lockstats_busy);
+  return i;
+}
+
+// Copy out up to n lockstat entries to user address addr,
+// summed over the CPUs. Returns the number copied, or -1.
+int
+lockstatcopy(uint64 addr, int n)
+{
+  struct lockstat ls;
+  int i, c;
+
+  for(i = 0; i < n && i < nlockstats; i++){
+    memset(&ls, 0, sizeof(ls));
+    safestrcpy(ls.name, locknames[i], sizeof(ls.name));
+    for(c = 0; c < NCPU; c++){
+      ls.nacquire += lockcounts[c].c[i].nacquire;
+      ls.ncontend += lockcounts[c].c[i].ncontend;
+      ls.cycles += lockcounts[c].c[i].cycles;
+    }
+    if(copyout(myproc()->pagetable, addr + i*sizeof(ls), (char*)&ls, sizeof(ls)) < 0)
+      return -1;
+  }
+  return i;
+}
 
 void
 initlock(struct spinlock *lk, char *name)
@@ -14,6 +78,22 @@ initlock(struct spinlock *lk, char *name)
   lk->name = name;
   lk->locked = 0;
   lk->cpu = 0;
+  lk->n = 0;
+  lk->nts = 0;
+  lk->fifo = 0;
+  lk->next = 0;
+  lk->serving = 0;
+  lk->stat = lockstat_for(name);
+}
+
+// Initialize a lock whose waiters get it in arrival order (a
+// ticket lock), for hot global locks that many harts wait on.
+// With TICKETLOCKS 0 it is an ordinary spinlock, for comparison.
+void
+initticketlock(struct spinlock *lk, char *name)
+{
+  initlock(lk, name);
+  lk->fifo = TICKETLOCKS;
 }
 
 // Acquire the lock.
@@ -21,16 +101,50 @@ initlock(struct spinlock *lk, char *name)
 void
 acquire(struct spinlock *lk)
 {
+  uint spins = 0;
+  uint64 t0;
+  struct lockcount *lc;
+
   push_off(); // disable interrupts to avoid deadlock.
   if(holding(lk))
     panic("acquire");
 
-  // On RISC-V, sync_lock_test_and_set turns into an atomic swap:
-  //   a5 = 1
-  //   s1 = &lk->locked
-  //   amoswap.w.aq a5, a5, (s1)
-  while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
-    ;
+  if(lk->fifo){
+    // Take a ticket and wait for it to be served. Waiters
+    // only read serving, so they don't fight over the line.
+    uint t = __sync_fetch_and_add(&lk->next, 1);
+    if(__atomic_load_n(&lk->serving, __ATOMIC_ACQUIRE) != t){
+      t0 = r_time();
+      while(__atomic_load_n(&lk->serving, __ATOMIC_ACQUIRE) != t)
+        spins++;
+    }
+    lk->locked = 1;
+  } else {
+    // On RISC-V, sync_lock_test_and_set turns into an atomic swap:
+    //   a5 = 1
+    //   s1 = &lk->locked
+    //   amoswap.w.aq a5, a5, (s1)
+    if(__sync_lock_test_and_set(&lk->locked, 1) != 0){
+      t0 = r_time();
+      do {
+        spins++;
+      } while(__sync_lock_test_and_set(&lk->locked, 1) != 0);
+    }
+  }
+  // the lock's own counters are the holder's to change, and
+  // lockcounts[] rows are per CPU, so plain adds do.
+  lk->n++;
+  lk->nts += spins;
+  if(lk->stat >= 0){
+    lc = &lockcounts[cpuid()].c[lk->stat];
+    lc->nacquire++;
+    if(spins){
+      lc->ncontend++;
+      lc->cycles += r_time() - t0;
+    }
+  }
+  if(spins)
+    kstatadd(KS_SPIN, spins);
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -68,6 +182,10 @@ release(struct spinlock *lk)
   //   amoswap.w zero, zero, (s1)
   __sync_lock_release(&lk->locked);
 
+  // Serve the next ticket.
+  if(lk->fifo)
+    __atomic_store_n(&lk->serving, lk->serving + 1, __ATOMIC_RELEASE);
+
   pop_off();
 }
 
@@ -2,8 +2,18 @@
 struct spinlock {
   uint locked;       // Is the lock held?
 
+  // Ticket locks (initticketlock()):
+  int fifo;          // Serve waiters in arrival order?
+  uint next;         // Next ticket to hand out.
+  uint serving;      // Ticket now allowed to hold the lock.
+
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
+
+  // For statistics, counted by the holder:
+  uint n;            // Number of acquire() calls.
+  uint nts;          // Number of failed test-and-set spins.
+  int stat;          // Entry of its name in the lockstat tables, or -1.
 };
 
@@ -6,10 +6,14 @@
 
 void main();
 void timerinit();
+extern void machinevec();
 
 // entry.S needs one stack per CPU.
 __attribute__ ((aligned (16))) char stack0[4096 * NCPU];
 
+// machinevec saves two registers per CPU here.
+uint64 mscratch0[NCPU * 2];
+
 // entry.S jumps here in machine mode on stack0.
 void
 start()
@@ -44,6 +48,12 @@ start()
   int id = r_mhartid();
   w_tp(id);
 
+  // machine-mode software interrupts, for cpukick(), can't be
+  // delegated; machinevec passes them on to supervisor mode.
+  w_mscratch((uint64)&mscratch0[id * 2]);
+  w_mtvec((uint64)machinevec);
+  w_mie(r_mie() | MIE_MSIE);
+
   // switch to supervisor mode and jump to main().
   asm volatile("mret");
 }
@@ -62,5 +72,5 @@ timerinit()
   w_mcounteren(r_mcounteren() | 2);
   
   // ask for the very first timer interrupt.
-  w_stimecmp(r_time() + 1000000);
+  w_stimecmp(r_time() + TICKTIME);
 }
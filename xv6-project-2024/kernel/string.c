@@ -1,13 +1,32 @@
 #include "types.h"
 
+// memset, memcmp and memmove work a uint64 at a time once the
+// pointers are word aligned, and a byte at a time for the
+// unaligned head and tail. Pages, blocks and log copies are
+// all aligned, so they take the fast path throughout.
+#define WSIZE sizeof(uint64)
+#define WALIGNED(p) (((uint64)(p) % WSIZE) == 0)
+
 void*
 memset(void *dst, int c, uint n)
 {
   char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
+  uint64 w;
+
+  if(n >= 2*WSIZE){
+    for(; !WALIGNED(cdst); n--)
+      *cdst++ = c;
+    w = (uchar)c;
+    w |= w << 8;
+    w |= w << 16;
+    w |= w << 32;
+    for(; n >= WSIZE; n -= WSIZE){
+      *(uint64*)cdst = w;
+      cdst += WSIZE;
+    }
   }
+  while(n-- > 0)
+    *cdst++ = c;
   return dst;
 }
 
@@ -18,6 +37,16 @@ memcmp(const void *v1, const void *v2, uint n)
 
   s1 = v1;
   s2 = v2;
+  if(n >= WSIZE && WALIGNED((uint64)s1 ^ (uint64)s2)){
+    for(; n > 0 && !WALIGNED(s1); n--, s1++, s2++)
+      if(*s1 != *s2)
+        return *s1 - *s2;
+    // skip equal words; the byte loop finds the difference.
+    for(; n >= WSIZE && *(uint64*)s1 == *(uint64*)s2; n -= WSIZE){
+      s1 += WSIZE;
+      s2 += WSIZE;
+    }
+  }
   while(n-- > 0){
     if(*s1 != *s2)
       return *s1 - *s2;
@@ -41,11 +70,32 @@ memmove(void *dst, const void *src, uint n)
   if(s < d && s + n > d){
     s += n;
     d += n;
+    if(WALIGNED((uint64)s ^ (uint64)d)){
+      for(; n > 0 && !WALIGNED(d); n--)
+        *--d = *--s;
+      for(; n >= WSIZE; n -= WSIZE){
+        d -= WSIZE;
+        s -= WSIZE;
+        *(uint64*)d = *(uint64*)s;
+      }
+    }
     while(n-- > 0)
       *--d = *--s;
-  } else
+  } else {
+    // a word is read whole before it is written, so this is
+    // safe for overlaps with d below s too.
+    if(WALIGNED((uint64)s ^ (uint64)d)){
+      for(; n > 0 && !WALIGNED(d); n--)
+        *d++ = *s++;
+      for(; n >= WSIZE; n -= WSIZE){
+        *(uint64*)d = *(uint64*)s;
+        d += WSIZE;
+        s += WSIZE;
+      }
+    }
     while(n-- > 0)
       *d++ = *s++;
+  }
 
   return dst;
 }
@@ -6,6 +6,7 @@
 #include "proc.h"
 #include "syscall.h"
 #include "defs.h"
+#include "kstat.h"
 
 // Fetch the uint64 at addr from the current process.
 int
@@ -102,6 +103,17 @@ extern uint64 sys_unlink(void);
 extern uint64 sys_link(void);
 extern uint64 sys_mkdir(void);
 extern uint64 sys_close(void);
+extern uint64 sys_lseek(void);
+extern uint64 sys_lockstat(void);
+extern uint64 sys_spawn(void);
+extern uint64 sys_mmap(void);
+extern uint64 sys_munmap(void);
+extern uint64 sys_setpriority(void);
+extern uint64 sys_setaffinity(void);
+extern uint64 sys_prof(void);
+extern uint64 sys_sync(void);
+extern uint64 sys_fsync(void);
+extern uint64 sys_splice(void);
 
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
@@ -128,6 +140,17 @@ static uint64 (*syscalls[])(void) = {
 [SYS_link]    sys_link,
 [SYS_mkdir]   sys_mkdir,
 [SYS_close]   sys_close,
+[SYS_lseek]   sys_lseek,
+[SYS_lockstat] sys_lockstat,
+[SYS_spawn]   sys_spawn,
+[SYS_mmap]    sys_mmap,
+[SYS_munmap]  sys_munmap,
+[SYS_setpriority] sys_setpriority,
+[SYS_setaffinity] sys_setaffinity,
+[SYS_prof]    sys_prof,
+[SYS_sync]    sys_sync,
+[SYS_fsync]   sys_fsync,
+[SYS_splice]  sys_splice,
 };
 
 void
@@ -137,6 +160,7 @@ syscall(void)
   struct proc *p = myproc();
 
   num = p->trapframe->a7;
+  kstatadd(KS_SYSCALL, 1);
   if(num > 0 && num < NELEM(syscalls) && syscalls[num]) {
     // Use num to lookup the system call function for num, call it,
     // and store its return value in p->trapframe->a0
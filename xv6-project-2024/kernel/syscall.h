@@ -21,4 +21,15 @@
 #define SYS_mkdir  20
 #define SYS_close  21
 #define SYS_symlink 22// *added*
+#define SYS_lseek  23
+#define SYS_lockstat 24
+#define SYS_spawn  25
+#define SYS_mmap   26
+#define SYS_munmap 27
+#define SYS_setpriority 28
+#define SYS_setaffinity 29
+#define SYS_prof 30
+#define SYS_sync 31
+#define SYS_fsync 32
+#define SYS_splice 33
 
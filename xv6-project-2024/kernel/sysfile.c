@@ -28,7 +28,7 @@ sys_symlink(void)
         return -1;
     }
 	//beginning the operation
-    begin_op();
+    begin_opn(LINKBLOCKS);
 	//creating an inode fot the symbolic link with type T_SYMLINK
     struct inode *ip = create(path, T_SYMLINK, 0, 0);
     if (ip == 0) {
@@ -37,6 +37,9 @@ sys_symlink(void)
     }
 	//writing the length of the target path to the inode's data block
     int len = strlen(target);
+	//short targets are kept in addrs[] itself, so the link needs no data block
+    if(sizeof(int) + len + 1 <= sizeof(ip->addrs))
+      ip->flags |= IF_INLINE;
     writei(ip, 0, (uint64)&len, 0, sizeof(int));//writing target's path length
     writei(ip, 0, (uint64)target, sizeof(int), len + 1); //target's path
     iupdate(ip);//updating the inode metadata to ensure changes are saved
@@ -137,6 +140,60 @@ sys_close(void)
   return 0;
 }
 
+uint64
+sys_lseek(void)
+{
+  struct file *f;
+  int off, whence;
+
+  argint(1, &off);
+  argint(2, &whence);
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  return filelseek(f, off, whence);
+}
+
+// Write everything that has been written so far to disk.
+// The second bflush() writes the data blocks that the log had
+// pinned, new blocks logged by bzero(), once installed.
+uint64
+sys_sync(void)
+{
+  bflush(1);
+  log_force();
+  bflush(1);
+  return 0;
+}
+
+// Write fd's file to disk. There is one cache and one log for
+// all files, so this does what sync() does.
+uint64
+sys_fsync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  if(f->type != FD_INODE)
+    return -1;
+  bflush(1);
+  log_force();
+  bflush(1);
+  return 0;
+}
+
+uint64
+sys_splice(void)
+{
+  struct file *in, *out;
+  int n;
+
+  argint(2, &n);
+  if(argfd(0, 0, &in) < 0 || argfd(1, 0, &out) < 0)
+    return -1;
+  return filesplice(in, out, n);
+}
+
 uint64
 sys_fstat(void)
 {
@@ -159,7 +216,7 @@ sys_link(void)
   if(argstr(0, old, MAXPATH) < 0 || argstr(1, new, MAXPATH) < 0)
     return -1;
 
-  begin_op();
+  begin_opn(LINKBLOCKS);
   if((ip = namei(old)) == 0){
     end_op();
     return -1;
@@ -200,16 +257,17 @@ bad:
 }
 
 // Is the directory dp empty except for "." and ".." ?
+// They are the first two entries only in a linear directory.
 static int
 isdirempty(struct inode *dp)
 {
   int off;
   struct dirent de;
 
-  for(off=2*sizeof(de); off<dp->size; off+=sizeof(de)){
+  for(off=0; off<dp->size; off+=sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
       panic("isdirempty: readi");
-    if(de.inum != 0)
+    if(de.inum != 0 && namecmp(de.name, ".") != 0 && namecmp(de.name, "..") != 0)
       return 0;
   }
   return 1;
@@ -226,7 +284,9 @@ sys_unlink(void)
   if(argstr(0, path, MAXPATH) < 0)
     return -1;
 
-  begin_op();
+  // freeing the file, if this was its last link, happens in
+  // end_op(), in a transaction of its own.
+  begin_opn(UNLINKBLOCKS);
   if((dp = nameiparent(path, name)) == 0){
     end_op();
     return -1;
@@ -252,6 +312,7 @@ sys_unlink(void)
   memset(&de, 0, sizeof(de));
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     panic("unlink: writei");
+  dcenter(dp, name, 0, 0);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -347,14 +408,16 @@ sys_open(void)
   char path[MAXPATH];
   int fd, omode;
   struct file *f;
-  struct inode *ip;
-  int n;
+  struct inode *ip, *next;
+  int n, trunc, ext;
 
   argint(1, &omode);
   if((n = argstr(0, path, MAXPATH)) < 0)
     return -1;
 
-  begin_op();
+  // opening an existing file only reads; O_TRUNC truncates
+  // afterwards, in transactions of its own.
+  begin_opn((omode & O_CREATE) ? LINKBLOCKS : 0);
 
   if(omode & O_CREATE){
     ip = create(path, T_FILE, 0, 0);
@@ -370,9 +433,18 @@ sys_open(void)
     ilock(ip);
 //added the below code to handle the symbolic links
 //checking if the inode is a symbolic link and following it unless O_NOFOLLOW is set
-    if(ip->type == T_SYMLINK && !(omode & O_NOFOLLOW)) {
+    if(ip->type == T_SYMLINK && !(omode & O_NOFOLLOW) && (next = symget(ip)) != 0) {
+	  //the chain was resolved before and nothing has changed since: jump to its end
+      iunlockput(ip);
+      ip = next;
+      ilock(ip);
+    } else if(ip->type == T_SYMLINK && !(omode & O_NOFOLLOW)) {
       int count = 0;//counter to track recursion depth for cycle detection
       char symlink_path[MAXPATH];
+	  //remembering the first link so the end of the chain can be recorded in it
+      struct inode *first = idup(ip);
+      uint gen = dcgen();
+      int absolute = 1;
 	  //following symbolic links up to 10 times to prevent cycles, as cited in the project description
       while (ip->type == T_SYMLINK && count < 10) {
         int len = 0;
@@ -380,14 +452,18 @@ sys_open(void)
 		//ensuring the lenght is valid and does not exceed the maximum path length MAXPATH
         if(len > MAXPATH) {
           iunlockput(ip);
+          iput(first);
           end_op();
           return -1;//return error for corrupted or invalid symbolic link
         }
 		//reading the target path from the inode's data block
         readi(ip, 0, (uint64)symlink_path, sizeof(int), len + 1);
+        if(symlink_path[0] != '/')
+          absolute = 0;//relative targets depend on the cwd, so the chain is not memoized
         iunlockput(ip);//unlocking the inode
 		//resolving the symbolic link by creating a new inode for the target path
         if((ip = namei(symlink_path)) == 0){
+          iput(first);
           end_op();
           return -1;
         }
@@ -398,9 +474,13 @@ sys_open(void)
 	 //if recursion exceeds 10, return an error to avoid infinite cycles
       if(count >= 10) {
         iunlockput(ip);
+        iput(first);
         end_op();
         return -1;
       }
+      if(absolute)
+        symset(first, gen, ip->inum);
+      iput(first);
     }
 
     if(ip->type == T_DIR && omode != O_RDONLY){
@@ -435,13 +515,37 @@ sys_open(void)
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
 
-  if((omode & O_TRUNC) && ip->type == T_FILE){
+  // a new, empty file can switch to the extent format, and so
+  // can one that O_TRUNC empties, once it has.
+  ext = (omode & O_CREATE) && (omode & O_EXTENT) && ip->type == T_FILE &&
+        (ip->flags & IF_EXTENT) == 0;
+  if(ext && ip->size == 0){
     itrunc(ip);
+    ip->flags |= IF_EXTENT;
+    iupdate(ip);
+    ext = 0;
   }
 
+  trunc = (omode & O_TRUNC) && ip->type == T_FILE;
   iunlock(ip);
   end_op();
 
+  // f holds the reference itruncsteps() needs.
+  if(trunc)
+    itruncsteps(ip);
+
+  if(ext && trunc){
+    begin_op();
+    ilock(ip);
+    if(ip->size == 0 && (ip->flags & IF_EXTENT) == 0){
+      itrunc(ip);
+      ip->flags |= IF_EXTENT;
+      iupdate(ip);
+    }
+    iunlock(ip);
+    end_op();
+  }
+
   return fd;
 }
 
@@ -452,7 +556,7 @@ sys_mkdir(void)
   char path[MAXPATH];
   struct inode *ip;
 
-  begin_op();
+  begin_opn(LINKBLOCKS);
   if(argstr(0, path, MAXPATH) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0){
     end_op();
     return -1;
@@ -469,7 +573,7 @@ sys_mknod(void)
   char path[MAXPATH];
   int major, minor;
 
-  begin_op();
+  begin_opn(LINKBLOCKS);
   argint(1, &major);
   argint(2, &minor);
   if((argstr(0, path, MAXPATH)) < 0 ||
@@ -489,7 +593,7 @@ sys_chdir(void)
   struct inode *ip;
   struct proc *p = myproc();
   
-  begin_op();
+  begin_opn(0);
   if(argstr(0, path, MAXPATH) < 0 || (ip = namei(path)) == 0){
     end_op();
     return -1;
@@ -507,24 +611,22 @@ sys_chdir(void)
   return 0;
 }
 
-uint64
-sys_exec(void)
+// Copy the user argument vector at uargv into argv[MAXARG],
+// one kalloc()ed page per string. The caller must freeargv()
+// afterwards, even if this fails.
+static int
+fetchargv(uint64 uargv, char **argv)
 {
-  char path[MAXPATH], *argv[MAXARG];
   int i;
-  uint64 uargv, uarg;
+  uint64 uarg;
 
-  argaddr(1, &uargv);
-  if(argstr(0, path, MAXPATH) < 0) {
-    return -1;
-  }
-  memset(argv, 0, sizeof(argv));
+  memset(argv, 0, MAXARG*sizeof(char*));
   for(i=0;; i++){
-    if(i >= NELEM(argv)){
-      goto bad;
+    if(i >= MAXARG){
+      return -1;
     }
     if(fetchaddr(uargv+sizeof(uint64)*i, (uint64*)&uarg) < 0){
-      goto bad;
+      return -1;
     }
     if(uarg == 0){
       argv[i] = 0;
@@ -532,22 +634,88 @@ sys_exec(void)
     }
     argv[i] = kalloc();
     if(argv[i] == 0)
-      goto bad;
+      return -1;
     if(fetchstr(uarg, argv[i], PGSIZE) < 0)
-      goto bad;
+      return -1;
   }
+  return 0;
+}
 
-  int ret = exec(path, argv);
+static void
+freeargv(char **argv)
+{
+  int i;
 
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
+  for(i = 0; i < MAXARG && argv[i] != 0; i++)
     kfree(argv[i]);
+}
+
+uint64
+sys_exec(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+  uint64 uargv;
+  int ret;
 
+  argaddr(1, &uargv);
+  if(argstr(0, path, MAXPATH) < 0) {
+    return -1;
+  }
+  ret = -1;
+  if(fetchargv(uargv, argv) == 0)
+    ret = exec(path, argv);
+  freeargv(argv);
   return ret;
+}
 
- bad:
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
-    kfree(argv[i]);
-  return -1;
+uint64
+sys_mmap(void)
+{
+  uint64 len;
+  int prot, flags, fd, off;
+  struct file *f = 0;
+
+  argaddr(1, &len);
+  argint(2, &prot);
+  argint(3, &flags);
+  argint(4, &fd);
+  argint(5, &off);
+  if((flags & MAP_ANON) == 0 && argfd(4, 0, &f) < 0)
+    return -1;
+  if(off < 0)
+    return -1;
+  return mmap(len, prot, flags, f, off);
+}
+
+uint64
+sys_munmap(void)
+{
+  uint64 addr, len;
+
+  argaddr(0, &addr);
+  argaddr(1, &len);
+  return munmap(addr, len);
+}
+
+uint64
+sys_spawn(void)
+{
+  char path[MAXPATH], *argv[MAXARG];
+  int fds[NSPAWNFD];
+  uint64 uargv, ufds;
+  int ret;
+
+  argaddr(1, &uargv);
+  argaddr(2, &ufds);
+  if(argstr(0, path, MAXPATH) < 0)
+    return -1;
+  if(ufds && copyin(myproc()->pagetable, (char*)fds, ufds, sizeof(fds)) < 0)
+    return -1;
+  ret = -1;
+  if(fetchargv(uargv, argv) == 0)
+    ret = spawn(path, argv, ufds ? fds : 0);
+  freeargv(argv);
+  return ret;
 }
 
 uint64
@@ -52,24 +52,41 @@ uint64
 sys_sleep(void)
 {
   int n;
-  uint ticks0;
+  uint deadline;
+  struct proc *p = myproc();
 
   argint(0, &n);
   if(n < 0)
     n = 0;
-  acquire(&tickslock);
-  ticks0 = ticks;
-  while(ticks - ticks0 < n){
-    if(killed(myproc())){
-      release(&tickslock);
+  deadline = tickcount() + n;
+  while((int)(deadline - tickcount()) > 0){
+    if(killed(p))
       return -1;
-    }
-    sleep(&ticks, &tickslock);
+    sleeptimed(p, 0, deadline);
   }
-  release(&tickslock);
   return 0;
 }
 
+uint64
+sys_setpriority(void)
+{
+  int pid, nice;
+
+  argint(0, &pid);
+  argint(1, &nice);
+  return setpriority(pid, nice);
+}
+
+uint64
+sys_setaffinity(void)
+{
+  int pid, cpu;
+
+  argint(0, &pid);
+  argint(1, &cpu);
+  return setaffinity(pid, cpu);
+}
+
 uint64
 sys_kill(void)
 {
@@ -79,15 +96,37 @@ sys_kill(void)
   return kill(pid);
 }
 
+// Copy the spinlock contention statistics to a user array
+// of n struct lockstat. Returns the number of entries.
+uint64
+sys_lockstat(void)
+{
+  uint64 addr;
+  int n;
+
+  argaddr(0, &addr);
+  argint(1, &n);
+  return lockstatcopy(addr, n);
+}
+
+// Control the sampling profiler: prof(op, buf, n), op being
+// one of PROF_* in prof.h.
+uint64
+sys_prof(void)
+{
+  uint64 addr;
+  int op, n;
+
+  argint(0, &op);
+  argaddr(1, &addr);
+  argint(2, &n);
+  return profctl(op, addr, n);
+}
+
 // return how many clock tick interrupts have occurred
 // since start.
 uint64
 sys_uptime(void)
 {
-  uint xticks;
-
-  acquire(&tickslock);
-  xticks = ticks;
-  release(&tickslock);
-  return xticks;
+  return tickcount();
 }
@@ -5,9 +5,7 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "defs.h"
-
-struct spinlock tickslock;
-uint ticks;
+#include "kstat.h"
 
 extern char trampoline[], uservec[], userret[];
 
@@ -19,7 +17,14 @@ extern int devintr();
 void
 trapinit(void)
 {
-  initlock(&tickslock, "time");
+}
+
+// Ticks since boot, straight from the time CSR, so that no CPU
+// has to take a timer interrupt just to count them.
+uint
+tickcount(void)
+{
+  return r_time() / TICKTIME;
 }
 
 // set up to take exceptions and traps while in the kernel.
@@ -67,6 +72,21 @@ usertrap(void)
     syscall();
   } else if((which_dev = devintr()) != 0){
     // ok
+  } else if(r_scause() == 12 || r_scause() == 13 || r_scause() == 15){
+    // page fault: a program segment or heap page that hasn't
+    // been touched yet, or a write to a copy-on-write page.
+    uint64 scause = r_scause(), stval = r_stval();
+
+    // paging in from the executable may sleep on the disk.
+    intr_on();
+
+    if(vmfault(p, stval, scause == 15) < 0){
+      printf("usertrap(): page fault scause 0x%lx pid=%d\n", scause, p->pid);
+      printf("            sepc=0x%lx stval=0x%lx\n", p->trapframe->epc, stval);
+      setkilled(p);
+    } else {
+      kstatadd(KS_PGFAULT, 1);
+    }
   } else {
     printf("usertrap(): unexpected scause 0x%lx pid=%d\n", r_scause(), p->pid);
     printf("            sepc=0x%lx stval=0x%lx\n", r_sepc(), r_stval());
@@ -163,17 +183,13 @@ kerneltrap()
 void
 clockintr()
 {
-  if(cpuid() == 0){
-    acquire(&tickslock);
-    ticks++;
-    wakeup(&ticks);
-    release(&tickslock);
-  }
+  // SPP says which mode the interrupt came from; sepc is
+  // the pc it interrupted.
+  profsample(r_sepc(), (r_sstatus() & SSTATUS_SPP) == 0);
 
-  // ask for the next timer interrupt. this also clears
-  // the interrupt request. 1000000 is about a tenth
-  // of a second.
-  w_stimecmp(r_time() + 1000000);
+  // wake sleepers due on this CPU, and ask for the next
+  // timer interrupt. this also clears the interrupt request.
+  timertick();
 }
 
 // check if it's an external interrupt or software interrupt,
@@ -211,6 +227,11 @@ devintr()
     // timer interrupt.
     clockintr();
     return 2;
+  } else if(scause == 0x8000000000000001L){
+    // software interrupt from cpukick(), via machinevec;
+    // it only wakes the scheduler from wfi.
+    w_sip(r_sip() & ~2);
+    return 1;
   } else {
     return 0;
   }
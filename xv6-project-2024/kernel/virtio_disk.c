@@ -19,7 +19,14 @@
 // the address of virtio mmio register r.
 #define R(r) ((volatile uint32 *)(VIRTIO0 + (r)))
 
-static struct disk {
+// at most this many virtqueues, one per hart. a hart submits
+// on queue cpuid() % disk.nq, under that queue's lock only, so
+// harts doing I/O at once don't contend in the driver. the
+// device has a single interrupt for all queues, and
+// virtio_disk_intr() completes each queue under its own lock.
+#define NVQ NCPU
+
+struct vq {
   // a set (not a ring) of DMA descriptors, with which the
   // driver tells the device where to read and write individual
   // disk operations. there are NUM descriptors.
@@ -53,18 +60,70 @@ static struct disk {
   // disk command headers.
   // one-for-one with descriptors, for convenience.
   struct virtio_blk_req ops[NUM];
-  
-  struct spinlock vdisk_lock;
-  
+
+  struct spinlock lock;
+} __attribute__((aligned(64)));
+
+static struct disk {
+  struct vq q[NVQ];
+  int nq;          // queues the device gave us
 } disk;
 
+// select virtqueue qi and set it up.
+static void
+vq_init(int qi)
+{
+  struct vq *q = &disk.q[qi];
+
+  initlock(&q->lock, "virtio_disk");
+
+  *R(VIRTIO_MMIO_QUEUE_SEL) = qi;
+
+  // ensure the queue is not in use.
+  if(*R(VIRTIO_MMIO_QUEUE_READY))
+    panic("virtio disk should not be ready");
+
+  // check maximum queue size.
+  uint32 max = *R(VIRTIO_MMIO_QUEUE_NUM_MAX);
+  if(max == 0)
+    panic("virtio disk has no queue");
+  if(max < NUM)
+    panic("virtio disk max queue too short");
+
+  // allocate and zero queue memory.
+  q->desc = kalloc();
+  q->avail = kalloc();
+  q->used = kalloc();
+  if(!q->desc || !q->avail || !q->used)
+    panic("virtio disk kalloc");
+  memset(q->desc, 0, PGSIZE);
+  memset(q->avail, 0, PGSIZE);
+  memset(q->used, 0, PGSIZE);
+
+  // set queue size.
+  *R(VIRTIO_MMIO_QUEUE_NUM) = NUM;
+
+  // write physical addresses.
+  *R(VIRTIO_MMIO_QUEUE_DESC_LOW) = (uint64)q->desc;
+  *R(VIRTIO_MMIO_QUEUE_DESC_HIGH) = (uint64)q->desc >> 32;
+  *R(VIRTIO_MMIO_DRIVER_DESC_LOW) = (uint64)q->avail;
+  *R(VIRTIO_MMIO_DRIVER_DESC_HIGH) = (uint64)q->avail >> 32;
+  *R(VIRTIO_MMIO_DEVICE_DESC_LOW) = (uint64)q->used;
+  *R(VIRTIO_MMIO_DEVICE_DESC_HIGH) = (uint64)q->used >> 32;
+
+  // queue is ready.
+  *R(VIRTIO_MMIO_QUEUE_READY) = 0x1;
+
+  // all NUM descriptors start out unused.
+  for(int i = 0; i < NUM; i++)
+    q->free[i] = 1;
+}
+
 void
 virtio_disk_init(void)
 {
   uint32 status = 0;
 
-  initlock(&disk.vdisk_lock, "virtio_disk");
-
   if(*R(VIRTIO_MMIO_MAGIC_VALUE) != 0x74726976 ||
      *R(VIRTIO_MMIO_VERSION) != 2 ||
      *R(VIRTIO_MMIO_DEVICE_ID) != 2 ||
@@ -88,7 +147,6 @@ virtio_disk_init(void)
   features &= ~(1 << VIRTIO_BLK_F_RO);
   features &= ~(1 << VIRTIO_BLK_F_SCSI);
   features &= ~(1 << VIRTIO_BLK_F_CONFIG_WCE);
-  features &= ~(1 << VIRTIO_BLK_F_MQ);
   features &= ~(1 << VIRTIO_F_ANY_LAYOUT);
   features &= ~(1 << VIRTIO_RING_F_EVENT_IDX);
   features &= ~(1 << VIRTIO_RING_F_INDIRECT_DESC);
@@ -103,47 +161,16 @@ virtio_disk_init(void)
   if(!(status & VIRTIO_CONFIG_S_FEATURES_OK))
     panic("virtio disk FEATURES_OK unset");
 
-  // initialize queue 0.
-  *R(VIRTIO_MMIO_QUEUE_SEL) = 0;
-
-  // ensure queue 0 is not in use.
-  if(*R(VIRTIO_MMIO_QUEUE_READY))
-    panic("virtio disk should not be ready");
-
-  // check maximum queue size.
-  uint32 max = *R(VIRTIO_MMIO_QUEUE_NUM_MAX);
-  if(max == 0)
-    panic("virtio disk has no queue 0");
-  if(max < NUM)
-    panic("virtio disk max queue too short");
-
-  // allocate and zero queue memory.
-  disk.desc = kalloc();
-  disk.avail = kalloc();
-  disk.used = kalloc();
-  if(!disk.desc || !disk.avail || !disk.used)
-    panic("virtio disk kalloc");
-  memset(disk.desc, 0, PGSIZE);
-  memset(disk.avail, 0, PGSIZE);
-  memset(disk.used, 0, PGSIZE);
-
-  // set queue size.
-  *R(VIRTIO_MMIO_QUEUE_NUM) = NUM;
-
-  // write physical addresses.
-  *R(VIRTIO_MMIO_QUEUE_DESC_LOW) = (uint64)disk.desc;
-  *R(VIRTIO_MMIO_QUEUE_DESC_HIGH) = (uint64)disk.desc >> 32;
-  *R(VIRTIO_MMIO_DRIVER_DESC_LOW) = (uint64)disk.avail;
-  *R(VIRTIO_MMIO_DRIVER_DESC_HIGH) = (uint64)disk.avail >> 32;
-  *R(VIRTIO_MMIO_DEVICE_DESC_LOW) = (uint64)disk.used;
-  *R(VIRTIO_MMIO_DEVICE_DESC_HIGH) = (uint64)disk.used >> 32;
-
-  // queue is ready.
-  *R(VIRTIO_MMIO_QUEUE_READY) = 0x1;
-
-  // all NUM descriptors start out unused.
-  for(int i = 0; i < NUM; i++)
-    disk.free[i] = 1;
+  // one queue per hart, if the device can do several.
+  disk.nq = 1;
+  if(features & (1 << VIRTIO_BLK_F_MQ))
+    disk.nq = *(volatile uint16 *)(VIRTIO0 + VIRTIO_MMIO_CONFIG + VIRTIO_BLK_CONFIG_NUM_QUEUES);
+  if(disk.nq < 1)
+    disk.nq = 1;
+  if(disk.nq > NVQ)
+    disk.nq = NVQ;
+  for(int qi = 0; qi < disk.nq; qi++)
+    vq_init(qi);
 
   // tell device we're completely ready.
   status |= VIRTIO_CONFIG_S_DRIVER_OK;
@@ -152,43 +179,43 @@ virtio_disk_init(void)
   // plic.c and trap.c arrange for interrupts from VIRTIO0_IRQ.
 }
 
-// find a free descriptor, mark it non-free, return its index.
+// find a free descriptor of q, mark it non-free, return its index.
 static int
-alloc_desc()
+alloc_desc(struct vq *q)
 {
   for(int i = 0; i < NUM; i++){
-    if(disk.free[i]){
-      disk.free[i] = 0;
+    if(q->free[i]){
+      q->free[i] = 0;
       return i;
     }
   }
   return -1;
 }
 
-// mark a descriptor as free.
+// mark a descriptor of q as free.
 static void
-free_desc(int i)
+free_desc(struct vq *q, int i)
 {
   if(i >= NUM)
     panic("free_desc 1");
-  if(disk.free[i])
+  if(q->free[i])
     panic("free_desc 2");
-  disk.desc[i].addr = 0;
-  disk.desc[i].len = 0;
-  disk.desc[i].flags = 0;
-  disk.desc[i].next = 0;
-  disk.free[i] = 1;
-  wakeup(&disk.free[0]);
+  q->desc[i].addr = 0;
+  q->desc[i].len = 0;
+  q->desc[i].flags = 0;
+  q->desc[i].next = 0;
+  q->free[i] = 1;
+  wakeup(&q->free[0]);
 }
 
-// free a chain of descriptors.
+// free a chain of descriptors of q.
 static void
-free_chain(int i)
+free_chain(struct vq *q, int i)
 {
   while(1){
-    int flag = disk.desc[i].flags;
-    int nxt = disk.desc[i].next;
-    free_desc(i);
+    int flag = q->desc[i].flags;
+    int nxt = q->desc[i].next;
+    free_desc(q, i);
     if(flag & VRING_DESC_F_NEXT)
       i = nxt;
     else
@@ -196,46 +223,80 @@ free_chain(int i)
   }
 }
 
-// allocate three descriptors (they need not be contiguous).
-// disk transfers always use three descriptors.
+// allocate n descriptors of q (they need not be contiguous).
+// a disk transfer of k blocks uses k+2 descriptors.
 static int
-alloc3_desc(int *idx)
+alloc_descs(struct vq *q, int *idx, int n)
 {
-  for(int i = 0; i < 3; i++){
-    idx[i] = alloc_desc();
+  for(int i = 0; i < n; i++){
+    idx[i] = alloc_desc(q);
     if(idx[i] < 0){
       for(int j = 0; j < i; j++)
-        free_desc(idx[j]);
+        free_desc(q, idx[j]);
       return -1;
     }
   }
   return 0;
 }
 
+// Queue a read or write of b on the disk and return without
+// waiting for it to finish; virtio_disk_wait() does that.
+// This lets callers have many requests in flight at once.
+// b must stay locked until the request completes.
 void
-virtio_disk_rw(struct buf *b, int write)
+virtio_disk_submit(struct buf *b, int write)
+{
+  virtio_disk_submit_at(b, b->blockno, write);
+}
+
+// Like virtio_disk_submit(), but transfer b->data to or from
+// disk block blockno instead of b's own block.
+void
+virtio_disk_submit_at(struct buf *b, uint blockno, int write)
+{
+  virtio_disk_submitv(&b, 1, blockno, write);
+}
+
+// Queue one request that transfers the n buffers bs[] to or
+// from the n consecutive disk blocks starting at blockno, so a
+// run of adjacent blocks costs the device a single request.
+// virtio_disk_wait() each buffer to finish.
+void
+virtio_disk_submitv(struct buf **bs, int n, uint blockno, int write)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
+  uint64 sector = blockno * (BSIZE / 512);
+  int i;
 
-  acquire(&disk.vdisk_lock);
+  if(n < 1 || n > DISKRUN)
+    panic("virtio_disk_submitv");
+
+  // this hart's queue. if the process moves to another hart
+  // meanwhile, the request still completes on this queue.
+  push_off();
+  int qi = cpuid() % disk.nq;
+  pop_off();
+  struct vq *q = &disk.q[qi];
+
+  acquire(&q->lock);
 
   // the spec's Section 5.2 says that legacy block operations use
-  // three descriptors: one for type/reserved/sector, one for the
-  // data, one for a 1-byte status result.
+  // a descriptor for type/reserved/sector, then the data, then
+  // one for a 1-byte status result. the data may be split over
+  // several descriptors, one per buffer here.
 
-  // allocate the three descriptors.
-  int idx[3];
+  // allocate the descriptors.
+  int idx[DISKRUN+2];
   while(1){
-    if(alloc3_desc(idx) == 0) {
+    if(alloc_descs(q, idx, n+2) == 0) {
       break;
     }
-    sleep(&disk.free[0], &disk.vdisk_lock);
+    sleep(&q->free[0], &q->lock);
   }
 
   // format the three descriptors.
   // qemu's virtio-blk.c reads them.
 
-  struct virtio_blk_req *buf0 = &disk.ops[idx[0]];
+  struct virtio_blk_req *buf0 = &q->ops[idx[0]];
 
   if(write)
     buf0->type = VIRTIO_BLK_T_OUT; // write the disk
@@ -244,84 +305,118 @@ virtio_disk_rw(struct buf *b, int write)
   buf0->reserved = 0;
   buf0->sector = sector;
 
-  disk.desc[idx[0]].addr = (uint64) buf0;
-  disk.desc[idx[0]].len = sizeof(struct virtio_blk_req);
-  disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
-  disk.desc[idx[0]].next = idx[1];
-
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
-  if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
-  else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
+  q->desc[idx[0]].addr = (uint64) buf0;
+  q->desc[idx[0]].len = sizeof(struct virtio_blk_req);
+  q->desc[idx[0]].flags = VRING_DESC_F_NEXT;
+  q->desc[idx[0]].next = idx[1];
+
+  for(i = 0; i < n; i++){
+    struct virtq_desc *d = &q->desc[idx[1+i]];
+    d->addr = (uint64) bs[i]->data;
+    d->len = BSIZE;
+    if(write)
+      d->flags = 0; // device reads b->data
+    else
+      d->flags = VRING_DESC_F_WRITE; // device writes b->data
+    d->flags |= VRING_DESC_F_NEXT;
+    d->next = idx[2+i];
+
+    // chain the bufs for virtio_disk_intr().
+    bs[i]->disk = 1;
+    bs[i]->vq = qi;
+    bs[i]->runnext = i+1 < n ? bs[i+1] : 0;
+  }
 
-  disk.info[idx[0]].status = 0xff; // device writes 0 on success
-  disk.desc[idx[2]].addr = (uint64) &disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk.desc[idx[2]].next = 0;
+  q->info[idx[0]].status = 0xff; // device writes 0 on success
+  q->desc[idx[n+1]].addr = (uint64) &q->info[idx[0]].status;
+  q->desc[idx[n+1]].len = 1;
+  q->desc[idx[n+1]].flags = VRING_DESC_F_WRITE; // device writes the status
+  q->desc[idx[n+1]].next = 0;
 
-  // record struct buf for virtio_disk_intr().
-  b->disk = 1;
-  disk.info[idx[0]].b = b;
+  // record the first struct buf for virtio_disk_intr().
+  q->info[idx[0]].b = bs[0];
 
   // tell the device the first index in our chain of descriptors.
-  disk.avail->ring[disk.avail->idx % NUM] = idx[0];
+  q->avail->ring[q->avail->idx % NUM] = idx[0];
 
   __sync_synchronize();
 
   // tell the device another avail ring entry is available.
-  disk.avail->idx += 1; // not % NUM ...
+  q->avail->idx += 1; // not % NUM ...
 
   __sync_synchronize();
 
-  *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+  *R(VIRTIO_MMIO_QUEUE_NOTIFY) = qi; // value is queue number
 
-  // Wait for virtio_disk_intr() to say request has finished.
+  release(&q->lock);
+}
+
+// Wait for virtio_disk_intr() to say b's request has finished.
+void
+virtio_disk_wait(struct buf *b)
+{
+  struct vq *q = &disk.q[b->vq];
+
+  acquire(&q->lock);
   while(b->disk == 1) {
-    sleep(b, &disk.vdisk_lock);
+    sleep(b, &q->lock);
   }
+  release(&q->lock);
+}
 
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
+void
+virtio_disk_rw(struct buf *b, int write)
+{
+  virtio_disk_submit(b, write);
+  virtio_disk_wait(b);
+}
+
+// complete the requests the device has finished on q.
+static void
+vq_intr(struct vq *q)
+{
+  acquire(&q->lock);
 
-  release(&disk.vdisk_lock);
+  // the device increments q->used->idx when it
+  // adds an entry to the used ring.
+
+  while(q->used_idx != q->used->idx){
+    __sync_synchronize();
+    int id = q->used->ring[q->used_idx % NUM].id;
+
+    if(q->info[id].status != 0)
+      panic("virtio_disk_intr status");
+
+    struct buf *b = q->info[id].b, *nb;
+    for(; b; b = nb){
+      nb = b->runnext;
+      b->runnext = 0;
+      b->disk = 0;   // disk is done with buf
+      wakeup(b);
+    }
+    q->info[id].b = 0;
+    free_chain(q, id);
+
+    q->used_idx += 1;
+  }
+
+  release(&q->lock);
 }
 
 void
 virtio_disk_intr()
 {
-  acquire(&disk.vdisk_lock);
-
   // the device won't raise another interrupt until we tell it
   // we've seen this interrupt, which the following line does.
   // this may race with the device writing new entries to
-  // the "used" ring, in which case we may process the new
+  // the "used" rings, in which case we may process the new
   // completion entries in this interrupt, and have nothing to do
   // in the next interrupt, which is harmless.
   *R(VIRTIO_MMIO_INTERRUPT_ACK) = *R(VIRTIO_MMIO_INTERRUPT_STATUS) & 0x3;
 
   __sync_synchronize();
 
-  // the device increments disk.used->idx when it
-  // adds an entry to the used ring.
-
-  while(disk.used_idx != disk.used->idx){
-    __sync_synchronize();
-    int id = disk.used->ring[disk.used_idx % NUM].id;
-
-    if(disk.info[id].status != 0)
-      panic("virtio_disk_intr status");
-
-    struct buf *b = disk.info[id].b;
-    b->disk = 0;   // disk is done with buf
-    wakeup(b);
-
-    disk.used_idx += 1;
-  }
-
-  release(&disk.vdisk_lock);
+  // the interrupt doesn't say which queue finished something.
+  for(int qi = 0; qi < disk.nq; qi++)
+    vq_intr(&disk.q[qi]);
 }
@@ -5,6 +5,8 @@
 #include "riscv.h"
 #include "defs.h"
 #include "fs.h"
+#include "spinlock.h"
+#include "proc.h"
 
 /*
  * the kernel's page table.
@@ -15,6 +17,9 @@ extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
 
+static pte_t *walklevel(pagetable_t, uint64, int, int);
+static void ucflush(pagetable_t);
+
 // Make a direct-map page table for the kernel.
 pagetable_t
 kvmmake(void)
@@ -30,6 +35,9 @@ kvmmake(void)
   // virtio mmio disk interface
   kvmmap(kpgtbl, VIRTIO0, VIRTIO0, PGSIZE, PTE_R | PTE_W);
 
+  // CLINT, for cpukick()
+  kvmmap(kpgtbl, CLINT, CLINT, 0x10000, PTE_R | PTE_W);
+
   // PLIC
   kvmmap(kpgtbl, PLIC, PLIC, 0x4000000, PTE_R | PTE_W);
 
@@ -82,29 +90,44 @@ kvminithart()
 //   21..29 -- 9 bits of level-1 index.
 //   12..20 -- 9 bits of level-0 index.
 //    0..11 -- 12 bits of byte offset within the page.
+//
+// A valid PTE with R, W or X set above level 0 is a megapage
+// leaf; walk returns it as is. Only the kernel page table
+// uses megapages, so user callers always get a level-0 PTE.
 pte_t *
 walk(pagetable_t pagetable, uint64 va, int alloc)
+{
+  return walklevel(pagetable, va, alloc, 0);
+}
+
+// Like walk, but stop at page-table level stop, so that
+// stop==1 yields the PTE for the 2MB megapage holding va.
+static pte_t *
+walklevel(pagetable_t pagetable, uint64 va, int alloc, int stop)
 {
   if(va >= MAXVA)
     panic("walk");
 
-  for(int level = 2; level > 0; level--) {
+  for(int level = 2; level > stop; level--) {
     pte_t *pte = &pagetable[PX(level, va)];
     if(*pte & PTE_V) {
+      if(*pte & (PTE_R|PTE_W|PTE_X))
+        return pte;
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
-      if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
+      if(!alloc || (pagetable = (pde_t*)kalloc_zeroed()) == 0)
         return 0;
-      memset(pagetable, 0, PGSIZE);
       *pte = PA2PTE(pagetable) | PTE_V;
     }
   }
-  return &pagetable[PX(0, va)];
+  return &pagetable[PX(stop, va)];
 }
 
 // Look up a virtual address, return the physical address,
 // or 0 if not mapped.
 // Can only be used to look up user pages.
+// Heap pages of the current process that haven't been
+// touched yet are allocated on the way.
 uint64
 walkaddr(pagetable_t pagetable, uint64 va)
 {
@@ -115,10 +138,11 @@ walkaddr(pagetable_t pagetable, uint64 va)
     return 0;
 
   pte = walk(pagetable, va, 0);
-  if(pte == 0)
-    return 0;
-  if((*pte & PTE_V) == 0)
-    return 0;
+  if(pte == 0 || (*pte & PTE_V) == 0){
+    if(lazyalloc(pagetable, va) < 0)
+      return 0;
+    pte = walk(pagetable, va, 0);
+  }
   if((*pte & PTE_U) == 0)
     return 0;
   pa = PTE2PA(*pte);
@@ -131,8 +155,32 @@ walkaddr(pagetable_t pagetable, uint64 va)
 void
 kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm)
 {
-  if(mappages(kpgtbl, va, sz, pa, perm) != 0)
-    panic("kvmmap");
+  uint64 n;
+  pte_t *pte;
+
+  // use a 2MB megapage wherever va and pa are both aligned and
+  // a whole megapage remains, and 4KB pages for the edges. This
+  // maps all of RAM with ~64 PTEs instead of ~32K, and lets the
+  // TLB cover the direct map with a handful of entries.
+  while(sz > 0){
+    if(va % MEGAPGSIZE == 0 && pa % MEGAPGSIZE == 0 && sz >= MEGAPGSIZE){
+      n = MEGAPGSIZE;
+      if((pte = walklevel(kpgtbl, va, 1, 1)) == 0)
+        panic("kvmmap");
+      if(*pte & PTE_V)
+        panic("kvmmap: remap");
+      *pte = PA2PTE(pa) | perm | PTE_V;
+    } else {
+      n = MEGAPGSIZE - va % MEGAPGSIZE;
+      if(n > sz)
+        n = sz;
+      if(mappages(kpgtbl, va, n, pa, perm) != 0)
+        panic("kvmmap");
+    }
+    va += n;
+    pa += n;
+    sz -= n;
+  }
 }
 
 // Create PTEs for virtual addresses starting at va that refer to
@@ -172,7 +220,8 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 }
 
 // Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
+// page-aligned. Pages that were never mapped (lazily
+// allocated heap that wasn't touched) are skipped.
 // Optionally free the physical memory.
 void
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
@@ -183,11 +232,13 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
   if((va % PGSIZE) != 0)
     panic("uvmunmap: not aligned");
 
+  ucflush(pagetable);
+
   for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
     if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
+      continue;
     if((*pte & PTE_V) == 0)
-      panic("uvmunmap: not mapped");
+      continue;
     if(PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");
     if(do_free){
@@ -204,10 +255,9 @@ pagetable_t
 uvmcreate()
 {
   pagetable_t pagetable;
-  pagetable = (pagetable_t) kalloc();
+  pagetable = (pagetable_t) kalloc_zeroed();
   if(pagetable == 0)
     return 0;
-  memset(pagetable, 0, PGSIZE);
   return pagetable;
 }
 
@@ -240,12 +290,11 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm)
 
   oldsz = PGROUNDUP(oldsz);
   for(a = oldsz; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = kalloc_zeroed();
     if(mem == 0){
       uvmdealloc(pagetable, a, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pagetable, a, PGSIZE, (uint64)mem, PTE_R|PTE_U|xperm) != 0){
       kfree(mem);
       uvmdealloc(pagetable, a, oldsz);
@@ -303,42 +352,191 @@ uvmfree(pagetable_t pagetable, uint64 sz)
   freewalk(pagetable);
 }
 
-// Given a parent process's page table, copy
-// its memory into a child's page table.
-// Copies both the page table and the
-// physical memory.
+// Given a parent process's page table, share
+// its memory with a child's page table.
+// Copies only the page table: writable pages are
+// made read-only and copy-on-write in both parent
+// and child, and cowfault() copies them on the
+// first write.
 // returns 0 on success, -1 on failure.
-// frees any allocated pages on failure.
+// releases any shared pages on failure.
 int
 uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
+{
+  return uvmcopyrange(old, new, 0, sz, 0);
+}
+
+// Like uvmcopy(), for the pages in [start, end). If shared,
+// the child gets the very same pages, writable as before,
+// as MAP_SHARED regions need.
+int
+uvmcopyrange(pagetable_t old, pagetable_t new, uint64 start, uint64 end, int shared)
 {
   pte_t *pte;
   uint64 pa, i;
   uint flags;
-  char *mem;
 
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
-    if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
+  ucflush(old);
+  for(i = start; i < end; i += PGSIZE){
+    if((pte = walk(old, i, 0)) == 0 || (*pte & PTE_V) == 0)
+      continue;  // lazy page not yet allocated in the parent
+    if((*pte & PTE_W) && !shared)
+      *pte = (*pte & ~PTE_W) | PTE_COW;
     pa = PTE2PA(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
+    if(mappages(new, i, PGSIZE, pa, flags) != 0)
       goto err;
-    memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
+    krefinc((void*)pa);
+  }
+  return 0;
+
+ err:
+  uvmunmap(new, start, (i - start) / PGSIZE, 1);
+  return -1;
+}
+
+// Return the segment of p's executable that covers va, or 0.
+static struct vmseg*
+findseg(struct proc *p, uint64 va)
+{
+  for(int i = 0; i < p->nseg; i++){
+    if(va >= p->seg[i].va && va < p->seg[i].va + p->seg[i].memsz)
+      return &p->seg[i];
+  }
+  return 0;
+}
+
+// Allocate and map the page at va if it lies in the current
+// process but was never touched. exec() leaves program
+// segments to be read from the executable here, and
+// growproc() only raises p->sz and leaves heap pages to
+// be zero-filled here.
+// Reading a segment page may sleep; see vmprefault().
+// Returns 0 on success, -1 if va is outside the process
+// or already mapped, or there is no memory.
+int
+lazyalloc(pagetable_t pagetable, uint64 va)
+{
+  struct proc *p = myproc();
+  struct vmseg *s;
+  struct vma *v;
+  pte_t *pte;
+  char *mem;
+  int perm;
+
+  if(p == 0 || p->pagetable != pagetable || va >= MAXVA)
+    return -1;
+  va = PGROUNDDOWN(va);
+  if((pte = walk(pagetable, va, 0)) != 0 && (*pte & PTE_V))
+    return -1;
+  if((v = vmafind(p, va)) != 0)
+    return vmafault(p, v, va);
+  if(va >= p->sz)
+    return -1;
+  if((mem = kalloc_zeroed()) == 0)
+    return -1;
+  perm = PTE_R|PTE_W|PTE_U;
+  if((s = findseg(p, va)) != 0){
+    perm = PTE_R|PTE_U|s->perm;
+    if(loadseg(p, s, va, mem) < 0){
       kfree(mem);
-      goto err;
+      return -1;
     }
   }
+  if(mappages(pagetable, va, PGSIZE, (uint64)mem, perm) != 0){
+    kfree(mem);
+    return -1;
+  }
   return 0;
+}
 
- err:
-  uvmunmap(new, 0, i / PGSIZE, 1);
+// Page in the file-backed parts of [va, va+len) in p before
+// a system call copies to or from them while holding a
+// spinlock (e.g. pipes, the console, wait()), since
+// lazyalloc() would have to sleep reading the executable
+// or an mmap()ed file.
+// Errors are left for the copy itself to report.
+void
+vmprefault(struct proc *p, uint64 va, uint64 len)
+{
+  uint64 a, end;
+  struct vmseg *s;
+  struct vma *v;
+
+  for(s = p->seg; s < &p->seg[p->nseg]; s++){
+    a = va > s->va ? va : s->va;
+    end = va + len < s->va + s->filesz ? va + len : s->va + s->filesz;
+    for(a = PGROUNDDOWN(a); a < end; a += PGSIZE)
+      lazyalloc(p->pagetable, a);
+  }
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->len == 0 || v->f == 0)
+      continue;
+    a = va > v->va ? va : v->va;
+    end = va + len < v->va + v->len ? va + len : v->va + v->len;
+    for(a = PGROUNDDOWN(a); a < end; a += PGSIZE)
+      lazyalloc(p->pagetable, a);
+  }
+}
+
+// Handle a page fault at va in process p. write is set
+// for store faults. Returns 0 if the fault was resolved
+// and the instruction can be restarted, -1 otherwise.
+int
+vmfault(struct proc *p, uint64 va, int write)
+{
+  pte_t *pte;
+
+  if(va >= MAXVA)
+    return -1;
+  pte = walk(p->pagetable, va, 0);
+  if(pte == 0 || (*pte & PTE_V) == 0)
+    return lazyalloc(p->pagetable, va);
+  if(write)
+    return cowfault(p->pagetable, va);
   return -1;
 }
 
+// Resolve a write to the copy-on-write page holding va:
+// give pagetable a private, writable copy of the page,
+// or just make it writable if no one else shares it.
+// Returns 0 on success, -1 if va isn't a COW page or
+// there's no memory for the copy. A store to a read-only
+// page that isn't COW may be the first to an mmap()ed
+// shared file page, which vmawrite() handles.
+int
+cowfault(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  uint64 pa;
+  uint flags;
+  char *mem;
+
+  if(va >= MAXVA)
+    return -1;
+  pte = walk(pagetable, va, 0);
+  if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_U) == 0)
+    return -1;
+  if((*pte & PTE_COW) == 0)
+    return vmawrite(pagetable, va, pte);
+  ucflush(pagetable);
+  pa = PTE2PA(*pte);
+  flags = (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+
+  if(krefcnt((void*)pa) == 1){
+    // the other sharers have gone; take the page over.
+    *pte = PA2PTE(pa) | flags;
+    return 0;
+  }
+
+  if((mem = kalloc()) == 0)
+    return -1;
+  memmove(mem, (char*)pa, PGSIZE);
+  *pte = PA2PTE(mem) | flags;
+  kfree((void*)pa);
+  return 0;
+}
+
 // mark a PTE invalid for user access.
 // used by exec for the user stack guard page.
 void
@@ -349,9 +547,104 @@ uvmclear(pagetable_t pagetable, uint64 va)
   pte = walk(pagetable, va, 0);
   if(pte == 0)
     panic("uvmclear");
+  ucflush(pagetable);
   *pte &= ~PTE_U;
 }
 
+// Lend the resident user page at page-aligned va to the
+// kernel, for pipe page flipping. A writable page becomes
+// copy-on-write, so the user's later stores go to a copy.
+// Returns the page's physical address with a reference
+// taken, or 0 if there is no resident user page at va.
+uint64
+uvmshare(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  uint64 pa;
+
+  if(va >= MAXVA)
+    return 0;
+  pte = walk(pagetable, va, 0);
+  if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_U) == 0)
+    return 0;
+  ucflush(pagetable);
+  if(*pte & PTE_W)
+    *pte = (*pte & ~PTE_W) | PTE_COW;
+  pa = PTE2PA(*pte);
+  krefinc((void*)pa);
+  return pa;
+}
+
+// Map page pa copy-on-write at page-aligned user va in place
+// of the resident writable page there, which is freed. Takes
+// over the caller's reference to pa. For pipe page flipping.
+// Returns -1 if there is no resident writable page at va.
+int
+uvmremap(pagetable_t pagetable, uint64 va, uint64 pa)
+{
+  pte_t *pte;
+  uint64 old;
+
+  if(va >= MAXVA)
+    return -1;
+  pte = walk(pagetable, va, 0);
+  if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_U) == 0 ||
+     (*pte & (PTE_W|PTE_COW)) == 0)
+    return -1;
+  ucflush(pagetable);
+  old = PTE2PA(*pte);
+  *pte = PA2PTE(pa) | (PTE_FLAGS(*pte) & ~PTE_W) | PTE_COW;
+  kfree((void*)old);
+  return 0;
+}
+
+// Drop the current process's cached copyin/copyout translation
+// if it came from pagetable, whose PTEs are about to change.
+static void
+ucflush(pagetable_t pagetable)
+{
+  struct proc *p = myproc();
+
+  if(p && p->ucpt == pagetable)
+    p->ucpt = 0;
+}
+
+// Return the physical address of user page va0 for copyin
+// (write==0) or copyout (write!=0), faulting in lazy and
+// copy-on-write pages, or 0 if the access isn't allowed.
+// The last translation is cached in the process, so a run of
+// small copies within one page (readi's blocks, the console's
+// bytes, a pipe's chunks) walks the page table only once.
+static uint64
+uxlate(pagetable_t pagetable, uint64 va0, int write)
+{
+  struct proc *p = myproc();
+  pte_t *pte;
+
+  if(p && p->ucpt == pagetable && p->ucva == va0 && (p->ucwrite || !write))
+    return p->ucpa;
+
+  if(va0 >= MAXVA)
+    return 0;
+  pte = walk(pagetable, va0, 0);
+  if((pte == 0 || (*pte & PTE_V) == 0) && lazyalloc(pagetable, va0) == 0)
+    pte = walk(pagetable, va0, 0);
+  if(write && pte != 0 && (*pte & PTE_V) && (*pte & PTE_W) == 0 &&
+     cowfault(pagetable, va0) < 0)
+    return 0;
+  if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_U) == 0 ||
+     (write && (*pte & PTE_W) == 0))
+    return 0;
+
+  if(p && p->pagetable == pagetable){
+    p->ucpt = pagetable;
+    p->ucva = va0;
+    p->ucpa = PTE2PA(*pte);
+    p->ucwrite = (*pte & PTE_W) != 0;
+  }
+  return PTE2PA(*pte);
+}
+
 // Copy from kernel to user.
 // Copy len bytes from src to virtual address dstva in a given page table.
 // Return 0 on success, -1 on error.
@@ -359,17 +652,11 @@ int
 copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
   uint64 n, va0, pa0;
-  pte_t *pte;
 
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    if(va0 >= MAXVA)
+    if((pa0 = uxlate(pagetable, va0, 1)) == 0)
       return -1;
-    pte = walk(pagetable, va0, 0);
-    if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_U) == 0 ||
-       (*pte & PTE_W) == 0)
-      return -1;
-    pa0 = PTE2PA(*pte);
     n = PGSIZE - (dstva - va0);
     if(n > len)
       n = len;
@@ -392,8 +679,7 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    if((pa0 = uxlate(pagetable, va0, 0)) == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
     if(n > len)
@@ -419,14 +705,25 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    if((pa0 = uxlate(pagetable, va0, 0)) == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
     if(n > max)
       n = max;
 
     char *p = (char *) (pa0 + (srcva - va0));
+    // a word at a time while both sides are aligned and
+    // none of the word's bytes is the terminating zero.
+    while(n >= sizeof(uint64) && (((uint64)p | (uint64)dst) % sizeof(uint64)) == 0){
+      uint64 w = *(uint64*)p;
+      if((w - 0x0101010101010101UL) & ~w & 0x8080808080808080UL)
+        break;
+      *(uint64*)dst = w;
+      p += sizeof(uint64);
+      dst += sizeof(uint64);
+      n -= sizeof(uint64);
+      max -= sizeof(uint64);
+    }
     while(n > 0){
       if(*p == '\0'){
         *dst = '\0';
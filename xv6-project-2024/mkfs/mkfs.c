@@ -4,8 +4,44 @@
 #include <string.h>
 #include <fcntl.h>
 #include <assert.h>
+#include <sys/mman.h>
+#include <dirent.h>
+
+// Host directory helpers, defined before fs.h renames
+// struct dirent below.
+static int
+hostisdir(char *path)
+{
+  DIR *d;
+
+  if((d = opendir(path)) == 0)
+    return 0;
+  closedir(d);
+  return 1;
+}
+
+// List the entries of host directory path, sorted by name and
+// without . and .., or return -1 on error.
+static int
+hostlist(char *path, char ***names)
+{
+  struct dirent **ents;
+  int i, j, n;
+
+  if((n = scandir(path, &ents, 0, alphasort)) < 0)
+    return -1;
+  *names = malloc((n + 1) * sizeof(char*));
+  for(i = j = 0; i < n; i++){
+    if(strcmp(ents[i]->d_name, ".") != 0 && strcmp(ents[i]->d_name, "..") != 0)
+      (*names)[j++] = strdup(ents[i]->d_name);
+    free(ents[i]);
+  }
+  free(ents);
+  return j;
+}
 
 #define stat xv6_stat  // avoid clash with host struct stat
+#define dirent xv6_dirent  // and with host struct dirent
 #include "kernel/types.h"
 #include "kernel/fs.h"
 #include "kernel/stat.h"
@@ -15,20 +51,21 @@
 #define static_assert(a, b) do { switch (0) case 0: case (a): ; } while (0)
 #endif
 
-#define NINODES 200
+#define NINODES 200  // default; mkfs -i raises it for big trees
 
 // Disk layout:
 // [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
 
 int nbitmap = FSSIZE/BPB + 1;
-int ninodeblocks = NINODES / IPB + 1;
-int nlog = LOGSIZE;
+int ninodes = NINODES;
+int ninodeblocks;
+int nlog = LOGSIZE + 1;  // header block + LOGSIZE blocks
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
 
 int fsfd;
 struct superblock sb;
-char zeroes[BSIZE];
+char *img;    // the whole image, built in memory and written at the end
 uint freeinode = 1;
 uint freeblock;
 
@@ -40,6 +77,13 @@ void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+void addfile(uint dir, char *path, char *name);
+void adddir(uint parent, char *path, char *name);
+void ireserve(uint inum, uint size);
+void wimage(void);
+uchar *sectp(uint sec);
+uint bmap(struct dinode *din, uint fbn);
+struct dinode *dinodep(uint inum);
 void die(const char *);
 
 // convert to riscv byte order
@@ -65,20 +109,129 @@ xint(uint x)
   return y;
 }
 
+// Add directory entry name -> inum to directory dir.
+void
+dirlink(uint dir, char *name, uint inum)
+{
+  struct dirent de;
+
+  if(strlen(name) > DIRSIZ){
+    fprintf(stderr, "mkfs: name too long: %s\n", name);
+    exit(1);
+  }
+  bzero(&de, sizeof(de));
+  de.inum = xshort(inum);
+  strncpy(de.name, name, DIRSIZ);
+  iappend(dir, &de, sizeof(de));
+}
+
+#define DPB (BSIZE / sizeof(struct dirent))
+
+static int
+hashcmp(const void *a, const void *b)
+{
+  uint ha = dirhash(((struct dirent*)a)->name);
+  uint hb = dirhash(((struct dirent*)b)->name);
+
+  return ha < hb ? -1 : ha > hb;
+}
+
+// Index just past the leaf starting at ents[i] of n.
+static uint
+leafend(struct dirent *ents, uint n, uint i)
+{
+  uint j = i + DPB*3/4;
+
+  if(j >= n)
+    return n;
+  while(j > i && dirhash(ents[j].name) == dirhash(ents[j-1].name))
+    j--;
+  if(j == i){
+    fprintf(stderr, "mkfs: too many names with one hash\n");
+    exit(1);
+  }
+  return j;
+}
+
+// Rebuild a directory of more than DIRHASHMIN blocks' worth of
+// entries in the kernel's hashed format: block 0 the index, then
+// leaves of entries sorted by hash, filled to 3/4 so the kernel
+// can add names before it must split them. Leaves only break
+// where the hash changes. A directory too big for the index
+// stays linear. Returns 0 if it did nothing.
+int
+dirhashify(uint inum)
+{
+  struct dinode *din = dinodep(inum);
+  struct dirent *ents, *de;
+  struct dirhent *x;
+  uint i, j, n, nleaf, fbn, size = xint(din->size);
+
+  if(size <= DIRHASHMIN * BSIZE)
+    return 0;
+  ents = malloc(size);
+  for(n = i = 0; i < size / sizeof(*de); i++){
+    de = (struct dirent*)sectp(bmap(din, i / DPB)) + i % DPB;
+    if(de->inum)
+      ents[n++] = *de;
+  }
+  qsort(ents, n, sizeof(*ents), hashcmp);
+
+  // count the leaves first.
+  for(nleaf = 0, i = 0; i < n; nleaf++)
+    i = leafend(ents, n, i);
+  if(nleaf > NDIRHLEAF){
+    free(ents);
+    return 0;
+  }
+
+  for(fbn = 0; fbn <= nleaf; fbn++)
+    memset(sectp(bmap(din, fbn)), 0, BSIZE);
+  x = (struct dirhent*)sectp(bmap(din, 0));
+  x[0].nleaf = xshort(nleaf);
+  x[0].hash = xint(DIRHMAGIC);
+  for(fbn = 1, i = 0; i < n; fbn++){
+    j = leafend(ents, n, i);
+    x[fbn].hash = xint(fbn == 1 ? 0 : dirhash(ents[i].name));
+    x[fbn].block = xint(fbn);
+    memmove(sectp(bmap(din, fbn)), &ents[i], (j - i) * sizeof(*ents));
+    i = j;
+  }
+  din->size = xint((nleaf + 1) * BSIZE);
+  din->flags = xshort(xshort(din->flags) | IF_DIRHASH);
+  free(ents);
+  return 1;
+}
+
+// Round a directory's size up to a whole block.
+void
+dirfix(uint inum)
+{
+  struct dinode *din = dinodep(inum);
+  uint off;
+
+  off = xint(din->size);
+  off = ((off + BSIZE - 1) / BSIZE) * BSIZE;
+  din->size = xint(off);
+}
+
 int
 main(int argc, char *argv[])
 {
-  int i, cc, fd;
-  uint rootino, inum, off;
-  struct dirent de;
+  int i;
+  uint rootino;
   char buf[BSIZE];
-  struct dinode din;
 
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
-  if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+  if(argc > 2 && strcmp(argv[1], "-i") == 0){
+    ninodes = atoi(argv[2]);
+    argc -= 2;
+    argv += 2;
+  }
+  if(argc < 2 || ninodes < 2 || ninodes > 65535){
+    fprintf(stderr, "Usage: mkfs [-i ninodes] fs.img files-or-dirs...\n");
     exit(1);
   }
 
@@ -90,13 +243,14 @@ main(int argc, char *argv[])
     die(argv[1]);
 
   // 1 fs block = 1 disk sector
+  ninodeblocks = ninodes / IPB + 1;
   nmeta = 2 + nlog + ninodeblocks + nbitmap;
   nblocks = FSSIZE - nmeta;
 
   sb.magic = FSMAGIC;
   sb.size = xint(FSSIZE);
   sb.nblocks = xint(nblocks);
-  sb.ninodes = xint(NINODES);
+  sb.ninodes = xint(ninodes);
   sb.nlog = xint(nlog);
   sb.logstart = xint(2);
   sb.inodestart = xint(2+nlog);
@@ -107,8 +261,12 @@ main(int argc, char *argv[])
 
   freeblock = nmeta;     // the first free block that we can allocate
 
-  for(i = 0; i < FSSIZE; i++)
-    wsect(i, zeroes);
+  // anonymous memory starts out zeroed, so there is no need to
+  // clear the image block by block.
+  img = mmap(0, (size_t)FSSIZE * BSIZE, PROT_READ|PROT_WRITE,
+             MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if(img == MAP_FAILED)
+    die("mmap");
 
   memset(buf, 0, sizeof(buf));
   memmove(buf, &sb, sizeof(sb));
@@ -116,30 +274,21 @@ main(int argc, char *argv[])
 
   rootino = ialloc(T_DIR);
   assert(rootino == ROOTINO);
-
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, ".");
-  iappend(rootino, &de, sizeof(de));
-
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, "..");
-  iappend(rootino, &de, sizeof(de));
+  dirlink(rootino, ".", rootino);
+  dirlink(rootino, "..", rootino);
 
   for(i = 2; i < argc; i++){
-    // get rid of "user/"
+    // get rid of "user/", or "kernel/" for kernel.sym
     char *shortname;
     if(strncmp(argv[i], "user/", 5) == 0)
       shortname = argv[i] + 5;
+    else if(strncmp(argv[i], "kernel/", 7) == 0)
+      shortname = argv[i] + 7;
     else
       shortname = argv[i];
     
     assert(index(shortname, '/') == 0);
 
-    if((fd = open(argv[i], 0)) < 0)
-      die(argv[i]);
-
     // Skip leading _ in name when writing to file system.
     // The binaries are named _rm, _cat, etc. to keep the
     // build operating system from trying to execute them
@@ -147,40 +296,113 @@ main(int argc, char *argv[])
     if(shortname[0] == '_')
       shortname += 1;
 
-    assert(strlen(shortname) <= DIRSIZ);
-    
-    inum = ialloc(T_FILE);
+    // A host directory is copied in as a whole subtree.
+    if(hostisdir(argv[i]))
+      adddir(rootino, argv[i], shortname);
+    else
+      addfile(rootino, argv[i], shortname);
+  }
+
+  if(!dirhashify(rootino))
+    dirfix(rootino);
 
-    bzero(&de, sizeof(de));
-    de.inum = xshort(inum);
-    strncpy(de.name, shortname, DIRSIZ);
-    iappend(rootino, &de, sizeof(de));
+  balloc(freeblock);
+
+  wimage();
+
+  exit(0);
+}
+
+// Copy host file path into directory dir as name.
+void
+addfile(uint dir, char *path, char *name)
+{
+  int cc, fd;
+  uint inum;
+  off_t size;
+  char buf[BSIZE];
+
+  if((fd = open(path, 0)) < 0)
+    die(path);
+
+  inum = ialloc(T_FILE);
+  dirlink(dir, name, inum);
 
-    while((cc = read(fd, buf, sizeof(buf))) > 0)
-      iappend(inum, buf, cc);
+  // lay the file's blocks out as one contiguous run.
+  if((size = lseek(fd, 0, SEEK_END)) < 0 || lseek(fd, 0, SEEK_SET) < 0)
+    die(path);
+  ireserve(inum, size);
+
+  while((cc = read(fd, buf, sizeof(buf))) > 0)
+    iappend(inum, buf, cc);
+
+  close(fd);
+}
 
-    close(fd);
+// Copy host directory path, and everything below it, into
+// directory parent as name. The tree is walked once, and each
+// file is written straight into the image as it is found.
+void
+adddir(uint parent, char *path, char *name)
+{
+  char **names, *sub;
+  struct dinode *din;
+  uint inum;
+  int i, n;
+
+  if((n = hostlist(path, &names)) < 0)
+    die(path);
+
+  inum = ialloc(T_DIR);
+  dirlink(parent, name, inum);
+  dirlink(inum, ".", inum);
+  dirlink(inum, "..", parent);
+  din = dinodep(parent);
+  din->nlink = xshort(xshort(din->nlink) + 1);  // for ".."
+
+  for(i = 0; i < n; i++){
+    sub = malloc(strlen(path) + strlen(names[i]) + 2);
+    sprintf(sub, "%s/%s", path, names[i]);
+    if(hostisdir(sub))
+      adddir(inum, sub, names[i]);
+    else
+      addfile(inum, sub, names[i]);
+    free(sub);
+    free(names[i]);
   }
+  free(names);
 
-  // fix size of root inode dir
-  rinode(rootino, &din);
-  off = xint(din.size);
-  off = ((off/BSIZE) + 1) * BSIZE;
-  din.size = xint(off);
-  winode(rootino, &din);
+  if(!dirhashify(inum))
+    dirfix(inum);
+}
 
-  balloc(freeblock);
+// Address of sector sec in the in-memory image.
+uchar*
+sectp(uint sec)
+{
+  assert(sec < FSSIZE);
+  return (uchar*)img + (size_t)sec * BSIZE;
+}
 
-  exit(0);
+// Write the finished image to fs.img.
+void
+wimage(void)
+{
+  size_t len = (size_t)FSSIZE * BSIZE, off;
+  ssize_t cc;
+
+  for(off = 0; off < len; off += cc){
+    if((cc = write(fsfd, img + off, len - off)) <= 0)
+      die("write");
+  }
+  if(close(fsfd) < 0)
+    die("close");
 }
 
 void
 wsect(uint sec, void *buf)
 {
-  if(lseek(fsfd, sec * BSIZE, 0) != sec * BSIZE)
-    die("lseek");
-  if(write(fsfd, buf, BSIZE) != BSIZE)
-    die("write");
+  memmove(sectp(sec), buf, BSIZE);
 }
 
 void
@@ -213,10 +435,14 @@ rinode(uint inum, struct dinode *ip)
 void
 rsect(uint sec, void *buf)
 {
-  if(lseek(fsfd, sec * BSIZE, 0) != sec * BSIZE)
-    die("lseek");
-  if(read(fsfd, buf, BSIZE) != BSIZE)
-    die("read");
+  memmove(buf, sectp(sec), BSIZE);
+}
+
+// The on-disk inode inum, in place in the image.
+struct dinode*
+dinodep(uint inum)
+{
+  return ((struct dinode*)sectp(IBLOCK(inum, sb))) + (inum % IPB);
 }
 
 uint
@@ -225,6 +451,11 @@ ialloc(ushort type)
   uint inum = freeinode++;
   struct dinode din;
 
+  if(inum >= ninodes){
+    fprintf(stderr, "mkfs: out of inodes, use -i\n");
+    exit(1);
+  }
+
   bzero(&din, sizeof(din));
   din.type = xshort(type);
   din.nlink = xshort(1);
@@ -236,63 +467,92 @@ ialloc(ushort type)
 void
 balloc(int used)
 {
-  uchar buf[BSIZE];
+  uchar *bm;
   int i;
 
   printf("balloc: first %d blocks have been allocated\n", used);
-  assert(used < BPB);
-  bzero(buf, BSIZE);
+  assert(used <= FSSIZE);
+  // the bitmap blocks are contiguous in the image, so mark
+  // the bits in place across as many of them as it takes.
+  bm = sectp(xint(sb.bmapstart));
   for(i = 0; i < used; i++){
-    buf[i/8] = buf[i/8] | (0x1 << (i%8));
+    bm[i/8] = bm[i/8] | (0x1 << (i%8));
   }
-  printf("balloc: write bitmap block at sector %d\n", sb.bmapstart);
-  wsect(sb.bmapstart, buf);
+  printf("balloc: wrote %d bitmap blocks at sector %d\n",
+         (used + BPB - 1) / BPB, xint(sb.bmapstart));
 }
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// Return the block named by *a, allocating the next free
+// block if it is still empty.
+uint
+bslot(uint *a)
+{
+  if(*a == 0){
+    assert(freeblock < FSSIZE);
+    *a = xint(freeblock++);
+  }
+  return xint(*a);
+}
+
+// Return the disk block holding file block fbn, allocating
+// it and any indirect blocks on the way. Indirect blocks are
+// edited in place in the image.
+uint
+bmap(struct dinode *din, uint fbn)
+{
+  uint *ind;
+
+  if(fbn < NDIRECT)
+    return bslot(&din->addrs[fbn]);
+  fbn -= NDIRECT;
+
+  if(fbn < NINDIRECT){
+    ind = (uint*)sectp(bslot(&din->addrs[NDIRECT]));
+    return bslot(&ind[fbn]);
+  }
+  fbn -= NINDIRECT;
+
+  assert(fbn < NDOUBLY_INDIRECT);
+  ind = (uint*)sectp(bslot(&din->addrs[NDIRECT+1]));
+  ind = (uint*)sectp(bslot(&ind[fbn / NINDIRECT]));
+  return bslot(&ind[fbn % NINDIRECT]);
+}
+
+// Allocate every block of an inode that will hold size bytes
+// up front, so that its data and indirect blocks form a single
+// run instead of interleaving with the directory's blocks.
+void
+ireserve(uint inum, uint size)
+{
+  struct dinode *din = dinodep(inum);
+  uint fbn;
+
+  assert((size + BSIZE - 1) / BSIZE <= MAXFILE);
+  for(fbn = 0; fbn * BSIZE < size; fbn++)
+    bmap(din, fbn);
+}
+
 void
 iappend(uint inum, void *xp, int n)
 {
   char *p = (char*)xp;
   uint fbn, off, n1;
-  struct dinode din;
-  char buf[BSIZE];
-  uint indirect[NINDIRECT];
-  uint x;
+  struct dinode *din = dinodep(inum);
 
-  rinode(inum, &din);
-  off = xint(din.size);
+  off = xint(din->size);
   // printf("append inum %d at off %d sz %d\n", inum, off, n);
   while(n > 0){
     fbn = off / BSIZE;
     assert(fbn < MAXFILE);
-    if(fbn < NDIRECT){
-      if(xint(din.addrs[fbn]) == 0){
-        din.addrs[fbn] = xint(freeblock++);
-      }
-      x = xint(din.addrs[fbn]);
-    } else {
-      if(xint(din.addrs[NDIRECT]) == 0){
-        din.addrs[NDIRECT] = xint(freeblock++);
-      }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      }
-      x = xint(indirect[fbn-NDIRECT]);
-    }
     n1 = min(n, (fbn + 1) * BSIZE - off);
-    rsect(x, buf);
-    bcopy(p, buf + off - (fbn * BSIZE), n1);
-    wsect(x, buf);
+    memmove(sectp(bmap(din, fbn)) + off - (fbn * BSIZE), p, n1);
     n -= n1;
     off += n1;
     p += n1;
   }
-  din.size = xint(off);
-  winode(inum, &din);
+  din->size = xint(off);
 }
 
 void
@@ -9,6 +9,14 @@ cat(int fd)
 {
   int n;
 
+  // between a file and a pipe, let the kernel move the bytes;
+  // splice() fails at once for anything else, such as the
+  // console, and then cat copies them itself.
+  while((n = splice(fd, 1, 64*1024)) > 0)
+    ;
+  if(n == 0)
+    return;
+
   while((n = read(fd, buf, sizeof(buf))) > 0) {
     if (write(1, buf, n) != n) {
       fprintf(2, "cat: write error\n");
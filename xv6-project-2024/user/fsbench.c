@@ -0,0 +1,218 @@
+// Time the file system, phase by phase: sequential and random
+// block reads and writes of one big file, a create/unlink storm,
+// lookups in a full directory, and opens through a chain of
+// symbolic links. Each phase prints one line
+//
+//   fsbench: phase=NAME ops=N bytes=B ticks=T
+//
+// for scripts to collect, and the whole run works in a scratch
+// directory that it removes afterwards.
+//
+//   fsbench [fileblocks [nfiles]]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "user/user.h"
+
+#define DIR    "fsbench.d"
+#define CHAIN  9     // symlink depth; open() follows at most 10
+#define NOPEN  200   // opens per lookup and symlink phase
+
+char buf[BSIZE];
+uint seed = 1;
+
+uint
+rnd(void)
+{
+  seed = seed * 1103515245 + 12345;
+  return seed >> 8;
+}
+
+void
+report(char *phase, int ops, int bytes, int start)
+{
+  printf("fsbench: phase=%s ops=%d bytes=%d ticks=%d\n",
+         phase, ops, bytes, uptime() - start);
+}
+
+void
+fail(char *what)
+{
+  printf("fsbench: %s failed\n", what);
+  exit(1);
+}
+
+// Name of the i'th small file, f0 .. fNNNN.
+void
+fname(char *p, int i)
+{
+  int j, n = 0, d = 1;
+
+  while(d * 10 <= i)
+    d *= 10;
+  p[n++] = 'f';
+  for(j = d; j > 0; j /= 10)
+    p[n++] = '0' + (i / j) % 10;
+  p[n] = 0;
+}
+
+void
+seqphases(int nblocks)
+{
+  int fd, i, start;
+
+  start = uptime();
+  if((fd = open("big", O_CREATE|O_RDWR)) < 0)
+    fail("create big");
+  for(i = 0; i < nblocks; i++){
+    buf[0] = i;
+    if(write(fd, buf, BSIZE) != BSIZE)
+      fail("seqwrite");
+  }
+  // time the blocks reaching the disk, not just the cache.
+  if(fsync(fd) < 0)
+    fail("fsync");
+  close(fd);
+  report("seqwrite", nblocks, nblocks * BSIZE, start);
+
+  start = uptime();
+  if((fd = open("big", O_RDONLY)) < 0)
+    fail("open big");
+  for(i = 0; i < nblocks; i++){
+    if(read(fd, buf, BSIZE) != BSIZE || buf[0] != (char)i)
+      fail("seqread");
+  }
+  close(fd);
+  report("seqread", nblocks, nblocks * BSIZE, start);
+}
+
+void
+randphases(int nblocks)
+{
+  int fd, i, b, start;
+
+  if((fd = open("big", O_RDWR)) < 0)
+    fail("open big");
+
+  start = uptime();
+  for(i = 0; i < nblocks; i++){
+    b = rnd() % nblocks;
+    buf[0] = b;
+    if(lseek(fd, b * BSIZE, SEEK_SET) < 0 || write(fd, buf, BSIZE) != BSIZE)
+      fail("randwrite");
+  }
+  if(fsync(fd) < 0)
+    fail("fsync");
+  report("randwrite", nblocks, nblocks * BSIZE, start);
+
+  start = uptime();
+  for(i = 0; i < nblocks; i++){
+    b = rnd() % nblocks;
+    if(lseek(fd, b * BSIZE, SEEK_SET) < 0 || read(fd, buf, BSIZE) != BSIZE ||
+       buf[0] != (char)b)
+      fail("randread");
+  }
+  report("randread", nblocks, nblocks * BSIZE, start);
+
+  close(fd);
+  unlink("big");
+}
+
+void
+dirphases(int nfiles)
+{
+  char name[DIRSIZ];
+  int fd, i, start;
+
+  start = uptime();
+  for(i = 0; i < nfiles; i++){
+    fname(name, i);
+    if((fd = open(name, O_CREATE|O_RDWR)) < 0)
+      fail("create");
+    close(fd);
+  }
+  report("create", nfiles, 0, start);
+
+  // spread over the whole directory, so that late entries
+  // cost as much as they would in a linear scan.
+  start = uptime();
+  for(i = 0; i < NOPEN; i++){
+    fname(name, rnd() % nfiles);
+    if((fd = open(name, O_RDONLY)) < 0)
+      fail("lookup");
+    close(fd);
+  }
+  report("lookup", NOPEN, 0, start);
+
+  start = uptime();
+  for(i = 0; i < nfiles; i++){
+    fname(name, i);
+    if(unlink(name) < 0)
+      fail("unlink");
+  }
+  report("unlink", nfiles, 0, start);
+}
+
+void
+symphase(void)
+{
+  char name[DIRSIZ], prev[DIRSIZ];
+  int fd, i, start;
+
+  if((fd = open("target", O_CREATE|O_RDWR)) < 0)
+    fail("create target");
+  close(fd);
+  strcpy(prev, "target");
+  for(i = 0; i < CHAIN; i++){
+    fname(name, i);
+    name[0] = 'l';
+    if(symlink(prev, name) < 0)
+      fail("symlink");
+    strcpy(prev, name);
+  }
+
+  start = uptime();
+  for(i = 0; i < NOPEN; i++){
+    if((fd = open(prev, O_RDONLY)) < 0)
+      fail("open through symlinks");
+    close(fd);
+  }
+  report("symlink", NOPEN, 0, start);
+
+  for(i = 0; i < CHAIN; i++){
+    fname(name, i);
+    name[0] = 'l';
+    unlink(name);
+  }
+  unlink("target");
+}
+
+int
+main(int argc, char *argv[])
+{
+  int nblocks = 1024, nfiles = 200;
+
+  if(argc > 1)
+    nblocks = atoi(argv[1]);
+  if(argc > 2)
+    nfiles = atoi(argv[2]);
+  if(nblocks < 1 || nfiles < 1){
+    printf("usage: fsbench [fileblocks [nfiles]]\n");
+    exit(1);
+  }
+
+  if(mkdir(DIR) < 0 || chdir(DIR) < 0)
+    fail("mkdir " DIR);
+
+  seqphases(nblocks);
+  randphases(nblocks);
+  dirphases(nfiles);
+  symphase();
+
+  chdir("..");
+  if(unlink(DIR) < 0)
+    fail("unlink " DIR);
+  exit(0);
+}
@@ -0,0 +1,65 @@
+// Print the kernel performance counters.
+//
+//   kstat              counter totals since boot
+//   kstat cmd args...  how much each counter changed while cmd ran
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/spinlock.h"
+#include "kernel/sleeplock.h"
+#include "kernel/fs.h"
+#include "kernel/file.h"
+#include "kernel/kstat.h"
+#include "user/user.h"
+
+char *names[NKSTAT] = KSTAT_NAMES;
+
+void
+readstats(int fd, uint64 *v)
+{
+  if(read(fd, v, NKSTAT*sizeof(uint64)) != NKSTAT*sizeof(uint64)){
+    fprintf(2, "kstat: read failed\n");
+    exit(1);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  uint64 before[NKSTAT], after[NKSTAT];
+  int fd, pid, i;
+
+  if((fd = open("/dev/kstat", O_RDONLY)) < 0){
+    mkdir("/dev");
+    mknod("/dev/kstat", KSTAT, 0);
+    if((fd = open("/dev/kstat", O_RDONLY)) < 0){
+      fprintf(2, "kstat: cannot open /dev/kstat\n");
+      exit(1);
+    }
+  }
+
+  readstats(fd, before);
+  if(argc < 2){
+    for(i = 0; i < NKSTAT; i++)
+      printf("%s %lu\n", names[i], before[i]);
+    exit(0);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    fprintf(2, "kstat: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(fd);
+    exec(argv[1], argv + 1);
+    fprintf(2, "kstat: exec %s failed\n", argv[1]);
+    exit(1);
+  }
+  wait(0);
+  readstats(fd, after);
+  for(i = 0; i < NKSTAT; i++)
+    printf("%s %lu\n", names[i], after[i] - before[i]);
+  exit(0);
+}
@@ -0,0 +1,101 @@
+// Measure interactive latency under CPU load. nhogs processes
+// spin, while a parent/child pair passes a byte back and forth
+// through two pipes, as a shell and its commands would; each
+// round trip needs both to be scheduled past the hogs. The
+// rounds are timed with the hogs at nice 0, at nice NICEMAX,
+// and at NICEMAX with the pair pinned to cpu 0.
+//
+//   latbench [nhogs [rounds]]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "user/user.h"
+
+#define MAXHOGS 8
+
+int
+pingpong(int rounds, int pin)
+{
+  int a[2], b[2], i, pid, start;
+  char c = 0;
+
+  if(pipe(a) < 0 || pipe(b) < 0){
+    printf("latbench: pipe failed\n");
+    exit(1);
+  }
+  if(pin)
+    setaffinity(0, 0);
+  start = uptime();
+  pid = fork();
+  if(pid < 0){
+    printf("latbench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    for(i = 0; i < rounds; i++){
+      if(read(a[0], &c, 1) != 1 || write(b[1], &c, 1) != 1)
+        exit(1);
+    }
+    exit(0);
+  }
+  for(i = 0; i < rounds; i++){
+    if(write(a[1], &c, 1) != 1 || read(b[0], &c, 1) != 1){
+      printf("latbench: pipe i/o failed\n");
+      exit(1);
+    }
+  }
+  wait(0);
+  if(pin)
+    setaffinity(0, -1);
+  close(a[0]);
+  close(a[1]);
+  close(b[0]);
+  close(b[1]);
+  return uptime() - start;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int nhogs = 4, rounds = 200, hogs[MAXHOGS], i, t;
+
+  if(argc > 1)
+    nhogs = atoi(argv[1]);
+  if(argc > 2)
+    rounds = atoi(argv[2]);
+  if(nhogs < 0 || nhogs > MAXHOGS){
+    printf("latbench: at most %d hogs\n", MAXHOGS);
+    exit(1);
+  }
+
+  t = pingpong(rounds, 0);
+  printf("latbench: %d rounds, idle: %d ticks\n", rounds, t);
+
+  for(i = 0; i < nhogs; i++){
+    if((hogs[i] = fork()) < 0){
+      printf("latbench: fork failed\n");
+      exit(1);
+    }
+    if(hogs[i] == 0)
+      for(;;)
+        ;
+  }
+
+  t = pingpong(rounds, 0);
+  printf("latbench: %d hogs at nice 0: %d ticks\n", nhogs, t);
+
+  for(i = 0; i < nhogs; i++)
+    setpriority(hogs[i], NICEMAX);
+  t = pingpong(rounds, 0);
+  printf("latbench: %d hogs at nice %d: %d ticks\n", nhogs, NICEMAX, t);
+
+  t = pingpong(rounds, 1);
+  printf("latbench: same, pair pinned to cpu 0: %d ticks\n", t);
+
+  for(i = 0; i < nhogs; i++){
+    kill(hogs[i]);
+    wait(0);
+  }
+  exit(0);
+}
@@ -0,0 +1,87 @@
+// Hammer the hot global locks from several processes at once:
+// "time" calls uptime(), which takes no lock, as a baseline,
+// and "wait" forks and waits for children, which takes
+// wait_lock. For each phase, print the elapsed ticks and when
+// the first and last processes finished, to show fairness. Build with
+// TICKETLOCKS 0 and 1 in kernel/param.h to compare the plain
+// and ticket spinlocks, and run it under CPUS=1..8.
+//
+//   lockbench [nproc [iters]]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+void
+work(int phase, int iters)
+{
+  int i, pid;
+
+  for(i = 0; i < iters; i++){
+    if(phase == 0){
+      uptime();
+    } else {
+      if((pid = fork()) < 0)
+        exit(1);
+      if(pid == 0)
+        exit(0);
+      wait(0);
+    }
+  }
+}
+
+void
+run(char *name, int phase, int nproc, int iters)
+{
+  int fds[2], i, pid, start, t, first, last;
+
+  if(pipe(fds) < 0){
+    printf("lockbench: pipe failed\n");
+    exit(1);
+  }
+  start = uptime();
+  for(i = 0; i < nproc; i++){
+    if((pid = fork()) < 0){
+      printf("lockbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      close(fds[0]);
+      work(phase, iters);
+      t = uptime();
+      write(fds[1], &t, sizeof(t));
+      exit(0);
+    }
+  }
+  close(fds[1]);
+  first = last = -1;
+  while(read(fds[0], &t, sizeof(t)) == sizeof(t)){
+    if(first < 0 || t < first)
+      first = t;
+    if(t > last)
+      last = t;
+  }
+  close(fds[0]);
+  for(i = 0; i < nproc; i++)
+    wait(0);
+  printf("lockbench: %s %d procs x %d: %d ticks, first done at %d, last at %d\n",
+         name, nproc, iters, uptime() - start, first - start, last - start);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int nproc = 3, iters = 20000;
+
+  if(argc > 1)
+    nproc = atoi(argv[1]);
+  if(argc > 2)
+    iters = atoi(argv[2]);
+  if(nproc < 1 || iters < 1){
+    printf("usage: lockbench [nproc [iters]]\n");
+    exit(1);
+  }
+  run("time", 0, nproc, iters);
+  run("wait", 1, nproc, iters / 100 + 1);
+  exit(0);
+}
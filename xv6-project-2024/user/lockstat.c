@@ -0,0 +1,68 @@
+// Print spinlock contention, most contended first.
+//
+//   lockstat              totals since boot
+//   lockstat cmd args...  what cmd's run added
+//
+// cycles are r_time() units spent spinning in acquire().
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/lockstat.h"
+#include "user/user.h"
+
+struct lockstat before[NLOCKSTAT], after[NLOCKSTAT];
+
+int
+main(int argc, char *argv[])
+{
+  struct lockstat t;
+  int n, m, i, j, pid;
+
+  if((n = lockstat(before, NLOCKSTAT)) < 0){
+    fprintf(2, "lockstat: lockstat failed\n");
+    exit(1);
+  }
+
+  if(argc > 1){
+    pid = fork();
+    if(pid < 0){
+      fprintf(2, "lockstat: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      exec(argv[1], argv + 1);
+      fprintf(2, "lockstat: exec %s failed\n", argv[1]);
+      exit(1);
+    }
+    wait(0);
+    // entries keep their places; new names are appended.
+    m = lockstat(after, NLOCKSTAT);
+    for(i = 0; i < m; i++){
+      if(i < n){
+        after[i].nacquire -= before[i].nacquire;
+        after[i].ncontend -= before[i].ncontend;
+        after[i].cycles -= before[i].cycles;
+      }
+      before[i] = after[i];
+    }
+    n = m;
+  }
+
+  // sort by spin cycles, then by contended acquisitions.
+  for(i = 1; i < n; i++){
+    t = before[i];
+    for(j = i; j > 0 && (before[j-1].cycles < t.cycles ||
+        (before[j-1].cycles == t.cycles && before[j-1].ncontend < t.ncontend)); j--)
+      before[j] = before[j-1];
+    before[j] = t;
+  }
+
+  printf("%s %s %s %s\n", "name", "acquire", "contend", "cycles");
+  for(i = 0; i < n; i++){
+    if(before[i].nacquire == 0)
+      continue;
+    printf("%s %lu %lu %lu\n", before[i].name, before[i].nacquire,
+           before[i].ncontend, before[i].cycles);
+  }
+  exit(0);
+}
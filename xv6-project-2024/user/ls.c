@@ -27,8 +27,8 @@ void
 ls(char *path)
 {
   char buf[512], *p;
-  int fd;
-  struct dirent de;
+  int fd, i, n;
+  struct dirent des[BSIZE/sizeof(struct dirent)], *de;
   struct stat st;
 
   if((fd = open(path, O_RDONLY)) < 0){
@@ -56,16 +56,21 @@ ls(char *path)
     strcpy(buf, path);
     p = buf+strlen(buf);
     *p++ = '/';
-    while(read(fd, &de, sizeof(de)) == sizeof(de)){
-      if(de.inum == 0)
-        continue;
-      memmove(p, de.name, DIRSIZ);
-      p[DIRSIZ] = 0;
-      if(stat(buf, &st) < 0){
-        printf("ls: cannot stat %s\n", buf);
-        continue;
+    // Read a block of entries at a time. Empty slots and the
+    // index records of hashed directories have inum 0.
+    while((n = read(fd, des, sizeof(des))) >= (int)sizeof(*de)){
+      for(i = 0; i < n / sizeof(*de); i++){
+        de = &des[i];
+        if(de->inum == 0)
+          continue;
+        memmove(p, de->name, DIRSIZ);
+        p[DIRSIZ] = 0;
+        if(stat(buf, &st) < 0){
+          printf("ls: cannot stat %s\n", buf);
+          continue;
+        }
+        printf("%s %d %d %d\n", fmtname(buf), st.type, st.ino, (int) st.size);
       }
-      printf("%s %d %d %d\n", fmtname(buf), st.type, st.ino, (int) st.size);
     }
     break;
   }
@@ -0,0 +1,95 @@
+// Time memset, memmove and memcmp from user/ulib.c, which go
+// a word at a time like the kernel's, against plain byte
+// loops, on aligned and misaligned buffers of a few sizes.
+// Prints ticks per phase; lower is better.
+//
+//   membench [iters]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define BUFSZ 8192
+
+char a[BUFSZ+16], b[BUFSZ+16];
+
+void
+bset(char *d, int c, uint n)
+{
+  while(n-- > 0)
+    *d++ = c;
+}
+
+void
+bmove(char *d, const char *s, uint n)
+{
+  while(n-- > 0)
+    *d++ = *s++;
+}
+
+int
+bcmp(const char *p, const char *q, uint n)
+{
+  for(; n > 0; n--, p++, q++)
+    if(*p != *q)
+      return *p - *q;
+  return 0;
+}
+
+// run op (0 set, 1 move, 2 cmp) iters times over n bytes at
+// byte offset off into a and b, and return the ticks taken.
+int
+run(int word, int op, int n, int off, int iters)
+{
+  int i, start;
+  volatile int sink = 0;
+
+  start = uptime();
+  for(i = 0; i < iters; i++){
+    if(op == 0){
+      if(word)
+        memset(a + off, i, n);
+      else
+        bset(a + off, i, n);
+    } else if(op == 1){
+      if(word)
+        memmove(a + off, b, n);
+      else
+        bmove(a + off, b, n);
+    } else {
+      if(word)
+        sink += memcmp(a + off, b + off, n);
+      else
+        sink += bcmp(a + off, b + off, n);
+    }
+  }
+  return uptime() - start;
+}
+
+int
+main(int argc, char *argv[])
+{
+  static char *ops[] = { "memset", "memmove", "memcmp" };
+  static int sizes[] = { 64, 1024, BUFSZ };
+  int iters = 20000, op, s, off, n;
+
+  if(argc > 1)
+    iters = atoi(argv[1]);
+
+  memset(b, 7, sizeof(b));
+  memset(a, 7, sizeof(a));
+  printf("op       size  off   byte   word\n");
+  for(op = 0; op < 3; op++){
+    for(s = 0; s < sizeof(sizes)/sizeof(sizes[0]); s++){
+      for(off = 0; off < 4; off += 3){
+        n = sizes[s];
+        // scale so every row copies about the same bytes.
+        int it = iters * (BUFSZ / n) / 8;
+        int tb = run(0, op, n, off, it);
+        int tw = run(1, op, n, off, it);
+        printf("%s  %d  %d  %d  %d\n", ops[op], n, off, tb, tw);
+      }
+    }
+  }
+  exit(0);
+}
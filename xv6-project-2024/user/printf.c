@@ -7,13 +7,13 @@
 static char digits[] = "0123456789ABCDEF";
 
 static void
-putc(int fd, char c)
+putc(FILE *f, char c)
 {
-  write(fd, &c, 1);
+  bputc(c, f);
 }
 
 static void
-printint(int fd, int xx, int base, int sgn)
+printint(FILE *f, int xx, int base, int sgn)
 {
   char buf[16];
   int i, neg;
@@ -35,21 +35,23 @@ printint(int fd, int xx, int base, int sgn)
     buf[i++] = '-';
 
   while(--i >= 0)
-    putc(fd, buf[i]);
+    putc(f, buf[i]);
 }
 
 static void
-printptr(int fd, uint64 x) {
+printptr(FILE *f, uint64 x) {
   int i;
-  putc(fd, '0');
-  putc(fd, 'x');
+  putc(f, '0');
+  putc(f, 'x');
   for (i = 0; i < (sizeof(uint64) * 2); i++, x <<= 4)
-    putc(fd, digits[x >> (sizeof(uint64) * 8 - 4)]);
+    putc(f, digits[x >> (sizeof(uint64) * 8 - 4)]);
 }
 
-// Print to the given fd. Only understands %d, %x, %p, %s.
-void
-vprintf(int fd, const char *fmt, va_list ap)
+// Print to stream f. Only understands %d, %x, %p, %s.
+// Streams that are not fully buffered are flushed at the end,
+// so a prompt with no newline still shows up.
+static void
+vfprintf(FILE *f, const char *fmt, va_list ap)
 {
   char *s;
   int c0, c1, c2, i, state;
@@ -61,81 +63,106 @@ vprintf(int fd, const char *fmt, va_list ap)
       if(c0 == '%'){
         state = '%';
       } else {
-        putc(fd, c0);
+        putc(f, c0);
       }
     } else if(state == '%'){
       c1 = c2 = 0;
       if(c0) c1 = fmt[i+1] & 0xff;
       if(c1) c2 = fmt[i+2] & 0xff;
       if(c0 == 'd'){
-        printint(fd, va_arg(ap, int), 10, 1);
+        printint(f, va_arg(ap, int), 10, 1);
       } else if(c0 == 'l' && c1 == 'd'){
-        printint(fd, va_arg(ap, uint64), 10, 1);
+        printint(f, va_arg(ap, uint64), 10, 1);
         i += 1;
       } else if(c0 == 'l' && c1 == 'l' && c2 == 'd'){
-        printint(fd, va_arg(ap, uint64), 10, 1);
+        printint(f, va_arg(ap, uint64), 10, 1);
         i += 2;
       } else if(c0 == 'u'){
-        printint(fd, va_arg(ap, int), 10, 0);
+        printint(f, va_arg(ap, int), 10, 0);
       } else if(c0 == 'l' && c1 == 'u'){
-        printint(fd, va_arg(ap, uint64), 10, 0);
+        printint(f, va_arg(ap, uint64), 10, 0);
         i += 1;
       } else if(c0 == 'l' && c1 == 'l' && c2 == 'u'){
-        printint(fd, va_arg(ap, uint64), 10, 0);
+        printint(f, va_arg(ap, uint64), 10, 0);
         i += 2;
       } else if(c0 == 'x'){
-        printint(fd, va_arg(ap, int), 16, 0);
+        printint(f, va_arg(ap, int), 16, 0);
       } else if(c0 == 'l' && c1 == 'x'){
-        printint(fd, va_arg(ap, uint64), 16, 0);
+        printint(f, va_arg(ap, uint64), 16, 0);
         i += 1;
       } else if(c0 == 'l' && c1 == 'l' && c2 == 'x'){
-        printint(fd, va_arg(ap, uint64), 16, 0);
+        printint(f, va_arg(ap, uint64), 16, 0);
         i += 2;
       } else if(c0 == 'p'){
-        printptr(fd, va_arg(ap, uint64));
+        printptr(f, va_arg(ap, uint64));
       } else if(c0 == 's'){
         if((s = va_arg(ap, char*)) == 0)
           s = "(null)";
         for(; *s; s++)
-          putc(fd, *s);
+          putc(f, *s);
       } else if(c0 == '%'){
-        putc(fd, '%');
+        putc(f, '%');
       } else {
         // Unknown % sequence.  Print it to draw attention.
-        putc(fd, '%');
-        putc(fd, c0);
+        putc(f, '%');
+        putc(f, c0);
       }
 
 #if 0
       if(c == 'd'){
-        printint(fd, va_arg(ap, int), 10, 1);
+        printint(f, va_arg(ap, int), 10, 1);
       } else if(c == 'l') {
-        printint(fd, va_arg(ap, uint64), 10, 0);
+        printint(f, va_arg(ap, uint64), 10, 0);
       } else if(c == 'x') {
-        printint(fd, va_arg(ap, int), 16, 0);
+        printint(f, va_arg(ap, int), 16, 0);
       } else if(c == 'p') {
-        printptr(fd, va_arg(ap, uint64));
+        printptr(f, va_arg(ap, uint64));
       } else if(c == 's'){
         s = va_arg(ap, char*);
         if(s == 0)
           s = "(null)";
         while(*s != 0){
-          putc(fd, *s);
+          putc(f, *s);
           s++;
         }
       } else if(c == 'c'){
-        putc(fd, va_arg(ap, uint));
+        putc(f, va_arg(ap, uint));
       } else if(c == '%'){
-        putc(fd, c);
+        putc(f, c);
       } else {
         // Unknown % sequence.  Print it to draw attention.
-        putc(fd, '%');
-        putc(fd, c);
+        putc(f, '%');
+        putc(f, c);
       }
 #endif
       state = 0;
     }
   }
+  if(f->mode != _IOFBF)
+    fflush(f);
+}
+
+// Print to the given fd, through stdout or stderr for 1 and 2
+// and through a one-shot buffer for anything else.
+void
+vprintf(int fd, const char *fmt, va_list ap)
+{
+  char buf[BUFSIZ];
+  FILE tmp;
+
+  if(fd == 1){
+    vfprintf(stdout, fmt, ap);
+  } else if(fd == 2){
+    vfprintf(stderr, fmt, ap);
+  } else {
+    memset(&tmp, 0, sizeof(tmp));
+    tmp.fd = fd;
+    tmp.mode = _IOFBF;
+    tmp.buf = buf;
+    tmp.size = sizeof(buf);
+    vfprintf(&tmp, fmt, ap);
+    fflush(&tmp);
+  }
 }
 
 void
@@ -0,0 +1,168 @@
+// Time process and pipe primitives: fork+wait, fork+exec+wait,
+// spawn+wait, one-byte pipe ping-pong between a parent/child
+// pair, and bulk pipe bandwidth across npairs writer/reader
+// pairs running at once. Each phase prints one line
+//
+//   procbench: phase=NAME ops=N bytes=B ticks=T
+//
+// in the same form as fsbench. procbench runs itself with
+// argument "-x", which exits at once, as the exec target.
+//
+//   procbench [iters [npairs]]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define MAXPAIRS 8
+#define CHUNK    512
+#define NCHUNK   1024   // chunks each bulk pair moves
+
+char buf[CHUNK];
+char *exargv[] = { "procbench", "-x", 0 };
+
+void
+report(char *phase, int ops, int bytes, int start)
+{
+  printf("procbench: phase=%s ops=%d bytes=%d ticks=%d\n",
+         phase, ops, bytes, uptime() - start);
+}
+
+void
+fail(char *what)
+{
+  printf("procbench: %s failed\n", what);
+  exit(1);
+}
+
+void
+forkphase(int iters)
+{
+  int i, pid, start;
+
+  start = uptime();
+  for(i = 0; i < iters; i++){
+    if((pid = fork()) < 0)
+      fail("fork");
+    if(pid == 0)
+      exit(0);
+    wait(0);
+  }
+  report("fork", iters, 0, start);
+}
+
+void
+execphase(int iters)
+{
+  int i, pid, start;
+
+  start = uptime();
+  for(i = 0; i < iters; i++){
+    if((pid = fork()) < 0)
+      fail("fork");
+    if(pid == 0){
+      exec(exargv[0], exargv);
+      fail("exec");
+    }
+    wait(0);
+  }
+  report("forkexec", iters, 0, start);
+
+  start = uptime();
+  for(i = 0; i < iters; i++){
+    if(spawn(exargv[0], exargv, 0) < 0)
+      fail("spawn");
+    wait(0);
+  }
+  report("spawn", iters, 0, start);
+}
+
+void
+pingphase(int iters)
+{
+  int a[2], b[2], i, pid, start;
+  char c = 0;
+
+  if(pipe(a) < 0 || pipe(b) < 0)
+    fail("pipe");
+  start = uptime();
+  if((pid = fork()) < 0)
+    fail("fork");
+  if(pid == 0){
+    for(i = 0; i < iters; i++){
+      if(read(a[0], &c, 1) != 1 || write(b[1], &c, 1) != 1)
+        exit(1);
+    }
+    exit(0);
+  }
+  for(i = 0; i < iters; i++){
+    if(write(a[1], &c, 1) != 1 || read(b[0], &c, 1) != 1)
+      fail("ping-pong");
+  }
+  wait(0);
+  report("pingpong", iters, 0, start);
+  close(a[0]);
+  close(a[1]);
+  close(b[0]);
+  close(b[1]);
+}
+
+// Each pair is a writer child and a reader child; the parent
+// only waits, so all the pairs compete for the CPUs.
+void
+bulkphase(int npairs)
+{
+  int fds[2], i, j, n, m, pid, start;
+
+  start = uptime();
+  for(i = 0; i < npairs; i++){
+    if(pipe(fds) < 0)
+      fail("pipe");
+    for(j = 0; j < 2; j++){
+      if((pid = fork()) < 0)
+        fail("fork");
+      if(pid == 0){
+        if(j == 0){
+          close(fds[0]);
+          for(n = 0; n < NCHUNK; n++)
+            if(write(fds[1], buf, CHUNK) != CHUNK)
+              exit(1);
+        } else {
+          close(fds[1]);
+          for(n = 0; n < NCHUNK * CHUNK; n += m)
+            if((m = read(fds[0], buf, CHUNK)) <= 0)
+              exit(1);
+        }
+        exit(0);
+      }
+    }
+    close(fds[0]);
+    close(fds[1]);
+  }
+  for(i = 0; i < 2 * npairs; i++)
+    wait(0);
+  report("pipebulk", npairs, npairs * NCHUNK * CHUNK, start);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int iters = 100, npairs = 4;
+
+  if(argc > 1 && strcmp(argv[1], "-x") == 0)
+    exit(0);
+  if(argc > 1)
+    iters = atoi(argv[1]);
+  if(argc > 2)
+    npairs = atoi(argv[2]);
+  if(iters < 1 || npairs < 1 || npairs > MAXPAIRS){
+    printf("usage: procbench [iters [npairs]], npairs <= %d\n", MAXPAIRS);
+    exit(1);
+  }
+
+  forkphase(iters);
+  execphase(iters);
+  pingphase(iters * 10);
+  bulkphase(npairs);
+  exit(0);
+}
@@ -0,0 +1,223 @@
+// Profile a command with the timer-driven sampler.
+//
+//   prof [-n count] cmd args...
+//
+// prints the count (default 20) kernel functions that the
+// most timer interrupts landed in while cmd ran, naming them
+// from /kernel.sym, and then the user samples of each process.
+// The timer interrupts every TICKTIME cycles on each CPU, so
+// a run needs to be long enough to gather samples.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/param.h"
+#include "kernel/prof.h"
+#include "user/user.h"
+
+#define SYMFILE "/kernel.sym"
+#define NPIDS   64   // processes whose user samples are told apart
+
+struct sym {
+  uint64 addr;
+  char *name;
+  int hits;
+};
+
+struct sym *syms;
+int nsyms;
+
+struct {
+  int pid;
+  int hits;
+} pids[NPIDS];
+int npids;
+
+struct profsample samples[64];
+
+int
+hexval(int c)
+{
+  if(c >= '0' && c <= '9')
+    return c - '0';
+  if(c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  return -1;
+}
+
+// Add a symbol, growing the table as needed.
+void
+addsym(uint64 addr, char *name, int len)
+{
+  static int cap;
+  struct sym *s;
+
+  if(nsyms == cap){
+    cap = cap ? cap*2 : 256;
+    s = malloc(cap * sizeof(*s));
+    if(s == 0){
+      fprintf(2, "prof: out of memory\n");
+      exit(1);
+    }
+    memmove(s, syms, nsyms * sizeof(*s));
+    free(syms);
+    syms = s;
+  }
+  s = &syms[nsyms++];
+  s->addr = addr;
+  s->name = malloc(len + 1);
+  memmove(s->name, name, len);
+  s->name[len] = 0;
+  s->hits = 0;
+}
+
+// Read "address name" lines, as the Makefile writes them,
+// keeping what can hold code: no section or file names.
+void
+loadsyms(char *path)
+{
+  char name[64];
+  uint64 addr;
+  int fd, c, d, len;
+  FILE *f;
+
+  if((fd = open(path, O_RDONLY)) < 0){
+    fprintf(2, "prof: cannot open %s\n", path);
+    exit(1);
+  }
+  f = fdopen(fd);
+  for(;;){
+    addr = 0;
+    while((c = fgetc(f)) != -1 && (d = hexval(c)) >= 0)
+      addr = addr*16 + d;
+    if(c == -1)
+      break;
+    len = 0;
+    while((c = fgetc(f)) != -1 && c != '\n')
+      if(len < sizeof(name) - 1)
+        name[len++] = c;
+    if(addr != 0 && len > 0 && name[0] != '.')
+      addsym(addr, name, len);
+    if(c == -1)
+      break;
+  }
+  fclose(f);
+
+  // shell sort by address.
+  for(int gap = nsyms/2; gap > 0; gap /= 2)
+    for(int i = gap; i < nsyms; i++){
+      struct sym t = syms[i];
+      int j;
+      for(j = i; j >= gap && syms[j-gap].addr > t.addr; j -= gap)
+        syms[j] = syms[j-gap];
+      syms[j] = t;
+    }
+}
+
+// The symbol pc is in: the last one at or below it.
+struct sym*
+lookup(uint64 pc)
+{
+  int lo = 0, hi = nsyms;
+
+  while(lo < hi){
+    int mid = (lo + hi) / 2;
+    if(syms[mid].addr <= pc)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo > 0 ? &syms[lo-1] : 0;
+}
+
+void
+userhit(int pid)
+{
+  int i;
+
+  for(i = 0; i < npids && pids[i].pid != pid; i++)
+    ;
+  if(i == NPIDS)
+    return;
+  if(i == npids){
+    pids[npids].pid = pid;
+    pids[npids++].hits = 0;
+  }
+  pids[i].hits++;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int top = 20, nuser = 0, nkernel = 0, unknown = 0;
+  int n, i, j, pid;
+  struct sym *s, t;
+
+  if(argc > 2 && strcmp(argv[1], "-n") == 0){
+    top = atoi(argv[2]);
+    argv += 2;
+    argc -= 2;
+  }
+  if(argc < 2){
+    fprintf(2, "usage: prof [-n count] cmd args...\n");
+    exit(1);
+  }
+  loadsyms(SYMFILE);
+
+  if(prof(PROF_START, 0, 0) < 0){
+    fprintf(2, "prof: prof failed\n");
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    fprintf(2, "prof: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    exec(argv[1], argv + 1);
+    fprintf(2, "prof: exec %s failed\n", argv[1]);
+    exit(1);
+  }
+  wait(0);
+  prof(PROF_STOP, 0, 0);
+
+  while((n = prof(PROF_DRAIN, samples, sizeof(samples)/sizeof(samples[0]))) > 0){
+    for(i = 0; i < n; i++){
+      if(samples[i].user){
+        nuser++;
+        userhit(samples[i].pid);
+      } else if((s = lookup(samples[i].pc)) != 0){
+        nkernel++;
+        s->hits++;
+      } else {
+        nkernel++;
+        unknown++;
+      }
+    }
+  }
+
+  printf("prof: %d samples, %d user, %d kernel, %d dropped\n",
+         nuser + nkernel, nuser, nkernel, prof(PROF_DROPPED, 0, 0));
+  if(nuser + nkernel == 0)
+    exit(0);
+
+  // hottest first; only the top few need to be in order.
+  for(i = 0; i < top && i < nsyms; i++){
+    for(j = i + 1; j < nsyms; j++)
+      if(syms[j].hits > syms[i].hits){
+        t = syms[i];
+        syms[i] = syms[j];
+        syms[j] = t;
+      }
+    if(syms[i].hits == 0)
+      break;
+    printf("%d %d%% %s\n", syms[i].hits,
+           syms[i].hits * 100 / (nuser + nkernel), syms[i].name);
+  }
+  if(unknown > 0)
+    printf("%d %d%% ?\n", unknown, unknown * 100 / (nuser + nkernel));
+  for(i = 0; i < npids; i++)
+    printf("%d %d%% user pid %d\n", pids[i].hits,
+           pids[i].hits * 100 / (nuser + nkernel), pids[i].pid);
+  exit(0);
+}
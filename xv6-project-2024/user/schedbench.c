@@ -0,0 +1,78 @@
+// Measure the context-switch rate of the scheduler.
+// Each of npairs process pairs passes a byte back and forth
+// through two pipes, so every round trip costs two switches.
+// Run it with different CPUS= settings to compare hart counts.
+//
+//   schedbench [npairs [rounds]]
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+void
+pingpong(int rounds)
+{
+  int a[2], b[2], i, pid;
+  char c = 0;
+
+  if(pipe(a) < 0 || pipe(b) < 0){
+    printf("schedbench: pipe failed\n");
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("schedbench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    for(i = 0; i < rounds; i++){
+      if(read(a[0], &c, 1) != 1 || write(b[1], &c, 1) != 1)
+        exit(1);
+    }
+    exit(0);
+  }
+  for(i = 0; i < rounds; i++){
+    if(write(a[1], &c, 1) != 1 || read(b[0], &c, 1) != 1){
+      printf("schedbench: pipe i/o failed\n");
+      exit(1);
+    }
+  }
+  wait(0);
+  exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int npairs = 2, rounds = 10000;
+  int i, start, ticks;
+
+  if(argc > 1)
+    npairs = atoi(argv[1]);
+  if(argc > 2)
+    rounds = atoi(argv[2]);
+  if(npairs < 1 || rounds < 1){
+    printf("usage: schedbench [npairs [rounds]]\n");
+    exit(1);
+  }
+
+  start = uptime();
+  for(i = 0; i < npairs; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("schedbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0)
+      pingpong(rounds);
+  }
+  for(i = 0; i < npairs; i++)
+    wait(0);
+  ticks = uptime() - start;
+  if(ticks == 0)
+    ticks = 1;
+
+  printf("schedbench: %d pairs, %d switches in %d ticks, %d switches/tick\n",
+         npairs, 2*npairs*rounds, ticks, 2*npairs*rounds/ticks);
+  exit(0);
+}
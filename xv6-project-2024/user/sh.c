@@ -53,6 +53,9 @@ int fork1(void);  // Fork but panics on failure.
 void panic(char*);
 struct cmd *parsecmd(char*);
 void runcmd(struct cmd*) __attribute__((noreturn));
+int spawnable(struct cmd*);
+int spawncmd(struct cmd*, int*);
+int gettoken(char**, char*, char**, char**);
 
 // Execute cmd.  Never returns.
 void
@@ -102,14 +105,20 @@ runcmd(struct cmd *cmd)
     pcmd = (struct pipecmd*)cmd;
     if(pipe(p) < 0)
       panic("pipe");
-    if(fork1() == 0){
+    if(spawnable(pcmd->left)){
+      int fds[3] = { 0, p[1], 2 };
+      spawncmd(pcmd->left, fds);
+    } else if(fork1() == 0){
       close(1);
       dup(p[1]);
       close(p[0]);
       close(p[1]);
       runcmd(pcmd->left);
     }
-    if(fork1() == 0){
+    if(spawnable(pcmd->right)){
+      int fds[3] = { p[0], 1, 2 };
+      spawncmd(pcmd->right, fds);
+    } else if(fork1() == 0){
       close(0);
       dup(p[0]);
       close(p[0]);
@@ -131,6 +140,90 @@ runcmd(struct cmd *cmd)
   exit(0);
 }
 
+// Can spawncmd() run cmd? That is, is it a plain command
+// with nothing but redirections around it.
+int
+spawnable(struct cmd *cmd)
+{
+  if(cmd->type == REDIR)
+    return spawnable(((struct redircmd*)cmd)->cmd);
+  return cmd->type == EXEC;
+}
+
+// Start spawnable cmd with spawn(), so that the kernel builds
+// the child straight from the program file rather than copying
+// the shell first. The child's fd i is our fd fds[i].
+// Returns the child's pid, or -1 if it could not be started.
+int
+spawncmd(struct cmd *cmd, int *fds)
+{
+  struct execcmd *ecmd;
+  struct redircmd *rcmd;
+  int fd, pid, old;
+
+  if(cmd->type == EXEC){
+    ecmd = (struct execcmd*)cmd;
+    if(ecmd->argv[0] == 0)
+      return -1;
+    if((pid = spawn(ecmd->argv[0], ecmd->argv, fds)) < 0)
+      fprintf(2, "exec %s failed\n", ecmd->argv[0]);
+    return pid;
+  }
+
+  // as in runcmd(), the inner redirection wins.
+  rcmd = (struct redircmd*)cmd;
+  if((fd = open(rcmd->file, rcmd->mode)) < 0){
+    fprintf(2, "open %s failed\n", rcmd->file);
+    return -1;
+  }
+  old = fds[rcmd->fd];
+  fds[rcmd->fd] = fd;
+  pid = spawncmd(rcmd->cmd, fds);
+  fds[rcmd->fd] = old;
+  close(fd);
+  return pid;
+}
+
+// Is the line in s a plain command, perhaps with redirections,
+// that parsecmd() will parse without a syntax error? Then the
+// shell itself can parse and spawn it; anything else is parsed
+// and run in a forked child, so that errors don't kill the shell.
+int
+simple(char *s)
+{
+  char *es;
+  int tok, argc;
+
+  es = s + strlen(s);
+  argc = 0;
+  while((tok = gettoken(&s, es, 0, 0)) != 0){
+    if(tok == 'a'){
+      if(++argc >= MAXARGS)
+        return 0;
+    } else if(tok == '<' || tok == '>' || tok == '+'){
+      if(gettoken(&s, es, 0, 0) != 'a')
+        return 0;
+    } else {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+// Free a command parsed by parsecmd().
+void
+freecmd(struct cmd *cmd)
+{
+  if(cmd->type == REDIR)
+    freecmd(((struct redircmd*)cmd)->cmd);
+  else if(cmd->type == PIPE || cmd->type == LIST){
+    freecmd(((struct pipecmd*)cmd)->left);
+    freecmd(((struct pipecmd*)cmd)->right);
+  } else if(cmd->type == BACK)
+    freecmd(((struct backcmd*)cmd)->cmd);
+  free(cmd);
+}
+
 int
 getcmd(char *buf, int nbuf)
 {
@@ -146,6 +239,7 @@ int
 main(void)
 {
   static char buf[100];
+  struct cmd *cmd;
   int fd;
 
   // Ensure that three file descriptors are open.
@@ -156,6 +250,10 @@ main(void)
     }
   }
 
+  // Commands share sh's input, so read it a byte at a time
+  // rather than buffering past the end of the current line.
+  setvbuf(stdin, 0, _IONBF, 0);
+
   // Read and run input commands.
   while(getcmd(buf, sizeof(buf)) >= 0){
     if(buf[0] == 'c' && buf[1] == 'd' && buf[2] == ' '){
@@ -165,6 +263,14 @@ main(void)
         fprintf(2, "cannot cd %s\n", buf+3);
       continue;
     }
+    if(simple(buf)){
+      int fds[3] = { 0, 1, 2 };
+      cmd = parsecmd(buf);
+      if(spawncmd(cmd, fds) > 0)
+        wait(0);
+      freecmd(cmd);
+      continue;
+    }
     if(fork1() == 0)
       runcmd(parsecmd(buf));
     wait(0);
@@ -0,0 +1,222 @@
+// Buffered stdio streams.
+//
+// A FILE batches the bytes of many small reads or writes into
+// one system call. Output is flushed when the buffer fills and,
+// depending on the mode, on each newline (_IOLBF) or after each
+// call (_IONBF). stdout is line buffered on a console and fully
+// buffered otherwise; stderr is unbuffered. Every stream is
+// flushed by exit(), and before fork() and exec() so a child
+// never inherits (and repeats) pending output. A stream is used
+// for reading or for writing, not both.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+static char inbuf[BUFSIZ], outbuf[BUFSIZ], errbuf[BUFSIZ];
+
+static FILE stdfiles[3] = {
+  { 0, -1, inbuf, BUFSIZ, 0, 0, 0 },
+  { 1, -1, outbuf, BUFSIZ, 0, 0, 0 },
+  { 2, _IONBF, errbuf, BUFSIZ, 0, 0, 0 },
+};
+
+FILE *stdin = &stdfiles[0];
+FILE *stdout = &stdfiles[1];
+FILE *stderr = &stdfiles[2];
+
+static FILE *opened;  // fdopen()ed streams, for fflush(0)
+
+// Pick the default mode the first time a stream is used.
+static void
+setmode(FILE *f)
+{
+  struct stat st;
+
+  if(f->mode >= 0)
+    return;
+  if(fstat(f->fd, &st) == 0 && st.type == T_DEVICE)
+    f->mode = _IOLBF;
+  else
+    f->mode = _IOFBF;
+}
+
+static int
+flush1(FILE *f)
+{
+  int n, off;
+
+  for(off = 0; off < f->n; off += n){
+    if((n = write(f->fd, f->buf + off, f->n - off)) <= 0){
+      f->n = 0;
+      return EOF;
+    }
+  }
+  f->n = 0;
+  return 0;
+}
+
+// Flush f, or every stream if f is 0.
+int
+fflush(FILE *f)
+{
+  int r = 0;
+
+  if(f)
+    return flush1(f);
+  for(f = stdfiles; f < stdfiles + 3; f++)
+    if(flush1(f) < 0)
+      r = EOF;
+  for(f = opened; f; f = f->next)
+    if(flush1(f) < 0)
+      r = EOF;
+  return r;
+}
+
+// Buffer c, flushing if full or at the end of a line; the
+// caller handles _IONBF.
+int
+bputc(int c, FILE *f)
+{
+  setmode(f);
+  f->buf[f->n++] = c;
+  if(f->n == f->size || (f->mode == _IOLBF && c == '\n'))
+    return flush1(f);
+  return 0;
+}
+
+int
+fputc(int c, FILE *f)
+{
+  if(bputc(c, f) < 0)
+    return EOF;
+  if(f->mode == _IONBF && flush1(f) < 0)
+    return EOF;
+  return (uchar)c;
+}
+
+int
+fwrite(const void *p, int n, FILE *f)
+{
+  const char *s = p;
+  int i;
+
+  for(i = 0; i < n; i++)
+    if(bputc(s[i], f) < 0)
+      return i;
+  if(f->mode == _IONBF && flush1(f) < 0)
+    return 0;
+  return n;
+}
+
+int
+fputs(const char *s, FILE *f)
+{
+  int n = strlen(s);
+
+  return fwrite(s, n, f) == n ? 0 : EOF;
+}
+
+// Return the next byte of f, or EOF. An unbuffered stream
+// reads one byte at a time, so it never takes input meant for
+// another process sharing the descriptor.
+int
+fgetc(FILE *f)
+{
+  int n;
+
+  if(f->r == f->n){
+    setmode(f);
+    n = read(f->fd, f->buf, f->mode == _IONBF ? 1 : f->size);
+    f->r = 0;
+    f->n = n > 0 ? n : 0;
+    if(n <= 0)
+      return EOF;
+  }
+  return (uchar)f->buf[f->r++];
+}
+
+// Change f's buffering mode, and its buffer size unless size
+// is 0. Call before the first read or write of f. buf may be
+// 0 to have one allocated.
+int
+setvbuf(FILE *f, char *buf, int mode, int size)
+{
+  if(f->n != 0 || mode < _IONBF || mode > _IOFBF)
+    return -1;
+  if(size > 0 && size != f->size){
+    if(buf == 0 && (buf = malloc(size)) == 0)
+      return -1;
+    f->buf = buf;
+    f->size = size;
+  }
+  f->mode = mode;
+  return 0;
+}
+
+FILE*
+fdopen(int fd)
+{
+  FILE *f;
+
+  if((f = malloc(sizeof(*f) + BUFSIZ)) == 0)
+    return 0;
+  memset(f, 0, sizeof(*f));
+  f->fd = fd;
+  f->mode = -1;
+  f->buf = (char*)(f + 1);
+  f->size = BUFSIZ;
+  f->next = opened;
+  opened = f;
+  return f;
+}
+
+// Flush and free f, and close its descriptor.
+int
+fclose(FILE *f)
+{
+  FILE **pp;
+  int r;
+
+  r = flush1(f);
+  for(pp = &opened; *pp; pp = &(*pp)->next){
+    if(*pp == f){
+      *pp = f->next;
+      break;
+    }
+  }
+  if(close(f->fd) < 0)
+    r = EOF;
+  free(f);
+  return r;
+}
+
+// The system calls that end or copy an address space, or start
+// a child, run pending output out first.
+int
+exit(int status)
+{
+  fflush(0);
+  _exit(status);
+}
+
+int
+fork(void)
+{
+  fflush(0);
+  return _fork();
+}
+
+int
+exec(const char *path, char **argv)
+{
+  fflush(0);
+  return _exec(path, argv);
+}
+
+int
+spawn(const char *path, char **argv, int *fds)
+{
+  fflush(0);
+  return _spawn(path, argv, fds);
+}
@@ -15,10 +15,17 @@ static int failed = 0;
 static void testsymlink(void);
 static void concur(void);
 static void cleanup(void);
+static void timing(int);
 
 int
 main(int argc, char *argv[])
 {
+  if(argc > 1 && strcmp(argv[1], "-t") == 0){
+    cleanup();
+    timing(argc > 2 ? atoi(argv[2]) : 1000);
+    cleanup();
+    exit(failed);
+  }
   cleanup();
   testsymlink();
   concur();
@@ -49,6 +56,41 @@ cleanup(void)
   unlink("/testsymlink");
 }
 
+// symlinktest -t [n]: time n opens through a chain of four
+// links against n opens of the file itself.
+static void
+timing(int n)
+{
+  int i, fd, t0, t1, t2;
+
+  printf("Start: symlink chain timing\n");
+  mkdir("/testsymlink");
+  fd = open("/testsymlink/a", O_CREATE | O_RDWR);
+  if(fd < 0) fail("failed to open a");
+  close(fd);
+  if(symlink("/testsymlink/a", "/testsymlink/4") < 0 ||
+     symlink("/testsymlink/4", "/testsymlink/3") < 0 ||
+     symlink("/testsymlink/3", "/testsymlink/2") < 0 ||
+     symlink("/testsymlink/2", "/testsymlink/1") < 0)
+    fail("failed to create chain");
+
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    if((fd = open("/testsymlink/a", O_RDONLY)) < 0) fail("failed to open a");
+    close(fd);
+  }
+  t1 = uptime();
+  for(i = 0; i < n; i++){
+    if((fd = open("/testsymlink/1", O_RDONLY)) < 0) fail("failed to open chain");
+    close(fd);
+  }
+  t2 = uptime();
+  printf("%d opens: direct %d ticks, 4-link chain %d ticks\n", n, t1 - t0, t2 - t1);
+  printf("test symlink chain timing: ok\n");
+done:
+  return;
+}
+
 // stat a symbolic link using O_NOFOLLOW
 static int
 stat_slink(char *pn, struct stat *st)
@@ -43,14 +43,31 @@ strlen(const char *s)
   return n;
 }
 
+// memset, memmove and memcmp go a uint64 at a time once the
+// pointers are word aligned, like their kernel/string.c twins.
+#define WSIZE sizeof(uint64)
+#define WALIGNED(p) (((uint64)(p) % WSIZE) == 0)
+
 void*
 memset(void *dst, int c, uint n)
 {
   char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
+  uint64 w;
+
+  if(n >= 2*WSIZE){
+    for(; !WALIGNED(cdst); n--)
+      *cdst++ = c;
+    w = (uchar)c;
+    w |= w << 8;
+    w |= w << 16;
+    w |= w << 32;
+    for(; n >= WSIZE; n -= WSIZE){
+      *(uint64*)cdst = w;
+      cdst += WSIZE;
+    }
   }
+  while(n-- > 0)
+    *cdst++ = c;
   return dst;
 }
 
@@ -70,9 +87,9 @@ gets(char *buf, int max)
   char c;
 
   for(i=0; i+1 < max; ){
-    cc = read(0, &c, 1);
-    if(cc < 1)
+    if((cc = fgetc(stdin)) == EOF)
       break;
+    c = cc;
     buf[i++] = c;
     if(c == '\n' || c == '\r')
       break;
@@ -115,11 +132,29 @@ memmove(void *vdst, const void *vsrc, int n)
   dst = vdst;
   src = vsrc;
   if (src > dst) {
+    if(WALIGNED((uint64)src ^ (uint64)dst)){
+      for(; n > 0 && !WALIGNED(dst); n--)
+        *dst++ = *src++;
+      for(; n >= WSIZE; n -= WSIZE){
+        *(uint64*)dst = *(uint64*)src;
+        dst += WSIZE;
+        src += WSIZE;
+      }
+    }
     while(n-- > 0)
       *dst++ = *src++;
   } else {
     dst += n;
     src += n;
+    if(WALIGNED((uint64)src ^ (uint64)dst)){
+      for(; n > 0 && !WALIGNED(dst); n--)
+        *--dst = *--src;
+      for(; n >= WSIZE; n -= WSIZE){
+        dst -= WSIZE;
+        src -= WSIZE;
+        *(uint64*)dst = *(uint64*)src;
+      }
+    }
     while(n-- > 0)
       *--dst = *--src;
   }
@@ -130,6 +165,15 @@ int
 memcmp(const void *s1, const void *s2, uint n)
 {
   const char *p1 = s1, *p2 = s2;
+  if(n >= WSIZE && WALIGNED((uint64)p1 ^ (uint64)p2)){
+    for(; n > 0 && !WALIGNED(p1); n--, p1++, p2++)
+      if(*p1 != *p2)
+        return *p1 - *p2;
+    for(; n >= WSIZE && *(uint64*)p1 == *(uint64*)p2; n -= WSIZE){
+      p1 += WSIZE;
+      p2 += WSIZE;
+    }
+  }
   while (n-- > 0) {
     if (*p1 != *p2) {
       return *p1 - *p2;
@@ -18,15 +18,42 @@ union header {
 
 typedef union header Header;
 
+// Small requests, up to SMALLMAX units counting the header, come
+// from segregated free lists, one per power-of-two size class,
+// so they never search and never coalesce. A class that runs
+// dry carves a SLABUNITS chunk from the big-object path into
+// blocks of its size. Larger requests use the first-fit list
+// below, which coalesces on free and grows the heap in
+// geometrically larger sbrk() steps, up to MAXGROW units.
+#define NCLASS    5
+#define SMALLMAX  (2 << (NCLASS-1))  // units, so 512 bytes
+#define SLABUNITS 256
+#define MAXGROW   65536
+
+static Header *smallfree[NCLASS];
+static uint growunits = 4096;
+
 static Header base;
 static Header *freep;
 
-void
-free(void *ap)
+// Class c holds blocks of 2<<c units.
+static int
+sizeclass(uint nunits)
 {
-  Header *bp, *p;
+  int c;
+
+  for(c = 0; (2 << c) < nunits; c++)
+    ;
+  return c;
+}
+
+// Put a big block back on the first-fit list, merging it with
+// its neighbours.
+static void
+bigfree(Header *bp)
+{
+  Header *p;
 
-  bp = (Header*)ap - 1;
   for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
     if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
       break;
@@ -43,30 +70,52 @@ free(void *ap)
   freep = p;
 }
 
+void
+free(void *ap)
+{
+  Header *bp;
+  int c;
+
+  if(ap == 0)
+    return;
+  bp = (Header*)ap - 1;
+  if(bp->s.size <= SMALLMAX){
+    c = sizeclass(bp->s.size);
+    bp->s.ptr = smallfree[c];
+    smallfree[c] = bp;
+  } else
+    bigfree(bp);
+}
+
 static Header*
 morecore(uint nu)
 {
   char *p;
   Header *hp;
+  uint grow;
 
-  if(nu < 4096)
-    nu = 4096;
-  p = sbrk(nu * sizeof(Header));
-  if(p == (char*)-1)
-    return 0;
+  grow = nu > growunits ? nu : growunits;
+  p = sbrk(grow * sizeof(Header));
+  if(p == (char*)-1){
+    // the heap may still have room for just this request.
+    if(grow == nu || (p = sbrk(nu * sizeof(Header))) == (char*)-1)
+      return 0;
+    grow = nu;
+  } else if(growunits < MAXGROW)
+    growunits *= 2;
   hp = (Header*)p;
-  hp->s.size = nu;
-  free((void*)(hp + 1));
+  hp->s.size = grow;
+  bigfree(hp);
   return freep;
 }
 
-void*
-malloc(uint nbytes)
+// First-fit allocation of nunits (> SMALLMAX) units; returns
+// the block's header.
+static Header*
+bigalloc(uint nunits)
 {
   Header *p, *prevp;
-  uint nunits;
 
-  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
   if((prevp = freep) == 0){
     base.s.ptr = freep = prevp = &base;
     base.s.size = 0;
@@ -81,10 +130,49 @@ malloc(uint nbytes)
         p->s.size = nunits;
       }
       freep = prevp;
-      return (void*)(p + 1);
+      return p;
     }
     if(p == freep)
       if((p = morecore(nunits)) == 0)
         return 0;
   }
 }
+
+// Cut a fresh slab into blocks for class c. The slab itself is
+// never given back to the big-object list.
+static int
+refill(int c)
+{
+  Header *p, *q;
+  uint n = 2 << c;
+
+  if((p = bigalloc(SLABUNITS)) == 0)
+    return -1;
+  for(q = p; q + n <= p + SLABUNITS; q += n){
+    q->s.size = n;
+    q->s.ptr = smallfree[c];
+    smallfree[c] = q;
+  }
+  return 0;
+}
+
+void*
+malloc(uint nbytes)
+{
+  Header *p;
+  uint nunits;
+  int c;
+
+  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
+  if(nunits > SMALLMAX){
+    if((p = bigalloc(nunits)) == 0)
+      return 0;
+    return (void*)(p + 1);
+  }
+  c = sizeclass(nunits);
+  if(smallfree[c] == 0 && refill(c) < 0)
+    return 0;
+  p = smallfree[c];
+  smallfree[c] = p->s.ptr;
+  return (void*)(p + 1);
+}
@@ -1,15 +1,15 @@
 struct stat;
 
 // system calls
-int fork(void);
-int exit(int) __attribute__((noreturn));
+int _fork(void);
+int _exit(int) __attribute__((noreturn));
 int wait(int*);
 int pipe(int*);
 int write(int, const void*, int);
 int read(int, void*, int);
 int close(int);
 int kill(int);
-int exec(const char*, char**);
+int _exec(const char*, char**);
 int open(const char*, int);
 int mknod(const char*, short, short);
 int unlink(const char*);
@@ -22,6 +22,19 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int lseek(int, int, int);
+struct lockstat;
+int lockstat(struct lockstat*, int);
+int _spawn(const char*, char**, int*);
+void* mmap(void*, uint64, int, int, int, int);
+int munmap(void*, uint64);
+int setpriority(int, int);
+int setaffinity(int, int);
+struct profsample;
+int prof(int, struct profsample*, int);
+int sync(void);
+int fsync(int);
+int splice(int, int, int);
 
 // ulib.c
 // system calls
@@ -40,6 +53,38 @@ int atoi(const char*);
 int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
 
+// stdio.c
+#define BUFSIZ 512   // default stream buffer size
+#define EOF    (-1)
+#define _IONBF 0     // flush after every call
+#define _IOLBF 1     // flush at each newline
+#define _IOFBF 2     // flush when the buffer fills
+
+typedef struct iobuf {
+  int fd;
+  int mode;          // _IO*, or -1 until first use
+  char *buf;
+  int size;          // of buf
+  int n;             // bytes buffered (writing) or read in (reading)
+  int r;             // next byte to hand out (reading)
+  struct iobuf *next;
+} FILE;
+
+extern FILE *stdin, *stdout, *stderr;
+int fork(void);
+int exit(int) __attribute__((noreturn));
+int exec(const char*, char**);
+int spawn(const char*, char**, int*);
+FILE* fdopen(int);
+int fclose(FILE*);
+int fflush(FILE*);
+int fgetc(FILE*);
+int fputc(int, FILE*);
+int bputc(int, FILE*);   // fputc without the _IONBF flush
+int fputs(const char*, FILE*);
+int fwrite(const void*, int, FILE*);
+int setvbuf(FILE*, char*, int, int);
+
 // umalloc.c
 void* malloc(uint);
 void free(void*);
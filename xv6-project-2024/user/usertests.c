@@ -578,6 +578,152 @@ writetest(char *s)
   }
 }
 
+// write two extent files a block at a time in turn, so that
+// neither can grow its last extent and both spill from the
+// NEXTENT inline extents into the extent block; then read them
+// back, overwrite them and read them again.
+#define EXTBLOCKS (NEXTENT*4)
+
+void
+extentfile(char *s)
+{
+  char *names[2] = { "ext0", "ext1" };
+  int fd[2], i, j, n, pass;
+
+  for(j = 0; j < 2; j++){
+    unlink(names[j]);
+    fd[j] = open(names[j], O_CREATE|O_RDWR|O_EXTENT);
+    if(fd[j] < 0){
+      printf("%s: create %s failed\n", s, names[j]);
+      exit(1);
+    }
+  }
+
+  for(pass = 0; pass < 2; pass++){
+    for(i = 0; i < EXTBLOCKS; i++){
+      for(j = 0; j < 2; j++){
+        ((int*)buf)[0] = pass*10000 + j*1000 + i;
+        if(write(fd[j], buf, BSIZE) != BSIZE){
+          printf("%s: write %s block %d failed\n", s, names[j], i);
+          exit(1);
+        }
+      }
+    }
+    for(j = 0; j < 2; j++){
+      if(lseek(fd[j], 0, SEEK_SET) != 0){
+        printf("%s: lseek %s failed\n", s, names[j]);
+        exit(1);
+      }
+      for(i = 0; i < EXTBLOCKS; i++){
+        n = read(fd[j], buf, BSIZE);
+        if(n != BSIZE || ((int*)buf)[0] != pass*10000 + j*1000 + i){
+          printf("%s: %s block %d: read %d, content %d\n", s,
+                 names[j], i, n, ((int*)buf)[0]);
+          exit(1);
+        }
+      }
+      if(read(fd[j], buf, BSIZE) != 0){
+        printf("%s: %s too long\n", s, names[j]);
+        exit(1);
+      }
+      lseek(fd[j], 0, SEEK_SET);
+    }
+  }
+
+  // extent files have no holes.
+  if(lseek(fd[0], BSIZE, SEEK_END) < 0 || write(fd[0], buf, 1) != -1){
+    printf("%s: write past the end of %s succeeded\n", s, names[0]);
+    exit(1);
+  }
+
+  for(j = 0; j < 2; j++){
+    close(fd[j]);
+    if(unlink(names[j]) < 0){
+      printf("%s: unlink %s failed\n", s, names[j]);
+      exit(1);
+    }
+  }
+}
+
+// MAP_SHARED regions, anonymous and of a file, mapped before a
+// fork() and first touched after it, are shared by parent and
+// child, and munmap() writes the file's back.
+void
+mmapshared(char *s)
+{
+  char *a;
+  int fd, pid, xst;
+
+  a = mmap(0, 2*PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANON, -1, 0);
+  if(a == (char*)-1){
+    printf("%s: mmap anonymous failed\n", s);
+    exit(1);
+  }
+  if((pid = fork()) < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    a[0] = 'c';
+    a[PGSIZE] = 'd';
+    exit(0);
+  }
+  wait(&xst);
+  if(xst != 0 || a[0] != 'c' || a[PGSIZE] != 'd'){
+    printf("%s: child's stores to shared anonymous memory lost\n", s);
+    exit(1);
+  }
+  if(munmap(a, 2*PGSIZE) < 0){
+    printf("%s: munmap anonymous failed\n", s);
+    exit(1);
+  }
+
+  unlink("mmapsh");
+  fd = open("mmapsh", O_CREATE|O_RDWR);
+  memset(buf, 'a', 2*PGSIZE);
+  if(fd < 0 || write(fd, buf, 2*PGSIZE) != 2*PGSIZE){
+    printf("%s: create mmapsh failed\n", s);
+    exit(1);
+  }
+  a = mmap(0, 2*PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(a == (char*)-1){
+    printf("%s: mmap mmapsh failed\n", s);
+    exit(1);
+  }
+  if((pid = fork()) < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    a[1] = 'x';
+    a[PGSIZE+1] = 'y';
+    exit(0);
+  }
+  wait(&xst);
+  if(xst != 0 || a[1] != 'x' || a[PGSIZE+1] != 'y'){
+    printf("%s: child's stores to shared file memory lost\n", s);
+    exit(1);
+  }
+  a[2] = 'z';
+  if(munmap(a, 2*PGSIZE) < 0){
+    printf("%s: munmap mmapsh failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("mmapsh", O_RDONLY);
+  if(fd < 0 || read(fd, buf, 2*PGSIZE) != 2*PGSIZE){
+    printf("%s: read mmapsh failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(buf[0] != 'a' || buf[1] != 'x' || buf[2] != 'z' || buf[PGSIZE+1] != 'y'){
+    printf("%s: stores not written back to mmapsh\n", s);
+    exit(1);
+  }
+  unlink("mmapsh");
+}
+
 void
 writebig(char *s)
 {
@@ -2605,6 +2751,8 @@ struct test {
   {opentest, "opentest"},
   {writetest, "writetest"},
   {writebig, "writebig"},
+  {extentfile, "extentfile"},
+  {mmapshared, "mmapshared"},
   {createtest, "createtest"},
   {dirtest, "dirtest"},
   {exectest, "exectest"},
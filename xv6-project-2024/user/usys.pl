@@ -6,24 +6,26 @@ print "# generated by usys.pl - do not edit\n";
 
 print "#include \"kernel/syscall.h\"\n";
 
+# entry("x", "_x") names the stub _x, for calls that ulib wraps.
 sub entry {
     my $name = shift;
-    print ".global $name\n";
-    print "${name}:\n";
+    my $stub = shift // $name;
+    print ".global $stub\n";
+    print "${stub}:\n";
     print " li a7, SYS_${name}\n";
     print " ecall\n";
     print " ret\n";
 }
 	
-entry("fork");
-entry("exit");
+entry("fork", "_fork");
+entry("exit", "_exit");
 entry("wait");
 entry("pipe");
 entry("read");
 entry("write");
 entry("close");
 entry("kill");
-entry("exec");
+entry("exec", "_exec");
 entry("open");
 entry("mknod");
 entry("unlink");
@@ -37,3 +39,14 @@ entry("sbrk");
 entry("sleep");
 entry("uptime");
 entry("symlink");#added to support symlink
+entry("lseek");
+entry("lockstat");
+entry("spawn", "_spawn");
+entry("mmap");
+entry("munmap");
+entry("setpriority");
+entry("setaffinity");
+entry("prof");
+entry("sync");
+entry("fsync");
+entry("splice");